@@ -34,9 +34,14 @@
 
 #include "common.h"
 
+#include <zlib.h>
+
 #include "bh_upload.h"
 #include "share.h"
 #include "bsched.h"
+#include "gnet_stats.h"
+#include "settings.h"		/* For listen_addr_primary() */
+#include "sockets.h"		/* For socket_listen_port() */
 #include "tx.h"
 #include "tx_link.h"
 #include "tx_chunk.h"
@@ -60,9 +65,11 @@
 #include "lib/product.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"
+#include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/url.h"
 #include "lib/walloc.h"
+#include "lib/zlib_util.h"
 
 #include "lib/override.h"	/* Must be the last header included */
 
@@ -79,6 +86,7 @@
 #define BH_SCAN_AHEAD		100		/**< Amount of files scanned ahead */
 
 #define BH_BUFSIZ			16384	/**< Buffer size for TX deflation */
+#define BH_CACHE_LIFETIME	600		/**< Cached payloads kept 10 minutes */
 
 enum bh_state {
 	BH_STATE_HEADER = 0,	/* Sending header */
@@ -96,6 +104,67 @@ enum bh_type {
 	BH_TYPE_QHIT			/* Send back Gnutella query hits */
 };
 
+/**
+ * Browse Host payload cache.
+ *
+ * Building the query hits for the whole library is expensive, and popular
+ * servents can get browsed repeatedly.  Since the payload only depends on
+ * the library and on a few settings (our address, port and whether we are
+ * firewalled), we record what the first browser of a kind gets sent and
+ * serve it as-is to subsequent browsers.
+ *
+ * The payload is compressed as it is recorded, so that browsers accepting
+ * deflated data can be served without going through a compressing TX layer.
+ * Compression is done piecewise as data is generated, at the default level,
+ * to not stall the first browser and everything else running meanwhile.
+ *
+ * A cached payload becomes stale as soon as the library changes, and after
+ * BH_CACHE_LIFETIME seconds in any case, since query hits also carry dynamic
+ * flags, such as whether we are busy.  Uploads that were using it keep their
+ * reference until they are done with it.
+ */
+enum bh_cache_kind {
+	BH_CACHE_HTML = 0,		/**< HTML page */
+	BH_CACHE_QHITS,			/**< Gnutella query hits */
+	BH_CACHE_QH2,			/**< G2 query hits */
+
+	BH_CACHE_COUNT
+};
+
+enum bh_cache_magic { BH_CACHE_MAGIC = 0x0d5b4c61 };
+
+struct bh_cache {
+	enum bh_cache_magic magic;
+	int refcnt;				/**< Reference count */
+	char *data;				/**< Plain payload */
+	size_t len;				/**< Length of plain payload */
+	size_t size;			/**< Allocated size for plain payload */
+	char *zdata;			/**< Deflated payload (zlib format) */
+	size_t zlen;			/**< Length of deflated payload */
+	size_t zsize;			/**< Allocated size for deflated payload */
+	z_stream *z;			/**< Compressor, whilst payload is recorded */
+	host_addr_t addr;		/**< Our address when recording started */
+	time_t built;			/**< When recording started */
+	uint generation;		/**< Library generation when recording started */
+	uint16 port;			/**< Our port when recording started */
+	uint8 firewalled;		/**< Whether we were firewalled */
+	uint8 complete;			/**< Whether payload is complete */
+};
+
+static inline void
+bh_cache_check(const struct bh_cache * const bc)
+{
+	g_assert(bc != NULL);
+	g_assert(BH_CACHE_MAGIC == bc->magic);
+}
+
+/**
+ * The payload of each kind, complete or being recorded.
+ */
+static struct bh_cache *bh_cache[BH_CACHE_COUNT];
+
+static uint64 bh_cache_mem;		/**< Memory used by cached payloads */
+
 struct browse_host_upload {
 	struct special_upload special;	/**< vtable, MUST be first field */
 	enum bh_type type;		/**< Type of data to send back */
@@ -111,6 +180,9 @@ struct browse_host_upload {
 	pslist_t *hits;			/**< Pending query hits to send back */
 	special_upload_closed_t cb;	/**< Callback to invoke when TX fully flushed */
 	void *cb_arg;			/**< Callback argument */
+	ssize_t (*generate)(struct special_upload *, void *dest, size_t size);
+	struct bh_cache *cache;	/**< Payload being recorded or served */
+	uint truncated:1;		/**< Library rebuilt whilst generating payload */
 };
 
 static struct browse_host_upload *
@@ -120,6 +192,294 @@ cast_to_browse_host_upload(struct special_upload *p)
 	return (void *) p;
 }
 
+/**
+ * @return the kind of payload requested by the browse host opening flags.
+ */
+static enum bh_cache_kind
+bh_cache_kind(int flags)
+{
+	if (flags & BH_F_HTML)
+		return BH_CACHE_HTML;
+
+	return (flags & BH_F_G2) ? BH_CACHE_QH2 : BH_CACHE_QHITS;
+}
+
+/**
+ * @return estimated memory used by cached payload.
+ */
+static size_t
+bh_cache_memory(const struct bh_cache *bc)
+{
+	return sizeof *bc + bc->size + bc->zsize;
+}
+
+/**
+ * Account for memory allocated to (positive delta) or freed from (negative
+ * delta) cached payloads.
+ */
+static void
+bh_cache_memory_update(int64 delta)
+{
+	g_assert(delta >= 0 || bh_cache_mem >= (uint64) -delta);
+
+	bh_cache_mem += delta;
+	gnet_stats_set_general(GNR_BROWSE_CACHE_MEMORY, bh_cache_mem);
+}
+
+/**
+ * Free cached payload.
+ */
+static void
+bh_cache_free(struct bh_cache *bc)
+{
+	bh_cache_check(bc);
+	g_assert(0 == bc->refcnt);
+
+	bh_cache_memory_update(-(int64) bh_cache_memory(bc));
+
+	if (bc->z != NULL) {
+		int ret = deflateEnd(bc->z);
+
+		if (Z_OK != ret && Z_DATA_ERROR != ret) {
+			g_warning("%s(): while freeing compressor: %s",
+				G_STRFUNC, zlib_strerror(ret));
+		}
+		WFREE(bc->z);
+	}
+
+	HFREE_NULL(bc->data);
+	HFREE_NULL(bc->zdata);
+	bc->magic = 0;
+	WFREE(bc);
+}
+
+/**
+ * Remove reference on cached payload, nullifying the pointer.
+ */
+static void
+bh_cache_unref(struct bh_cache **bc_ptr)
+{
+	struct bh_cache *bc = *bc_ptr;
+
+	if (bc != NULL) {
+		bh_cache_check(bc);
+		g_assert(bc->refcnt > 0);
+
+		if (0 == --bc->refcnt)
+			bh_cache_free(bc);
+
+		*bc_ptr = NULL;
+	}
+}
+
+/**
+ * Create a new payload being recorded.
+ *
+ * @return new cached payload, NULL if we cannot compress it.
+ */
+static struct bh_cache *
+bh_cache_alloc(void)
+{
+	struct bh_cache *bc;
+	z_stream *z;
+	int ret;
+
+	WALLOC0(z);
+	z->zalloc = zlib_alloc_func;
+	z->zfree = zlib_free_func;
+	z->opaque = NULL;
+
+	ret = deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+
+	if (Z_OK != ret) {
+		g_warning("%s(): unable to initialize compressor: %s",
+			G_STRFUNC, zlib_strerror(ret));
+		WFREE(z);
+		return NULL;
+	}
+
+	WALLOC0(bc);
+	bc->magic = BH_CACHE_MAGIC;
+	bc->refcnt = 1;
+	bc->z = z;
+	bc->generation = share_library_generation();
+	bc->built = tm_time();
+	bc->addr = listen_addr_primary();
+	bc->port = socket_listen_port();
+	bc->firewalled = booleanize(GNET_PROPERTY(is_firewalled));
+
+	bh_cache_memory_update(bh_cache_memory(bc));
+
+	return bc;
+}
+
+/**
+ * @return whether cached payload still reflects what we would generate now.
+ */
+static bool
+bh_cache_is_valid(const struct bh_cache *bc)
+{
+	bh_cache_check(bc);
+
+	return
+		bc->generation == share_library_generation() &&
+		delta_time(tm_time(), bc->built) < BH_CACHE_LIFETIME &&
+		bc->port == socket_listen_port() &&
+		host_addr_equiv(bc->addr, listen_addr_primary()) &&
+		bc->firewalled == booleanize(GNET_PROPERTY(is_firewalled));
+}
+
+/**
+ * Get the payload of the given kind, discarding it if it is stale.
+ *
+ * @return the payload, complete or being recorded, NULL if none.
+ */
+static struct bh_cache *
+bh_cache_get(enum bh_cache_kind kind)
+{
+	struct bh_cache *bc = bh_cache[kind];
+
+	if (bc != NULL && !bh_cache_is_valid(bc))
+		bh_cache_unref(&bh_cache[kind]);
+
+	return bh_cache[kind];
+}
+
+/**
+ * Ensure there is room for `len' more bytes in buffer.
+ */
+static void
+bh_cache_grow(char **buf, size_t *size, size_t len, size_t fill)
+{
+	size_t old = *size;
+
+	if (fill + len <= old)
+		return;
+
+	*size = MAX(fill + len, MAX(BH_BUFSIZ, old + old / 2));
+	*buf = hrealloc(*buf, *size);
+
+	bh_cache_memory_update(*size - old);
+}
+
+/**
+ * Run the compressor over the supplied data, or flush the compressed stream.
+ *
+ * @return TRUE if OK, FALSE on error.
+ */
+static bool
+bh_cache_deflate(struct bh_cache *bc, const void *data, size_t len, int flush)
+{
+	z_stream *z = bc->z;
+
+	z->next_in = deconstify_pointer(data);
+	z->avail_in = len;
+
+	for (;;) {
+		int ret;
+
+		bh_cache_grow(&bc->zdata, &bc->zsize, BH_BUFSIZ, bc->zlen);
+
+		z->next_out = (void *) &bc->zdata[bc->zlen];
+		z->avail_out = bc->zsize - bc->zlen;
+
+		ret = deflate(z, flush);
+		bc->zlen = bc->zsize - z->avail_out;
+
+		if (Z_STREAM_END == ret)
+			return TRUE;
+
+		if (Z_OK != ret && Z_BUF_ERROR != ret) {
+			g_warning("%s(): while compressing: %s",
+				G_STRFUNC, zlib_strerror(ret));
+			return FALSE;
+		}
+
+		if (0 == z->avail_in && 0 != z->avail_out && Z_FINISH != flush)
+			return TRUE;
+	}
+}
+
+/**
+ * Append generated data to the payload being recorded.
+ */
+static void
+bh_cache_record(struct browse_host_upload *bh, const void *data, size_t len)
+{
+	struct bh_cache *bc = bh->cache;
+
+	bh_cache_check(bc);
+	g_assert(!bc->complete);
+
+	bh_cache_grow(&bc->data, &bc->size, len, bc->len);
+	memcpy(&bc->data[bc->len], data, len);
+	bc->len += len;
+
+	if (!bh_cache_deflate(bc, data, len, Z_NO_FLUSH))
+		bh->truncated = TRUE;		/* Don't install a bad payload */
+}
+
+/**
+ * Payload was fully recorded, make it available to subsequent browsers
+ * if it is still accurate.
+ */
+static void
+bh_cache_install(struct browse_host_upload *bh, enum bh_cache_kind kind)
+{
+	struct bh_cache *bc = bh->cache;
+
+	bh_cache_check(bc);
+
+	if (
+		bh->truncated || bc != bh_cache[kind] || !bh_cache_is_valid(bc) ||
+		!bh_cache_deflate(bc, NULL, 0, Z_FINISH)
+	) {
+		if (bc == bh_cache[kind])
+			bh_cache_unref(&bh_cache[kind]);
+		bh_cache_unref(&bh->cache);
+		return;
+	}
+
+	(void) deflateEnd(bc->z);
+	WFREE(bc->z);
+
+	/*
+	 * Trim buffers to their final size.
+	 */
+
+	bh_cache_memory_update(
+		-(int64) (bc->size - bc->len) - (int64) (bc->zsize - bc->zlen));
+
+	bc->data = hrealloc(bc->data, bc->len);
+	bc->size = bc->len;
+	bc->zdata = hrealloc(bc->zdata, bc->zlen);
+	bc->zsize = bc->zlen;
+	bc->complete = TRUE;
+
+	gnet_stats_inc_general(GNR_BROWSE_CACHE_BUILT);
+
+	if (GNET_PROPERTY(upload_debug)) {
+		g_debug("%s(): cached %zu bytes of browse host payload, "
+			"%zu bytes once deflated", G_STRFUNC, bc->len, bc->zlen);
+	}
+
+	bh_cache_unref(&bh->cache);		/* Recording done, cache holds it */
+}
+
+/**
+ * Release all the cached payloads.
+ */
+void
+bh_upload_close(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(bh_cache); i++) {
+		bh_cache_unref(&bh_cache[i]);
+	}
+}
+
 /**
  * Copies up to ``*size'' bytes from current data block
  * (bh->b_data + bh->b_offset) to the buffer ``dest''.
@@ -270,6 +630,7 @@ browse_host_read_html(struct special_upload *ctx,
 						browse_host_next_state(bh, BH_STATE_TRAILER);
 					/* Skip holes in the file_index table */
 				} else if (SHARE_REBUILDING == sf) {
+					bh->truncated = TRUE;
 					browse_host_next_state(bh, BH_STATE_REBUILDING);
 				} else {
 					const char * const name_nfc = shared_file_name_nfc(sf);
@@ -433,7 +794,12 @@ browse_host_read_qhits(struct special_upload *ctx,
 				sf = shared_file_sorted(bh->file_index);
 			} while (NULL == sf && bh->file_index <= shared_files_scanned());
 
-			if (SHARE_REBUILDING == sf || NULL == sf)
+			if (SHARE_REBUILDING == sf) {
+				bh->truncated = TRUE;
+				break;
+			}
+
+			if (NULL == sf)
 				break;
 
 			files = pslist_prepend(files, sf);
@@ -487,6 +853,60 @@ browse_host_read_qhits(struct special_upload *ctx,
 	return size - remain;
 }
 
+/**
+ * Writes the browse host data of the context ``ctx'' to the buffer
+ * ``dest'', recording it in the payload cache.
+ *
+ * @param ctx an initialized browse host context.
+ * @param dest the destination buffer.
+ * @param size the amount of bytes ``dest'' can hold.
+ *
+ * @return -1 on failure, zero at the end-of-file condition or if size
+ *         was zero. On success, the amount of bytes copied to ``dest''
+ *         is returned.
+ */
+static ssize_t
+browse_host_read_record(struct special_upload *ctx,
+	void *const dest, size_t size)
+{
+	struct browse_host_upload *bh = cast_to_browse_host_upload(ctx);
+	ssize_t r;
+
+	r = (*bh->generate)(ctx, dest, size);
+
+	if (NULL == bh->cache)
+		return r;		/* Recording is over */
+
+	if (r > 0)
+		bh_cache_record(bh, dest, r);
+	else if (0 == r && size != 0)
+		bh_cache_install(bh, bh_cache_kind(bh->flags));
+
+	return r;
+}
+
+/**
+ * Writes the cached browse host payload to the buffer ``dest''.
+ *
+ * @param ctx an initialized browse host context.
+ * @param dest the destination buffer.
+ * @param size the amount of bytes ``dest'' can hold.
+ *
+ * @return zero at the end-of-file condition or if size was zero, the amount
+ * of bytes copied to ``dest'' otherwise.
+ */
+static ssize_t
+browse_host_read_cached(struct special_upload *ctx,
+	void *const dest, size_t size)
+{
+	struct browse_host_upload *bh = cast_to_browse_host_upload(ctx);
+
+	if (0 == bh->b_size)
+		return 0;		/* Empty payload */
+
+	return browse_host_read_data(bh, dest, &size);
+}
+
 /**
  * Write data to the TX stack.
  */
@@ -565,6 +985,19 @@ browse_host_close(struct special_upload *ctx, bool fully_served)
 	}
 	tx_free(bh->tx);
 
+	/*
+	 * If we were recording the payload and did not reach the end, nobody
+	 * will complete it, so discard it.
+	 */
+
+	if (bh->cache != NULL && !bh->cache->complete) {
+		enum bh_cache_kind kind = bh_cache_kind(bh->flags);
+
+		if (bh->cache == bh_cache[kind])
+			bh_cache_unref(&bh_cache[kind]);
+	}
+	bh_cache_unref(&bh->cache);
+
 	/*
 	 * Update statistics if fully served.
 	 */
@@ -608,16 +1041,20 @@ browse_host_open(
 	int flags)
 {
 	struct browse_host_upload *bh;
+	enum bh_cache_kind kind = bh_cache_kind(flags);
+	struct bh_cache *bc;
+	bool precompressed;
 
 	/* BH_HTML xor BH_QHITS set */
 	g_assert(flags & (BH_F_HTML|BH_F_QHITS));
 	g_assert((flags & (BH_F_HTML|BH_F_QHITS)) != (BH_F_HTML|BH_F_QHITS));
 
-	WALLOC(bh);
+	WALLOC0(bh);
 	bh->special.magic = SPECIAL_UPLOAD_BROWSE_MAGIC;
-	bh->special.read  = (flags & BH_F_HTML)
+	bh->generate      = (flags & BH_F_HTML)
 						? browse_host_read_html
 						: browse_host_read_qhits;
+	bh->special.read  = bh->generate;
 	bh->special.write = browse_host_write;
 	bh->special.flush = browse_host_flush;
 	bh->special.close = browse_host_close;
@@ -627,6 +1064,16 @@ browse_host_open(
 	bh->file_index = 0;
 	bh->flags = flags;
 
+	/*
+	 * When the payload is cached and they accept deflated data (but not
+	 * gzipped data, which has its own wrapping), we send the precompressed
+	 * payload directly.
+	 */
+
+	bc = bh_cache_get(kind);
+	precompressed = bc != NULL && bc->complete &&
+		(flags & BH_F_DEFLATE) && !(flags & BH_F_GZIP);
+
 	/*
 	 * Instantiate the TX stack.
 	 */
@@ -644,7 +1091,7 @@ browse_host_open(
 	if (flags & BH_F_CHUNKED) {
 		bh->tx = tx_make_above(bh->tx, tx_chunk_get_ops(), 0);
 	}
-	if (flags & (BH_F_DEFLATE | BH_F_GZIP)) {
+	if (!precompressed && (flags & (BH_F_DEFLATE | BH_F_GZIP))) {
 		struct tx_deflate_args args;
 		txdrv_t *tx;
 
@@ -652,6 +1099,7 @@ browse_host_open(
 		args.cb = deflate_cb;
 		args.nagle = FALSE;
 		args.reduced = FALSE;
+		args.gnet = FALSE;
 		args.gzip = 0 != (flags & BH_F_GZIP);
 		args.buffer_flush = INT_MAX;		/* Flush only at the end */
 		args.buffer_size = BH_BUFSIZ;
@@ -668,6 +1116,29 @@ browse_host_open(
 		bh->tx = tx;
 	}
 
+	/*
+	 * Serve the cached payload if we have one, otherwise record what
+	 * we generate, unless someone else is already doing it.
+	 */
+
+	if (NULL == bc) {
+		bc = bh_cache[kind] = bh_cache_alloc();
+		if (bc != NULL) {
+			bc->refcnt++;
+			bh->cache = bc;
+			bh->special.read = browse_host_read_record;
+		}
+	} else if (bc->complete) {
+		bc->refcnt++;
+		bh->cache = bc;
+		bh->special.read = browse_host_read_cached;
+		bh->b_data = precompressed ? bc->zdata : bc->data;
+		bh->b_size = precompressed ? bc->zlen : bc->len;
+		gnet_stats_inc_general(GNR_BROWSE_CACHE_HITS);
+		if (precompressed)
+			gnet_stats_inc_general(GNR_BROWSE_CACHE_PRECOMPRESSED);
+	}
+
 	/*
 	 * Put stack in "eager" mode: we want to be notified whenever
 	 * we can write something.
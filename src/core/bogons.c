@@ -44,6 +44,7 @@
 #include "lib/parse.h"
 #include "lib/path.h"
 #include "lib/str.h"
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/walloc.h"
 #include "lib/watcher.h"
@@ -59,13 +60,26 @@ static const char bogons_what[] = "Bogus IP addresses";
 static struct iprange_db *bogons_db; /**< The database of bogus CIDR ranges */
 static time_t bogons_mtime;			 /**< Modification time of loaded file */
 
+/**
+ * Database parsed by bogons_parse(), until bogons_init() installs it.
+ */
+static struct bogons_parsed {
+	struct iprange_db *db;	/**< Parsed database, NULL if no file found */
+	char *pathname;			/**< File it was read from (halloc()'ed) */
+	time_t mtime;			/**< Modification time of that file */
+	bool done;				/**< Whether bogons_parse() was run */
+} bogons_parsed;
+
 /**
  * Load bogons data from the supplied FILE.
  *
- * @returns the amount of entries loaded.
+ * @param f			the file to read
+ * @param mtime		where the modification time of the file is written
+ *
+ * @returns a new database holding the entries loaded.
  */
-static int G_COLD
-bogons_load(FILE *f)
+static struct iprange_db * G_COLD
+bogons_load(FILE *f, time_t *mtime)
 {
 	char line[1024];
 	uint32 ip, netmask;
@@ -73,12 +87,13 @@ bogons_load(FILE *f)
 	int bits;
 	iprange_err_t error;
 	filestat_t buf;
+	struct iprange_db *db;
 
-	bogons_db = iprange_new();
+	db = iprange_new();
 	if (-1 == fstat(fileno(f), &buf)) {
 		g_warning("cannot stat %s: %m", bogons_file);
 	} else {
-		bogons_mtime = buf.st_mtime;
+		*mtime = buf.st_mtime;
 	}
 
 	while (fgets(line, sizeof(line), f)) {
@@ -104,7 +119,7 @@ bogons_load(FILE *f)
 		}
 
 		bits = netmask_to_cidr(netmask);
-		error = iprange_add_cidr(bogons_db, ip, bits, 1);
+		error = iprange_add_cidr(db, ip, bits, 1);
 
 		switch (error) {
 		case IPR_ERR_OK:
@@ -118,15 +133,14 @@ bogons_load(FILE *f)
 		}
 	}
 
-	iprange_sync(bogons_db);
+	iprange_sync(db);
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u bogus IP ranges (%u hosts)",
-			iprange_get_item_count(bogons_db),
-			iprange_get_host_count4(bogons_db));
+			iprange_get_item_count(db), iprange_get_host_count4(db));
 	}
 
-	return iprange_get_item_count(bogons_db);
+	return db;
 }
 
 /**
@@ -138,7 +152,7 @@ bogons_changed(const char *filename, void *unused_udata)
 {
 	FILE *f;
 	char buf[80];
-	int count;
+	uint count;
 
 	(void) unused_udata;
 
@@ -147,15 +161,16 @@ bogons_changed(const char *filename, void *unused_udata)
 		return;
 
 	bogons_close();
-	count = bogons_load(f);
+	bogons_db = bogons_load(f, &bogons_mtime);
+	count = iprange_get_item_count(bogons_db);
 	fclose(f);
 
-	str_bprintf(ARYLEN(buf), "Reloaded %d bogus IP ranges.", count);
+	str_bprintf(ARYLEN(buf), "Reloaded %u bogus IP ranges.", count);
 	gcu_statusbar_message(buf);
 }
 
 /**
- * Loads the bogons.txt into memory.
+ * Parses the bogons.txt file, leaving the database for bogons_init().
  *
  * Choosing the first file we find among the several places we look at,
  * typically:
@@ -164,18 +179,20 @@ bogons_changed(const char *filename, void *unused_udata)
  *	-# /usr/share/gtk-gnutella/bogons.txt
  *	-# PACKAGE_EXTRA_SOURCE_DIR/bogons.txt
  *
- * The selected file will then be monitored and a reloading will occur
- * shortly after a modification.
+ * This only reads the file and can therefore be run by a separate thread.
  */
-static void G_COLD
-bogons_retrieve(void)
+void G_COLD
+bogons_parse(void)
 {
+	struct bogons_parsed *bp = &bogons_parsed;
 	FILE *f;
 	int idx;
-	char *filename;
 	file_path_t fp[4];
 	unsigned length;
 
+	g_assert(!bp->done);
+
+	bp->done = TRUE;
 	length = settings_file_path_load(fp, bogons_file, SFP_DFLT);
 
 	g_assert(length <= N_ITEMS(fp));
@@ -185,21 +202,37 @@ bogons_retrieve(void)
 	if (NULL == f)
 	   return;
 
-	filename = make_pathname(fp[idx].dir, fp[idx].name);
-	watcher_register(filename, bogons_changed, NULL);
-	HFREE_NULL(filename);
-
-	bogons_load(f);
+	bp->pathname = make_pathname(fp[idx].dir, fp[idx].name);
+	bp->db = bogons_load(f, &bp->mtime);
 	fclose(f);
 }
 
 /**
- * Called on startup. Loads the bogons.txt into memory.
+ * Called on startup. Installs the database parsed by bogons_parse(),
+ * parsing the bogons.txt file now if not done yet.
+ *
+ * The selected file will then be monitored and a reloading will occur
+ * shortly after a modification.
  */
 void
 bogons_init(void)
 {
-	bogons_retrieve();
+	struct bogons_parsed *bp = &bogons_parsed;
+
+	g_assert(thread_is_main());
+
+	if (!bp->done)
+		bogons_parse();
+
+	if (NULL == bp->db)
+		return;
+
+	watcher_register(bp->pathname, bogons_changed, NULL);
+	HFREE_NULL(bp->pathname);
+
+	bogons_db = bp->db;
+	bogons_mtime = bp->mtime;
+	bp->db = NULL;
 }
 
 /**
@@ -38,6 +38,7 @@
 #include "lib/host_addr.h"
 
 bool bogons_check(const host_addr_t addr);
+void bogons_parse(void);
 void bogons_init(void);
 void bogons_close(void);
 
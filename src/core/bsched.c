@@ -43,6 +43,7 @@
 #include "if/gnet_property_priv.h"
 
 #include "lib/compat_sendfile.h"
+#include "lib/elist.h"
 #include "lib/entropy.h"
 #include "lib/halloc.h"
 #include "lib/hstrfn.h"
@@ -114,12 +115,26 @@ enum bsched_magic {
  * of the period, any amount of bandwidth that has been unused will be
  * given as "stolen" bandwidth to some of the schedulers stealing from us.
  * Priority is given to schedulers that used up all their bandwidth.
+ *
+ * Per-source accounting is lazy, so that the cost of a timeslice is
+ * proportional to the amount of sources that actually did something during
+ * that slice, not to the total amount of sources registered:
+ *
+ * - Sources requesting bandwidth, doing I/O or holding pre-allocated or
+ *   favoured bandwidth are put in the `active' list, which is the only one
+ *   walked when a new timeslice begins.
+ * - Running out of bandwidth does not disable all the sources: each source
+ *   is disabled when it next triggers, and re-enabled at the next timeslice.
+ * - The bandwidth EMAs of sources idle during some timeslices are caught up
+ *   when the source becomes active again, or when they are queried.
  */
 
 struct bsched {
 	enum bsched_magic magic;
 	tm_t last_period;			/**< Last time we ran our period */
 	plist_t *sources;			/**< List of bio_source_t */
+	elist_t active;				/**< Sources to process at next timeslice */
+	elist_t passive;			/**< Passive sources with a callback */
 	pslist_t *stealers;			/**< List of bsched_t stealing bw */
 	char *name;					/**< Name, for tracing purposes */
 	property_t byte_count;		/**< Property used to count transferred bytes */
@@ -146,6 +161,7 @@ struct bsched {
 	int last_used;				/**< Nb of active sources last period */
 	int current_used;			/**< Nb of active sources this period */
 	uint io_favours;			/**< Amount of sources wanting favours */
+	uint32 slice;				/**< Current timeslice number */
 	unsigned looped:1;			/**< True when looped once over sources */
 };
 
@@ -226,6 +242,8 @@ bsched_make(const char *name, property_t account, uint type, uint32 mode,
 	bs->period_ema = period;
 	bs->bw_per_second = bandwidth;
 	bs->bw_max = (int64) (bandwidth / 1000.0 * period);
+	elist_init(&bs->active, offsetof(bio_source_t, active_lnk));
+	elist_init(&bs->passive, offsetof(bio_source_t, passive_lnk));
 
 	return bs;
 }
@@ -260,9 +278,12 @@ bsched_free(bsched_t *bs)
 		bio_check(bio);
 		g_assert(bsched_get(bio->bws) == bs);
 		bio->bws = BSCHED_BWS_INVALID;	/* Mark orphan source */
+		bio->flags &= ~BIO_F_LISTED;
 	}
 
 	plist_free_null(&bs->sources);
+	elist_discard(&bs->active);
+	elist_discard(&bs->passive);
 	pslist_free_null(&bs->stealers);
 	HFREE_NULL(bs->name);
 	bs->magic = 0;
@@ -806,6 +827,107 @@ bio_bw_per_second(const bio_source_t *bio)
 	return bs->bw_per_second;
 }
 
+/**
+ * Apply `n' idle timeslices to the fast and slow bandwidth EMAs.
+ *
+ * This is exactly what bsched_begin_timeslice() would have computed for a
+ * source that did not use any bandwidth during these `n' timeslices.
+ */
+static void
+bio_ema_decay(int64 *fast, int64 *slow, uint32 n)
+{
+	uint32 i;
+
+	for (i = 0; i < n && *fast > 1; i++)
+		*fast -= *fast >> 1;
+
+	for (i = 0; i < n && *slow >= 64; i++)
+		*slow -= *slow >> 6;
+}
+
+/**
+ * Catch up with the timeslices during which the source was not listed
+ * in the scheduler's active list, updating its bandwidth EMAs.
+ */
+static void
+bio_catchup(bio_source_t *bio, const bsched_t *bs)
+{
+	uint32 idle = bs->slice - bio->bw_slice;
+
+	if G_LIKELY(0 == idle)
+		return;
+
+	g_assert(0 == bio->bw_actual);	/* No I/O whilst not listed */
+
+	bio_ema_decay(&bio->bw_fast_ema, &bio->bw_slow_ema, idle);
+	bio->bw_last_bps = 0;
+	bio->bw_slice = bs->slice;
+}
+
+/**
+ * Record source in the scheduler's active list, so that its state is
+ * processed when the next timeslice begins.
+ */
+static void
+bsched_bio_activate(bsched_t *bs, bio_source_t *bio)
+{
+	if (bio->flags & BIO_F_LISTED)
+		return;
+
+	bio_catchup(bio, bs);
+	elist_append(&bs->active, bio);
+	bio->flags |= BIO_F_LISTED;
+}
+
+/**
+ * Record I/O source as active in its scheduler, if not already done.
+ */
+static void
+bio_activate(bio_source_t *bio)
+{
+	if G_UNLIKELY(BSCHED_BWS_INVALID == bio->bws)
+		return;					/* Orphan source, scheduler gone */
+
+	bsched_bio_activate(bsched_get(bio->bws), bio);
+}
+
+/**
+ * @return b/w used by the source during the last timeslice, in bytes/sec.
+ */
+int64
+bio_bps(const bio_source_t *bio)
+{
+	bio_check(bio);
+
+	if G_UNLIKELY(BSCHED_BWS_INVALID == bio->bws)
+		return bio->bw_last_bps;
+
+	/*
+	 * If the source was not listed last timeslice, it did not do any I/O.
+	 */
+
+	return bsched_get(bio->bws)->slice == bio->bw_slice ? bio->bw_last_bps : 0;
+}
+
+/**
+ * @return average b/w used by the source, in bytes/sec.
+ */
+int64
+bio_avg_bps(const bio_source_t *bio)
+{
+	int64 fast, slow;
+
+	bio_check(bio);
+
+	fast = bio->bw_fast_ema;
+	slow = bio->bw_slow_ema;
+
+	if G_LIKELY(BSCHED_BWS_INVALID != bio->bws)
+		bio_ema_decay(&fast, &slow, bsched_get(bio->bws)->slice - bio->bw_slice);
+
+	return slow >> BIO_EMA_SHIFT;
+}
+
 /**
  * Trigger the "passive" callback to signify that a new timeslice has begun
  * and that I/Os can resume on the source.
@@ -890,7 +1012,9 @@ bio_add_callback(bio_source_t *bio, inputevt_handler_t callback, void *arg)
 	bio->io_arg = arg;
 	bio->flags &= ~BIO_F_PASSIVE;
 
-	if (!(bsched_get(bio->bws)->flags & BS_F_NOBW))
+	if (bsched_get(bio->bws)->flags & BS_F_NOBW)
+		bio_activate(bio);				/* Enabled at next timeslice */
+	else
 		bio_enable(bio);
 }
 
@@ -916,6 +1040,9 @@ bio_add_passive_callback(bio_source_t *bio, inputevt_handler_t cb, void *arg)
 	bio->io_callback = cb;
 	bio->io_arg = arg;
 	bio->flags |= BIO_F_PASSIVE;		/* Don't call bio_enable() */
+
+	if G_LIKELY(BSCHED_BWS_INVALID != bio->bws)
+		elist_append(&bsched_get(bio->bws)->passive, bio);
 }
 
 /**
@@ -930,6 +1057,9 @@ bio_remove_callback(bio_source_t *bio)
 	if (bio->io_tag)
 		bio_disable(bio);
 
+	if ((bio->flags & BIO_F_PASSIVE) && BSCHED_BWS_INVALID != bio->bws)
+		elist_remove(&bsched_get(bio->bws)->passive, bio);
+
 	bio->flags &= ~BIO_F_PASSIVE;
 	bio->io_callback = NULL;
 	bio->io_arg = NULL;
@@ -937,22 +1067,17 @@ bio_remove_callback(bio_source_t *bio)
 
 
 /**
- * Disable all sources and flag that we have no more bandwidth.
+ * Flag that we have no more bandwidth.
+ *
+ * Sources are not disabled here: that would cost one event removal per
+ * source, most of which would not have triggered anyway, and as many
+ * re-registrations when the next timeslice begins.  Instead, each source
+ * is disabled when it next triggers, by bw_available().
  */
 static void
 bsched_no_more_bandwidth(bsched_t *bs)
 {
-	plist_t *iter;
-
 	bsched_check(bs);
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
-
-		bio_check(bio);
-
-		if (bio->io_tag)
-			bio_disable(bio);
-	}
 
 	bs->flags |= BS_F_NOBW;
 }
@@ -963,11 +1088,16 @@ bsched_no_more_bandwidth(bsched_t *bs)
 static void
 bsched_clear_active(bsched_t *bs)
 {
-	plist_t *iter;
+	link_t *lk;
 
 	bsched_check(bs);
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
+
+	/*
+	 * Only sources in the active list can have the BIO_F_ACTIVE flag set.
+	 */
+
+	ELIST_FOREACH(&bs->active, lk) {
+		bio_source_t *bio = elist_data(&bs->active, lk);
 
 		bio_check(bio);
 		bio->flags &= ~BIO_F_ACTIVE;
@@ -977,17 +1107,17 @@ bsched_clear_active(bsched_t *bs)
 /**
  * Called whenever a new scheduling timeslice begins.
  *
- * Re-enable all sources and flag that we have bandwidth.
- * Update the per-source bandwidth statistics.
+ * Re-enable all sources disabled during the last timeslice and flag that
+ * we have bandwidth.
+ * Update the per-source bandwidth statistics of active sources.
  * Clears all activation indication on all sources.
  */
 static void
 bsched_begin_timeslice(bsched_t *bs)
 {
-	plist_t *iter, *last = NULL;
+	link_t *lk, *next;
 	pslist_t *trigger = NULL;
 	double norm_factor;
-	int count;
 	int64 bw_max;
 
 	bsched_check(bs);
@@ -1032,23 +1162,27 @@ bsched_begin_timeslice(bsched_t *bs)
 	norm_factor = 1000.0 / bs->period;
 	bs->io_favours = 0;
 	bw_max = bs->bw_max;
-	count = 0;
 
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
+	/*
+	 * Only the sources listed in the active list have state to update:
+	 * all the others were idle and kept their I/O callbacks installed.
+	 * Their bandwidth EMAs are updated lazily, by bio_catchup().
+	 */
+
+	for (lk = elist_first(&bs->active); lk != NULL; lk = next) {
+		bio_source_t *bio = elist_data(&bs->active, lk);
 		uint64 actual;
 
 		bio_check(bio);
+		g_assert(bio->flags & BIO_F_LISTED);
+		g_assert(bio->bw_slice == bs->slice);
 
-		last = iter;		/* Remember last seen source for rotation */
-		count++;			/* Count them for assertion */
+		next = elist_next(lk);
 
 		bio->flags &= ~(BIO_F_ACTIVE | BIO_F_USED);
 
 		if (bio->io_tag == 0 && bio->io_callback) {
-			if (bio->flags & BIO_F_PASSIVE)
-				trigger = pslist_prepend(trigger, bio);
-			else
+			if (!(bio->flags & BIO_F_PASSIVE))
 				bio_enable(bio);
 		}
 
@@ -1076,8 +1210,8 @@ bsched_begin_timeslice(bsched_t *bs)
 		 * Because we use integer arithmetic (and therefore loose important
 		 * decimals), the actual values are shifted by BIO_EMA_SHIFT.
 		 * The fields storing the EMAs should therefore only be accessed via
-		 * the macros, which perform the shift in the other way to
-		 * re-establish proper scaling.
+		 * the bio_bps() and bio_avg_bps() routines, which perform the shift in
+		 * the other way to re-establish proper scaling.
 		 */
 
 		actual = bio->bw_actual << BIO_EMA_SHIFT;
@@ -1085,27 +1219,42 @@ bsched_begin_timeslice(bsched_t *bs)
 		bio->bw_slow_ema += (actual >> 6) - (bio->bw_slow_ema >> 6);
 		bio->bw_last_bps = (int64) (bio->bw_actual * norm_factor);
 		bio->bw_actual = 0;
+		bio->bw_slice = bs->slice + 1;
+
+		/*
+		 * Sources holding favours or pre-allocated bandwidth remain listed
+		 * since they must be accounted for at each timeslice.
+		 */
+
+		if (0 == bio->bw_allocated && !(bio->flags & BIO_F_FAVOUR)) {
+			elist_link_remove(&bs->active, lk);
+			bio->flags &= ~BIO_F_LISTED;
+		}
 	}
 
-	g_assert(bs->count == count);	/* All sources are there */
+	bs->slice++;
 
 	/*
-	 * Rotate sources, since we don't know how glib handles callbacks on
-	 * the registered sources.  We don't want to always have the same
-	 * sources get most of the bandwidth because they simply get added
-	 * first as I/O sources.
+	 * Passive sources are triggered at the beginning of each timeslice.
+	 *
+	 * Rotate them, since we don't want to always have the same sources get
+	 * most of the bandwidth because they simply get triggered first.
 	 */
 
-	if (last != NULL && last != bs->sources) {
-		bio_source_t *bio;
+	if (elist_count(&bs->passive) > 1)
+		elist_moveto_tail(&bs->passive, elist_head(&bs->passive));
+
+	ELIST_FOREACH(&bs->passive, lk) {
+		bio_source_t *bio = elist_data(&bs->passive, lk);
 
-		g_assert(bs->sources != NULL);
-		bio = bs->sources->data;
 		bio_check(bio);
-		bs->sources = plist_remove(bs->sources, bio);
-		bs->sources = plist_insert_after(bs->sources, last, bio);
+		g_assert(bio->flags & BIO_F_PASSIVE);
+
+		trigger = pslist_prepend(trigger, bio);
 	}
 
+	trigger = pslist_reverse(trigger);
+
 	bs->flags &= ~(BS_F_NOBW|BS_F_FROZEN_SLOT|BS_F_CHANGED_BW|BS_F_CLEARED);
 
 	/*
@@ -1192,6 +1341,7 @@ bsched_bio_add(bsched_t *bs, bio_source_t *bio)
 
 	bs->sources = plist_append(bs->sources, bio);
 	bs->count++;
+	bio->bw_slice = bs->slice;
 
 	bs->bw_slot = (bs->bw_max + bs->bw_stolen) / bs->count;
 
@@ -1218,6 +1368,14 @@ bsched_bio_remove(bsched_bws_t bws, bio_source_t *bio)
 	bs->sources = plist_remove(bs->sources, bio);
 	bs->count--;
 
+	if (bio->flags & BIO_F_LISTED) {
+		elist_remove(&bs->active, bio);
+		bio->flags &= ~BIO_F_LISTED;
+	}
+
+	if ((bio->flags & BIO_F_PASSIVE) && bio->io_callback != NULL)
+		elist_remove(&bs->passive, bio);
+
 	if (bs->count)
 		bs->bw_slot = (bs->bw_max + bs->bw_stolen) / bs->count;
 
@@ -1273,8 +1431,12 @@ bsched_source_add(
 
 	bsched_bio_add(bs, bio);
 
-	if (!(bs->flags & BS_F_NOBW) && bio->io_callback)
-		bio_enable(bio);
+	if (bio->io_callback != NULL) {
+		if (bs->flags & BS_F_NOBW)
+			bsched_bio_activate(bs, bio);	/* Enabled at next timeslice */
+		else
+			bio_enable(bio);
+	}
 
 	return bio;
 }
@@ -1366,8 +1528,23 @@ bw_available(bio_source_t *bio, int len)
 	if (!(bs->flags & BS_F_ENABLED))		/* Scheduler disabled */
 		return len;							/* Use amount requested */
 
-	if (bs->flags & BS_F_NOBW)				/* No more bandwidth */
+	/*
+	 * From now on, the source state can change during this timeslice and
+	 * must be reset when the next one begins.
+	 */
+
+	bsched_bio_activate(bs, bio);
+
+	/*
+	 * When we ran out of bandwidth, disable the source so that it does
+	 * not trigger again until the next timeslice.
+	 */
+
+	if (bs->flags & BS_F_NOBW) {			/* No more bandwidth */
+		if (bio->io_tag)
+			bio_disable(bio);
 		return 0;							/* Grant nothing */
+	}
 
 	/*
 	 * Source is already disabled if there is a callback and no tag on a
@@ -1778,6 +1955,9 @@ bsched_bw_update(bsched_t *bs, ssize_t used, size_t requested)
 static inline ALWAYS_INLINE void
 bio_bw_update(bio_source_t *bio, ssize_t used)
 {
+	if G_UNLIKELY(!(bio->flags & BIO_F_LISTED))
+		bio_activate(bio);
+
 	bio->bw_actual += used;
 
 	if G_UNLIKELY(0 != bio->bw_allocated)
@@ -1801,6 +1981,7 @@ bio_set_favour(bio_source_t *bio, bool on)
 	if (on) {
 		bio->flags |= BIO_F_FAVOUR;
 		bio->bw_allocated = 0;
+		bio_activate(bio);		/* Must be accounted for at each timeslice */
 	} else {
 		bio->flags &= ~BIO_F_FAVOUR;
 	}
@@ -1820,6 +2001,9 @@ bio_add_allocated(bio_source_t *bio, unsigned bw)
 
 	bio->bw_allocated = uint_saturate_add(bio->bw_allocated, bw);
 
+	if (0 != bio->bw_allocated)
+		bio_activate(bio);		/* Must be accounted for at each timeslice */
+
 	return bio->bw_allocated;
 }
 
@@ -2857,7 +3041,7 @@ bws_can_connect(enum socket_type type)
 static void
 bsched_heartbeat(bsched_t *bs, tm_t *tv)
 {
-	plist_t *iter;
+	link_t *lk;
 	int delay;
 	int64 overused;
 	int64 theoric;
@@ -3003,8 +3187,8 @@ bsched_heartbeat(bsched_t *bs, tm_t *tv)
 
 	last_used = 0;
 
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
+	ELIST_FOREACH(&bs->active, lk) {
+		bio_source_t *bio = elist_data(&bs->active, lk);
 
 		bio_check(bio);
 
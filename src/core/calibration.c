@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Persistence of the startup calibration of library routines.
+ *
+ * Both vsort_init() and pattern_init() run timed benchmarks to select the
+ * fastest sorting and string matching routines for the running machine,
+ * which slows down startup by a few seconds.
+ *
+ * Since the outcome only depends on the CPU, on the compiled code and on the
+ * CPU frequency scaling policy, we save the selected routines in the config
+ * directory, along with a key describing these three items.  On subsequent
+ * startups, when the key is unchanged, the routines are restored directly.
+ *
+ * When the key differs (or there is no saved calibration), the library keeps
+ * its hardwired defaults and the benchmarks are run in a background thread
+ * once the startup sequence is over, saving the results when done.  Routines
+ * are switched atomically by the library as results come in, so this is safe
+ * whilst other threads run.
+ *
+ * Results measured whilst other threads or processes competed for the CPU
+ * would be skewed: these are not saved, and the benchmarks are run again a
+ * little later.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "calibration.h"
+#include "settings.h"
+#include "version.h"
+
+#include "lib/ascii.h"
+#include "lib/atomic.h"
+#include "lib/file.h"
+#include "lib/getcpucount.h"
+#include "lib/halloc.h"
+#include "lib/misc.h"
+#include "lib/pattern.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/thread.h"
+#include "lib/tm.h"
+#include "lib/vsort.h"
+
+#if defined(I_SYS_SYSCTL) && defined(HAS_SYSCTL) && defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define CALIBRATION_LOAD_MAX	0.25	/**< Max CPU fraction taken by others */
+#define CALIBRATION_ATTEMPTS	3		/**< Benchmark runs before giving up */
+#define CALIBRATION_RETRY_MS	60000	/**< Delay before running them again */
+
+static const char calibration_file[] = "calibration";
+static const char calibration_what[] = "startup calibration";
+
+static const char calibration_file_header[] =
+	"#\n"
+	"# gtk-gnutella startup calibration of library routines\n"
+	"#\n"
+	"# The \"cpu\", \"build\" and \"cpufreq\" lines are the key: when any\n"
+	"# of them changes, the routines are benchmarked again.\n"
+	"# Remove this file to force a new calibration at next startup.\n"
+	"#\n"
+	"\n";
+
+enum calibration_state {
+	CALIBRATION_DEFAULT = 0,	/**< Using hardwired library defaults */
+	CALIBRATION_RUNNING,		/**< Benchmarks running in the background */
+	CALIBRATION_MEASURED,		/**< Benchmarked during this session */
+	CALIBRATION_RESTORED,		/**< Restored from the saved calibration */
+	CALIBRATION_LOADED			/**< Only benchmarked under load, not saved */
+};
+
+static int calibration_state;	/**< An enum calibration_state value */
+static char *calibration_key;	/**< The key for this run, "x y\n" lines */
+static char *calibration_path;	/**< Executable path, for the build key */
+static int calibration_vsort_verbose;
+static int calibration_pattern_verbose;
+static uint calibration_ms;		/**< Time taken by benchmarks, in ms */
+
+/**
+ * Read the first line of a file into a string.
+ *
+ * @return TRUE if we got something.
+ */
+static bool
+calibration_read_line(const char *path, char *buf, size_t len)
+{
+	FILE *f;
+	bool ok = FALSE;
+
+	f = fopen(path, "r");
+	if (NULL == f)
+		return FALSE;
+
+	if (fgets(buf, len, f) != NULL) {
+		strchomp(buf, 0);
+		ok = '\0' != buf[0];
+	}
+
+	fclose(f);
+	return ok;
+}
+
+/**
+ * Append the CPU model to the string.
+ */
+static void
+calibration_cpu_model(str_t *s)
+{
+	bool found = FALSE;
+	FILE *f;
+
+#if defined(I_SYS_SYSCTL) && defined(HAS_SYSCTL) && defined(__APPLE__)
+	{
+		char model[256];
+		size_t len = sizeof model;
+
+		if (0 == sysctlbyname("machdep.cpu.brand_string", model, &len, NULL, 0)) {
+			model[MIN(len, sizeof model - 1)] = '\0';
+			str_cat(s, model);
+			found = TRUE;
+		}
+	}
+#endif
+
+	f = found ? NULL : fopen("/proc/cpuinfo", "r");
+
+	if (f != NULL) {
+		static const char *fields[] = { "model name", "cpu model", "cpu" };
+		char line[256];
+
+		while (!found && fgets(line, sizeof line, f) != NULL) {
+			uint i;
+
+			for (i = 0; i < N_ITEMS(fields); i++) {
+				const char *p = is_strprefix(line, fields[i]);
+
+				if (p != NULL && (' ' == *p || '\t' == *p || ':' == *p)) {
+					p = vstrchr(p, ':');
+					if (NULL == p)
+						continue;
+					p = skip_ascii_blanks(p + 1);
+					strchomp(deconstify_char(p), 0);
+					str_cat(s, p);
+					found = TRUE;
+					break;
+				}
+			}
+		}
+
+		fclose(f);
+	}
+
+	if (!found)
+		STR_CAT(s, "unknown");
+
+	str_catf(s, " x%ld", getcpucount());
+}
+
+/**
+ * Append the CPU frequency scaling state to the string.
+ */
+static void
+calibration_cpufreq(str_t *s)
+{
+	static const char cpufreq[] = "/sys/devices/system/cpu/cpu0/cpufreq";
+	char path[MAX_PATH_LEN];
+	char buf[64];
+	bool found = FALSE;
+
+	str_bprintf(ARYLEN(path), "%s/scaling_governor", cpufreq);
+	if (calibration_read_line(path, ARYLEN(buf))) {
+		str_cat(s, buf);
+		found = TRUE;
+	}
+
+	str_bprintf(ARYLEN(path), "%s/scaling_max_freq", cpufreq);
+	if (calibration_read_line(path, ARYLEN(buf))) {
+		str_catf(s, "%s%s", found ? " " : "", buf);
+		found = TRUE;
+	}
+
+	if (!found)
+		STR_CAT(s, "none");
+}
+
+/**
+ * Compute the key under which calibration results are saved.
+ *
+ * @return the key, as a newly allocated string (via halloc).
+ */
+static char *
+calibration_compute_key(void)
+{
+	str_t *s = str_new(256);
+	filestat_t buf;
+
+	STR_CAT(s, "cpu ");
+	calibration_cpu_model(s);
+
+	/*
+	 * The version string changes with each build, but a locally recompiled
+	 * binary can have different compiler flags with the same version, so
+	 * we also include the executable size and modification time.
+	 */
+
+	str_catf(s, "\nbuild %s", version_build_string());
+	if (calibration_path != NULL && 0 == stat(calibration_path, &buf)) {
+		str_catf(s, " %s %lu",
+			filesize_to_string(buf.st_size), (ulong) buf.st_mtime);
+	}
+
+	STR_CAT(s, "\ncpufreq ");
+	calibration_cpufreq(s);
+	str_putc(s, '\n');
+
+	return str_s2c_null(&s);
+}
+
+/**
+ * Apply one "key value" line from the saved calibration.
+ *
+ * @param line		the line, which is modified
+ * @param key		string collecting the key lines found
+ *
+ * @return FALSE if the line was not understood.
+ */
+static bool
+calibration_apply(char *line, str_t *key)
+{
+	char *value;
+
+	value = vstrchr(line, ' ');
+	if (NULL == value)
+		return FALSE;
+
+	*value++ = '\0';
+
+	if (
+		0 == strcmp(line, "cpu") ||
+		0 == strcmp(line, "build") ||
+		0 == strcmp(line, "cpufreq")
+	) {
+		str_catf(key, "%s %s\n", line, value);
+		return TRUE;
+	}
+
+	/*
+	 * Since the key lines come first in the file, we do not apply anything
+	 * until we know the key matches ours.
+	 */
+
+	if (0 != strcmp(str_2c(key), calibration_key))
+		return FALSE;
+
+	return
+		vsort_calibration_set(line, value) ||
+		pattern_calibration_set(line, value);
+}
+
+/**
+ * Attempt to restore the saved calibration.
+ *
+ * @return TRUE if the calibration was restored.
+ */
+static bool
+calibration_restore(void)
+{
+	file_path_t fp;
+	FILE *f;
+	str_t *key;
+	bool ok = TRUE;
+	uint lines = 0;
+	char line[1024];
+
+	file_path_set(&fp, settings_config_dir(), calibration_file);
+	f = file_config_open_read_norename(calibration_what, &fp, 1);
+	if (NULL == f)
+		return FALSE;
+
+	key = str_new(256);
+
+	while (ok && fgets(line, sizeof line, f) != NULL) {
+		if (!file_line_chomp_tail(ARYLEN(line), NULL)) {
+			ok = FALSE;
+			break;
+		}
+		if (file_line_is_skipable(line))
+			continue;
+		ok = calibration_apply(line, key);
+		lines++;
+	}
+
+	fclose(f);
+
+	/*
+	 * A file with a matching key but no data is as good as no file.
+	 * If we bailed out in the middle, some routines may have been restored
+	 * already: that is harmless since the benchmarks will run anyway.
+	 */
+
+	if (ok && 0 != strcmp(str_2c(key), calibration_key))
+		ok = FALSE;
+
+	if (ok && lines <= 3)
+		ok = FALSE;
+
+	str_destroy_null(&key);
+	return ok;
+}
+
+/**
+ * Save the calibration results.
+ *
+ * @return TRUE if the results were saved.
+ */
+static bool
+calibration_save(void)
+{
+	file_path_t fp;
+	FILE *f;
+	str_t *s;
+	bool ok;
+
+	file_path_set(&fp, settings_config_dir(), calibration_file);
+	f = file_config_open_write(calibration_what, &fp);
+	if (NULL == f)
+		return FALSE;
+
+	s = str_new(512);
+	vsort_calibration(s);
+	pattern_calibration(s);
+
+	fputs(calibration_file_header, f);
+	fputs(calibration_key, f);
+	fputs("\n", f);
+	fputs(str_2c(s), f);
+	ok = file_config_close(f, &fp);
+
+	str_destroy_null(&s);
+	return ok;
+}
+
+/**
+ * Run the benchmarks.
+ *
+ * @return TRUE if they ran without competing for the CPU.
+ */
+static bool
+calibration_run(void)
+{
+	tm_t start, end;
+	double cpu, elapsed;
+
+	cpu = tm_thread_cputime();
+	tm_now_exact(&start);
+	vsort_init(calibration_vsort_verbose);
+	pattern_init(calibration_pattern_verbose);
+	tm_now_exact(&end);
+	cpu = tm_thread_cputime() - cpu;
+
+	elapsed = tm_elapsed_f(&end, &start);
+	atomic_uint_set(&calibration_ms, (uint) (elapsed * 1000.0));
+
+	/*
+	 * Only the CPU time of this thread is considered: the process-wide
+	 * figure would include the main thread and the tqsort() workers.
+	 * Getting much less than the elapsed time means other processes got
+	 * the CPU whilst we were measuring.
+	 *
+	 * When the thread CPU clock is not available, we cannot tell and
+	 * trust the results.
+	 */
+
+	if (cpu >= 0.0 && elapsed - cpu > CALIBRATION_LOAD_MAX * elapsed) {
+		s_info("startup calibration done in %F secs under load "
+			"(%.0f%% CPU used), results discarded",
+			elapsed, elapsed != 0.0 ? 100.0 * cpu / elapsed : 0.0);
+		return FALSE;
+	}
+
+	s_info("startup calibration done in %F secs", elapsed);
+	return TRUE;
+}
+
+/**
+ * Thread running the benchmarks.
+ */
+static void *
+calibration_thread(void *unused_arg)
+{
+	uint i;
+
+	(void) unused_arg;
+
+	thread_set_name("calibration");
+
+	for (i = 0; i < CALIBRATION_ATTEMPTS; i++) {
+		if (0 != i)
+			thread_sleep_ms(CALIBRATION_RETRY_MS);
+
+		if (calibration_run()) {
+			if (calibration_save())
+				s_info("startup calibration results saved");
+			else
+				s_warning("could not save startup calibration results");
+			atomic_int_set(&calibration_state, CALIBRATION_MEASURED);
+			return NULL;
+		}
+	}
+
+	atomic_int_set(&calibration_state, CALIBRATION_LOADED);
+	return NULL;
+}
+
+/**
+ * Select the fastest library routines for this machine by restoring a
+ * previously saved calibration.
+ *
+ * When that is not possible, the library defaults are used until the
+ * benchmarks launched by calibration_launch() complete.
+ *
+ * @param argv0				the program name, to locate the executable
+ * @param vsort_verbose		verbosity level for vsort_init()
+ * @param pattern_verbose	verbosity level for pattern_init()
+ */
+void G_COLD
+calibration_init(const char *argv0, int vsort_verbose, int pattern_verbose)
+{
+	calibration_path = file_program_path(argv0);
+	calibration_key = calibration_compute_key();
+	calibration_vsort_verbose = vsort_verbose;
+	calibration_pattern_verbose = pattern_verbose;
+
+	if (calibration_restore()) {
+		atomic_int_set(&calibration_state, CALIBRATION_RESTORED);
+		if (vsort_verbose || pattern_verbose)
+			s_info("restored saved startup calibration");
+	}
+}
+
+/**
+ * Benchmark the library routines in the background, unless the saved
+ * calibration was restored.
+ *
+ * This must be called once the startup sequence is over, so that the
+ * benchmarks do not compete with the initialization work.
+ */
+void G_COLD
+calibration_launch(void)
+{
+	int r;
+
+	g_assert(thread_is_main());
+
+	if (CALIBRATION_DEFAULT != atomic_int_get(&calibration_state))
+		return;
+
+	/*
+	 * If we cannot launch a thread, run the benchmarks synchronously as we
+	 * always did: correctness does not depend on this, but speed does.
+	 */
+
+	atomic_int_set(&calibration_state, CALIBRATION_RUNNING);
+
+	r = thread_create(calibration_thread, NULL,
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL | THREAD_F_WARN, 0);
+
+	if (-1 == r) {
+		bool ok = calibration_run();
+
+		if (ok)
+			calibration_save();
+		atomic_int_set(&calibration_state,
+			ok ? CALIBRATION_MEASURED : CALIBRATION_LOADED);
+	} else if (calibration_vsort_verbose || calibration_pattern_verbose) {
+		s_info("startup calibration running in the background");
+	}
+}
+
+/**
+ * Append a description of the calibration state and of the selected
+ * routines to the string, for the shell.
+ */
+void
+calibration_info(str_t *s)
+{
+	const char *what;
+	uint ms;
+
+	switch (atomic_int_get(&calibration_state)) {
+	case CALIBRATION_DEFAULT:	what = "library defaults"; break;
+	case CALIBRATION_RUNNING:	what = "benchmarking in progress"; break;
+	case CALIBRATION_MEASURED:	what = "benchmarked this session"; break;
+	case CALIBRATION_RESTORED:	what = "restored from saved results"; break;
+	case CALIBRATION_LOADED:	what = "benchmarked under load, not saved"; break;
+	default:					what = "unknown"; break;
+	}
+
+	str_catf(s, "state %s", what);
+	ms = atomic_uint_get(&calibration_ms);
+	if (ms != 0)
+		str_catf(s, " (took %.2f secs)", ms / 1000.0);
+	str_putc(s, '\n');
+
+	if (calibration_key != NULL)
+		str_cat(s, calibration_key);
+
+	vsort_calibration(s);
+	pattern_calibration(s);
+}
+
+/**
+ * Release resources at shutdown time.
+ */
+void
+calibration_close(void)
+{
+	/*
+	 * If the background thread is still running, it will need the key to
+	 * save its results, so leave everything alone: the process is exiting.
+	 */
+
+	if (CALIBRATION_RUNNING == atomic_int_get(&calibration_state))
+		return;
+
+	HFREE_NULL(calibration_key);
+	HFREE_NULL(calibration_path);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Persistence of the startup calibration of library routines.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_calibration_h_
+#define _core_calibration_h_
+
+#include "common.h"
+
+struct str;
+
+void calibration_init(const char *argv0, int vsort_verbose, int pattern_verbose);
+void calibration_launch(void);
+void calibration_info(struct str *s);
+void calibration_close(void);
+
+#endif /* _core_calibration_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
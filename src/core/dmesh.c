@@ -39,6 +39,7 @@
 #include "ctl.h"
 #include "downloads.h"
 #include "fileinfo.h"
+#include "gnet_stats.h"
 #include "gnutella.h"
 #include "guid.h"
 #include "hcache.h"
@@ -59,22 +60,29 @@
 #include "lib/atoms.h"
 #include "lib/base32.h"
 #include "lib/concat.h"
+#include "lib/compat_pio.h"
 #include "lib/cq.h"
+#include "lib/crc.h"
 #include "lib/endian.h"
+#include "lib/elist.h"
 #include "lib/entropy.h"
+#include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/getdate.h"
 #include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/hashlist.h"
 #include "lib/header.h"
+#include "lib/hevset.h"
 #include "lib/hikset.h"
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/parse.h"
+#include "lib/path.h"
 #include "lib/pslist.h"
 #include "lib/shuffle.h"
 #include "lib/str.h"
+#include "lib/stringify.h"
 #include "lib/strtok.h"
 #include "lib/timestamp.h"
 #include "lib/tm.h"
@@ -91,15 +99,20 @@ dmesh_url_error_t dmesh_url_errno;	/**< Error from dmesh_url_parse() */
  * The download mesh records all the known sources for a given SHA1.
  * It is implemented as a big hash table, where SHA1 are keys, each value
  * being a struct dmesh pointer.
+ *
+ * Entries within a bucket are kept in LRU order: the entries seen last are
+ * at the tail of the list, the head being evicted first when the bucket is
+ * full or when the whole mesh goes over its memory budget.
  */
 static hikset_t *mesh = NULL;
 
 struct dmesh {				/**< A download mesh bucket */
-	list_t *entries;		/**< The download mesh entries, dmesh_entry data */
-	htable_t *by_host;		/**< Entries indexed by host (IP:port) */
+	elist_t entries;		/**< The download mesh entries, dmesh_entry data */
+	hevset_t *by_host;		/**< Plain entries, keyed by their IP:port */
 	htable_t *by_guid;		/**< Entries indexed by GUID (firewalled entries) */
 	time_t last_update;		/**< Timestamp of last insert/expire in the mesh */
 	const sha1_t *sha1;		/**< The SHA1 of this mesh */
+	size_t memory;			/**< Estimated memory used by entries */
 };
 
 struct dmesh_entry {
@@ -110,22 +123,83 @@ struct dmesh_entry {
 		dmesh_fwinfo_t fwh;		/**< Firewalled host */
 	} e;
 	hash_list_t *bad;		/**< Keeps track of IPs reporting entry as bad */
+	link_t lnk;				/**< Links entries in the bucket, LRU order */
 	uint8 good;				/**< Whether marked as being a good entry */
 	uint8 fw_entry;			/**< Whether entry is that of a firewalled host */
 };
 
+/*
+ * Estimated memory footprint of the download mesh, used to enforce the
+ * memory budget: the entry itself and its slot in the host index, which
+ * uses the address embedded in the entry as key (the slot and the spare
+ * room of the hash table amount to about three pointers per entry);
+ * push-proxies of firewalled entries come on top.
+ */
+#define DMESH_BUCKET_SIZE \
+	(sizeof(struct dmesh) + SHA1_RAW_SIZE + 64 * sizeof(void *))
+#define DMESH_ENTRY_SIZE \
+	(sizeof(struct dmesh_entry) + 3 * sizeof(void *))
+#define DMESH_PROXY_SIZE	(sizeof(gnet_host_t) + 4 * sizeof(void *))
+
+static size_t dmesh_memory;			/**< Estimated memory used by the mesh */
+static size_t dmesh_altlocs;		/**< Amount of entries in the mesh */
+static cperiodic_t *dmesh_trim_ev;	/**< Periodic budget enforcement */
+
 #define MAX_LIFETIME	43200		/**< half a day */
 #define MAX_LIBLIFETIME	3600		/**< 1 hour for shared/seeded files */
 #define MAX_ENTRIES		256			/**< Max amount of entries kept per SHA1 */
 
 #define MIN_BAD_REPORT	3			/**< Don't ban before that many X-Nalt */
 #define DMESH_CALLOUT	5000		/**< Callout heartbeat every 5 seconds */
+#define DMESH_TRIM		60000		/**< Budget enforcement every minute */
 #define DMESH_BAN_VETO	300			/**< 5 minutes, to keep banned entry */
 #define EXPIRE_DELAY	600			/**< 10 minutes after last update */
 
 #define FW_MAX_PROXIES	4			/**< At most 4 push-proxies */
 
-static const char dmesh_file[] = "dmesh";
+static const char dmesh_file[] = "dmesh";			/**< Text, import only */
+static const char dmesh_bin_file[] = "dmesh.bin";	/**< Binary store */
+
+#define DMESH_BIN_MAGIC		"GDMESH01"	/**< Binary store header magic */
+#define DMESH_BIN_MAGIC_LEN	8
+#define DMESH_BIN_VERSION	1			/**< Binary store format version */
+#define DMESH_BIN_HDR		16			/**< Magic, version, reserved */
+
+/*
+ * Layout of a binary store record, all numbers being little-endian.  There
+ * is one record per SHA1, made of a fixed part followed by the entries.
+ * The CRC covers all the record but the CRC itself.
+ */
+#define DMESH_REC_CRC		0			/**< 32-bit CRC */
+#define DMESH_REC_LEN		4			/**< 32-bit length of whole record */
+#define DMESH_REC_SHA1		8			/**< SHA1, in binary form */
+#define DMESH_RECORD_HDR	(DMESH_REC_SHA1 + SHA1_RAW_SIZE)
+
+/*
+ * Each entry starts with a common part giving its kind and time stamp.
+ *
+ * Plain entries are followed by a packed address, the port and the file
+ * index, and by the file name when the index is not URN_INDEX (in which case
+ * the name is the urn:sha1 of the record and is not stored).
+ *
+ * Firewalled entries are followed by the GUID and the push-proxies, each
+ * stored as a packed address and a port.
+ */
+#define DMESH_ENT_KIND		0			/**< 8-bit kind of entry */
+#define DMESH_ENT_COUNT		1			/**< 8-bit amount of proxies */
+#define DMESH_ENT_NAMELEN	2			/**< 16-bit file name length */
+#define DMESH_ENT_STAMP		4			/**< 64-bit time stamp */
+#define DMESH_ENT_HDR		12			/**< Common part */
+#define DMESH_ADDR_NET		0			/**< 8-bit network type */
+#define DMESH_ADDR_PORT		1			/**< 16-bit port */
+#define DMESH_ADDR_IP		3			/**< IPv4 or IPv6 address */
+#define DMESH_ADDR_SIZE		19			/**< Fixed size of an address */
+#define DMESH_ENT_URL_HDR	(DMESH_ENT_HDR + DMESH_ADDR_SIZE + 4)
+#define DMESH_ENT_FW_HDR	(DMESH_ENT_HDR + GUID_RAW_SIZE)
+
+#define DMESH_ENT_URL		1			/**< Plain entry */
+#define DMESH_ENT_FW		2			/**< Firewalled entry */
+
 static cqueue_t *dmesh_cq;			/**< Download mesh callout queue */
 
 /**
@@ -167,6 +241,8 @@ static void dmesh_retrieve(void);
 static void dmesh_ban_retrieve(void);
 static char *dmesh_urlinfo_to_string(const dmesh_urlinfo_t *info);
 static char *dmesh_fwinfo_to_string(const dmesh_fwinfo_t *info);
+static const char *dmesh_entry_to_string(const struct dmesh_entry *dme);
+static bool dmesh_trim_periodic(void *unused_obj);
 
 /**
  * Hash a URL info.
@@ -198,6 +274,39 @@ urlinfo_eq(const void *a, const void *b)
 		(ia->name == ib->name || 0 == strcmp(ia->name, ib->name));
 }
 
+/**
+ * Hash the host of a plain mesh entry, ignoring the file.
+ */
+static uint
+dmesh_host_hash(const void *key)
+{
+	const dmesh_urlinfo_t *info = key;
+
+	return host_addr_port_hash(info->addr, info->port);
+}
+
+/**
+ * Alternate hashing of the host of a plain mesh entry.
+ */
+static uint
+dmesh_host_hash2(const void *key)
+{
+	const dmesh_urlinfo_t *info = key;
+
+	return host_addr_port_hash2(info->addr, info->port);
+}
+
+/**
+ * Test whether two plain mesh entries refer to the same host.
+ */
+static int
+dmesh_host_eq(const void *a, const void *b)
+{
+	const dmesh_urlinfo_t *ia = a, *ib = b;
+
+	return ia->port == ib->port && host_addr_equiv(ia->addr, ib->addr);
+}
+
 /**
  * Initialize the download mesh.
  */
@@ -210,6 +319,8 @@ dmesh_init(void)
 		urlinfo_hash, urlinfo_eq);
 	ban_mesh_by_sha1 = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
 	dmesh_cq = cq_main_submake("dmesh", DMESH_CALLOUT);
+	dmesh_trim_ev = cq_periodic_add(dmesh_cq, DMESH_TRIM,
+		dmesh_trim_periodic, NULL);
 	dmesh_retrieve();
 	dmesh_ban_retrieve();
 }
@@ -577,6 +688,53 @@ dmesh_url_parse(const char *url, dmesh_urlinfo_t *info)
 	return TRUE;
 }
 
+/**
+ * @return estimated amount of memory used by a mesh entry.
+ */
+static size_t
+dmesh_entry_memory(const struct dmesh_entry *dme)
+{
+	size_t size = DMESH_ENTRY_SIZE;
+
+	if (dme->fw_entry && dme->e.fwh.proxies != NULL)
+		size += hash_list_length(dme->e.fwh.proxies) * DMESH_PROXY_SIZE;
+
+	return size;
+}
+
+/**
+ * Update statistics on the memory used by the mesh.
+ */
+static void
+dmesh_stats_update(void)
+{
+	gnet_stats_set_general(GNR_DMESH_ALTLOCS, dmesh_altlocs);
+	gnet_stats_set_general(GNR_DMESH_MEMORY, dmesh_memory);
+	gnet_stats_set_general(GNR_DMESH_ALTLOC_AVG_SIZE,
+		0 == dmesh_altlocs ? 0 : dmesh_memory / dmesh_altlocs);
+}
+
+/**
+ * Account for memory used by entries of the mesh bucket.
+ *
+ * @param dm		the mesh bucket
+ * @param size		amount of memory added (or removed, when negative)
+ * @param count		amount of entries added (or removed, when negative)
+ */
+static void
+dm_account(struct dmesh *dm, ssize_t size, int count)
+{
+	g_assert(size >= 0 || dm->memory >= UNSIGNED(-size));
+	g_assert(size >= 0 || dmesh_memory >= UNSIGNED(-size));
+	g_assert(count >= 0 || dmesh_altlocs >= UNSIGNED(-count));
+
+	dm->memory += size;
+	dmesh_memory += size;
+	dmesh_altlocs += count;
+
+	dmesh_stats_update();
+}
+
 /**
  * Allocate a new download mesh structure (there is one per SHA1).
  */
@@ -585,33 +743,42 @@ dm_alloc(const struct sha1 *sha1)
 {
 	struct dmesh *dm;
 
-	WALLOC(dm);
-	dm->last_update = 0;
-	dm->entries = list_new();
+	WALLOC0(dm);
+	elist_init(&dm->entries, offsetof(struct dmesh_entry, lnk));
 	dm->sha1 = atom_sha1_get(sha1);
-	dm->by_host = htable_create_any(packed_host_hash_func,
-		packed_host_hash_func2, packed_host_eq_func);
+	dm->by_host = hevset_create_any(offsetof(struct dmesh_entry, e.url),
+		dmesh_host_hash, dmesh_host_hash2, dmesh_host_eq);
 	dm->by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 
+	dmesh_memory += DMESH_BUCKET_SIZE;
+
 	return dm;
 }
 
+/**
+ * Free download mesh entry, callback for elist_foreach().
+ */
+static void
+dm_free_entry(void *data, void *unused_udata)
+{
+	(void) unused_udata;
+	dmesh_entry_free(data);
+}
+
 /**
  * Free download mesh structure.
  */
 static void
 dm_free(struct dmesh *dm)
 {
-	list_free_all(&dm->entries,
-		cast_to_list_destroy((func_ptr_t) dmesh_entry_free));
+	dm_account(dm, -(ssize_t) dm->memory, -(int) elist_count(&dm->entries));
+	dmesh_memory -= DMESH_BUCKET_SIZE;
 
-	/*
-	 * Values in the dme->by_host table were the dmesh_entry structures
-	 * we just disposed of above, so we only need to get rid of the keys.
-	 */
+	elist_foreach(&dm->entries, dm_free_entry, NULL);
+	elist_discard(&dm->entries);
 
-	htable_foreach_key(dm->by_host, wfree_packed_host, NULL);
-	htable_free_null(&dm->by_host);
+	/* Keys were embedded in the dmesh_entry, nothing else to free */
+	hevset_free_null(&dm->by_host);
 
 	/* Keys were GUID in the dmesh_entry, no need to free them */
 	htable_free_null(&dm->by_guid);
@@ -620,19 +787,33 @@ dm_free(struct dmesh *dm)
 	WFREE(dm);
 }
 
+/**
+ * @return the plain entry for addr:port in the mesh bucket, NULL if none.
+ */
+static struct dmesh_entry *
+dm_lookup_host(const struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	dmesh_urlinfo_t key;
+
+	ZERO(&key);
+	key.addr = addr;
+	key.port = port;
+
+	return hevset_lookup(dm->by_host, &key);
+}
+
 /**
  * Remove specified entry from mesh bucket and reclaim it.
  */
 static void
 dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 {
-	struct packed_host packed;
 	const void *key;
 	void *value;
 	bool found;
 
 	g_assert(dm);
-	g_assert(list_length(dm->entries) > 0);
+	g_assert(elist_count(&dm->entries) > 0);
 
 	if (GNET_PROPERTY(dmesh_debug) > 1) {
 		g_debug("dmesh %sentry removed for urn:sha1:%s at %s",
@@ -646,27 +827,23 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 		found = htable_lookup_extended(dm->by_guid,
 					dme->e.fwh.guid, &key, &value);
 	} else {
-		packed = host_pack(dme->e.url.addr, dme->e.url.port);
-		found = htable_lookup_extended(dm->by_host,
-					&packed, &key, &value);
+		found = hevset_lookup_extended(dm->by_host, &dme->e.url, &value);
 	}
 
 	g_assert(found);
 	g_assert(value == (void *) dme);
 
-	found = list_remove(dm->entries, dme);		/* Remove from list... */
-
-	g_assert(found);
+	elist_remove(&dm->entries, dme);		/* Remove from list... */
 
 	/* ...and from the proper hash table */
 
 	if (dme->fw_entry) {
 		htable_remove(dm->by_guid, dme->e.fwh.guid);
 	} else {
-		htable_remove(dm->by_host, &packed);
-		wfree_packed_host(deconstify_pointer(key), NULL);
+		hevset_remove(dm->by_host, &dme->e.url);
 	}
 
+	dm_account(dm, -(ssize_t) dmesh_entry_memory(dme), -1);
 	dmesh_entry_free(dme);
 }
 
@@ -676,35 +853,92 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 static void
 dm_remove(struct dmesh *dm, const host_addr_t addr, uint16 port)
 {
-	struct packed_host packed;
 	struct dmesh_entry *dme;
-	const void *key;
-	void *value;
-	bool found;
 
 	g_assert(dm);
 
-	packed = host_pack(addr, port);
-	found = htable_lookup_extended(dm->by_host, &packed, &key, &value);
+	dme = dm_lookup_host(dm, addr, port);
 
-	if (!found)
-		return;
+	if (dme != NULL) {
+		g_assert(!dme->fw_entry);
+		dm_remove_entry(dm, dme);
+	}
+}
 
-	if (GNET_PROPERTY(dmesh_debug) > 1) {
-		g_debug("dmesh entry removed for urn:sha1:%s at %s",
-			sha1_base32(dm->sha1), host_addr_port_to_string(addr, port));
+/**
+ * Record that entry was seen again, moving it to the tail of the LRU list.
+ */
+static void
+dm_refresh(struct dmesh *dm, struct dmesh_entry *dme, time_t stamp)
+{
+	if (stamp > dme->stamp) {	/* Don't move stamp back in the past */
+		dme->stamp = stamp;
+		elist_moveto_tail(&dm->entries, dme);
 	}
+}
+
+/**
+ * Evict least recently seen entries from the mesh bucket when it is full,
+ * or when the mesh is over its memory budget and the bucket uses more than
+ * its fair share of that budget.
+ *
+ * The most recent entry is never evicted, so that the bucket is never left
+ * empty: we don't want to dispose of a bucket we may be iterating over.
+ */
+static void
+dm_trim(struct dmesh *dm)
+{
+	size_t budget = GNET_PROPERTY(dmesh_max_memory);
+	size_t share = budget / MAX(1, hikset_count(mesh));
 
-	dme = value;
-	found = list_remove(dm->entries, dme);		/* Remove from list */
+	while (elist_count(&dm->entries) > 1) {
+		struct dmesh_entry *oldest;
 
-	g_assert(found);
-	g_assert(!dme->fw_entry);
+		if (elist_count(&dm->entries) < MAX_ENTRIES) {
+			if (dmesh_memory <= budget || dm->memory <= share)
+				break;
+			gnet_stats_inc_general(GNR_DMESH_EVICTED);
+		}
 
-	htable_remove(dm->by_host, &packed);	/* And from hash table */
-	wfree_packed_host(deconstify_pointer(key), NULL);
+		oldest = elist_head(&dm->entries);
 
-	dmesh_entry_free(dme);
+		if (GNET_PROPERTY(dmesh_debug) > 4) {
+			g_debug("MESH %s: EVICTED \"%s\" (%zu entries, %zu bytes)",
+				sha1_base32(dm->sha1), dmesh_entry_to_string(oldest),
+				elist_count(&dm->entries), dm->memory);
+		}
+
+		dm_remove_entry(dm, oldest);
+	}
+}
+
+/**
+ * Mesh iterator callback to trim buckets over their fair share of the
+ * memory budget.
+ */
+static void
+dm_trim_kv(void *value, void *unused_udata)
+{
+	(void) unused_udata;
+	dm_trim(value);
+}
+
+/**
+ * Periodic callback enforcing the memory budget of the mesh.
+ *
+ * Buckets are also trimmed when entries are added to them, but the fair
+ * share of each bucket decreases as new SHA1 enter the mesh, hence we
+ * must also trim buckets which are no longer updated.
+ */
+static bool
+dmesh_trim_periodic(void *unused_obj)
+{
+	(void) unused_obj;
+
+	if (dmesh_memory > GNET_PROPERTY(dmesh_max_memory))
+		hikset_foreach(mesh, dm_trim_kv, NULL);
+
+	return TRUE;		/* Keep calling */
 }
 
 /**
@@ -749,15 +983,11 @@ dm_expire(struct dmesh *dm)
 	pslist_t *sl;
 	time_t now = tm_time();
 	long agemax;
-	list_iter_t *iter;
+	struct dmesh_entry *dme;
 
 	agemax = dm_lifetime(dm);
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
-
+	ELIST_FOREACH_DATA(&dm->entries, dme) {
 		if (delta_time(now, dme->stamp) <= agemax)
 			continue;
 
@@ -779,12 +1009,8 @@ dm_expire(struct dmesh *dm)
 		expired = pslist_prepend(expired, dme);
 	}
 
-	list_iter_free(&iter);
-
 	PSLIST_FOREACH(expired, sl) {
-		struct dmesh_entry *dme = sl->data;
-
-		dm_remove_entry(dm, dme);
+		dm_remove_entry(dm, sl->data);
 	}
 
 	pslist_free(expired);
@@ -806,7 +1032,7 @@ dmesh_dispose(const struct sha1 *sha1)
 
 	dm = value;
 	g_assert(found);
-	g_assert(list_length(dm->entries) == 0);
+	g_assert(elist_count(&dm->entries) == 0);
 
 	hikset_remove(mesh, sha1);
 	dm_free(dm);
@@ -847,7 +1073,7 @@ dmesh_remove(const struct sha1 *sha1, const host_addr_t addr, uint16 port,
 	 * If there is nothing left, clear the mesh entry.
 	 */
 
-	if (list_length(dm->entries) == 0)
+	if (elist_count(&dm->entries) == 0)
 		dmesh_dispose(sha1);
 
     return TRUE;
@@ -876,13 +1102,13 @@ dmesh_count(const struct sha1 *sha1)
 	if (NULL != dm && delta_time(tm_time(), dm->last_update) > EXPIRE_DELAY) {
 		dm_expire(dm);
 
-		if (list_length(dm->entries) == 0) {
+		if (elist_count(&dm->entries) == 0) {
 			dmesh_dispose(sha1);
 			dm = NULL;
 		}
 	}
 
-	return dm ? list_length(dm->entries) : 0;
+	return dm ? elist_count(&dm->entries) : 0;
 }
 
 /**
@@ -935,7 +1161,6 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	uint16 port = info->port;
 	uint idx = info->idx;
 	const char *name = info->name;
-	struct packed_host packed;
 	const char *reason = NULL;
 
 	g_return_val_if_fail(sha1, FALSE);
@@ -998,8 +1223,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme) {
 		/*
@@ -1018,8 +1242,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 			atom_str_change(&dme->e.url.name, name);
 		}
 
-		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
-			dme->stamp = stamp;
+		dm_refresh(dm, dme, stamp);
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
 			g_debug("dmesh entry reused for urn:sha1:%s at %s",
@@ -1029,7 +1252,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 		 * Allocate new entry.
 		 */
 
-		WALLOC(dme);
+		WALLOC0(dme);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
@@ -1053,15 +1276,12 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 		 * into the hash table indexed by host.
 		 */
 
-		list_append(dm->entries, dme);
+		elist_append(&dm->entries, dme);
 		dm->last_update = now;
 
-		htable_insert(dm->by_host, walloc_packed_host(addr, port), dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
+		hevset_insert(dm->by_host, dme);
+		dm_account(dm, dmesh_entry_memory(dme), 1);
+		dm_trim(dm);
 	}
 
 	/*
@@ -1142,8 +1362,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 
 		g_assert(guid_eq(dme->e.fwh.guid, info->guid));
 
-		if (stamp > dme->stamp)		/* Don't move stamp back in the past */
-			dme->stamp = stamp;
+		dm_refresh(dm, dme, stamp);
 
 		/*
 		 * If we have new proxies, the new list supersedes the old one.
@@ -1151,9 +1370,12 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 		 */
 
 		if (info->proxies != NULL) {
+			size_t old = dmesh_entry_memory(dme);
+
 			hash_list_free_all(&dme->e.fwh.proxies, gnet_host_free);
 			dme->e.fwh.proxies = info->proxies;
 			dme->inserted = now;	/* List of push-proxies changed */
+			dm_account(dm, (ssize_t) dmesh_entry_memory(dme) - (ssize_t) old, 0);
 		}
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
@@ -1165,7 +1387,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 		 * Allocate new entry.
 		 */
 
-		WALLOC(dme);
+		WALLOC0(dme);
 
 		dme->inserted = now;
 		dme->stamp = stamp;
@@ -1187,15 +1409,12 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 		 * into the hash table indexed by GUID.
 		 */
 
-		list_append(dm->entries, dme);
+		elist_append(&dm->entries, dme);
 		dm->last_update = now;
 
 		htable_insert(dm->by_guid, dme->e.fwh.guid, dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
+		dm_account(dm, dmesh_entry_memory(dme), 1);
+		dm_trim(dm);
 	}
 
 	/*
@@ -1309,7 +1528,6 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	host_addr_t addr, uint16 port)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	host_addr_t net;
 
@@ -1322,8 +1540,7 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	if (dm == NULL)				/* Nothing for this SHA1 key */
 		return;
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL)
 		return;
@@ -1368,7 +1585,6 @@ dmesh_good_mark(const struct sha1 *sha1,
 	host_addr_t addr, uint16 port, bool good)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	bool retried = FALSE;
 
@@ -1376,10 +1592,8 @@ dmesh_good_mark(const struct sha1 *sha1,
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	packed = host_pack(addr, port);
-
 retry:
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL) {
 		/*
@@ -1788,7 +2002,7 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	int i;
 	int j;
 	bool complete_file;
-	list_iter_t *iter;
+	struct dmesh_entry *dme;
 
 	/*
 	 * Fetch the mesh entry for this SHA1.
@@ -1804,11 +2018,7 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 
 	i = 0;
 	complete_file = sha1_of_finished_file(sha1);
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
-
+	ELIST_FOREACH_DATA(&dm->entries, dme) {
 		if (dme->fw_entry || dme->e.url.idx != URN_INDEX)
 			continue;
 
@@ -1840,12 +2050,11 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		return 0;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= elist_count(&dm->entries));
 
 	/*
 	 * Second pass: choose at most `hcnt' entries at random.
@@ -1857,8 +2066,6 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	SHUFFLE_ARRAY_N(selected, nselected);
 
 	for (i = j = 0; i < nselected && j < hcnt; i++, j++) {
-		struct dmesh_entry *dme;
-
 		dme = selected[i];
 		gnet_host_set(&hvec[j], dme->e.url.addr, dme->e.url.port);
 	}
@@ -1974,7 +2181,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	size_t maxlinelen = 0;
 	header_fmt_t *fmt;
 	bool added;
-	list_iter_t *iter;
+	struct dmesh_entry *dme;
 	bool complete_file;
 	bool can_share_partials;
 
@@ -2140,7 +2347,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 
 	dm_expire(dm);
 
-	if (list_length(dm->entries) == 0) {
+	if (elist_count(&dm->entries) == 0) {
 		dmesh_dispose(sha1);
 		goto nomore;
 	}
@@ -2159,12 +2366,9 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 */
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 	complete_file = sha1_of_finished_file(sha1);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
-
+	ELIST_FOREACH_DATA(&dm->entries, dme) {
 		if (dme->fw_entry)
 			continue;
 
@@ -2206,12 +2410,11 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		goto nomore;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= elist_count(&dm->entries));
 
 	/*
 	 * Second pass.
@@ -2220,9 +2423,10 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	SHUFFLE_ARRAY_N(selected, nselected);
 
 	for (i = 0; i < nselected; i++) {
-		struct dmesh_entry *dme = selected[i];
 		size_t url_len;
 
+		dme = selected[i];
+
 		g_assert(delta_time(dme->inserted, last_sent) > 0);
 
 		url_len = dmesh_entry_compact(dme, ARYLEN(url));
@@ -2292,10 +2496,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 * to have firewalled ones.
 	 */
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	ELIST_FOREACH_DATA(&dm->entries, dme) {
 		sequence_t *proxies;
 		host_addr_t servent_addr;
 		uint16 servent_port;
@@ -2367,8 +2568,6 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		}
 	}
 
-	list_iter_free(&iter);
-
 	/* FALL THROUGH */
 
 nomore:
@@ -2948,7 +3147,7 @@ static int
 dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 {
 	struct dmesh *dm;
-	list_iter_t *iter;
+	struct dmesh_entry *dme;
 	int i;
 
 	g_assert(sha1);
@@ -2960,10 +3159,10 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		return 0;
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
+	ELIST_FOREACH_DATA(&dm->entries, dme) {
+		if (i >= count)
+			break;
 
-	while (list_iter_has_next(iter) && i < count) {
-		struct dmesh_entry *dme = list_iter_next(iter);
 		dmesh_urlinfo_t *from;
 
 		if (dme->fw_entry)
@@ -2975,8 +3174,6 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		buf[i++] = *from;
 	}
 
-	list_iter_free(&iter);
-
 	return i;
 }
 
@@ -3262,28 +3459,418 @@ dmesh_multiple_downloads(const struct sha1 *sha1,
 	}
 }
 
+struct dmesh_store_context {
+	FILE *f;			/**< Where records are written */
+	char *buf;			/**< Buffer where records are built */
+	size_t size;		/**< Size of buffer */
+	size_t len;			/**< Length of record being built */
+	bool failed;		/**< Set when a write failed */
+};
+
 /**
- * Store key/value pair in file.
+ * Reserve `n' bytes at the end of the record being built.
+ *
+ * @return pointer to the reserved area.
+ */
+static char *
+dmesh_store_grow(struct dmesh_store_context *ctx, size_t n)
+{
+	char *p;
+
+	if (ctx->len + n > ctx->size) {
+		ctx->size = MAX(ctx->len + n, 2 * ctx->size);
+		HREALLOC_ARRAY(ctx->buf, ctx->size);
+	}
+
+	p = &ctx->buf[ctx->len];
+	ctx->len += n;
+
+	return p;
+}
+
+/**
+ * Serialize host address and port at `p', in DMESH_ADDR_SIZE bytes.
+ *
+ * @return FALSE if the address cannot be serialized.
+ */
+static bool
+dmesh_addr_poke(char *p, const host_addr_t addr, uint16 port)
+{
+	memset(p, 0, DMESH_ADDR_SIZE);
+	poke_le16(&p[DMESH_ADDR_PORT], port);
+
+	switch (host_addr_net(addr)) {
+	case NET_TYPE_IPV4:
+		p[DMESH_ADDR_NET] = 4;
+		poke_be32(&p[DMESH_ADDR_IP], host_addr_ipv4(addr));
+		return TRUE;
+	case NET_TYPE_IPV6:
+		p[DMESH_ADDR_NET] = 6;
+		memcpy(&p[DMESH_ADDR_IP], host_addr_ipv6(&addr), 16);
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * Deserialize host address and port from `p'.
+ *
+ * @return FALSE if the address is not valid.
+ */
+static bool
+dmesh_addr_peek(const char *p, host_addr_t *addr, uint16 *port)
+{
+	*port = peek_le16(&p[DMESH_ADDR_PORT]);
+
+	switch (p[DMESH_ADDR_NET]) {
+	case 4:
+		*addr = host_addr_peek_ipv4(&p[DMESH_ADDR_IP]);
+		return TRUE;
+	case 6:
+		*addr = host_addr_peek_ipv6(&p[DMESH_ADDR_IP]);
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * Serialize mesh entry at the end of the record being built.
+ */
+static void
+dmesh_store_entry(struct dmesh_store_context *ctx,
+	const struct dmesh_entry *dme)
+{
+	size_t start = ctx->len;
+	char *p;
+
+	if (dme->fw_entry) {
+		hash_list_iter_t *iter;
+		uint n = 0;
+
+		p = dmesh_store_grow(ctx, DMESH_ENT_FW_HDR);
+		p[DMESH_ENT_KIND] = DMESH_ENT_FW;
+		memcpy(&p[DMESH_ENT_HDR], dme->e.fwh.guid, GUID_RAW_SIZE);
+
+		if (dme->e.fwh.proxies != NULL) {
+			iter = hash_list_iterator(dme->e.fwh.proxies);
+
+			while (hash_list_iter_has_next(iter) && n < MAX_INT_VAL(uint8)) {
+				const gnet_host_t *host = hash_list_iter_next(iter);
+
+				p = dmesh_store_grow(ctx, DMESH_ADDR_SIZE);
+				if (
+					dmesh_addr_poke(p, gnet_host_get_addr(host),
+						gnet_host_get_port(host))
+				)
+					n++;
+				else
+					ctx->len -= DMESH_ADDR_SIZE;
+			}
+
+			hash_list_iter_release(&iter);
+		}
+
+		p = &ctx->buf[start];
+		p[DMESH_ENT_COUNT] = n;
+		poke_le16(&p[DMESH_ENT_NAMELEN], 0);
+	} else {
+		const dmesh_urlinfo_t *info = &dme->e.url;
+		size_t namelen = URN_INDEX == info->idx ? 0 : vstrlen(info->name);
+
+		if G_UNLIKELY(namelen > MAX_INT_VAL(uint16))
+			return;
+
+		p = dmesh_store_grow(ctx, DMESH_ENT_URL_HDR + namelen);
+
+		if (!dmesh_addr_poke(&p[DMESH_ENT_HDR], info->addr, info->port)) {
+			ctx->len = start;
+			return;
+		}
+
+		p[DMESH_ENT_KIND] = DMESH_ENT_URL;
+		p[DMESH_ENT_COUNT] = 0;
+		poke_le16(&p[DMESH_ENT_NAMELEN], namelen);
+		poke_le32(&p[DMESH_ENT_HDR + DMESH_ADDR_SIZE], info->idx);
+		memcpy(&p[DMESH_ENT_URL_HDR], info->name, namelen);
+	}
+
+	poke_le64(&ctx->buf[start + DMESH_ENT_STAMP], dme->stamp);
+}
+
+/**
+ * Write the record of a mesh bucket, callback for hikset_foreach().
  */
 static void
 dmesh_store_kv(void *value, void *udata)
 {
 	const struct dmesh *dm = value;
-	FILE *out = udata;
-	list_iter_t *iter;
+	struct dmesh_store_context *ctx = udata;
+	const struct dmesh_entry *dme;
+	uint32 crc;
 
-	fprintf(out, "%s\n", sha1_base32(dm->sha1));
+	if G_UNLIKELY(ctx->failed)
+		return;
 
-	iter = list_iter_before_head(dm->entries);
+	ctx->len = 0;
+	(void) dmesh_store_grow(ctx, DMESH_RECORD_HDR);
+	memcpy(&ctx->buf[DMESH_REC_SHA1], dm->sha1, SHA1_RAW_SIZE);
 
-	while (list_iter_has_next(iter)) {
-		const struct dmesh_entry *dme = list_iter_next(iter);
-		fprintf(out, "%s\n", dmesh_entry_to_string(dme));
+	ELIST_FOREACH_DATA(&dm->entries, dme) {
+		dmesh_store_entry(ctx, dme);
 	}
 
-	list_iter_free(&iter);
+	poke_le32(&ctx->buf[DMESH_REC_LEN], ctx->len);
+	crc = crc32_update(-1U, &ctx->buf[DMESH_REC_LEN],
+		ctx->len - DMESH_REC_LEN);
+	poke_le32(&ctx->buf[DMESH_REC_CRC], crc);
 
-	fputs("\n", out);
+	if (1 != fwrite(ctx->buf, ctx->len, 1, ctx->f))
+		ctx->failed = TRUE;
+}
+
+/**
+ * Store download mesh onto file.
+ * The download mesh is normally stored in ~/.gtk-gnutella/dmesh.bin.
+ */
+void
+dmesh_store(void)
+{
+	struct dmesh_store_context ctx;
+	char hdr[DMESH_BIN_HDR];
+	char *path, *tmp;
+
+	path = make_pathname(settings_config_dir(), dmesh_bin_file);
+	tmp = h_strconcat(path, ".new", NULL_PTR);
+
+	ZERO(&ctx);
+	ctx.f = file_fopen(tmp, "wb");
+	if (NULL == ctx.f)
+		goto done;
+
+	ZERO(&hdr);
+	memcpy(hdr, DMESH_BIN_MAGIC, DMESH_BIN_MAGIC_LEN);
+	poke_le32(&hdr[DMESH_BIN_MAGIC_LEN], DMESH_BIN_VERSION);
+	ctx.failed = 1 != fwrite(ARYLEN(hdr), 1, ctx.f);
+
+	hikset_foreach(mesh, dmesh_store_kv, &ctx);
+	HFREE_NULL(ctx.buf);
+
+	/*
+	 * Never replace a good mesh with a truncated one.
+	 */
+
+	if (ctx.failed || ferror(ctx.f)) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, tmp);
+		fclose(ctx.f);
+		unlink(tmp);
+		goto done;
+	}
+
+	if (0 != file_sync_fclose(ctx.f)) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, tmp);
+		unlink(tmp);
+		goto done;
+	}
+
+	if (-1 == rename(tmp, path)) {
+		g_warning("%s(): cannot rename %s as %s: %m", G_STRFUNC, tmp, path);
+		unlink(tmp);
+	}
+
+done:
+	HFREE_NULL(tmp);
+	HFREE_NULL(path);
+}
+
+/**
+ * Load entries from a binary store record into the mesh.
+ *
+ * @return FALSE if the record is inconsistent.
+ */
+static bool
+dmesh_load_record(const char *rec, size_t len)
+{
+	struct sha1 sha1;
+	size_t offset = DMESH_RECORD_HDR;
+
+	memcpy(&sha1, &rec[DMESH_REC_SHA1], SHA1_RAW_SIZE);
+
+	while (len - offset >= DMESH_ENT_HDR) {
+		const char *p = &rec[offset];
+		time_t stamp = peek_le64(&p[DMESH_ENT_STAMP]);
+		size_t namelen = peek_le16(&p[DMESH_ENT_NAMELEN]);
+		uint count = peek_u8(&p[DMESH_ENT_COUNT]);
+
+		switch (peek_u8(&p[DMESH_ENT_KIND])) {
+		case DMESH_ENT_URL:
+			{
+				dmesh_urlinfo_t info;
+				host_addr_t addr;
+				uint16 port;
+				uint idx;
+				char *name;
+
+				if (len - offset < DMESH_ENT_URL_HDR + namelen)
+					return FALSE;
+
+				if (!dmesh_addr_peek(&p[DMESH_ENT_HDR], &addr, &port))
+					return FALSE;
+
+				idx = peek_le32(&p[DMESH_ENT_HDR + DMESH_ADDR_SIZE]);
+
+				if (0 == namelen) {
+					dmesh_fill_info(&info, &sha1, addr, port, idx, NULL);
+					(void) dmesh_raw_add(&sha1, &info, stamp, TRUE);
+				} else {
+					name = h_strndup(&p[DMESH_ENT_URL_HDR], namelen);
+					dmesh_fill_info(&info, NULL, addr, port, idx, name);
+					(void) dmesh_raw_add(&sha1, &info, stamp, TRUE);
+					hfree(name);
+				}
+
+				offset += DMESH_ENT_URL_HDR + namelen;
+			}
+			break;
+		case DMESH_ENT_FW:
+			{
+				dmesh_fwinfo_t info;
+				uint i;
+
+				if (len - offset < DMESH_ENT_FW_HDR + count * DMESH_ADDR_SIZE)
+					return FALSE;
+
+				info.guid = atom_guid_get((guid_t *) &p[DMESH_ENT_HDR]);
+				info.proxies = NULL;
+
+				for (i = 0; i < count; i++) {
+					const char *q =
+						&p[DMESH_ENT_FW_HDR + i * DMESH_ADDR_SIZE];
+					host_addr_t addr;
+					uint16 port;
+					gnet_host_t host;
+
+					if (!dmesh_addr_peek(q, &addr, &port))
+						continue;
+
+					if (NULL == info.proxies) {
+						info.proxies =
+							hash_list_new(gnet_host_hash, gnet_host_equal);
+					}
+
+					gnet_host_set(&host, addr, port);
+					if (!hash_list_contains(info.proxies, &host))
+						hash_list_append(info.proxies, gnet_host_dup(&host));
+				}
+
+				if (!dmesh_raw_fw_add(&sha1, &info, stamp, TRUE))
+					hash_list_free_all(&info.proxies, gnet_host_free);
+				atom_guid_free_null(&info.guid);
+
+				offset += DMESH_ENT_FW_HDR + count * DMESH_ADDR_SIZE;
+			}
+			break;
+		default:
+			return FALSE;
+		}
+	}
+
+	return offset == len;
+}
+
+/**
+ * Retrieve download mesh from the binary store and add entries that have
+ * not expired yet.
+ *
+ * @return TRUE if the binary store was found, FALSE if it is missing.
+ */
+static bool G_COLD
+dmesh_retrieve_binary(void)
+{
+	char *path, *buf = NULL;
+	size_t size = 0, offset;
+	filestat_t sb;
+	bool found = FALSE;
+	int fd;
+
+	path = make_pathname(settings_config_dir(), dmesh_bin_file);
+	fd = file_open_missing(path, O_RDONLY);
+
+	if (fd < 0)
+		goto done;
+
+	found = TRUE;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat %s: %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	if (
+		sb.st_size < DMESH_BIN_HDR ||
+		UNSIGNED(sb.st_size) != (size_t) sb.st_size
+	)
+		goto invalid;
+
+	size = sb.st_size;
+	buf = halloc(size);
+
+	if ((ssize_t) size != compat_pread(fd, buf, size, 0)) {
+		g_warning("%s(): cannot read %s: %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	if (
+		0 != memcmp(buf, DMESH_BIN_MAGIC, DMESH_BIN_MAGIC_LEN) ||
+		DMESH_BIN_VERSION != peek_le32(&buf[DMESH_BIN_MAGIC_LEN])
+	)
+		goto invalid;
+
+	offset = DMESH_BIN_HDR;
+
+	while (size - offset >= DMESH_RECORD_HDR) {
+		const char *rec = &buf[offset];
+		size_t len = peek_le32(&rec[DMESH_REC_LEN]);
+
+		if (len < DMESH_RECORD_HDR || len > size - offset)
+			break;
+
+		if (
+			crc32_update(-1U, &rec[DMESH_REC_LEN], len - DMESH_REC_LEN) !=
+				peek_le32(&rec[DMESH_REC_CRC])
+		)
+			break;
+
+		if (!dmesh_load_record(rec, len))
+			break;
+
+		offset += len;
+	}
+
+	if (offset < size) {
+		g_warning("%s(): ignoring trailing %zu bytes of corrupted data in %s",
+			G_STRFUNC, size - offset, path);
+	}
+
+	if (GNET_PROPERTY(dmesh_debug)) {
+		g_info("%s(): loaded %zu entr%s for %zu file%s (%zu bytes)",
+			G_STRFUNC, dmesh_altlocs, plural_y(dmesh_altlocs),
+			hikset_count(mesh), plural(hikset_count(mesh)), dmesh_memory);
+	}
+
+	goto done;
+
+invalid:
+	g_warning("%s(): ignoring invalid download mesh %s", G_STRFUNC, path);
+
+	/* FALL THROUGH */
+
+done:
+	fd_close(&fd);
+	HFREE_NULL(buf);
+	HFREE_NULL(path);
+	return found;
 }
 
 /* XXX add dmesh_store_if_dirty() and export that only */
@@ -3315,40 +3902,12 @@ dmesh_store_hikset(const char *what, hikset_t *hash, const char *file,
 }
 
 /**
- * Prints header to dmesh store file.
- */
-static void
-dmesh_header_print(FILE *out)
-{
-	file_config_preamble(out, "Download mesh");
-
-	fputs(	"#\n# Format is:\n"
-			"#   SHA1\n"
-			"#   URL1 timestamp1\n"
-			"#   URL2 timestamp2\n"
-			"#   FWALT timestamp\n"
-			"#   <blank line>\n"
-			"#\n\n",
-			out);
-}
-
-/**
- * Store download mesh onto file.
- * The download mesh is normally stored in ~/.gtk-gnutella/dmesh.
- */
-void
-dmesh_store(void)
-{
-	dmesh_store_hikset("download mesh",
-		mesh, dmesh_file, dmesh_header_print, dmesh_store_kv);
-}
-
-/**
- * Retrieve download mesh and add entries that have not expired yet.
- * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh.
+ * Import download mesh from the text file used by earlier versions and add
+ * entries that have not expired yet.
+ * The mesh was normally stored in ~/.gtk-gnutella/dmesh.
  */
 static void G_COLD
-dmesh_retrieve(void)
+dmesh_retrieve_text(void)
 {
 	FILE *f;
 	char tmp[4096];
@@ -3418,6 +3977,20 @@ dmesh_retrieve(void)
 	}
 
 	fclose(f);
+}
+
+/**
+ * Retrieve download mesh and add entries that have not expired yet.
+ *
+ * The text file from earlier versions is only imported when there is no
+ * binary store yet.
+ */
+static void G_COLD
+dmesh_retrieve(void)
+{
+	if (!dmesh_retrieve_binary())
+		dmesh_retrieve_text();
+
 	dmesh_store();			/* Persist what we have retrieved */
 }
 
@@ -3577,6 +4150,7 @@ dmesh_close(void)
 	hikset_free_null(&ban_mesh);
 	htable_free_null(&ban_mesh_by_sha1);
 
+	cq_periodic_remove(&dmesh_trim_ev);
 	cq_free_null(&dmesh_cq);
 }
 
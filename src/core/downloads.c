@@ -88,6 +88,7 @@
 
 #include "lib/adns.h"
 #include "lib/aging.h"
+#include "lib/aioq.h"
 #include "lib/array.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
@@ -96,8 +97,10 @@
 #include "lib/cstr.h"
 #include "lib/dbus_util.h"
 #include "lib/dualhash.h"
+#include "lib/elist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
+#include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/file_object.h"
 #include "lib/filename.h"
@@ -112,6 +115,7 @@
 #include "lib/http_range.h"
 #include "lib/idtable.h"
 #include "lib/iso3166.h"
+#include "lib/journal.h"
 #include "lib/magnet.h"
 #include "lib/palloc.h"
 #include "lib/parse.h"
@@ -127,6 +131,7 @@
 #include "lib/url.h"
 #include "lib/urn.h"
 #include "lib/utf8.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -158,6 +163,8 @@
 #define DOWNLOAD_FS_SPACE		16384	/**< Min filesystem free space */
 #define DOWNLOAD_PUSH_FREQ		30		/**< Each 30 secs, we allow sending... */
 #define DOWNLOAD_PUSH_MAX		4		/**< ...4 PUSHes max to a server */
+#define DOWNLOAD_WB_EXTENT		1048576	/**< Max coalesced data per source */
+#define DOWNLOAD_AIO_DEPTH		64		/**< Max queued writes, all sources */
 
 #define IO_AVG_RATE		5			/**< Compute global recv rate every 5 secs */
 #define ONE_DAY			(24*3600)	/**< Seconds in one day */
@@ -201,6 +208,8 @@ static void download_queue_hold(struct download *d, uint32 hold,
 static void download_force_stop(struct download *d, const char * reason, ...);
 static void download_reparent(struct download *d, struct dl_server *new_server);
 static void download_silent_flush(struct download *d);
+static void download_aio_wait(struct download *d);
+static void download_aio_done(const aioq_result_t *res, void *unused_arg);
 static void change_server_addr(struct dl_server *server,
 	const host_addr_t new_addr, const uint16 new_port);
 static struct download *download_pick_another(const struct download *d);
@@ -208,7 +217,26 @@ static void download_got_push_route(const guid_t *guid);
 
 static bool download_dirty;
 static bool download_shutdown;
+static journal_t *download_journal;
 static bool queue_frozen_on_write_error;
+static size_t download_wb_held;		/**< Data buffered across all sources */
+static size_t download_wb_verifiable;	/**< Part covered by a TTH tree */
+static uint64 download_wr_count;	/**< Disk writes of downloaded data */
+static uint64 download_wr_bytes;	/**< Bytes written by these writes */
+
+/**
+ * A write queued on behalf of a download.
+ */
+struct dl_aio_write {
+	struct download *d;		/**< The download whose data we write, or NULL */
+	filesize_t from;		/**< Offset of the data in the file */
+	size_t size;			/**< Amount of data to write */
+	pslist_t *mbs;			/**< Messages holding the data (referenced) */
+	link_t lk;				/**< Links writes in download_aio_writes */
+};
+
+static aioq_t *download_aioq;		/**< Queued writes, NULL if synchronous */
+static elist_t download_aio_writes;	/**< Writes queued in download_aioq */
 
 static void download_store(void);
 static void download_retrieve(void);
@@ -1058,10 +1086,20 @@ download_free(struct download **d_ptr)
 	g_assert(d_ptr);
 	d = *d_ptr;
 	download_check(d);
+	g_assert(0 == d->aio_pending);
 
 	hikset_remove(dl_by_id, d->id);
 	dualhash_remove_key(dl_thex, d->id);
 	atom_guid_free_null(&d->id);
+
+	if (d->persisted != NULL) {
+		if (
+			!download_shutdown && download_journal != NULL &&
+			journal_is_active(download_journal)
+		)
+			journal_delete(download_journal, d->persisted);
+		atom_str_free_null(&d->persisted);
+	}
 	d->magic = 0;
 	WFREE(d);
 	*d_ptr = NULL;
@@ -1319,6 +1357,11 @@ download_init(void)
 	dl_thex = dualhash_new(guid_hash, guid_eq, guid_hash, guid_eq);
 	local_pushes = aging_make(DOWNLOAD_PUSH_FREQ, dl_key_hash, dl_key_eq, NULL);
 
+	elist_init(&download_aio_writes, offsetof(struct dl_aio_write, lk));
+	download_aioq = aioq_make(DOWNLOAD_AIO_DEPTH);
+	if (!aioq_set_callback(download_aioq, download_aio_done, NULL))
+		aioq_free_null(&download_aioq);		/* Will write synchronously */
+
 	header_features_add_guarded(FEATURES_DOWNLOADS, "browse",
 		BH_VERSION_MAJOR, BH_VERSION_MINOR,
 		GNET_PROPERTY_PTR(browse_host_enabled));
@@ -1430,11 +1473,12 @@ buffers_reset_reading(struct download *d)
 }
 
 /**
- * Reset the I/O vector for writing the whole data held in the buffer.
+ * Reset the I/O vector for writing the leading `max' bytes of the data held
+ * in the buffer, or all of it if less is held.
  * The returned object must be freed via hfree().
  */
 static iovec_t *
-buffers_to_iovec(struct download *d, int *iov_cnt)
+buffers_to_iovec(struct download *d, int *iov_cnt, size_t max)
 {
 	struct dl_buffers *b;
 	iovec_t *iov;
@@ -1456,12 +1500,80 @@ buffers_to_iovec(struct download *d, int *iov_cnt)
 	g_assert(iov);
 	g_assert(*iov_cnt > 0);
 	g_assert(held == b->held);
+	g_assert(max > 0);
+
+	if (max < held) {
+		size_t len = 0;
+		int i;
+
+		for (i = 0; i < *iov_cnt; i++) {
+			size_t n = iovec_len(&iov[i]);
+
+			if (len + n >= max) {
+				iovec_set_len(&iov[i], max - len);
+				*iov_cnt = i + 1;
+				break;
+			}
+			len += n;
+		}
+	}
 
 	b->mode = DL_BUF_WRITING;
 
 	return iov;
 }
 
+/**
+ * Account for `amount' bytes no longer being held in the read buffers.
+ */
+static inline void
+buffers_released(struct download *d, size_t amount)
+{
+	fileinfo_t *fi = d->file_info;
+
+	if (fi->buffered >= amount)
+		fi->buffered -= amount;
+	else
+		fi->buffered = 0;		/* Be fault-tolerant, this is not critical */
+
+	if (download_wb_held >= amount)
+		download_wb_held -= amount;
+	else
+		download_wb_held = 0;
+
+	if (d->buffers->verifiable) {
+		if (download_wb_verifiable >= amount)
+			download_wb_verifiable -= amount;
+		else
+			download_wb_verifiable = 0;
+	}
+}
+
+/**
+ * Account for the data held in the read buffers as being covered by the
+ * TTH tree of the file or not, depending on whether we know that tree now.
+ */
+static void
+buffers_classify(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+	bool verifiable = d->file_info->tigertree.leaves != NULL;
+
+	if (verifiable == b->verifiable)
+		return;
+
+	if (verifiable) {
+		download_wb_verifiable += b->held;
+	} else {
+		if (download_wb_verifiable >= b->held)
+			download_wb_verifiable -= b->held;
+		else
+			download_wb_verifiable = 0;
+	}
+
+	b->verifiable = verifiable;
+}
+
 /**
  * Discard all read data from buffers.
  */
@@ -1469,25 +1581,22 @@ static inline void
 buffers_discard(struct download *d)
 {
 	struct dl_buffers *b;
-	fileinfo_t *fi;
 
 	download_check(d);
 
 	g_assert(d->buffers);
 	b = d->buffers;
-	fi = d->file_info;
-
-	if (fi->buffered >= b->held)
-		fi->buffered -= b->held;
-	else
-		fi->buffered = 0;		/* Be fault-tolerant, this is not critical */
 
+	buffers_released(d, b->held);
 	b->held = 0;
 	buffers_reset_reading(d);
 }
 
 /**
  * Check whether reception buffers are full.
+ *
+ * Since buffered data are normally flushed as soon as buffers_should_flush()
+ * says so, this only happens when we cannot write to disk.
  */
 static inline bool
 buffers_full(const struct download *d)
@@ -1499,7 +1608,7 @@ buffers_full(const struct download *d)
 
 	b = d->buffers;
 
-	return b->held >= GNET_PROPERTY(download_buffer_size);
+	return b->held >= MAX(b->amount, DOWNLOAD_WB_EXTENT);
 }
 
 /**
@@ -1561,6 +1670,12 @@ buffers_add_read(struct download *d, pmsg_t *mb)
 	 */
 
 	fi->buffered += size;
+	download_wb_held += size;
+
+	if (b->verifiable)
+		download_wb_verifiable += size;
+
+	buffers_classify(d);
 }
 
 /**
@@ -1581,7 +1696,37 @@ buffers_should_flush(const struct download *d)
 	 * this requires looping with [p]writev() - at least with the
 	 * current download logic - which is inefficient.
 	 */
-	return b->held >= b->amount || slist_length(b->list) >= MAX_IOV_COUNT;
+
+	if (slist_length(b->list) >= MAX_IOV_COUNT)
+		return TRUE;
+
+	if (b->held < b->amount)
+		return FALSE;
+
+	/*
+	 * Past the configured amount, keep coalescing data as long as the
+	 * global write-back budget allows it: with many slow sources, this
+	 * turns a flurry of small scattered writes into fewer larger ones.
+	 *
+	 * When the budget is exhausted, sources holding at least the configured
+	 * amount flush, so the largest extents are written first.  Data covered
+	 * by a known TTH tree are flushed first, since bad slices can then be
+	 * spotted by the TTH sweep and downloaded again: other sources keep
+	 * coalescing as long as flushing these would be enough to come back
+	 * within the budget.
+	 */
+
+	if (b->held >= DOWNLOAD_WB_EXTENT)
+		return TRUE;
+
+	if (download_wb_held < GNET_PROPERTY(download_writeback_memory))
+		return FALSE;
+
+	if (b->verifiable)
+		return TRUE;
+
+	return download_wb_held - download_wb_verifiable >=
+		GNET_PROPERTY(download_writeback_memory);
 }
 
 /**
@@ -1632,13 +1777,11 @@ static void
 buffers_strip_leading(struct download *d, size_t amount)
 {
 	struct dl_buffers *b;
-	fileinfo_t *fi;
 
 	download_check(d);
 	g_assert(d->buffers != NULL);
 
 	b = d->buffers;
-	fi = d->file_info;
 
 	g_assert(b->mode == DL_BUF_READING);
 	g_assert(amount <= b->held);
@@ -1650,11 +1793,7 @@ buffers_strip_leading(struct download *d, size_t amount)
 
 	pmsg_slist_discard(b->list, amount);
 	b->held -= amount;
-
-	if (fi->buffered >= amount)
-		fi->buffered -= amount;
-	else
-		fi->buffered = 0;		/* Not critical, be fault-tolerant */
+	buffers_released(d, amount);
 }
 
 /**
@@ -1700,14 +1839,12 @@ buffers_strip_trailing(struct download *d, size_t amount)
 {
 	struct dl_buffers *b;
 	slist_iter_t *iter;
-	fileinfo_t *fi;
 	size_t n;
 
 	download_check(d);
 	g_assert(d->buffers != NULL);
 
 	b = d->buffers;
-	fi = d->file_info;
 
 	g_assert(b->mode == DL_BUF_READING);
 	g_assert(amount <= b->held);
@@ -1745,11 +1882,7 @@ buffers_strip_trailing(struct download *d, size_t amount)
 	slist_iter_free(&iter);
 
 	b->held -= amount;
-
-	if (fi->buffered >= amount)
-		fi->buffered -= amount;
-	else
-		fi->buffered = 0;		/* Not critical, be fault-tolerant */
+	buffers_released(d, amount);
 }
 
 /* ----------------------------------------- */
@@ -3892,6 +4025,7 @@ download_clone(struct download *d)
 	g_assert(!(d->flags & (DL_F_ACTIVE_QUEUED|DL_F_PASSIVE_QUEUED)));
 
 	entropy_harvest_time();
+	download_aio_wait(d);		/* Completions refer to `d' */
 
 	/* The socket can be NULL if we're acting on a queued source */
 
@@ -3926,6 +4060,8 @@ download_clone(struct download *d)
 	cd->file_name = atom_str_get(d->file_name);
 	cd->id = atom_guid_get(d->id);
 	cd->uri = d->uri ? atom_str_get(d->uri) : NULL;
+	d->persisted = NULL;				/* Clone now persisted instead */
+	d->persisted_digest = 0;
 	cd->flags &= ~(DL_F_MUST_IGNORE | DL_F_SWITCHED |
 		DL_F_FROM_PLAIN | DL_F_FROM_ERROR | DL_F_CLONED | DL_F_NO_PIPELINE);
 	cd->server->refcnt++;
@@ -4599,6 +4735,8 @@ download_stop_v(struct download *d, download_status_t new_status,
 	g_assert(!DOWNLOAD_IS_STOPPED(d));
 	g_assert(d->status != new_status);
 
+	download_aio_wait(d);		/* Before closing the file */
+
 	if (DOWNLOAD_IS_ACTIVE(d)) {
 		g_assert(d->file_info->recvcount > 0);
 		g_assert(d->file_info->recvcount <= d->file_info->refcount);
@@ -5000,6 +5138,7 @@ download_queue_v(struct download *d, const char *fmt, va_list ap)
 			goto not_running;
 		}
 	} else {
+		download_aio_wait(d);
 		file_info_clear_download(d, TRUE);	/* Also done by download_stop() */
 	}
 
@@ -5309,6 +5448,7 @@ download_info_reget(struct download *d)
 	if (fi->flags & FI_F_TRANSIENT)
 		return;
 
+	download_aio_wait(d);
 	file_info_clear_download(d, TRUE);			/* `d' might be running */
 	download_pipeline_free_null(&d->pipeline);
 	file_size_known = fi->file_size_known;		/* This should not change */
@@ -7167,6 +7307,7 @@ download_fallback_to_push(struct download *d,
 		socket_free_null(&d->socket);
 	}
 
+	download_aio_wait(d);
 	file_object_close(&d->out_file);
 
 	download_set_status(d, user_request ? GTA_DL_PUSH_SENT : GTA_DL_FALLBACK);
@@ -9187,22 +9328,280 @@ out:
 	return success;
 }
 
+/**
+ * Account for data written to the file of a download, forcing a
+ * synchronization to disk when enough data were written since the last one.
+ */
+static void
+download_written(struct download *d, size_t amount)
+{
+	fileinfo_t *fi = d->file_info;
+
+	download_wr_count++;
+	download_wr_bytes += amount;
+
+	gnet_stats_inc_general(GNR_DOWNLOAD_WRITES);
+	gnet_stats_count_general(GNR_DOWNLOAD_WRITTEN_BYTES, amount);
+	gnet_stats_set_general(GNR_DOWNLOAD_AVG_WRITE_SIZE,
+		download_wr_bytes / download_wr_count);
+
+	if (0 == GNET_PROPERTY(download_sync_amount))
+		return;
+
+	fi->unsynced += amount;
+
+	if (fi->unsynced >= GNET_PROPERTY(download_sync_amount)) {
+		if (-1 == fd_fdatasync(file_object_fd(d->out_file))) {
+			g_warning("%s(): cannot sync \"%s\": %m",
+				G_STRFUNC, download_basename(d));
+		}
+		fi->unsynced = 0;
+		gnet_stats_inc_general(GNR_DOWNLOAD_SYNCS);
+	}
+}
+
+/**
+ * Completion of a queued write, invoked from the main event loop or
+ * when we wait for queued writes.
+ */
+static void
+download_aio_done(const aioq_result_t *res, void *unused_arg)
+{
+	struct dl_aio_write *w = res->udata;
+	struct download *d = w->d;
+	fileinfo_t *fi;
+	size_t written;
+
+	(void) unused_arg;
+
+	elist_remove(&download_aio_writes, w);
+
+	if G_UNLIKELY(NULL == d)
+		goto done;			/* Write was disowned, see download_aio_wait() */
+
+	download_check(d);
+	g_assert(d->aio_pending != 0);
+
+	fi = d->file_info;
+	d->aio_pending--;
+
+	if (fi->buffered >= w->size)
+		fi->buffered -= w->size;
+	else
+		fi->buffered = 0;		/* Be fault-tolerant, this is not critical */
+
+	written = res->ret > 0 ? (size_t) res->ret : 0;
+	g_assert(written <= w->size);
+
+	if (written != 0) {
+		download_written(d, written);
+		file_info_update(d, w->from, w->from + written, DL_CHUNK_DONE);
+		gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
+			GNET_PROPERTY(dl_byte_count) + written);
+	}
+
+	/*
+	 * On failure, the data we could not write will have to be fetched
+	 * again and the error is reported by the next flush of the source.
+	 */
+
+	if (written < w->size) {
+		d->aio_error = 0 == written && 0 != res->error ? res->error : EIO;
+		file_info_update(d, w->from + written, w->from + w->size,
+			DL_CHUNK_EMPTY);
+		g_warning("%s(): wrote %zu/%zu bytes at offset %s to file \"%s\": %s",
+			G_STRFUNC, written, w->size, filesize_to_string(w->from),
+			download_basename(d), g_strerror(d->aio_error));
+	}
+
+done:
+	PSLIST_FOREACH_CALL(w->mbs, pmsg_free);
+	pslist_free_null(&w->mbs);
+	WFREE(w);
+}
+
+/**
+ * Is download idle as far as queued writes are concerned?
+ */
+static bool
+download_aio_idle(void *data)
+{
+	const struct download *d = data;
+
+	return 0 == d->aio_pending;
+}
+
+/**
+ * Disown a queued write of the download, whose completion will be ignored.
+ */
+static void
+download_aio_disown(void *data, void *udata)
+{
+	struct dl_aio_write *w = data;
+	struct download *d = udata;
+	fileinfo_t *fi = d->file_info;
+
+	if (w->d != d)
+		return;
+
+	g_assert(d->aio_pending != 0);
+
+	d->aio_pending--;
+	w->d = NULL;
+
+	if (fi->buffered >= w->size)
+		fi->buffered -= w->size;
+	else
+		fi->buffered = 0;
+
+	file_info_update(d, w->from, w->from + w->size, DL_CHUNK_EMPTY);
+}
+
+/**
+ * Wait for the queued writes of a download to complete.
+ *
+ * Completions of other downloads are dispatched as the kernel posts them,
+ * but we only wait until the writes of this download are done, so that
+ * a stopping source or a chunk ending does not stall on the disk I/O of
+ * all the other downloads.
+ *
+ * Should we be unable to wait, the pending writes of the download are
+ * disowned: their data will be fetched again, and the error is reported
+ * by the next flush of the source, through d->aio_error.
+ */
+static void
+download_aio_wait(struct download *d)
+{
+	download_check(d);
+
+	if (0 == d->aio_pending)
+		return;
+
+	g_assert(download_aioq != NULL);
+
+	if (aioq_wait(download_aioq, download_aio_idle, d))
+		return;
+
+	g_warning("%s(): cannot wait for %u queued write%s of \"%s\"",
+		G_STRFUNC, PLURAL(d->aio_pending), download_basename(d));
+
+	elist_foreach(&download_aio_writes, download_aio_disown, d);
+
+	g_assert(0 == d->aio_pending);
+
+	if (0 == d->aio_error)
+		d->aio_error = EIO;
+}
+
+/**
+ * Wait for all the queued writes to complete, at shutdown time.
+ */
+static void
+download_aio_drain(void)
+{
+	if (NULL == download_aioq || 0 == aioq_pending(download_aioq))
+		return;
+
+	if (!aioq_drain(download_aioq)) {
+		g_warning("%s(): cannot wait for %u queued write%s",
+			G_STRFUNC, PLURAL(aioq_pending(download_aioq)));
+	}
+}
+
+/**
+ * Queue write of the leading `target' bytes of the buffered data.
+ *
+ * Completions come in any order and update the fileinfo, so the data remain
+ * accounted for as buffered by the file until then.
+ *
+ * @return TRUE if the write was queued, FALSE if it must be done now.
+ */
+static bool
+download_aio_write(struct download *d, size_t target)
+{
+	struct dl_buffers *b = d->buffers;
+	fileinfo_t *fi = d->file_info;
+	struct dl_aio_write *w;
+	slist_iter_t *iter;
+	iovec_t *iov;
+	size_t len = 0;
+	int n, r;
+
+	if (NULL == download_aioq || 0 == aioq_room(download_aioq))
+		return FALSE;
+
+	if (!fi->use_swarming || !fi->file_size_known)
+		return FALSE;		/* Data must be written in sequence */
+
+	WALLOC0(w);
+	w->d = d;
+	w->from = d->pos;
+	w->size = target;
+
+	/*
+	 * Keep a reference on the messages holding the data, since these are
+	 * released from the buffers as soon as the write is queued.
+	 */
+
+	iter = slist_iter_before_head(b->list);
+	while (len < target) {
+		pmsg_t *mb;
+
+		g_assert(slist_iter_has_next(iter));
+		mb = slist_iter_next(iter);
+		w->mbs = pslist_prepend(w->mbs, pmsg_ref(mb));
+		len += pmsg_size(mb);
+	}
+	slist_iter_free(&iter);
+
+	iov = buffers_to_iovec(d, &n, target);
+	r = file_object_pwritev_async(d->out_file, download_aioq, iov, n, d->pos, w);
+	HFREE_NULL(iov);
+
+	b->mode = DL_BUF_READING;
+
+	if (-1 == r) {
+		PSLIST_FOREACH_CALL(w->mbs, pmsg_free);
+		pslist_free_null(&w->mbs);
+		WFREE(w);
+		return FALSE;
+	}
+
+	elist_append(&download_aio_writes, w);
+	d->aio_pending++;
+	d->pos += target;
+	buffers_strip_leading(d, target);
+	fi->buffered += target;		/* Until the write completes */
+
+	return TRUE;
+}
+
 /**
  * Flush buffered data to disk.
  *
+ * When `aligned' is set, only the leading part of the buffered data that
+ * ends on a page boundary in the file is written, the remaining being kept
+ * for the next flush.  This lets sources write whole pages, which the
+ * kernel can then commit without having to read back partial pages.
+ * These writes never complete the chunk or the file, and are queued when
+ * writes are asynchronous: other flushes wait for the queued writes of
+ * the source.
+ *
  * @param d			the download to flush
  * @param trimmed	if not NULL, filled with whether we trimmed data or not
  * @param may_stop	whether we can stop the download on errors
+ * @param aligned	whether to only write up to the last page boundary
  *
  * @return TRUE if OK, FALSE on failure.
  */
 static bool
-download_flush(struct download *d, bool *trimmed, bool may_stop)
+download_flush(struct download *d, bool *trimmed, bool may_stop, bool aligned)
 {
 	struct dl_buffers *b;
 	ssize_t written;
 	filesize_t old_pos;		/* For assertion: original d->pos */
 	filesize_t old_held;	/* For assertion: original buffered amount */
+	size_t target;			/* Amount of data to write */
 
 	download_check(d);
 	b = d->buffers;
@@ -9255,10 +9654,30 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	written = 0;
 	old_held = download_buffered(d);
 	old_pos = d->pos;
+	target = b->held;
+
+	if (aligned) {
+		filesize_t end = d->pos + b->held;
+
+		end &= ~((filesize_t) compat_pagesize() - 1);
+		if (end > d->pos)
+			target = end - d->pos;
+	}
 
 	entropy_harvest_small(VARLEN(d), VARLEN(old_held), VARLEN(old_pos), NULL);
 
-	do {
+	if (aligned && 0 == d->aio_error && download_aio_write(d, target)) {
+		written = target;
+	} else {
+		download_aio_wait(d);
+		if (0 != d->aio_error) {
+			errno = d->aio_error;		/* A queued write failed */
+			d->aio_error = 0;
+			written = -1;
+		}
+	}
+
+	while (written >= 0 && (size_t) written < target) {
 		iovec_t *iov;
 		ssize_t ret;
 		int n;
@@ -9269,7 +9688,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 		 * Prepare I/O vector for writing.
 		 */
 
-		iov = buffers_to_iovec(d, &n);
+		iov = buffers_to_iovec(d, &n, target - written);
 		ret = file_object_pwritev(d->out_file, iov, n, d->pos);
 		HFREE_NULL(iov);
 
@@ -9285,6 +9704,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 
 			g_assert(size <= b->held);
 
+			download_written(d, size);
 			file_info_update(d, d->pos, d->pos + size, DL_CHUNK_DONE);
 			gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
 				GNET_PROPERTY(dl_byte_count) + size);
@@ -9294,7 +9714,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 
 			buffers_strip_leading(d, size);
 		}
-	} while (b->held > 0);
+	}
 
 	if ((ssize_t) -1 == written) {
 		const char *error;
@@ -9332,7 +9752,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 		return FALSE;
 	}
 
-	if (b->held > 0) {
+	if ((size_t) written < target) {
 		g_warning("partial write (written=%lu, still held=%lu) to file \"%s\"",
 			(ulong) written, (ulong) b->held, download_basename(d));
 
@@ -9343,11 +9763,12 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 		return FALSE;
 	}
 
-	g_assert(0 == b->held);
-	g_assert((size_t) written == old_held);
-	g_assert(d->pos - old_pos == old_held);
+	g_assert((size_t) written == target);
+	g_assert(b->held == old_held - target);
+	g_assert(d->pos - old_pos == target);
 
-	buffers_discard(d);			/* Since we wrote everything... */
+	if (0 == b->held)
+		buffers_discard(d);		/* Since we wrote everything... */
 
 	return TRUE;
 }
@@ -9365,7 +9786,7 @@ download_silent_flush(struct download *d)
 	g_assert(d->status == GTA_DL_IGNORING || d->status == GTA_DL_RECEIVING);
 
 	if (d->buffers->held > 0) {
-		download_flush(d, NULL, FALSE);
+		download_flush(d, NULL, FALSE, FALSE);
 		if (d->buffers->held > 0) {
 			buffers_discard(d);
 		}
@@ -9537,7 +9958,7 @@ download_write_data(struct download *d)
 	fileinfo_t *fi;
 	bool trimmed = FALSE;
 	enum dl_chunk_status status = DL_CHUNK_BUSY;
-	bool should_flush;
+	bool should_flush, aligned;
 
 	download_check(d);
 
@@ -9610,7 +10031,27 @@ download_write_data(struct download *d)
 	if (!should_flush)
 		return TRUE;
 
-	if (!download_flush(d, &trimmed, TRUE))
+	/*
+	 * Unless we are reaching the end of our range or of the file, only
+	 * write whole pages and keep the trailing partial page buffered.
+	 */
+
+	aligned = b->held < d->chunk.end - d->pos &&
+		download_filedone(d) < download_filesize(d);
+
+	if (!download_flush(d, &trimmed, TRUE, aligned))
+		return FALSE;
+
+	/*
+	 * If we bumped into a zone that is no longer ours, write what we kept
+	 * so that nothing remains buffered when deciding what to do next.
+	 */
+
+	if (
+		b->held > 0 && fi->use_swarming &&
+		file_info_pos_status(fi, d->pos) != DL_CHUNK_BUSY &&
+		!download_flush(d, &trimmed, TRUE, FALSE)
+	)
 		return FALSE;
 
 	/*
@@ -12146,6 +12587,7 @@ http_version_nofix:
 			 * remotely by freeing the current chunk...
 			 */
 
+			download_aio_wait(d);
 			file_info_clear_download(d, TRUE);		/* `d' is running */
 
 			download_add_mesh(d);	/* Update mesh -- we're about to return */
@@ -12929,6 +13371,7 @@ http_version_nofix:
 		d->flags &= ~DL_F_PREFIX_HEAD;
 		d->served_reqs++;
 		download_set_status(d, GTA_DL_CONNECTED);
+		download_aio_wait(d);
 		file_info_clear_download(d, TRUE);
 		s->pos = 0;
 		download_send_request(d);
@@ -13017,6 +13460,7 @@ http_version_nofix:
 		struct rx_inflate_args args;
 
 		args.cb = &download_rx_inflate_cb;
+		args.gnet = FALSE;
 		d->rx = rx_make_above(d->rx, rx_inflate_get_ops(), &args);
 		d->flags |= DL_F_NO_PIPELINE;	/* Disabled for this request */
 	}
@@ -14870,24 +15314,148 @@ download_build_magnet(const struct download *d)
 	return url;
 }
 
-static void
-download_store_magnet(FILE *f, const struct download *d)
+/**
+ * @return whether the download is to be persisted.
+ */
+static bool
+download_is_persistent(const struct download *d)
 {
-	char *url;
-
-	g_return_if_fail(f);
 	download_check(d);
 
 	if (d->status == GTA_DL_DONE || d->status == GTA_DL_REMOVED)
-		return;
+		return FALSE;
 	if (d->flags & (DL_F_TRANSIENT | DL_F_CLONED))
-		return;
+		return FALSE;
+
+	return TRUE;
+}
 
-	url = download_build_magnet(d);
+/**
+ * @return the magnet under which the download is to be persisted, NULL
+ * if it must not be persisted.  The string must be freed with hfree().
+ */
+static char *
+download_persistent_magnet(const struct download *d)
+{
+	if (!download_is_persistent(d))
+		return NULL;
+
+	return download_build_magnet(d);
+}
+
+/**
+ * Running digest of the data from which a magnet is built.
+ */
+struct dl_digest {
+	uint32 h1, h2;
+};
+
+static void
+dl_digest_add(struct dl_digest *dg, const void *data, size_t len)
+{
+	dg->h1 = hashing_mix32(dg->h1 ^ binary_hash(data, len));
+	dg->h2 = dg->h2 * 31 + binary_hash2(data, len);
+}
+
+static void
+dl_digest_add_string(struct dl_digest *dg, const char *s)
+{
+	/* A NULL string and an empty one yield different digests */
+	dl_digest_add(dg, s, NULL == s ? 0 : strlen(s) + 1);
+}
+
+static void
+dl_digest_add_proxy(void *data, void *udata)
+{
+	const gnet_host_t *h = data;
+	struct dl_digest *dg = udata;
+	uint32 v[2];
+
+	v[0] = gnet_host_hash(h);
+	v[1] = gnet_host_hash2(h);
+	dl_digest_add(dg, VARLEN(v));
+}
+
+/**
+ * Compute a digest of everything download_build_magnet() depends on, so that
+ * we can tell whether the magnet of a download changed without building it.
+ * This must be kept in sync with download_build_magnet().
+ *
+ * @return digest, 0 if the download is not to be persisted.
+ */
+static uint64
+download_persistent_digest(const struct download *d)
+{
+	const fileinfo_t *fi = d->file_info;
+	const struct sha1 *sha1;
+	const struct tth *tth;
+	struct dl_digest dg;
+	uint32 v[8];
+	host_addr_t addr;
+
+	if (!download_is_persistent(d))
+		return 0;
+
+	ZERO(&dg);
+	sha1 = download_get_sha1(d);
+	tth = download_get_tth(d);
+	addr = download_addr(d);
+
+	v[0] = download_port(d);
+	v[1] = d->record_index;
+	v[2] = (d->always_push ? 1 : 0) | (d->browse ? 2 : 0) |
+		(fi->file_size_known ? 4 : 0) | (NULL == sha1 ? 8 : 0) |
+		(NULL == tth ? 16 : 0);
+	v[3] = d->server->attrs & (DLS_A_DHT_PUBLISH | DLS_A_G2_ONLY);
+	v[4] = fi->size & MAX_INT_VAL(uint32);
+	v[5] = fi->size >> 32;
+	v[6] = host_addr_hash(addr);
+	v[7] = host_addr_hash2(addr);
+
+	dl_digest_add(&dg, VARLEN(v));
+	dl_digest_add(&dg, download_guid(d), GUID_RAW_SIZE);
+	if (sha1 != NULL)
+		dl_digest_add(&dg, sha1, SHA1_RAW_SIZE);
+	if (tth != NULL)
+		dl_digest_add(&dg, tth, TTH_RAW_SIZE);
+	dl_digest_add_string(&dg, fi->pathname);
+	dl_digest_add_string(&dg, d->uri);
+	dl_digest_add_string(&dg, d->file_name);
+	dl_digest_add_string(&dg, get_parq_dl_id(d));
+	dl_digest_add_string(&dg, download_vendor(d));
+	dl_digest_add_string(&dg, download_hostname(d));
+
+	if (d->server->proxies != NULL)
+		pproxy_set_foreach(d->server->proxies, dl_digest_add_proxy, &dg);
+
+	return ((uint64) dg.h1 << 32) | dg.h2 | 1;	/* Never 0 */
+}
+
+/**
+ * Record the magnet under which the download was last persisted.
+ */
+static void
+download_set_persisted(struct download *d, const char *url, uint64 digest)
+{
+	atom_str_free_null(&d->persisted);
+	if (url != NULL)
+		d->persisted = atom_str_get(url);
+	d->persisted_digest = digest;
+}
+
+static void
+download_store_magnet(FILE *f, struct download *d)
+{
+	char *url;
+
+	g_return_if_fail(f);
+
+	url = download_persistent_magnet(d);
 	if (url) {
 		fprintf(f, "%s\n\n", url);
-		HFREE_NULL(url);
 	}
+	download_set_persisted(d, url, download_persistent_digest(d));
+	HFREE_NULL(url);
 }
 
 static void
@@ -14895,6 +15463,7 @@ download_store_magnets(void)
 {
 	file_path_t fp;
 	FILE *f;
+	long size;
 
 	g_return_if_fail(!retrieving);
 
@@ -14920,6 +15489,7 @@ download_store_magnets(void)
 		hash_list_iter_t *iter;
 
 		file_config_preamble(f, "Downloads");
+		journal_checkpoint_mark(download_journal, f);
 		iter = hash_list_iterator(sl_downloads);
 
 		while (hash_list_iter_has_next(iter)) {
@@ -14930,10 +15500,71 @@ download_store_magnets(void)
 		}
 
 		hash_list_iter_release(&iter);
-		file_config_close(f, &fp);
+		size = ftell(f);
+
+		if (file_config_close(f, &fp)) {
+			journal_checkpointed(download_journal, MAX(size, 0));
+			file_info_persisted(MAX(size, 0), TRUE);
+		}
 	}
 }
 
+/**
+ * Append the downloads whose magnet changed since they were last persisted
+ * to the journal of the downloads database.
+ */
+static void
+download_journal_changes(void)
+{
+	hash_list_iter_t *iter;
+	ssize_t written;
+
+	iter = hash_list_iterator(sl_downloads);
+
+	while (hash_list_iter_has_next(iter)) {
+		struct download *d = hash_list_iter_next(iter);
+		uint64 digest;
+		char *url;
+
+		download_check(d);
+
+		/*
+		 * Only rebuild the magnet when what it is built from changed.
+		 */
+
+		digest = download_persistent_digest(d);
+		if (digest == d->persisted_digest)
+			continue;
+
+		url = download_persistent_magnet(d);
+
+		if (NULL == url ? NULL == d->persisted :
+			(d->persisted != NULL && 0 == strcmp(url, d->persisted))
+		) {
+			d->persisted_digest = digest;
+			HFREE_NULL(url);
+			continue;		/* Unchanged */
+		}
+
+		if (d->persisted != NULL)
+			journal_delete(download_journal, d->persisted);
+
+		if (url != NULL) {
+			fprintf(journal_begin(download_journal, NULL), "%s\n", url);
+			journal_end(download_journal);
+		}
+
+		download_set_persisted(d, url, digest);
+		HFREE_NULL(url);
+	}
+
+	hash_list_iter_release(&iter);
+
+	written = journal_sync(download_journal);
+	if (written > 0)
+		file_info_persisted(written, FALSE);
+}
+
 /**
  * Store all pending downloads.
  *
@@ -14965,7 +15596,10 @@ download_store_if_dirty(void)
 		return;
 
 	if (download_dirty) {
-		download_store();
+		if (journal_wants_checkpoint(download_journal))
+			download_store();
+		else
+			download_journal_changes();
 		file_info_store_if_dirty();
 	}
 }
@@ -15284,6 +15918,10 @@ download_retrieve(void)
 	file_path_t fp[1];
 	FILE *f;
 
+	download_journal = journal_make(settings_config_dir(), download_file,
+		file_what);
+	journal_replay(settings_config_dir(), download_file, file_what, "magnet:");
+
 	file_path_set(fp, settings_config_dir(), download_file);
 	f = file_config_open_read(file_what, fp, N_ITEMS(fp));
 	if (f) {
@@ -16264,6 +16902,7 @@ download_close(void)
 
 	download_store();			/* Save latest copy */
 	download_freeze_queue();
+	download_aio_drain();		/* Account for all the queued writes */
 	file_info_store();			/* Must do BEFORE we remove downloads */
 
 	/*
@@ -16272,10 +16911,12 @@ download_close(void)
 	 * downloads, nothing what we do from here on is meant to persist.
 	 */
 	download_shutdown = TRUE;
+	journal_free_null(&download_journal);
 
 	download_clear_stopped(TRUE, TRUE, TRUE, TRUE, TRUE);
 	download_remove_all();
 	download_free_removed();
+	aioq_free_null(&download_aioq);
 
 	hash_list_free(&sl_downloads);
 	hash_list_free(&sl_unqueued);
@@ -17455,6 +18096,7 @@ download_timer(time_t now)
 		FALSE);
 
 	download_free_removed();
+	gnet_stats_set_general(GNR_DOWNLOAD_WRITEBACK_BYTES, download_wb_held);
 
 	/*
 	 * If we froze the queue due to a previous recoverable write error (such
@@ -1595,21 +1595,14 @@ ext_ggep_inflate(const char *buf, int len, uint16 *retlen, const char *name)
 	g_assert(retlen);
 
 	/*
-	 * Allocate decompressor.
+	 * Get decompressor.
 	 */
 
-	WALLOC(inz);
+	inz = zlib_inflate_stream_get();
 
-	inz->zalloc = zlib_alloc_func;
-	inz->zfree = zlib_free_func;
-	inz->opaque = NULL;
-
-	ret = inflateInit(inz);
-
-	if (ret != Z_OK) {
-		WFREE(inz);
-		g_warning("unable to setup decompressor for GGEP payload \"%s\": %s",
-			name, zlib_strerror(ret));
+	if (NULL == inz) {
+		g_warning("unable to setup decompressor for GGEP payload \"%s\"",
+			name);
 		return NULL;
 	}
 
@@ -1697,18 +1690,10 @@ ext_ggep_inflate(const char *buf, int len, uint16 *retlen, const char *name)
 	}
 
 	/*
-	 * Dispose of decompressor.
+	 * Give back decompressor.
 	 */
 
-	ret = inflateEnd(inz);
-	if (ret != Z_OK) {
-		if (GNET_PROPERTY(ggep_debug)) {
-			g_warning("while freeing decompressor for GGEP payload \"%s\": %s",
-				name, zlib_strerror(ret));
-		}
-	}
-
-	WFREE(inz);
+	zlib_inflate_stream_put(inz);
 
 	/*
 	 * return NULL on error.
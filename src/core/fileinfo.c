@@ -49,6 +49,7 @@
 #include "downloads.h"
 #include "gdht.h"
 #include "gmsg.h"
+#include "gnet_stats.h"
 #include "guid.h"
 #include "hosts.h"
 #include "huge.h"
@@ -83,9 +84,11 @@
 #include "lib/halloc.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/hset.h"
 #include "lib/htable.h"
 #include "lib/http_range.h"
 #include "lib/idtable.h"
+#include "lib/journal.h"
 #include "lib/magnet.h"
 #include "lib/mempcpy.h"
 #include "lib/parse.h"
@@ -217,6 +220,75 @@ static bool fileinfo_dirty = FALSE;
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
 
+/*
+ * Changes to the fileinfo database are appended to a journal, the whole
+ * database being only rewritten when the journal grows larger than it.
+ * The `fi_journal_pending' set holds the entries changed since the last
+ * time the database or the journal was written.
+ */
+
+#define FI_JOURNAL_KEY		"GUID "		/**< Line identifying a stanza */
+#define FI_JOURNAL_KEYLEN	(CONST_STRLEN(FI_JOURNAL_KEY) + GUID_HEX_SIZE + 1)
+
+static journal_t *fi_journal;
+static hset_t *fi_journal_pending;
+static bool fi_closing;				/**< Set by file_info_close_pre() */
+
+static time_t fi_persist_hour;		/**< Start of current persistence hour */
+static uint64 fi_persist_bytes;		/**< Bytes persisted during that hour */
+
+/**
+ * Record that the persisted state of the fileinfo changed.
+ */
+static void
+fi_persist_dirty(fileinfo_t *fi)
+{
+	fileinfo_dirty = TRUE;
+
+	if (!(fi->flags & FI_F_TRANSIENT) && fi_journal_pending != NULL)
+		hset_insert(fi_journal_pending, fi);
+}
+
+/**
+ * Fill buffer with the key identifying the fileinfo in the journal.
+ */
+static void
+fi_journal_key(const fileinfo_t *fi, char *buf, size_t len)
+{
+	str_bprintf(buf, len, FI_JOURNAL_KEY "%s", guid_hex_str(fi->guid));
+}
+
+/**
+ * Update the "bytes persisted during the last hour" statistic.
+ */
+static void
+fi_persist_hourly(void)
+{
+	time_t now = tm_time();
+
+	if (delta_time(now, fi_persist_hour) >= 3600) {
+		gnet_stats_set_general(GNR_PERSIST_BYTES_LAST_HOUR, fi_persist_bytes);
+		fi_persist_hour = now;
+		fi_persist_bytes = 0;
+	}
+}
+
+/**
+ * Account for data written to persist the fileinfo or download databases.
+ *
+ * @param written		amount of bytes written
+ * @param checkpoint	TRUE if the whole database was rewritten
+ */
+void
+file_info_persisted(size_t written, bool checkpoint)
+{
+	gnet_stats_count_general(checkpoint ?
+		GNR_PERSIST_CHECKPOINT_BYTES : GNR_PERSIST_JOURNAL_BYTES, written);
+
+	fi_persist_bytes += written;
+	fi_persist_hourly();
+}
+
 #define	FILE_INFO_MAGIC32 0xD1BB1ED0U
 #define	FILE_INFO_MAGIC64 0X91E63640U
 
@@ -861,7 +933,7 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	}
 
 	fi->dirty = FALSE;
-	fileinfo_dirty = TRUE;
+	fi_persist_dirty(fi);
 
 	entropy_harvest_time();
 }
@@ -921,9 +993,15 @@ file_info_got_tth_internal(fileinfo_t *fi, const struct tth *tth, bool update)
 	g_return_if_fail(NULL == fi->tth);
 	fi->tth = atom_tth_get(tth);
 
-	/* Update the GUI, if requested */
-	if (update)
-		fi_event_trigger(fi, EV_FI_INFO_CHANGED);
+	/*
+	 * When not updating, we are loading the fileinfo from its persisted
+	 * state, hence nothing changed.
+	 */
+
+	if (update) {
+		fi_persist_dirty(fi);
+		fi_event_trigger(fi, EV_FI_INFO_CHANGED);	/* Update the GUI */
+	}
 }
 
 void
@@ -1344,7 +1422,7 @@ file_info_resize(fileinfo_t *fi, filesize_t size)
 
 	if (!(fi->flags & FI_F_TRANSIENT)) {
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		fi_persist_dirty(fi);
 	}
 }
 
@@ -2398,6 +2476,7 @@ file_info_store(void)
 {
 	FILE *f;
 	file_path_t fp;
+	long size;
 
 	file_path_set(&fp, settings_config_dir(), file_info_file);
 	f = file_config_open_write(file_info_what, &fp);
@@ -2406,6 +2485,7 @@ file_info_store(void)
 		return;
 
 	file_config_preamble(f, "Fileinfo database");
+	journal_checkpoint_mark(fi_journal, f);
 
 	fputs(
 		"#\n"
@@ -2435,18 +2515,81 @@ file_info_store(void)
 
 	hikset_foreach(fi_by_outname, file_info_store_list, f);
 
-	file_config_close(f, &fp);
+	size = ftell(f);
+
+	if (file_config_close(f, &fp)) {
+		journal_checkpointed(fi_journal, MAX(size, 0));
+		file_info_persisted(MAX(size, 0), TRUE);
+	}
+
+	hset_clear(fi_journal_pending);
 	fileinfo_dirty = FALSE;
 }
 
+/**
+ * Set iterator to collect pending fileinfo entries.
+ */
+static void
+file_info_journal_collect(const void *key, void *data)
+{
+	pslist_t **list = data;
+
+	*list = pslist_prepend(*list, deconstify_pointer(key));
+}
+
+/**
+ * Append the changed entries to the journal of the fileinfo database.
+ */
+static void
+file_info_journal(void)
+{
+	pslist_t *sl, *pending = NULL;
+	ssize_t written;
+
+	/*
+	 * Storing an entry can flush its trailer, which marks it as dirty
+	 * again: snapshot the set before iterating.
+	 */
+
+	hset_foreach(fi_journal_pending, file_info_journal_collect, &pending);
+
+	PSLIST_FOREACH(pending, sl) {
+		fileinfo_t *fi = sl->data;
+		char key[FI_JOURNAL_KEYLEN];
+
+		fi_journal_key(fi, ARYLEN(key));
+		file_info_store_one(journal_begin(fi_journal, key), fi);
+		journal_end(fi_journal);
+	}
+
+	pslist_free_null(&pending);
+	hset_clear(fi_journal_pending);
+	fileinfo_dirty = FALSE;
+
+	written = journal_sync(fi_journal);
+
+	if (written >= 0)
+		file_info_persisted(written, FALSE);
+	else
+		fileinfo_dirty = TRUE;		/* Journal deactivated, checkpoint needed */
+}
+
 /**
  * Store global file information cache if dirty.
+ *
+ * Unless the journal has grown too large, only the entries that changed
+ * are appended to the journal, instead of rewriting the whole database.
  */
 void
 file_info_store_if_dirty(void)
 {
-	if (fileinfo_dirty)
+	if (!fileinfo_dirty)
+		return;
+
+	if (fi_closing || journal_wants_checkpoint(fi_journal))
 		file_info_store();
+	else
+		file_info_journal();
 }
 
 /*
@@ -2603,6 +2746,7 @@ file_info_close_pre(void)
 {
 	src_remove_listener(fi_update_seen_on_network, EV_SRC_RANGES_CHANGED);
 	can_publish_partial_sha1 = FALSE;
+	fi_closing = TRUE;		/* Only full stores from now on */
 }
 
 /**
@@ -2624,6 +2768,9 @@ file_info_close(void)
 	hikset_foreach(fi_by_guid, file_info_free_guid_kv, NULL);
 	hikset_foreach(fi_by_outname, file_info_free_outname_kv, NULL);
 
+	journal_free_null(&fi_journal);
+	hset_free_null(&fi_journal_pending);
+
 	g_assert(0 == idtable_count(src_handle_map));
 	idtable_destroy(src_handle_map);
 
@@ -2742,6 +2889,7 @@ transient:
 
 	fi->hashed = TRUE;
     fi->fi_handle = file_info_request_handle(fi);
+	fi_persist_dirty(fi);
 
 	gnet_prop_incr_guint32(PROP_FI_ALL_COUNT);
 
@@ -2770,6 +2918,24 @@ file_info_hash_remove(fileinfo_t *fi)
 	file_info_drop_handle(fi, "Discarding file info");
 	entropy_harvest_single(PTRLEN(fi->guid));
 
+	/*
+	 * Persisted entries are removed from the database through the journal.
+	 * At shutdown time, the final checkpoint has already been written.
+	 */
+
+	if (fi_journal_pending != NULL)
+		hset_remove(fi_journal_pending, fi);
+
+	if (
+		!(fi->flags & FI_F_TRANSIENT) && !fi_closing &&
+		fi_journal != NULL && journal_is_active(fi_journal)
+	) {
+		char key[FI_JOURNAL_KEYLEN];
+
+		fi_journal_key(fi, ARYLEN(key));
+		journal_delete(fi_journal, key);
+	}
+
 	g_assert(GNET_PROPERTY(fi_all_count) > 0);
 	gnet_prop_decr_guint32(PROP_FI_ALL_COUNT);
 
@@ -2830,7 +2996,7 @@ file_info_upload_stop(fileinfo_t *fi, const char *reason)
 		}
 
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		fi_persist_dirty(fi);
 	}
 }
 
@@ -2842,6 +3008,7 @@ file_info_resume(fileinfo_t *fi)
 	if (FI_F_PAUSED & fi->flags) {
 		fi->flags &= ~FI_F_PAUSED;
 		file_info_changed(fi);
+		fi_persist_dirty(fi);
 	}
 }
 
@@ -2853,7 +3020,7 @@ file_info_pause(fileinfo_t *fi)
 	if (!(FI_F_PAUSED & fi->flags)) {
 		fi->flags |= FI_F_PAUSED;
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		fi_persist_dirty(fi);
 	}
 }
 
@@ -2949,6 +3116,7 @@ file_info_got_sha1(fileinfo_t *fi, const struct sha1 *sha1)
 	if (NULL == xfi) {
 		fi->sha1 = atom_sha1_get(sha1);
 		hikset_insert_key(fi_by_sha1, &fi->sha1);
+		fi_persist_dirty(fi);
 
 		if (can_publish_partial_sha1)
 			publisher_add(fi->sha1);
@@ -3003,6 +3171,7 @@ file_info_got_sha1(fileinfo_t *fi, const struct sha1 *sha1)
 		fi->sha1 = atom_sha1_get(sha1);
 		file_info_reparent_all(xfi, fi);	/* All `xfi' replaced by `fi' */
 		hikset_insert_key(fi_by_sha1, &fi->sha1);
+		fi_persist_dirty(fi);
 	} else {
 		g_assert(0 == fi->done);
 		file_info_reparent_all(fi, xfi);	/* All `fi' replaced by `xfi' */
@@ -3201,6 +3370,13 @@ file_info_retrieve(void)
 
 	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
 
+	/*
+	 * Merge the changes journaled since the last checkpoint first.
+	 */
+
+	journal_replay(settings_config_dir(), file_info_file,
+		file_info_what, FI_JOURNAL_KEY);
+
 	file_path_set(&fp, settings_config_dir(), file_info_file);
 	f = file_config_open_read(file_info_what, &fp, 1);
 	if (!f)
@@ -4152,7 +4328,7 @@ file_info_moved(fileinfo_t *fi, const char *pathname)
 
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 	file_info_changed(fi);
-	fileinfo_dirty = TRUE;
+	fi_persist_dirty(fi);
 }
 
 /**
@@ -4460,7 +4636,7 @@ file_info_size_unknown(fileinfo_t *fi)
 	if (0 == (fi->flags & FI_F_TRANSIENT)) {
 		file_info_hash_remove_name_size(fi);
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		fi_persist_dirty(fi);
 	}
 
 	fi->file_size_known = FALSE;
@@ -4536,7 +4712,7 @@ file_info_size_known(struct download *d, filesize_t size)
 	fi->use_swarming = TRUE;
 	fi->size = MAX(size, fi->done);
 	fi->dirty = TRUE;
-	fileinfo_dirty = TRUE;
+	fi_persist_dirty(fi);
 
 	if (0 == (FI_F_TRANSIENT & fi->flags)) {
 		file_info_hash_insert_name_size(fi);
@@ -4914,7 +5090,7 @@ restart:
 	}
 
 	file_info_merge_adjacent(fi);
-	fileinfo_dirty = TRUE;
+	fi_persist_dirty(fi);
 }
 
 /**
@@ -7377,6 +7553,8 @@ file_info_dht_query(const sha1_t *sha1)
 void
 file_info_slow_timer(void)
 {
+	fi_persist_hourly();
+
 	if (!dht_bootstrapped() || GNET_PROPERTY(ancient_version))
 		return;
 
@@ -8608,6 +8786,11 @@ file_info_init(void)
 	fi_by_outname  = hikset_create(offsetof(fileinfo_t, pathname),
 						HASH_KEY_STRING, 0);
 
+	fi_journal = journal_make(settings_config_dir(), file_info_file,
+		file_info_what);
+	fi_journal_pending = hset_create(HASH_KEY_SELF, 0);
+	fi_persist_hour = tm_time();
+
     fi_handle_map = idtable_new(32);
 
     fi_events[EV_FI_ADDED]          = event_new("fi_added");
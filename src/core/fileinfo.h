@@ -60,6 +60,7 @@ void file_info_retrieve(void);
 void file_info_store(void);
 void file_info_store_binary(fileinfo_t *fi, bool force);
 void file_info_store_if_dirty(void);
+void file_info_persisted(size_t written, bool checkpoint);
 void file_info_set_discard(fileinfo_t *fi, bool state);
 enum dl_chunk_status file_info_find_hole(
 	const struct download *d, filesize_t *from, filesize_t *to);
@@ -46,6 +46,7 @@
 #include "lib/path.h"
 #include "lib/str.h"
 #include "lib/stringify.h"		/* For ipv6_to_string() */
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/walloc.h"
 #include "lib/watcher.h"
@@ -75,10 +76,21 @@ static struct gip_source gip_source[] = {
 
 static struct iprange_db *geo_db;	/**< The database of bogus CIDR ranges */
 
+/**
+ * Database parsed by gip_parse(), until gip_init() installs it.
+ */
+static struct gip_parsed {
+	struct iprange_db *db;						/**< Parsed database */
+	char *pathname[N_ITEMS(gip_source)];		/**< Files read, or NULL */
+	time_t mtime[N_ITEMS(gip_source)];			/**< Their modification time */
+	bool done;									/**< Whether gip_parse() ran */
+} gip_parsed;
+
 /**
  * Context used during ip_range_split() calls.
  */
 struct range_context {
+	struct iprange_db *db;		/**< The database being filled */
 	const char *line;			/**< The line from the input file */
 	int linenum;				/**< Line number in input file, for errors */
 	uint32 ip1;					/**< Original lower IP in global range */
@@ -103,7 +115,7 @@ gip_add_cidr(uint32 ip, uint bits, void *udata)
 			ip_to_string(ip), bits, ctx->line);
 
 	cc = ctx->country;
-	error = iprange_add_cidr(geo_db, ip, bits, cc);
+	error = iprange_add_cidr(ctx->db, ip, bits, cc);
 
 	switch (error) {
 	case IPR_ERR_OK:
@@ -131,12 +143,14 @@ gip_add_cidr(uint32 ip, uint bits, void *udata)
  *
  * as disciminated by the the tag parameter.
  *
+ * @param db		the database being filled
  * @param line		the string to parse
  * @param linenum	the source line number in the file
  * @param tag		either GIP_IPV4 or GIP_IPV6 depending on file parsed
  */
 static void
-gip_parse_ip(const char *line, int linenum, enum gip_type tag)
+gip_parse_ip(struct iprange_db *db, const char *line, int linenum,
+	enum gip_type tag)
 {
 	const char *end;
 	uint16 code;
@@ -228,10 +242,10 @@ no_bits:
 
 	switch (tag) {
 	case GIP_IPV4:
-		error = iprange_add_cidr (geo_db, ipv4, bits, (code + 1) << 1);
+		error = iprange_add_cidr (db, ipv4, bits, (code + 1) << 1);
 		break;
 	case GIP_IPV6:
-		error = iprange_add_cidr6(geo_db, ipv6, bits, (code + 1) << 1);
+		error = iprange_add_cidr6(db, ipv6, bits, (code + 1) << 1);
 		break;
 
 	}
@@ -262,7 +276,7 @@ bad:
  * delimited by the two IP addresses.
  */
 static void
-gip_parse_ipv4_legacy(const char *line, int linenum)
+gip_parse_ipv4_legacy(struct iprange_db *db, const char *line, int linenum)
 {
 	const char *end;
 	uint16 code;
@@ -346,6 +360,7 @@ gip_parse_ipv4_legacy(const char *line, int linenum)
 	/* code must not be zero and the LSB must be zero due to using it as
 	 * as key for ipranges */
 	ctx.country = (code + 1) << 1;
+	ctx.db = db;
 	ctx.line = line;
 	ctx.linenum = linenum;
 
@@ -370,16 +385,16 @@ gip_parse_ipv4_legacy(const char *line, int linenum)
  * entry per line.
  */
 static void
-gip_parse_ipv4_new(const char *line, int linenum)
+gip_parse_ipv4_new(struct iprange_db *db, const char *line, int linenum)
 {
-	gip_parse_ip(line, linenum, GIP_IPV4);
+	gip_parse_ip(db, line, linenum, GIP_IPV4);
 }
 
 /**
  * Parse an IPv4 Geo IP line and record the range in the database.
  */
 static void
-gip_parse_ipv4(const char *line, int linenum)
+gip_parse_ipv4(struct iprange_db *db, const char *line, int linenum)
 {
 	/*
 	 * We discriminate between the legacy and new format based on the
@@ -387,9 +402,9 @@ gip_parse_ipv4(const char *line, int linenum)
 	 */
 
 	if (NULL == vstrchr(line, '/'))
-		gip_parse_ipv4_legacy(line, linenum);
+		gip_parse_ipv4_legacy(db, line, linenum);
 	else
-		gip_parse_ipv4_new(line, linenum);
+		gip_parse_ipv4_new(db, line, linenum);
 
 }
 
@@ -397,18 +412,26 @@ gip_parse_ipv4(const char *line, int linenum)
  * Parse an IPv6 Geo IP line and record the range in the database.
  */
 static void
-gip_parse_ipv6(const char *line, int linenum)
+gip_parse_ipv6(struct iprange_db *db, const char *line, int linenum)
 {
-	gip_parse_ip(line, linenum, GIP_IPV6);
+	gip_parse_ip(db, line, linenum, GIP_IPV6);
 }
 
 /**
  * Load geographic IP data from the supplied FILE.
  *
+ * @param db		the database to fill, whose previous entries are reset
+ * @param f			the file to read
+ * @param idx		either GIP_IPV4 or GIP_IPV6 depending on file parsed
+ * @param filename	the name of the file, for logging
+ * @param initial	whether we load the file for the first time
+ * @param mtime		where the modification time of the file is written
+ *
  * @return The amount of entries loaded.
  */
 static uint G_COLD
-gip_load(FILE *f, unsigned idx, const char *filename, bool initial)
+gip_load(struct iprange_db *db, FILE *f, unsigned idx, const char *filename,
+	bool initial, time_t *mtime)
 {
 	char line[1024];
 	int linenum = 0;
@@ -420,10 +443,10 @@ gip_load(FILE *f, unsigned idx, const char *filename, bool initial)
 
 	switch (idx) {
 	case GIP_IPV4:
-		iprange_reset_ipv4(geo_db);
+		iprange_reset_ipv4(db);
 		break;
 	case GIP_IPV6:
-		iprange_reset_ipv6(geo_db);
+		iprange_reset_ipv6(db);
 		break;
 	default:
 		g_assert_not_reached();
@@ -432,7 +455,7 @@ gip_load(FILE *f, unsigned idx, const char *filename, bool initial)
 	if (-1 == fstat(fileno(f), &buf)) {
 		g_warning("cannot stat %s: %m (at %s)", gip_source[idx].file, filename);
 	} else {
-		gip_source[idx].mtime = buf.st_mtime;
+		*mtime = buf.st_mtime;
 	}
 
 	while (fgets(line, sizeof(line), f)) {
@@ -453,27 +476,27 @@ gip_load(FILE *f, unsigned idx, const char *filename, bool initial)
 			continue;
 
 		if (GIP_IPV4 == idx)
-			gip_parse_ipv4(line, linenum);
+			gip_parse_ipv4(db, line, linenum);
 		else
-			gip_parse_ipv6(line, linenum);
+			gip_parse_ipv6(db, line, linenum);
 
 	}
 
-	iprange_sync(geo_db);
+	iprange_sync(db);
 
 	if (GNET_PROPERTY(reload_debug) || initial) {
 		if (GIP_IPV4 == idx) {
 			g_debug("loaded %u geographical IPv4 ranges (%u hosts) from \"%s\"",
-				iprange_get_item_count4(geo_db),
-				iprange_get_host_count4(geo_db), filename);
+				iprange_get_item_count4(db),
+				iprange_get_host_count4(db), filename);
 		} else {
 			g_debug("loaded %u geographical IPv6 ranges from \"%s\"",
-				iprange_get_item_count6(geo_db), filename);
+				iprange_get_item_count6(db), filename);
 		}
 	}
 
 	return GIP_IPV4 == idx ?
-		iprange_get_item_count4(geo_db) : iprange_get_item_count6(geo_db);
+		iprange_get_item_count4(db) : iprange_get_item_count6(db);
 }
 
 /**
@@ -492,7 +515,7 @@ gip_changed(const char *filename, void *idx_ptr)
 	if (f == NULL)
 		return;
 
-	count = gip_load(f, idx, filename, FALSE);
+	count = gip_load(geo_db, f, idx, filename, FALSE, &gip_source[idx].mtime);
 	fclose(f);
 
 	str_bprintf(ARYLEN(buf), "Reloaded %u geographic IPv%c ranges.",
@@ -502,7 +525,7 @@ gip_changed(const char *filename, void *idx_ptr)
 }
 
 /**
- * Loads the geo-ip.txt into memory.
+ * Parses the geo-ip.txt file of the given kind into the database.
  *
  * Choosing the first file we find among the several places we look at,
  * typically:
@@ -511,11 +534,10 @@ gip_changed(const char *filename, void *idx_ptr)
  *		-# /usr/share/gtk-gnutella/geo-ip.txt
  *		-# /home/src/gtk-gnutella/geo-ip.txt
  *
- * The selected file will then be monitored and a reloading will occur
- * shortly after a modification.
+ * @return the pathname of the file read (halloc()'ed), NULL if none found.
  */
-static void
-gip_retrieve(unsigned n)
+static char *
+gip_parse_one(struct iprange_db *db, unsigned n, time_t *mtime)
 {
 	FILE *f;
 	int idx;
@@ -531,26 +553,65 @@ gip_retrieve(unsigned n)
 			gip_source[n].what, fp, length, &idx);
 
 	if (NULL == f)
-	   return;
+	   return NULL;
 
 	filename = make_pathname(fp[idx].dir, fp[idx].name);
-	watcher_register(filename, gip_changed, uint_to_pointer(n));
-
-	gip_load(f, n, filename, TRUE);
+	gip_load(db, f, n, filename, TRUE, mtime);
 	fclose(f);
-	HFREE_NULL(filename);
+
+	return filename;
+}
+
+/**
+ * Parses the geo-ip.txt files, leaving the database for gip_init().
+ *
+ * This only reads files and can therefore be run by a separate thread.
+ */
+void G_COLD
+gip_parse(void)
+{
+	struct gip_parsed *gp = &gip_parsed;
+	unsigned n;
+
+	g_assert(!gp->done);
+
+	gp->db = iprange_new();
+
+	for (n = 0; n < N_ITEMS(gip_source); n++)
+		gp->pathname[n] = gip_parse_one(gp->db, n, &gp->mtime[n]);
+
+	gp->done = TRUE;
 }
 
 /**
- * Called on startup. Loads the geo-ip.txt file into memory.
+ * Called on startup. Installs the database parsed by gip_parse(), parsing
+ * the geo-ip.txt files now if not done yet.
+ *
+ * The selected files will then be monitored and a reloading will occur
+ * shortly after a modification.
  */
 void
 gip_init(void)
 {
-	geo_db = iprange_new();
+	struct gip_parsed *gp = &gip_parsed;
+	unsigned n;
 
-	gip_retrieve(GIP_IPV4);
-	gip_retrieve(GIP_IPV6);
+	g_assert(thread_is_main());
+
+	if (!gp->done)
+		gip_parse();
+
+	geo_db = gp->db;
+	gp->db = NULL;
+
+	for (n = 0; n < N_ITEMS(gip_source); n++) {
+		if (NULL == gp->pathname[n])
+			continue;
+
+		watcher_register(gp->pathname[n], gip_changed, uint_to_pointer(n));
+		HFREE_NULL(gp->pathname[n]);
+		gip_source[n].mtime = gp->mtime[n];
+	}
 }
 
 /**
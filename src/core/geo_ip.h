@@ -37,6 +37,7 @@
 #include "common.h"
 #include "lib/host_addr.h"
 
+void gip_parse(void);
 void gip_init(void);
 void gip_close(void);
 
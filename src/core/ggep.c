@@ -710,6 +710,74 @@ ggep_stream_close(ggep_stream_t *gs)
 	return len;
 }
 
+/**
+ * Append a complete GGEP block to the stream.
+ *
+ * The block is typically the output of an earlier stream, saved after
+ * ggep_stream_close().  Its extensions are copied as-is, and the stream
+ * can be further extended afterwards as if they had been written to it.
+ *
+ * @param gs		a GGEP stream, not in the middle of an extension
+ * @param data		start of the GGEP block, beginning with the GGEP magic
+ * @param len		length of the GGEP block
+ *
+ * @return TRUE if OK, FALSE if there's not enough room in the output, with
+ * ggep_errno set.  On error, the stream is left unchanged.
+ */
+bool
+ggep_stream_append_block(ggep_stream_t *gs, const void *data, size_t len)
+{
+	const uchar *p = data, *end = p + len, *last = NULL;
+	size_t skip;
+
+	g_assert(ggep_stream_is_valid(gs));
+	g_assert(!gs->begun);
+	g_assert(data != NULL);
+	g_assert(len > 1);
+	g_assert(GGEP_MAGIC == p[0]);
+
+	/*
+	 * Locate the flags of the last extension in the block: once copied,
+	 * it will no longer be the last extension of the stream.
+	 */
+
+	for (p++; p < end; /* empty */) {
+		const uchar *q = p + 1 + (*p & GGEP_F_IDLEN);
+		size_t plen = 0;
+		uchar c;
+
+		last = p;
+
+		do {
+			g_assert(q < end);
+			c = *q++;
+			plen = (plen << GGEP_L_VSHIFT) | (c & GGEP_L_VALUE);
+		} while (!(c & GGEP_L_LAST));
+
+		p = q + plen;
+
+		if (*last & GGEP_F_LAST)
+			break;
+	}
+
+	g_assert(p == end);
+	g_assert(last != NULL);
+
+	skip = gs->magic_sent ? 1 : 0;		/* Leading magic already there? */
+
+	if (len - skip > ggep_stream_avail(gs)) {
+		ggep_errno = GGEP_E_SPACE;
+		return FALSE;
+	}
+
+	gs->last_fp = gs->o + (last - (const uchar *) data) - skip;
+	gs->o = mempcpy(gs->o, const_ptr_add_offset(data, skip), len - skip);
+	gs->magic_sent = TRUE;
+	*gs->last_fp &= ~GGEP_F_LAST;
+
+	return TRUE;
+}
+
 /**
  * The vectorized version of ggep_stream_pack().
  *
@@ -136,6 +136,8 @@ bool ggep_stream_writev(ggep_stream_t *gs,
 bool ggep_stream_write(ggep_stream_t *gs, const void *data, size_t len);
 bool ggep_stream_end(ggep_stream_t *gs);
 size_t ggep_stream_close(ggep_stream_t *gs);
+bool ggep_stream_append_block(ggep_stream_t *gs,
+	const void *data, size_t len);
 bool ggep_stream_packv(ggep_stream_t *gs,
 	const char *id, const iovec_t *iov, int iovcnt, uint32 wflags);
 bool ggep_stream_pack(ggep_stream_t *gs,
@@ -422,6 +422,9 @@ static cperiodic_t *guess_bw_ev;		/**< Periodic b/w checking */
 static cperiodic_t *guess_load_ev;		/**< Periodic DBMW load checking */
 static wq_event_t *guess_new_host_ev;	/**< Waiting for a new host */
 static aging_table_t *guess_qk_reqs;	/**< Recent query key requests */
+static htable_t *guess_qk_waiters;		/**< Queries waiting for a query key */
+static pslist_t *guess_qk_ready;		/**< Hosts with key request completed */
+static cevent_t *guess_qk_release_ev;	/**< Release of query key waiters */
 static aging_table_t *guess_alien;		/**< Recently seen non-GUESS hosts */
 static aging_table_t *guess_old_muids;	/**< Recently expired GUESS MUIDs */
 static ripening_table_t *guess_deferred;/**< Hosts with deferred processing */
@@ -435,6 +438,7 @@ static void guess_iterate(guess_t *gq);
 static bool guess_send(guess_t *gq, const gnet_host_t *host);
 static bool guess_request_qk(const gnet_host_t *host, bool intro, bool g2);
 static bool guess_has_valid_qk(const gnet_host_t *host);
+static void guess_qk_release(cqueue_t *cq, void *unused);
 
 /**
  * Listening interface, used by the GUI through the bridge to plug in
@@ -1849,6 +1853,106 @@ guess_remove_link_cache(const gnet_host_t *h)
 	}
 }
 
+/**
+ * Make query wait for the outcome of the query key request pending for host.
+ *
+ * Query keys are not tied to a query, so a single request can serve all the
+ * searches willing to contact the host.  The host is marked as queried
+ * until the request completes, at which time the query is either sent with
+ * the freshly obtained key or the host is put back into the pool.
+ */
+static void
+guess_qk_wait(guess_t *gq, const gnet_host_t *host)
+{
+	const void *key;
+	void *value;
+
+	guess_check(gq);
+	g_assert(atom_is_host(host));
+
+	if (!hset_contains(gq->queried, host))
+		hset_insert(gq->queried, atom_host_get(host));
+
+	if (htable_lookup_extended(guess_qk_waiters, host, &key, &value)) {
+		htable_insert(guess_qk_waiters, key,
+			pslist_prepend(value, WCOPY(&gq->gid)));
+	} else {
+		htable_insert(guess_qk_waiters, atom_host_get(host),
+			pslist_prepend(NULL, WCOPY(&gq->gid)));
+	}
+
+	if (GNET_PROPERTY(guess_client_debug) > 2) {
+		g_debug("GUESS QUERY[%s] waiting for pending query key from %s",
+			nid_to_string(&gq->gid), gnet_host_to_string(host));
+	}
+}
+
+/**
+ * Signal that the query key request sent to host is completed, successfully
+ * or not, allowing new requests to be made and releasing waiting queries.
+ */
+static void
+guess_qk_request_done(const gnet_host_t *host)
+{
+	if G_UNLIKELY(NULL == guess_qk_reqs)
+		return;		/* GUESS layer was shutdown */
+
+	aging_remove(guess_qk_reqs, host);
+
+	/*
+	 * Waiting queries are released asynchronously since we can be called
+	 * in the middle of a query iteration or of reply processing.
+	 */
+
+	if (htable_contains(guess_qk_waiters, host)) {
+		guess_qk_ready = pslist_prepend(guess_qk_ready,
+			deconstify_pointer(atom_host_get(host)));
+		if (NULL == guess_qk_release_ev)
+			guess_qk_release_ev = cq_main_insert(1, guess_qk_release, NULL);
+	}
+}
+
+/**
+ * Hash table iterator to flag hosts with no pending query key request.
+ *
+ * This catches requests whose completion we could not observe, so that no
+ * query waits forever on them.
+ */
+static void
+guess_qk_waiters_check(const void *key, void *unused_value, void *unused_data)
+{
+	const gnet_host_t *host = key;
+
+	(void) unused_value;
+	(void) unused_data;
+
+	if (NULL == aging_lookup(guess_qk_reqs, host)) {
+		guess_qk_ready = pslist_prepend(guess_qk_ready,
+			deconstify_pointer(atom_host_get(host)));
+		if (NULL == guess_qk_release_ev)
+			guess_qk_release_ev = cq_main_insert(1, guess_qk_release, NULL);
+	}
+}
+
+/**
+ * Hash table iterator to free query key waiters at shutdown.
+ */
+static void
+guess_qk_waiters_free_kv(const void *key, void *value, void *unused_data)
+{
+	pslist_t *gids = value, *sl;
+
+	(void) unused_data;
+
+	PSLIST_FOREACH(gids, sl) {
+		struct nid *gid = sl->data;
+		WFREE(gid);
+	}
+
+	pslist_free(gids);
+	atom_host_free(key);
+}
+
 /**
  * Record query key for host.
  *
@@ -1899,10 +2003,11 @@ guess_record_qk(const gnet_host_t *h, const void *buf, size_t len, bool g2)
 
 	/*
 	 * Remove pending "query key" indication for the host: we can now use the
-	 * cached query key, no need to contact the host.
+	 * cached query key, no need to contact the host.  Queries waiting for
+	 * that key will be able to send their query.
 	 */
 
-	aging_remove(guess_qk_reqs, h);
+	guess_qk_request_done(h);
 }
 
 /**
@@ -2641,8 +2746,7 @@ guess_qk_g2_reply(enum udp_ping_ret type,
 		g_assert_not_reached();
 	}
 
-	if G_LIKELY(guess_qk_reqs != NULL)
-		aging_remove(guess_qk_reqs, h);
+	guess_qk_request_done(h);
 
 	atom_host_free(h);
 }
@@ -2693,8 +2797,7 @@ guess_qk_reply(enum udp_ping_ret type,
 			g_debug("GUESS done waiting for replies from %s",
 				gnet_host_to_string(h));
 		}
-		if G_LIKELY(guess_qk_reqs != NULL)
-			aging_remove(guess_qk_reqs, h);
+		guess_qk_request_done(h);
 		atom_host_free(h);
 		break;
 
@@ -3459,6 +3562,7 @@ guess_periodic_check(void *unused_obj)
 	(void) unused_obj;
 
 	guess_check_link_cache();
+	htable_foreach(guess_qk_waiters, guess_qk_waiters_check, NULL);
 	return TRUE;				/* Keep calling */
 }
 
@@ -3736,15 +3840,14 @@ guess_pick_next(guess_t *gq)
 		}
 
 		/*
-		 * Skip host from which we're waiting for a query key.
+		 * If we're waiting for a query key from the host and have no valid
+		 * key for it yet, share the pending request: the host will come
+		 * back at the head of the pool when the request completes.
 		 */
 
-		if (aging_lookup(guess_qk_reqs, host)) {
-			if (GNET_PROPERTY(guess_client_debug) > 5) {
-				g_debug("GUESS QUERY[%s] still waiting for query key from %s",
-					nid_to_string(&gq->gid), gnet_host_to_string(host));
-			}
-			continue;
+		if (aging_lookup(guess_qk_reqs, host) && !guess_has_valid_qk(host)) {
+			guess_qk_wait(gq, host);
+			goto drop_silently;
 		}
 
 		found = TRUE;
@@ -3761,6 +3864,9 @@ guess_pick_next(guess_t *gq)
 				nid_to_string(&gq->gid), gnet_host_to_string(host), reason);
 		}
 
+		/* FALL THROUGH */
+
+	drop_silently:
 		hash_list_iter_remove(iter);
 		atom_host_free_null(&host);
 	}
@@ -4331,6 +4437,90 @@ guess_alien_host(const guess_t *gq, const gnet_host_t *host, bool reached)
 	hevset_foreach(gqueries, guess_ignore_alien_host, deconstify_pointer(host));
 }
 
+/**
+ * Release queries waiting for the completion of the query key request to
+ * the given host.
+ *
+ * The host is put back at the head of their pool and they are scheduled
+ * for an iteration, which will send the query if we now have a valid key,
+ * within the limits of the query parallelism and of the shared b/w budget.
+ * Otherwise, the regular host selection will get rid of timeouting or
+ * alien hosts, or request the key again later.
+ */
+static void
+guess_qk_release_host(const gnet_host_t *host)
+{
+	const void *key;
+	void *value;
+	pslist_t *gids, *sl;
+	bool valid;
+
+	if (!htable_lookup_extended(guess_qk_waiters, host, &key, &value))
+		return;
+
+	htable_remove(guess_qk_waiters, host);
+	gids = value;
+	valid = guess_has_valid_qk(host);
+
+	PSLIST_FOREACH(gids, sl) {
+		struct nid *gid = sl->data;
+		guess_t *gq = guess_is_alive(*gid);
+		const gnet_host_t *h;
+
+		WFREE(gid);
+
+		if (NULL == gq || NULL == (h = hset_lookup(gq->queried, host)))
+			continue;
+
+		if (GNET_PROPERTY(guess_client_debug) > 2) {
+			g_debug("GUESS QUERY[%s] %s query key from %s, back to pool",
+				nid_to_string(&gq->gid), valid ? "got shared" : "no",
+				gnet_host_to_string(host));
+		}
+
+		hset_remove(gq->queried, host);
+
+		if (
+			(!valid && (gq->flags & GQ_F_END_STARVING)) ||
+			hash_list_contains(gq->pool, h)
+		) {
+			atom_host_free(h);
+		} else {
+			hash_list_prepend(gq->pool, h);
+			if (valid)
+				gnet_stats_inc_general(GNR_GUESS_SHARED_QUERY_KEYS);
+		}
+		guess_async_iterate_if_needed(gq);
+	}
+
+	pslist_free(gids);
+	atom_host_free(key);
+}
+
+/**
+ * Callout queue callback to release queries waiting for query keys.
+ */
+static void
+guess_qk_release(cqueue_t *cq, void *unused)
+{
+	pslist_t *ready, *sl;
+
+	(void) unused;
+
+	cq_zero(cq, &guess_qk_release_ev);
+	ready = guess_qk_ready;
+	guess_qk_ready = NULL;
+
+	PSLIST_FOREACH(ready, sl) {
+		const gnet_host_t *host = sl->data;
+
+		guess_qk_release_host(host);
+		atom_host_free(host);
+	}
+
+	pslist_free(ready);
+}
+
 enum guess_qk_magic { GUESS_QK_MAGIC = 0x2868c199 };
 
 /**
@@ -4385,8 +4575,10 @@ guess_got_query_key(enum udp_ping_ret type,
 
 	gq = guess_is_alive(ctx->gid);
 	if (NULL == gq) {
-		if (UDP_PING_EXPIRED == type || UDP_PING_TIMEDOUT == type || t != NULL)
+		if (UDP_PING_EXPIRED == type || UDP_PING_TIMEDOUT == type || t != NULL) {
+			guess_qk_request_done(host);
 			guess_qk_context_free(ctx);
+		}
 		return;
 	}
 
@@ -4435,6 +4627,7 @@ guess_got_query_key(enum udp_ping_ret type,
 						nid_to_string(&gq->gid), gnet_host_to_string(host));
 				}
 				guess_alien_host(gq, host, FALSE);
+				guess_qk_request_done(host);
 				guess_qk_context_free(ctx);
 				goto no_query_key;
 			}
@@ -4456,8 +4649,8 @@ guess_got_query_key(enum udp_ping_ret type,
 		/* FALL THROUGH */
 
 	case UDP_PING_EXPIRED:
+		guess_qk_request_done(host);
 		guess_qk_context_free(ctx);
-		aging_remove(guess_qk_reqs, host);
 		goto no_query_key;
 
 	case UDP_PING_REPLY:
@@ -4515,8 +4708,8 @@ guess_got_query_key(enum udp_ping_ret type,
 			}
 		}
 		if (g2) {
+			guess_qk_request_done(host);
 			guess_qk_context_free(ctx);		/* No further reply expected */
-			aging_remove(guess_qk_reqs, host);
 		} else
 			guess_extract_ipp(gq, n, host);
 		break;
@@ -4786,6 +4979,16 @@ guess_send(guess_t *gq, const gnet_host_t *host)
 		struct guess_qk_context *ctx;
 		bool intro = settings_is_ultra();
 
+		/*
+		 * If another query (or the background discovery) is already
+		 * requesting the key from that host, wait for the outcome.
+		 */
+
+		if (aging_lookup(guess_qk_reqs, host)) {
+			guess_qk_wait(gq, host);
+			return TRUE;
+		}
+
 		WALLOC(ctx);
 		ctx->magic = GUESS_QK_MAGIC;
 		ctx->gid = gq->gid;
@@ -5891,6 +6094,7 @@ guess_init(void)
 	pending = htable_create_any(guess_rpc_key_hash, NULL, guess_rpc_key_eq);
 	guess_qk_reqs = aging_make(GUESS_QK_FREQ,
 		gnet_host_hash, gnet_host_equal, gnet_host_free_atom2);
+	guess_qk_waiters = htable_create_any(gnet_host_hash, NULL, gnet_host_equal);
 	guess_alien = aging_make(GUESS_ALIEN_FREQ,
 		gnet_host_hash, gnet_host_equal, gnet_host_free_atom2);
 	guess_old_muids =
@@ -5956,6 +6160,11 @@ guess_close(void)
 	hikset_free_null(&gmuid);
 	htable_free_null(&pending);
 	aging_destroy(&guess_qk_reqs);
+	cq_cancel(&guess_qk_release_ev);
+	htable_foreach(guess_qk_waiters, guess_qk_waiters_free_kv, NULL);
+	htable_free_null(&guess_qk_waiters);
+	PSLIST_FOREACH_CALL(guess_qk_ready, gnet_host_free_atom);
+	pslist_free_null(&guess_qk_ready);
 	aging_destroy(&guess_alien);
 	aging_destroy(&guess_old_muids);
 	ripening_destroy(&guess_deferred);
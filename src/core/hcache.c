@@ -35,6 +35,11 @@
  * @author Raphael Manfredi
  * @date 2011
  *
+ * The host caches are only ever accessed from the main thread, which owns
+ * them: no locking is needed, and their updates drive property callbacks.
+ * Another thread wishing to query them must do so via teq_safe_rpc() to
+ * the main thread.
+ *
  * @todo
  * TODO:
  *
@@ -66,11 +71,11 @@
 #include "lib/file.h"
 #include "lib/getdate.h"
 #include "lib/hashlist.h"
-#include "lib/hset.h"
 #include "lib/htable.h"
 #include "lib/path.h"
 #include "lib/random.h"
 #include "lib/stringify.h"
+#include "lib/thread.h"
 #include "lib/timestamp.h"
 #include "lib/tm.h"
 #include "lib/vmm.h"
@@ -113,6 +118,7 @@ typedef struct hostcache {
 
     bool        	addr_only;			/**< Use IP only, port always 0 */
     bool			dirty;     	      	/**< If updated since last disk flush */
+    bool			far_only;			/**< No nearby host seen at last scan */
     hash_list_t *   hostlist;           /**< Host list: IP/Port  */
 
     uint			hits;               /**< Hits to the cache */
@@ -532,6 +538,8 @@ hcache_move_entries(hostcache_t *to, hostcache_t *from)
 	hash_list_free(&to->hostlist);
     to->hostlist = from->hostlist;
     from->hostlist = hash_list_new(NULL, NULL);
+	to->far_only = from->far_only;
+	from->far_only = FALSE;
 
     /*
      * Make sure that after switching hce->list points to the new
@@ -782,6 +790,7 @@ hcache_add_internal(hcache_type_t type, time_t added,
 
 	g_assert(UNSIGNED(type) < HCACHE_MAX);
 	g_assert(type != HCACHE_NONE);
+	g_assert(thread_is_main());
 
 	if (GNET_PROPERTY(stop_host_get))
 		return FALSE;
@@ -980,6 +989,7 @@ hcache_add_internal(hcache_type_t type, time_t added,
 
 		hash_list_prepend(hc->hostlist, host);
 		caches[hce->type]->dirty = hc->dirty = TRUE;
+		hc->far_only = FALSE;
 
 		hce->type = type;
 		hce->time_added = added;
@@ -1032,6 +1042,7 @@ hcache_add_internal(hcache_type_t type, time_t added,
 
     hc->misses++;
 	hc->dirty = TRUE;
+	hc->far_only = FALSE;
 
     if (hc->mass_update == 0)
 		gnet_prop_incr_guint32(hc->hosts_in_catcher);
@@ -1495,10 +1506,10 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 	int i;
 	hostcache_t *hc = NULL;
 	hostcache_t *hc2 = NULL;
-	hset_t *seen_host =
-		hset_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
 	hash_list_iter_t *iter;
 
+	g_assert(thread_is_main());
+
     switch (type) {
     case HOST_ANY:
 		switch (net) {
@@ -1577,26 +1588,30 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 
 	/*
 	 * We first try to fill IPv6 addresses, or IPv4 if they only want that.
+	 *
+	 * There is no need to keep track of the hosts we already filled in:
+	 * a host appears only once in a given cache, and when we have an
+	 * alternate cache, it holds hosts from the other address family.
+	 * This routine is called for every handshake and every GUESS query,
+	 * so avoiding the creation of a transient set here matters.
 	 */
 
+	g_assert(NULL == hc2 || hc2->class == hc->class);
+
 	iter = hash_list_iterator(hc->hostlist);
-	for (i = 0; i < hcount; /* empty */) {
+	for (i = 0; i < hcount; i++) {
 		gnet_host_t *h;
 
 		h = hash_list_iter_next(iter);
 		if (NULL == h)
 			break;
 
-		if (hset_contains(seen_host, h))
-			continue;
-
 		/*
 		 * Cannot do a struct copy, the host atom may be shorter than
 		 * the structure when holding an IPv4 address.
 		 */
 
 		gnet_host_copy(&hosts[i], h);
-		hset_insert(seen_host, &hosts[i++]);
 	}
 	hash_list_iter_release(&iter);
 
@@ -1606,7 +1621,7 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 	 */
 
 	if (NULL == hc2 || i == hcount)
-		goto done;
+		return i;
 
 	iter = hash_list_iterator(hc2->hostlist);
 	while (i < hcount) {
@@ -1616,22 +1631,10 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 		if (NULL == h)
 			break;
 
-		if (hset_contains(seen_host, h))
-			continue;
-
-		/*
-		 * Cannot do a struct copy, the host atom may be shorter than
-		 * the structure when holding an IPv4 address.
-		 */
-
-		gnet_host_copy(&hosts[i], h);
-		hset_insert(seen_host, &hosts[i++]);
+		gnet_host_copy(&hosts[i++], h);
 	}
 	hash_list_iter_release(&iter);
 
-done:
-	hset_free_null(&seen_host);	/* Keys point into vector */
-
 	return i;				/* Amount of hosts we filled */
 }
 
@@ -1648,6 +1651,8 @@ hcache_find_nearby(host_type_t type, host_addr_t *addr, uint16 *port)
 	hostcache_t *hc = NULL;
 	hash_list_iter_t *iter;
 
+	g_assert(thread_is_main());
+
     switch (type) {
     case HOST_ANY:
         hc = caches[HCACHE_FRESH_ANY];
@@ -1674,6 +1679,16 @@ hcache_find_nearby(host_type_t type, host_addr_t *addr, uint16 *port)
 	if (!hc)
         g_error("%s: unknown host type: %d", G_STRFUNC, type);
 
+	/*
+	 * Removing hosts cannot make a nearby host appear in the list, so if
+	 * the last scan did not find any, there is no need to walk the whole
+	 * list again until a new host gets added to this cache or the local
+	 * networks are re-configured.
+	 */
+
+	if (hc->far_only)
+		return FALSE;
+
 	/* iterate through whole list */
 
 	iter = hash_list_iterator(hc->hostlist);
@@ -1690,9 +1705,28 @@ hcache_find_nearby(host_type_t type, host_addr_t *addr, uint16 *port)
 		hcache_unlink_host(hc, h);
 		return TRUE;
 	}
+
+	hc->far_only = TRUE;
 	return FALSE;
 }
 
+/**
+ * Signals that the definition of local networks changed.
+ *
+ * This invalidates the knowledge we had about the absence of nearby hosts
+ * in the caches, forcing hcache_find_nearby() to scan them again.
+ */
+void
+hcache_netmasks_changed(void)
+{
+	uint i;
+
+	for (i = 0; i < HCACHE_MAX; i++) {
+		if (caches[i] != NULL)
+			caches[i]->far_only = FALSE;
+	}
+}
+
 /**
  * Sorting callback, by decreading added time.
  */
@@ -1754,6 +1788,7 @@ hcache_get_caught(host_type_t type, host_addr_t *addr, uint16 *port)
 
 	g_assert(addr);
 	g_assert(port);
+	g_assert(thread_is_main());
 
 	*addr = zero_host_addr;
 	*port = 0;
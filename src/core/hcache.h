@@ -89,6 +89,7 @@ int hcache_fill_caught_array(
 bool hcache_get_caught(host_type_t type, host_addr_t *addr, uint16 *port);
 bool hcache_find_nearby(host_type_t type,
 	host_addr_t *addr, uint16 *port);
+void hcache_netmasks_changed(void);
 
 #endif /* _core_hcache_h_ */
 
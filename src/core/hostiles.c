@@ -61,6 +61,7 @@
 #include "lib/random.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/walloc.h"
 #include "lib/watcher.h"
@@ -86,6 +87,17 @@ static const char * const hostiles_what[NUM_HOSTILES] = {
 
 static struct iprange_db *hostile_db[NUM_HOSTILES];	/**< The hostile database */
 
+/**
+ * Databases parsed by hostiles_parse(), until hostiles_retrieve_all()
+ * installs them.
+ */
+static struct hostiles_parsed {
+	struct iprange_db *db;	/**< Parsed database, NULL if no file found */
+	char *pathname;			/**< File it was read from (halloc()'ed) */
+} hostiles_parsed[NUM_HOSTILES];
+
+static bool hostiles_parse_done;	/**< Whether hostiles_parse() was run */
+
 /**
  * Hostile addresses dynamically collected at runtime for duration of a
  * session. If the hashtable reaches a certain size, we could create
@@ -278,9 +290,9 @@ hostiles_close_one(hostiles_t which)
 /**
  * Load hostile data from the supplied FILE.
  *
- * @returns the amount of entries loaded.
+ * @returns a new database holding the entries loaded.
  */
-static int
+static struct iprange_db *
 hostiles_load(FILE *f, hostiles_t which)
 {
 	char line[1024];
@@ -288,11 +300,11 @@ hostiles_load(FILE *f, hostiles_t which)
 	int linenum = 0;
 	int bits;
 	iprange_err_t error;
+	struct iprange_db *db;
 
 	g_assert(UNSIGNED(which) < NUM_HOSTILES);
-	g_assert(NULL == hostile_db[which]);
 
-	hostile_db[which] = iprange_new();
+	db = iprange_new();
 
 	while (fgets(line, sizeof(line), f)) {
 		linenum++;
@@ -317,7 +329,7 @@ hostiles_load(FILE *f, hostiles_t which)
 		}
 
 		bits = netmask_to_cidr(netmask);
-		error = iprange_add_cidr(hostile_db[which], ip, bits, 1);
+		error = iprange_add_cidr(db, ip, bits, 1);
 
 		switch (error) {
 		case IPR_ERR_OK:
@@ -333,14 +345,14 @@ hostiles_load(FILE *f, hostiles_t which)
 		}
 	}
 
-	iprange_sync(hostile_db[which]);
+	iprange_sync(db);
 
 	if (GNET_PROPERTY(reload_debug)) {
 		g_debug("loaded %u addresses/netmasks from %s (%u hosts)",
-			iprange_get_item_count(hostile_db[which]), hostiles_what[which],
-			iprange_get_host_count4(hostile_db[which]));
+			iprange_get_item_count(db), hostiles_what[which],
+			iprange_get_host_count4(db));
 	}
-	return iprange_get_item_count(hostile_db[which]);
+	return db;
 }
 
 /**
@@ -363,7 +375,8 @@ hostiles_changed(const char *filename, void *udata)
 		return;
 
 	hostiles_close_one(which);
-	count = hostiles_load(f, which);
+	hostile_db[which] = hostiles_load(f, which);
+	count = iprange_get_item_count(hostile_db[which]);
 	fclose(f);
 
 	str_bprintf(ARYLEN(buf), "Reloaded %d hostile IP addresses.", count);
@@ -372,25 +385,8 @@ hostiles_changed(const char *filename, void *udata)
 	node_kill_hostiles();
 }
 
-static void
-hostiles_retrieve_from_file(FILE *f, hostiles_t which,
-	const char *path, const char *filename)
-{
-	char *pathname;
-
-	g_assert(f);
-	g_assert(path);
-	g_assert(filename);
-	g_assert(UNSIGNED(which) < NUM_HOSTILES);
-
-	pathname = make_pathname(path, filename);
-	watcher_register(pathname, hostiles_changed, GUINT_TO_POINTER(which));
-	HFREE_NULL(pathname);
-	hostiles_load(f, which);
-}
-
 /**
- * Loads the hostiles.txt into memory.
+ * Parses the hostiles.txt file.
  *
  * Choosing the first file we find among the several places we look at,
  * typically:
@@ -399,59 +395,90 @@ hostiles_retrieve_from_file(FILE *f, hostiles_t which,
  *	-# /usr/share/gtk-gnutella/hostiles.txt
  *	-# /home/src/gtk-gnutella/hostiles.txt
  *
- * The selected file will then be monitored and a reloading will occur
- * shortly after a modification.
+ * This only reads the file and does not touch any shared state.
+ *
+ * @param which		which hostiles file to parse
+ * @param pathname	where the pathname of the selected file is returned
+ *
+ * @return the parsed database, NULL if no file was found.
  */
-static void G_COLD
-hostiles_retrieve(hostiles_t which)
+static struct iprange_db * G_COLD
+hostiles_parse_one(hostiles_t which, char **pathname)
 {
+	file_path_t fp[3];
+	FILE *f;
+	int idx;
+	uint length;
+	struct iprange_db *db;
+
 	g_assert(UNSIGNED(which) < NUM_HOSTILES);
 
 	switch (which) {
 	case HOSTILE_PRIVATE:
-		{
-			FILE *f;
-			int idx;
-			file_path_t fp_private[1];
-
-			file_path_set(&fp_private[0], settings_config_dir(), hostiles_file);
-			f = file_config_open_read_norename_chosen(
-					hostiles_what[HOSTILE_PRIVATE],
-					fp_private, N_ITEMS(fp_private), &idx);
-
-			if (f) {
-				hostiles_retrieve_from_file(f, HOSTILE_PRIVATE,
-					fp_private[idx].dir, fp_private[idx].name);
-				fclose(f);
-			}
-		}
+		file_path_set(&fp[0], settings_config_dir(), hostiles_file);
+		length = 1;
 		break;
-
 	case HOSTILE_GLOBAL:
-		{
-			file_path_t fp[3];
-			FILE *f;
-			int idx;
-			uint length;
+		length = settings_file_path_load(fp, hostiles_file, SFP_NO_CONFIG);
+		break;
+	default:
+		g_assert_not_reached();
+	}
 
-			length = settings_file_path_load(fp, hostiles_file, SFP_NO_CONFIG);
+	g_assert(length <= N_ITEMS(fp));
 
-			g_assert(length <= N_ITEMS(fp));
+	f = file_config_open_read_norename_chosen(
+			hostiles_what[which], fp, length, &idx);
 
-			f = file_config_open_read_norename_chosen(
-					hostiles_what[HOSTILE_GLOBAL], fp, length, &idx);
+	if (NULL == f) {
+		*pathname = NULL;
+		return NULL;
+	}
 
-			if (f) {
-				hostiles_retrieve_from_file(f,
-				HOSTILE_GLOBAL, fp[idx].dir, fp[idx].name);
-				fclose(f);
-			}
-		}
-		break;
+	*pathname = make_pathname(fp[idx].dir, fp[idx].name);
+	db = hostiles_load(f, which);
+	fclose(f);
 
-	case NUM_HOSTILES:
-		g_assert_not_reached();
-	}
+	return db;
+}
+
+/**
+ * Install a parsed hostiles database.
+ *
+ * The selected file will then be monitored and a reloading will occur
+ * shortly after a modification.
+ *
+ * @param which		which hostiles file was parsed
+ * @param db		the parsed database, NULL if no file was found
+ * @param pathname	the file it was read from, freed
+ */
+static void
+hostiles_install(hostiles_t which, struct iprange_db *db, char **pathname)
+{
+	g_assert(UNSIGNED(which) < NUM_HOSTILES);
+	g_assert(thread_is_main());
+
+	if (NULL == db)
+		return;
+
+	watcher_register(*pathname, hostiles_changed, GUINT_TO_POINTER(which));
+	HFREE_NULL(*pathname);
+
+	hostiles_close_one(which);
+	hostile_db[which] = db;
+}
+
+/**
+ * Loads the hostiles.txt into memory.
+ */
+static void G_COLD
+hostiles_retrieve(hostiles_t which)
+{
+	struct iprange_db *db;
+	char *pathname;
+
+	db = hostiles_parse_one(which, &pathname);
+	hostiles_install(which, db, &pathname);
 }
 
 /**
@@ -1143,7 +1170,9 @@ hostiles_ipv6_eq(const void *a, const void *b)
 }
 
 /**
- * Called on startup. Loads the hostiles.txt into memory.
+ * Called on startup. Sets up the hostile databases.
+ *
+ * The hostiles.txt files are loaded by hostiles_retrieve_all().
  */
 void G_COLD
 hostiles_init(void)
@@ -1171,9 +1200,52 @@ hostiles_init(void)
 
 	cq_periodic_main_add(
 		HOSTILES_DYNAMIC_PERIOD_MS, hostiles_dynamic_timer, NULL);
-	hostiles_retrieve(HOSTILE_PRIVATE);
     gnet_prop_add_prop_changed_listener(PROP_USE_GLOBAL_HOSTILES_TXT,
-		use_global_hostiles_txt_changed, TRUE);
+		use_global_hostiles_txt_changed, FALSE);
+}
+
+/**
+ * Called on startup. Parses the hostiles.txt files, leaving the databases
+ * for hostiles_retrieve_all() to install.
+ *
+ * This only reads files and can therefore be run by a separate thread.
+ */
+void G_COLD
+hostiles_parse(void)
+{
+	struct hostiles_parsed *hp = hostiles_parsed;
+
+	g_assert(!hostiles_parse_done);
+
+	hp[HOSTILE_PRIVATE].db =
+		hostiles_parse_one(HOSTILE_PRIVATE, &hp[HOSTILE_PRIVATE].pathname);
+
+	if (GNET_PROPERTY(use_global_hostiles_txt)) {
+		hp[HOSTILE_GLOBAL].db =
+			hostiles_parse_one(HOSTILE_GLOBAL, &hp[HOSTILE_GLOBAL].pathname);
+	}
+
+	hostiles_parse_done = TRUE;
+}
+
+/**
+ * Called on startup, after hostiles_init(). Installs the hostiles.txt
+ * databases parsed by hostiles_parse(), parsing them now if not done yet.
+ */
+void G_COLD
+hostiles_retrieve_all(void)
+{
+	uint i;
+
+	if (!hostiles_parse_done)
+		hostiles_parse();
+
+	for (i = 0; i < NUM_HOSTILES; i++) {
+		struct hostiles_parsed *hp = &hostiles_parsed[i];
+
+		hostiles_install(i, hp->db, &hp->pathname);
+		hp->db = NULL;
+	}
 }
 
 /**
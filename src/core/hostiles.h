@@ -76,6 +76,8 @@ typedef enum hostiles_flags {
 const char *hostiles_flags_to_string(const hostiles_flags_t flags);
 
 void hostiles_init(void);
+void hostiles_parse(void);
+void hostiles_retrieve_all(void);
 void hostiles_close(void);
 
 hostiles_flags_t hostiles_check(const host_addr_t addr);
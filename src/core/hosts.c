@@ -36,6 +36,7 @@
 #include "hosts.h"
 #include "bogons.h"
 #include "gmsg.h"
+#include "hcache.h"
 #include "hostiles.h"
 #include "nodes.h"
 #include "pcache.h"
@@ -496,6 +497,7 @@ parse_netmasks(const char *str)
 	int i;
 
 	free_networks();
+	hcache_netmasks_changed();
 
 	if (!masks)
 		return;
@@ -54,19 +54,26 @@
 
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/compat_pio.h"
 #include "lib/cq.h"
+#include "lib/crc.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/gnet_host.h"
 #include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/hstrfn.h"
+#include "lib/iovec.h"
 #include "lib/parse.h"
 #include "lib/pattern.h"
 #include "lib/sha1.h"
 #include "lib/stringify.h"
 #include "lib/tm.h"
 #include "lib/urn.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 
 #include "if/gnet_property.h"
@@ -74,11 +81,38 @@
 
 #include "lib/override.h"		/* Must be the last header included */
 
-#define HUGE_SHA1_CACHE_FREQ	60	/* seconds, for SHA1 cache dumps */
+#define HUGE_SHA1_CACHE_FREQ	60	/* seconds, for SHA1 cache compactions */
+
+#define HUGE_CACHE_FILE		"sha1_cache.bin"	/**< Binary cache */
+#define HUGE_CACHE_TEXT		"sha1_cache"		/**< Text import / export */
+#define HUGE_CACHE_MAGIC	"GSHA1BIN"	/**< Binary cache header magic */
+#define HUGE_CACHE_MAGIC_LEN	8
+#define HUGE_CACHE_VERSION	1			/**< Binary cache format version */
+#define HUGE_CACHE_HDR		32			/**< Magic, version, text stamp */
+#define HUGE_HDR_TEXT_MTIME	16			/**< 64-bit mtime of text cache */
+#define HUGE_HDR_TEXT_SIZE	24			/**< 64-bit size of text cache */
+#define HUGE_CACHE_SLACK	1024		/**< Obsolete records we always allow */
+
+/*
+ * Layout of a binary cache record, all numbers being little-endian.
+ * The fixed part is immediately followed by the file name, without any
+ * trailing NUL.  The CRC covers all the record but the CRC itself.
+ */
+#define HUGE_REC_CRC		0			/**< 32-bit CRC */
+#define HUGE_REC_NAMELEN	4			/**< 16-bit file name length */
+#define HUGE_REC_FLAGS		6			/**< 8-bit flags, then 1 unused byte */
+#define HUGE_REC_SIZE		8			/**< 64-bit file size */
+#define HUGE_REC_MTIME		16			/**< 64-bit modification time */
+#define HUGE_REC_SHA1		24			/**< SHA-1, in binary form */
+#define HUGE_REC_TTH		(HUGE_REC_SHA1 + SHA1_RAW_SIZE)	/**< TTH root */
+#define HUGE_RECORD_HDR		(HUGE_REC_TTH + TTH_RAW_SIZE)	/**< Fixed part */
+#define HUGE_RECORD_NAME_MAX	MAX_INT_VAL(uint16)
+
+#define HUGE_REC_F_TTH		(1U << 0)	/**< TTH field is meaningful */
 
 /**
  * There's an in-core cache (the hash table ``sha1_cache''), and a
- * persistent copy (normally in ~/.gtk-gnutella/sha1_cache). The
+ * persistent copy (normally in ~/.gtk-gnutella/sha1_cache.bin). The
  * in-core cache is filled with the persistent one at launch. When the
  * "shared_file" (the records describing the shared files, see
  * share.h) are created, a call is made to sha1_set_digest to fill the
@@ -89,10 +123,23 @@
  * modification time. If they're identical to the ones in the cache,
  * the digest is considered to be accurate, and is used. If the file
  * size or last modification time don't match, the digest is computed
- * again and stored in the in-core cache, but it isn't stored in the
- * persistent one. Instead, the cache is marked as dirty, and will be
- * entirely overwritten by dump_cache, called when everything has been
- * computed.
+ * again, updated in the in-core cache and a new record is appended to
+ * the persistent one, superseding the previous one.
+ *
+ * The persistent cache is a binary file made of checksummed records, which
+ * is memory-mapped and walked at launch: no parsing is needed, and the
+ * existence of the files is not checked either since all the lookups
+ * compare the file size and modification time anyway, and since entries
+ * for files which are no longer shared are pruned after the first library
+ * rescan.  The file is only rewritten when obsolete records take more space
+ * than the live ones.
+ *
+ * The older text format (~/.gtk-gnutella/sha1_cache) is exported on shutdown
+ * when the cache was changed, so that it remains usable by older versions
+ * and external tools.  The size and modification time of the text file are
+ * recorded in the header of the binary cache: when they no longer match at
+ * launch, the text file was changed behind our back (e.g. entries computed
+ * by scripts were appended to it) and it is imported again.
  */
 
 struct sha1_cache_entry {
@@ -108,10 +155,16 @@ struct sha1_cache_entry {
 static hikset_t *sha1_cache;
 
 /**
- * cache_dirty = TRUE means that in-core cache is different from the disk one.
+ * cache_dirty = TRUE means that the exported text cache is out of date.
  */
 static bool cache_dirty;
-static time_t cache_dumped;
+static time_t cache_compacted;
+
+static int cache_fd = -1;			/**< Binary cache, for appending */
+static filesize_t cache_size;		/**< Size of the binary cache */
+static size_t cache_records;		/**< Amount of records in binary cache */
+static time_t text_mtime;			/**< Last known mtime of text cache */
+static filesize_t text_size;		/**< Last known size of text cache */
 
 static cpattern_t *has_http_urls;
 
@@ -159,7 +212,471 @@ add_volatile_cache_entry(const char *filename, filesize_t size, time_t mtime,
 	hikset_insert_key(sha1_cache, &item->file_name);
 }
 
-/* Disk cache */
+/**
+ * Record an entry read from the persistent cache into the in-memory cache,
+ * superseding any previous entry for the same file.
+ */
+static void
+set_volatile_cache_entry(const char *filename, filesize_t size, time_t mtime,
+	const struct sha1 *sha1, const struct tth *tth)
+{
+	struct sha1_cache_entry *cached;
+	const char *atom;
+
+	/*
+	 * Keys are atoms, hence we need one to look for a previous entry.
+	 */
+
+	atom = atom_str_get(filename);
+	cached = hikset_lookup(sha1_cache, atom);
+
+	if (cached != NULL) {
+		cached->size = size;
+		cached->mtime = mtime;
+		atom_sha1_change(&cached->sha1, sha1);
+		atom_tth_change(&cached->tth, tth);
+	} else {
+		add_volatile_cache_entry(atom, size, mtime, sha1, tth, FALSE);
+	}
+
+	atom_str_free(atom);
+}
+
+/**
+ * Free SHA1 cache entry.
+ */
+static void
+cache_free_entry(void *v, void *unused_udata)
+{
+	struct sha1_cache_entry *e = v;
+
+	(void) unused_udata;
+
+	atom_str_free_null(&e->file_name);
+	atom_sha1_free_null(&e->sha1);
+	atom_tth_free_null(&e->tth);
+	WFREE(e);
+}
+
+/* Binary disk cache */
+
+/**
+ * @return the pathname of the binary cache, to be freed with hfree().
+ */
+static char *
+cache_pathname(void)
+{
+	return make_pathname(settings_config_dir(), HUGE_CACHE_FILE);
+}
+
+/**
+ * Fill the fixed part of a binary cache record and compute the checksum
+ * of the whole record.
+ *
+ * @param hdr		where the fixed part of the record is built
+ * @param filename	the file name, which will follow the fixed part
+ * @param namelen	length of the file name
+ */
+static void
+cache_record_fill(char hdr[HUGE_RECORD_HDR],
+	const char *filename, size_t namelen, filesize_t size, time_t mtime,
+	const struct sha1 *sha1, const struct tth *tth)
+{
+	uint32 crc;
+
+	g_assert(namelen <= HUGE_RECORD_NAME_MAX);
+
+	memset(hdr, 0, HUGE_RECORD_HDR);
+	poke_le16(&hdr[HUGE_REC_NAMELEN], namelen);
+	poke_le64(&hdr[HUGE_REC_SIZE], size);
+	poke_le64(&hdr[HUGE_REC_MTIME], mtime);
+	memcpy(&hdr[HUGE_REC_SHA1], sha1, SHA1_RAW_SIZE);
+
+	if (tth != NULL) {
+		hdr[HUGE_REC_FLAGS] = HUGE_REC_F_TTH;
+		memcpy(&hdr[HUGE_REC_TTH], tth, TTH_RAW_SIZE);
+	}
+
+	crc = crc32_update(-1U,
+		&hdr[HUGE_REC_NAMELEN], HUGE_RECORD_HDR - HUGE_REC_NAMELEN);
+	crc = crc32_update(crc, filename, namelen);
+	poke_le32(&hdr[HUGE_REC_CRC], crc);
+}
+
+/**
+ * @return whether obsolete records take more space than live ones in the
+ * binary cache, warranting a rewrite.
+ */
+static bool
+cache_needs_compaction(void)
+{
+	size_t live = hikset_count(sha1_cache);
+
+	if (cache_records <= live)
+		return FALSE;
+
+	return cache_records - live > MAX(live, HUGE_CACHE_SLACK);
+}
+
+static void cache_compact_schedule(void);
+
+/**
+ * Append a record to the binary cache, superseding any previous record
+ * for the same file.
+ */
+static void
+cache_record_append(const char *filename, filesize_t size,
+	time_t mtime, const struct sha1 *sha1, const struct tth *tth)
+{
+	char hdr[HUGE_RECORD_HDR];
+	size_t namelen = strlen(filename);
+	iovec_t iov[2];
+	ssize_t r;
+
+	if (-1 == cache_fd)
+		return;
+
+	if G_UNLIKELY(namelen > HUGE_RECORD_NAME_MAX) {
+		g_warning("%s(): file name too long to be cached: \"%s\"",
+			G_STRFUNC, filename);
+		return;
+	}
+
+	cache_record_fill(hdr, filename, namelen, size, mtime, sha1, tth);
+
+	iov[0] = iov_get(ARYLEN(hdr));
+	iov[1] = iov_get(deconstify_pointer(filename), namelen);
+
+	r = compat_pwritev(cache_fd, iov, N_ITEMS(iov), cache_size);
+
+	if ((ssize_t) (sizeof hdr + namelen) != r) {
+		if ((ssize_t) -1 == r)
+			g_warning("%s(): cannot append to SHA-1 cache: %m", G_STRFUNC);
+		else
+			g_warning("%s(): incomplete write to SHA-1 cache", G_STRFUNC);
+		if (-1 == ftruncate(cache_fd, cache_size))
+			g_warning("%s(): cannot truncate SHA-1 cache: %m", G_STRFUNC);
+		return;
+	}
+
+	cache_size += r;
+	cache_records++;
+	cache_dirty = TRUE;
+
+	if (cache_needs_compaction())
+		cache_compact_schedule();
+}
+
+struct cache_rewrite_context {
+	FILE *f;
+	filesize_t size;
+	size_t records;
+	bool failed;
+};
+
+/**
+ * Write one (in-memory) cache entry to the new binary cache.  This is a
+ * callback called by cache_rewrite().
+ */
+static void
+cache_rewrite_one_entry(void *value, void *udata)
+{
+	const struct sha1_cache_entry *e = value;
+	struct cache_rewrite_context *ctx = udata;
+	char hdr[HUGE_RECORD_HDR];
+	size_t namelen = strlen(e->file_name);
+
+	if G_UNLIKELY(namelen > HUGE_RECORD_NAME_MAX || ctx->failed)
+		return;
+
+	cache_record_fill(hdr, e->file_name, namelen,
+		e->size, e->mtime, e->sha1, e->tth);
+
+	if (
+		1 != fwrite(ARYLEN(hdr), 1, ctx->f) ||
+		1 != fwrite(e->file_name, namelen, 1, ctx->f)
+	) {
+		ctx->failed = TRUE;
+		return;
+	}
+
+	ctx->size += sizeof hdr + namelen;
+	ctx->records++;
+}
+
+/**
+ * Rewrite the whole binary cache from the in-memory cache, then re-open it
+ * for appending.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+cache_rewrite(void)
+{
+	struct cache_rewrite_context ctx;
+	char hdr[HUGE_CACHE_HDR];
+	char *path, *tmp;
+	bool ok = FALSE;
+
+	path = cache_pathname();
+	tmp = h_strconcat(path, ".new", NULL_PTR);
+
+	ctx.f = file_fopen(tmp, "wb");
+	if (NULL == ctx.f)
+		goto done;
+
+	ZERO(&hdr);
+	memcpy(hdr, HUGE_CACHE_MAGIC, HUGE_CACHE_MAGIC_LEN);
+	poke_le32(&hdr[HUGE_CACHE_MAGIC_LEN], HUGE_CACHE_VERSION);
+	poke_le64(&hdr[HUGE_HDR_TEXT_MTIME], text_mtime);
+	poke_le64(&hdr[HUGE_HDR_TEXT_SIZE], text_size);
+	ctx.failed = 1 != fwrite(ARYLEN(hdr), 1, ctx.f);
+	ctx.size = sizeof hdr;
+	ctx.records = 0;
+	hikset_foreach(sha1_cache, cache_rewrite_one_entry, &ctx);
+
+	if (ctx.failed) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, tmp);
+		fclose(ctx.f);
+		unlink(tmp);
+		goto done;
+	}
+
+	if (0 != file_sync_fclose(ctx.f)) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, tmp);
+		unlink(tmp);
+		goto done;
+	}
+
+	if (-1 == rename(tmp, path)) {
+		g_warning("%s(): cannot rename %s as %s: %m", G_STRFUNC, tmp, path);
+		unlink(tmp);
+		goto done;
+	}
+
+	fd_forget_and_close(&cache_fd);
+	cache_fd = file_open(path, O_RDWR, 0);
+	cache_size = ctx.size;
+	cache_records = ctx.records;
+	ok = TRUE;
+
+done:
+	/*
+	 * Update the timestamp even on failure to avoid that we retry this
+	 * too frequently.
+	 */
+
+	cache_compacted = tm_time();
+
+	HFREE_NULL(tmp);
+	HFREE_NULL(path);
+	return ok;
+}
+
+/**
+ * Load one binary cache record into the in-memory cache.
+ *
+ * @param rec		the record, which has been validated
+ * @param name		the NUL-terminated file name held in the record
+ */
+static void
+cache_record_load(const char *rec, const char *name)
+{
+	struct sha1 sha1;
+	struct tth tth;
+	const struct tth *tthp = NULL;
+
+	memcpy(&sha1, &rec[HUGE_REC_SHA1], SHA1_RAW_SIZE);
+	if (rec[HUGE_REC_FLAGS] & HUGE_REC_F_TTH) {
+		memcpy(&tth, &rec[HUGE_REC_TTH], TTH_RAW_SIZE);
+		tthp = &tth;
+	}
+
+	set_volatile_cache_entry(name, peek_le64(&rec[HUGE_REC_SIZE]),
+		peek_le64(&rec[HUGE_REC_MTIME]), &sha1, tthp);
+}
+
+/**
+ * Load the binary cache into memory.
+ *
+ * The file is mapped and its records are walked in the order in which they
+ * were appended, later records superseding earlier ones.  A torn or corrupted
+ * record, which can result from a crash, is truncated along with what follows.
+ *
+ * @return TRUE if the cache was loaded, FALSE if it is missing or unusable.
+ */
+static bool G_COLD
+cache_load(void)
+{
+	char *path, *name = NULL, *buf = NULL;
+	const char *base = NULL;
+	size_t size = 0, namesize = 0, offset, records = 0;
+	filestat_t sb;
+	bool ok = FALSE;
+	int fd;
+
+	path = cache_pathname();
+	fd = file_open_missing(path, O_RDWR);
+
+	if (fd < 0)
+		goto done;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat %s: %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	if (
+		sb.st_size < HUGE_CACHE_HDR ||
+		UNSIGNED(sb.st_size) != (size_t) sb.st_size
+	)
+		goto invalid;
+
+	size = sb.st_size;
+
+#ifdef HAS_MMAP
+	{
+		void *p = vmm_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (MAP_FAILED != p)
+			base = p;
+	}
+#endif	/* HAS_MMAP */
+
+	if (NULL == base) {
+		buf = halloc(size);
+		if ((ssize_t) size != compat_pread(fd, buf, size, 0)) {
+			g_warning("%s(): cannot read %s: %m", G_STRFUNC, path);
+			goto done;
+		}
+		base = buf;
+	}
+
+	if (
+		0 != memcmp(base, HUGE_CACHE_MAGIC, HUGE_CACHE_MAGIC_LEN) ||
+		HUGE_CACHE_VERSION != peek_le32(&base[HUGE_CACHE_MAGIC_LEN])
+	)
+		goto invalid;
+
+	text_mtime = peek_le64(&base[HUGE_HDR_TEXT_MTIME]);
+	text_size = peek_le64(&base[HUGE_HDR_TEXT_SIZE]);
+	offset = HUGE_CACHE_HDR;
+
+	while (size - offset >= HUGE_RECORD_HDR) {
+		const char *rec = &base[offset];
+		size_t namelen = peek_le16(&rec[HUGE_REC_NAMELEN]);
+		uint32 crc;
+
+		if (0 == namelen || size - offset - HUGE_RECORD_HDR < namelen)
+			break;
+
+		crc = crc32_update(-1U, &rec[HUGE_REC_NAMELEN],
+			HUGE_RECORD_HDR - HUGE_REC_NAMELEN + namelen);
+
+		if (crc != peek_le32(&rec[HUGE_REC_CRC]))
+			break;
+
+		if (namelen >= namesize) {
+			namesize = namelen + 1;
+			HREALLOC_ARRAY(name, namesize);
+		}
+
+		memcpy(name, &rec[HUGE_RECORD_HDR], namelen);
+		name[namelen] = '\0';
+
+		cache_record_load(rec, name);
+
+		offset += HUGE_RECORD_HDR + namelen;
+		records++;
+	}
+
+	if (offset < size) {
+		g_warning("%s(): truncating SHA-1 cache at %zu (was %zu)",
+			G_STRFUNC, offset, size);
+		if (-1 == ftruncate(fd, offset))
+			g_warning("%s(): cannot truncate %s: %m", G_STRFUNC, path);
+	}
+
+	cache_fd = fd;
+	cache_size = offset;
+	cache_records = records;
+	fd = -1;
+	ok = TRUE;
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_info("%s(): loaded %zu entr%s from %zu record%s",
+			G_STRFUNC, hikset_count(sha1_cache),
+			plural_y(hikset_count(sha1_cache)), records, plural(records));
+	}
+
+	goto done;
+
+invalid:
+	g_warning("%s(): ignoring invalid SHA-1 cache %s", G_STRFUNC, path);
+
+	/* FALL THROUGH */
+
+done:
+#ifdef HAS_MMAP
+	if (base != NULL && NULL == buf)
+		vmm_munmap(deconstify_pointer(base), size);
+#endif	/* HAS_MMAP */
+
+	fd_close(&fd);
+	HFREE_NULL(buf);
+	HFREE_NULL(name);
+	HFREE_NULL(path);
+	return ok;
+}
+
+/* Text disk cache, for import and export */
+
+/**
+ * Check whether the text cache differs from the one we last exported or
+ * imported, recording its current size and modification time.
+ *
+ * @return TRUE if the text cache exists and was changed.
+ */
+static bool
+cache_text_changed(void)
+{
+	filestat_t sb;
+	char *path;
+	bool changed = FALSE;
+
+	path = make_pathname(settings_config_dir(), HUGE_CACHE_TEXT);
+
+	if (
+		0 == stat(path, &sb) &&
+		(sb.st_mtime != text_mtime || UNSIGNED(sb.st_size) != text_size)
+	) {
+		text_mtime = sb.st_mtime;
+		text_size = sb.st_size;
+		changed = TRUE;
+	}
+
+	HFREE_NULL(path);
+	return changed;
+}
+
+/**
+ * Record the current size and modification time of the text cache in the
+ * header of the binary cache, after we exported it.
+ */
+static void
+cache_text_stamp(void)
+{
+	char buf[16];
+
+	if (-1 == cache_fd || !cache_text_changed())
+		return;
+
+	poke_le64(&buf[0], text_mtime);
+	poke_le64(&buf[8], text_size);
+
+	if (sizeof buf != compat_pwrite(cache_fd, ARYLEN(buf), HUGE_HDR_TEXT_MTIME))
+		g_warning("%s(): cannot update SHA-1 cache header: %m", G_STRFUNC);
+}
 
 static const char sha1_persistent_cache_file_header[] =
 "#\n"
@@ -190,91 +707,44 @@ cache_entry_print(FILE *f, const char *filename,
 }
 
 /**
- * Add an entry to the persistent cache.
- */
-static void
-add_persistent_cache_entry(const char *filename, filesize_t size,
-	time_t mtime, const struct sha1 *sha1, const struct tth *tth)
-{
-	char *pathname;
-	FILE *f;
-
-	pathname = make_pathname(settings_config_dir(), "sha1_cache");
-	f = file_fopen(pathname, "a");
-	if (f) {
-		filestat_t sb;
-
-		/*
-		 * If we're adding the very first entry (file empty), then emit header.
-		 */
-
-		if (fstat(fileno(f), &sb)) {
-			g_warning("%s(): could not stat \"%s\": %m", G_STRFUNC, pathname);
-		} else {
-			if (0 == sb.st_size) {
-				fputs(sha1_persistent_cache_file_header, f);
-			}
-			cache_entry_print(f, filename, sha1, tth, size, mtime);
-		}
-		fclose(f);
-	} else {
-		g_warning("%s(): could not open \"%s\": %m", G_STRFUNC, pathname);
-	}
-	HFREE_NULL(pathname);
-}
-
-struct dump_cache_context {
-	FILE *f;
-	bool forced;
-};
-
-/**
- * Dump one (in-memory) cache into the persistent cache. This is a callback
+ * Dump one (in-memory) cache into the text cache. This is a callback
  * called by dump_cache to dump the whole in-memory cache onto disk.
  */
 static void
 dump_cache_one_entry(void *value, void *udata)
 {
 	struct sha1_cache_entry *e = value;
-	struct dump_cache_context *ctx = udata;
+	FILE *f = udata;
 
-	if (ctx->forced || e->shared) {
-		cache_entry_print(ctx->f,
-			e->file_name, e->sha1, e->tth, e->size, e->mtime);
-	}
+	cache_entry_print(f, e->file_name, e->sha1, e->tth, e->size, e->mtime);
 }
 
 /**
- * Dump the whole in-memory cache onto disk.
+ * Export the whole in-memory cache into the text cache, if it changed.
+ *
+ * @return TRUE if the text cache was written.
  */
-static void
-dump_cache(bool force)
+static bool
+dump_cache(void)
 {
 	FILE *f;
 	file_path_t fp;
 
-	if (!force && !cache_dirty)
-		return;
+	if (!cache_dirty)
+		return FALSE;
 
-	file_path_set(&fp, settings_config_dir(), "sha1_cache");
+	file_path_set(&fp, settings_config_dir(), HUGE_CACHE_TEXT);
 	f = file_config_open_write("SHA-1 cache", &fp);
 	if (f) {
-		struct dump_cache_context ctx;
-
 		fputs(sha1_persistent_cache_file_header, f);
-		ctx.f = f;
-		ctx.forced = force;
-		hikset_foreach(sha1_cache, dump_cache_one_entry, &ctx);
+		hikset_foreach(sha1_cache, dump_cache_one_entry, f);
 		if (file_config_close(f, &fp)) {
 			cache_dirty = FALSE;
+			return TRUE;
 		}
 	}
 
-	/*
-	 * Update the timestamp even on failure to avoid that we retry this
-	 * too frequently.
-	 */
-	cache_dumped = tm_time();
+	return FALSE;
 }
 
 /**
@@ -376,8 +846,7 @@ parse_and_append_cache_entry(char *line)
 			return;		/* File was modified */
 	}
 
-	add_volatile_cache_entry(p, size, mtime,
-		&sha1, has_tth ? &tth : NULL, FALSE);
+	set_volatile_cache_entry(p, size, mtime, &sha1, has_tth ? &tth : NULL);
 	return;
 
 failure:
@@ -385,7 +854,7 @@ failure:
 }
 
 /**
- * Read the whole persistent cache into memory.
+ * Import the whole text cache into memory.
  */
 static void G_COLD
 sha1_read_cache(void)
@@ -396,7 +865,7 @@ sha1_read_cache(void)
 
 	g_return_if_fail(settings_config_dir());
 
-	file_path_set(fp, settings_config_dir(), "sha1_cache");
+	file_path_set(fp, settings_config_dir(), HUGE_CACHE_TEXT);
 	f = file_config_open_read("SHA-1 cache", fp, N_ITEMS(fp));
 	if (f) {
 		for (;;) {
@@ -414,7 +883,6 @@ sha1_read_cache(void)
 			}
 		}
 		fclose(f);
-		dump_cache(TRUE);
 	}
 }
 
@@ -436,43 +904,41 @@ huge_spam_check(shared_file_t *sf, const struct sha1 *sha1)
 	return FALSE;
 }
 
-static cevent_t *cache_dump_ev;
+static cevent_t *cache_compact_ev;
 
 /**
- * Callout queue callback invoked when we should flush the SHA1 cache.
+ * Callout queue callback invoked when we should compact the SHA1 cache.
  */
 static void
-cache_dump_due(cqueue_t *cq, void *unused_obj)
+cache_compact_due(cqueue_t *cq, void *unused_obj)
 {
 	(void) unused_obj;
 
-	cq_zero(cq, &cache_dump_ev);	/* Indicates callback fired */
-	dump_cache(FALSE);
+	cq_zero(cq, &cache_compact_ev);	/* Indicates callback fired */
+	cache_rewrite();
 }
 
 /**
- * Dump the cache at most about once per HUGE_SHA1_CACHE_FREQ secs..
+ * Compact the cache at most about once per HUGE_SHA1_CACHE_FREQ secs.
  */
 static void
-cache_dump_schedule(void)
+cache_compact_schedule(void)
 {
 	time_delta_t t;
 
-	cache_dirty = TRUE;
-
-	if G_UNLIKELY(0 == cache_dumped) {
+	if G_UNLIKELY(0 == cache_compacted) {
 		t = 0;
 	} else {
-		t = delta_time(tm_time(), cache_dumped);
+		t = delta_time(tm_time(), cache_compacted);
 		if (t >= HUGE_SHA1_CACHE_FREQ)
 			t = 0;
 		else
 			t = HUGE_SHA1_CACHE_FREQ - t;
 	}
 	if (0 == t) {
-		dump_cache(FALSE);
-	} else if (NULL == cache_dump_ev) {
-		cache_dump_ev = cq_main_insert(t * 1000, cache_dump_due, NULL);
+		cache_rewrite();
+	} else if (NULL == cache_compact_ev) {
+		cache_compact_ev = cq_main_insert(t * 1000, cache_compact_due, NULL);
 	}
 }
 
@@ -537,16 +1003,15 @@ huge_update_hashes(shared_file_t *sf,
 	if (cached) {
 		update_volatile_cache(cached, shared_file_size(sf),
 			shared_file_modification_time(sf), sha1, tth);
-
-		cache_dump_schedule(); 	/* Dump cache once per minute */
 	} else {
 		add_volatile_cache_entry(shared_file_path(sf),
 			shared_file_size(sf), shared_file_modification_time(sf),
 			sha1, tth, TRUE);
-		add_persistent_cache_entry(shared_file_path(sf),
-			shared_file_size(sf), shared_file_modification_time(sf),
-			sha1, tth);
 	}
+
+	cache_record_append(shared_file_path(sf),
+		shared_file_size(sf), shared_file_modification_time(sf), sha1, tth);
+
 	return TRUE;
 }
 
@@ -729,7 +1194,6 @@ request_sha1(shared_file_t *sf)
 	cached = hikset_lookup(sha1_cache, shared_file_path(sf));
 
 	if (cached && cached_entry_up_to_date(cached, sf)) {
-		cache_dirty = TRUE;
 		cached->shared = TRUE;
 		shared_file_set_sha1(sf, cached->sha1);
 		shared_file_set_tth(sf, cached->tth);
@@ -1060,8 +1524,15 @@ huge_sha1_cache_prune(void)
 			G_STRFUNC, pruned, plural_y(pruned));
 	}
 
-	if (pruned != 0)
-		cache_dump_schedule();
+	/*
+	 * Since this is done once per session, get rid of the records of the
+	 * pruned entries right away, or they would be loaded again next time.
+	 */
+
+	if (pruned != 0) {
+		cache_dirty = TRUE;
+		cache_compact_schedule();
+	}
 }
 
 /**
@@ -1070,26 +1541,28 @@ huge_sha1_cache_prune(void)
 void
 huge_init(void)
 {
+	bool loaded;
+
 	sha1_cache = hikset_create(		/* Keys are atoms */
 		offsetof(struct sha1_cache_entry, file_name), HASH_KEY_SELF, 0);
-	sha1_read_cache();
-	has_http_urls = pattern_compile("http://", FALSE);
-}
 
-/**
- * Free SHA1 cache entry.
- */
-static void
-cache_free_entry(void *v, void *unused_udata)
-{
-	struct sha1_cache_entry *e = v;
+	/*
+	 * The text cache is imported over the binary cache when it was changed
+	 * since we last saw it, or when there is no usable binary cache.  The
+	 * binary cache is then rewritten to hold the imported entries.
+	 */
 
-	(void) unused_udata;
+	loaded = cache_load();
 
-	atom_str_free_null(&e->file_name);
-	atom_sha1_free_null(&e->sha1);
-	atom_tth_free_null(&e->tth);
-	WFREE(e);
+	if (cache_text_changed()) {
+		sha1_read_cache();
+		cache_dirty = TRUE;			/* Re-export without obsolete entries */
+		cache_rewrite();
+	} else if (!loaded) {
+		cache_rewrite();
+	}
+
+	has_http_urls = pattern_compile("http://", FALSE);
 }
 
 /**
@@ -1098,7 +1571,14 @@ cache_free_entry(void *v, void *unused_udata)
 void
 huge_close(void)
 {
-	dump_cache(FALSE);
+	if (cache_compact_ev != NULL || cache_needs_compaction())
+		cache_rewrite();
+
+	cq_cancel(&cache_compact_ev);
+
+	if (dump_cache())
+		cache_text_stamp();
+	fd_forget_and_close(&cache_fd);
 
 	hikset_foreach(sha1_cache, cache_free_entry, NULL);
 	hikset_free_null(&sha1_cache);
@@ -59,6 +59,9 @@
 static void mq_tcp_service(void *data);
 static const struct mq_ops mq_tcp_ops;
 
+#define MQ_TCP_LOWAT(m)		((m) >> 2)		/* 25% of max size */
+#define MQ_TCP_HIWAT(m)		((m) >> 1)		/* 50% of max size */
+
 /**
  * Create new message queue capable of holding `maxsize' bytes, and
  * owned by the supplied node.
@@ -84,8 +87,8 @@ mq_tcp_make(int maxsize,
 	q->node = n;
 	q->tx_drv = nd;
 	q->maxsize = maxsize;
-	q->lowat = maxsize >> 2;		/* 25% of max size */
-	q->hiwat = maxsize >> 1;		/* 50% of max size */
+	q->lowat = MQ_TCP_LOWAT(maxsize);
+	q->hiwat = MQ_TCP_HIWAT(maxsize);
 	q->qwait = slist_new();
 	q->ops = &mq_tcp_ops;
 	q->cops = mq_get_cops();
@@ -97,6 +100,33 @@ mq_tcp_make(int maxsize,
 	return q;
 }
 
+/**
+ * Lower the watermarks of the queue by `amount' bytes, to account for data
+ * that the kernel is now allowed to buffer beyond its nominal send buffer.
+ *
+ * This keeps the total amount of data buffered for the node roughly constant
+ * when its socket send buffer is enlarged, so that flow-control still kicks
+ * in at the same point.  The watermarks never drop below half their initial
+ * values, and a zero `amount' restores them.
+ *
+ * The new watermarks are taken into account at the next queue operation.
+ */
+void
+mq_tcp_reserve(mqueue_t *q, int amount)
+{
+	int lowat, hiwat;
+
+	mq_check_consistency(q);
+	g_assert(amount >= 0);
+
+	lowat = MQ_TCP_LOWAT(q->maxsize);
+	hiwat = MQ_TCP_HIWAT(q->maxsize);
+	amount = MIN(amount, lowat / 2);
+
+	q->lowat = lowat - amount;
+	q->hiwat = hiwat - amount;
+}
+
 /**
  * Service routine for TCP message queue.
  */
@@ -195,6 +195,7 @@
 #define NODE_TSYNC_WAIT_MS		5000	/**< Wait time after connecting (5s) */
 #define NODE_TSYNC_PERIOD_MS	300000	/**< Synchronize every 5 minutes */
 #define NODE_TSYNC_CHECK		15		/**< 15 secs before a timeout */
+#define NODE_TCP_INFO_PERIOD	10		/**< Secs between TCP_INFO samples */
 
 #define TCP_CRAWLER_FREQ		300		/**< once every 5 minutes */
 #define UDP_CRAWLER_FREQ		120		/**< once every 2 minutes */
@@ -1414,6 +1415,109 @@ node_missing_vmsg(gnutella_node_t *n)
 	n->flags &= ~NODE_F_EXPECT_VMSG;
 }
 
+/**
+ * @return nominal size of the socket send buffer for the node.
+ *
+ * This is kept small to make sure we flow control early, so that messages
+ * sit in our queue where they can be prioritized or dropped.
+ */
+static int
+node_send_bufsize(const gnutella_node_t *n)
+{
+	return NODE_IS_LEAF(n) ? NODE_SEND_LEAF_BUFSIZE : NODE_SEND_BUFSIZE;
+}
+
+/**
+ * Sample kernel TCP telemetry for the node and adapt its socket buffers
+ * to the bandwidth-delay product of the link.
+ *
+ * Our small nominal send buffer caps the throughput to one buffer per
+ * round-trip, which starves high-latency links.  When the kernel buffer
+ * is the bottleneck (messages are queued, the buffer is all in flight
+ * and the congestion window allows more), we let it grow towards the
+ * congestion window and lower the queue watermarks by the same amount,
+ * so that the total data buffered for the node is unchanged.
+ *
+ * The receive buffer is only ever enlarged, towards twice the amount of
+ * data the kernel expects to receive per round-trip.
+ */
+static void
+node_tcp_tune(gnutella_node_t *n, time_t now)
+{
+	struct gnutella_socket *s = n->socket;
+	socket_tcp_info_t *ti;
+	uint32 nominal, max, sndmax, rcvmax, sndbuf;
+
+	if (
+		NULL == s || NULL == n->outq || (n->flags & NODE_F_BYE_SENT) ||
+		delta_time(now, n->tcp_info_last) < NODE_TCP_INFO_PERIOD
+	)
+		return;
+
+	n->tcp_info_last = now;
+
+	if (NULL == n->tcp_info)
+		WALLOC0(n->tcp_info);
+
+	ti = n->tcp_info;
+
+	if (!socket_tcp_info(s, ti)) {
+		WFREE_TYPE_NULL(n->tcp_info);
+		return;
+	}
+
+	if (!GNET_PROPERTY(node_tcp_tuning))
+		return;
+
+	nominal = node_send_bufsize(n);
+	max = MAX(nominal, GNET_PROPERTY(node_tcp_buffer_max) * 1024);
+	sndbuf = MAX(s->so_sndbuf, nominal);
+
+	/*
+	 * Once the kernel refused to grant us a larger buffer, do not ask for
+	 * more than what we got, lest we would retry for nothing each period.
+	 */
+
+	sndmax = 0 == n->tcp_sndbuf_cap ? max : MIN(max, n->tcp_sndbuf_cap);
+	rcvmax = 0 == n->tcp_rcvbuf_cap ? max : MIN(max, n->tcp_rcvbuf_cap);
+
+	if (
+		mq_size(n->outq) != 0 &&
+		ti->cwnd > ti->unacked &&
+		ti->unacked >= sndbuf - sndbuf / 4
+	) {
+		sndbuf = MIN(sndbuf * 2, ti->cwnd);		/* Buffer-limited */
+	} else if (ti->cwnd < sndbuf / 2) {
+		sndbuf = ti->cwnd;						/* Network-limited */
+	}
+	sndbuf = MAX(MIN(sndbuf, sndmax), nominal);
+
+	if (sndbuf != s->so_sndbuf) {
+		socket_send_buf(s, sndbuf, TRUE);
+		if (s->so_sndbuf < sndbuf)
+			n->tcp_sndbuf_cap = MAX(s->so_sndbuf, nominal);
+		mq_tcp_reserve(n->outq,
+			s->so_sndbuf > nominal ? s->so_sndbuf - nominal : 0);
+
+		if (GNET_PROPERTY(node_debug) > 1) {
+			g_debug("NODE %s send buffer now %u bytes "
+				"(rtt=%u us, cwnd=%u, unacked=%u), %s",
+				node_infostr(n), s->so_sndbuf, ti->rtt, ti->cwnd, ti->unacked,
+				mq_info(n->outq));
+		}
+	}
+
+	if (ti->rcv_space != 0) {
+		uint32 rcvbuf = MIN(uint32_saturate_mult(ti->rcv_space, 2), rcvmax);
+
+		if (rcvbuf > s->so_rcvbuf + s->so_rcvbuf / 4) {
+			socket_recv_buf(s, rcvbuf, FALSE);
+			if (s->so_rcvbuf < rcvbuf)
+				n->tcp_rcvbuf_cap = s->so_rcvbuf;
+		}
+	}
+}
+
 /**
  * Periodic node heartbeat timer.
  */
@@ -1547,6 +1651,9 @@ node_timer(time_t now)
 		if (n->searchq != NULL)
 			sq_process(n->searchq, now);
 
+		if (n->status == GTA_NODE_CONNECTED)
+			node_tcp_tune(n, now);
+
 		/*
 		 * Sanity checks for connected nodes.
 		 */
@@ -2233,6 +2340,7 @@ node_real_remove(gnutella_node_t *n)
 	if (n->alive_pings)			/* Must be freed after the TX stack */
 		alive_free(n->alive_pings);
 
+	WFREE_TYPE_NULL(n->tcp_info);
 	nid_unref(NODE_ID(n));
 	n->id = NULL;
 
@@ -4941,6 +5049,7 @@ node_net_stack_create(gnutella_node_t *n)
 			g_debug("receiving compressed data from %s", node_infostr(n));
 
 		args.cb = &node_rx_inflate_cb;
+		args.gnet = TRUE;
 
 		n->rx = rx_make_above(n->rx, rx_inflate_get_ops(), &args);
 
@@ -4983,6 +5092,7 @@ node_net_stack_create(gnutella_node_t *n)
 		args.cb = &node_tx_deflate_cb;
 		args.nagle = TRUE;
 		args.gzip = FALSE;
+		args.gnet = TRUE;
 		args.reduced = settings_is_ultra() && NODE_IS_LEAF(n);
 		args.buffer_size = NODE_TX_BUFSIZ;
 		args.buffer_flush = NODE_TX_FLUSH;
@@ -5286,8 +5396,7 @@ node_is_now_connected(gnutella_node_t *n)
 	 * flow control early.  Use their setup for the receive buffer.
 	 */
 
-	socket_send_buf(n->socket, NODE_IS_LEAF(n) ?
-		NODE_SEND_LEAF_BUFSIZE : NODE_SEND_BUFSIZE, TRUE);
+	socket_send_buf(n->socket, node_send_bufsize(n), TRUE);
 
 	socket_recv_buf(n->socket, GNET_PROPERTY(node_rx_size) * 1024, TRUE);
 
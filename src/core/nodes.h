@@ -223,6 +223,16 @@ typedef struct gnutella_node {
 	uint32 udp_rtt;				/**< RTT when exchange takes place over UDP  */
 	cevent_t *tsync_ev;			/**< Time sync event */
 
+	/*
+	 * Kernel TCP telemetry, sampled periodically to adapt socket buffers
+	 * and message queue watermarks to the link.
+	 */
+
+	struct socket_tcp_info *tcp_info;	/**< Last sample, NULL if none */
+	time_t tcp_info_last;		/**< When `tcp_info' was last sampled */
+	uint32 tcp_sndbuf_cap;		/**< Largest send buffer granted, 0 if none */
+	uint32 tcp_rcvbuf_cap;		/**< Largest receive buffer granted, 0 if none */
+
 	/*
 	 * Data structures used by the ping/pong reduction scheme.
 	 *		--RAM, 02/02/2002
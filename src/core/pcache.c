@@ -1122,6 +1122,8 @@ struct cached_pong {		/**< A cached pong */
 	struct nid *last_sent_id; /**< Node ID we last sent this pong to */
 	struct pong_info info;	/**< Values from the pong message */
 	pong_meta_t *meta;		/**< Optional meta data */
+	void *payload;			/**< Encoded pong payload, built on first send */
+	uint32 payload_len;		/**< Length of encoded payload */
 };
 
 struct cache_line {			/**< A cache line for a given hop value */
@@ -1293,6 +1295,8 @@ free_cached_pong(struct cached_pong *cp)
 
 	if (cp->meta != NULL)
 		WFREE(cp->meta);
+	if (cp->payload != NULL)
+		wfree(cp->payload, cp->payload_len);
 
 	nid_unref(cp->node_id);
 	nid_unref(cp->last_sent_id);
@@ -1727,6 +1731,55 @@ setup_pong_demultiplexing(gnutella_node_t *n, uint8 ttl)
 	g_assert(remains == 0);
 }
 
+/**
+ * Send cached pong to node `n', routed with the given hop count and TTL.
+ *
+ * The payload of a cached pong only depends on the pong information and
+ * its meta data, which never change once the pong is cached.  It is therefore
+ * encoded the first time we send the pong and kept along with the cached
+ * entry: subsequent sends only need to build a new Gnutella header, which
+ * avoids re-encoding all the GGEP extensions for each ping we answer.
+ */
+static void
+send_cached_pong(gnutella_node_t *n, struct cached_pong *cp,
+	uint8 hops, uint8 ttl)
+{
+	gnutella_header_t head;
+
+	g_assert(ttl >= 1);
+	g_assert(!NODE_IS_UDP(n));
+
+	if (!NODE_IS_WRITABLE(n))
+		return;
+
+	if G_UNLIKELY(NULL == cp->payload) {
+		const gnutella_msg_init_response_t *r;
+		uint32 size;
+
+		r = build_pong_msg(zero_host_addr, 0, hops, ttl, &n->ping_guid,
+				&cp->info, cp->meta, PING_F_NONE, &size);
+
+		g_assert(size >= GTA_HEADER_SIZE);
+
+		cp->payload_len = size - GTA_HEADER_SIZE;
+		cp->payload =
+			wcopy(const_ptr_add_offset(r, GTA_HEADER_SIZE), cp->payload_len);
+		gnet_stats_inc_general(GNR_PCACHE_PONGS_ENCODED);
+	} else {
+		gnet_stats_inc_general(GNR_PCACHE_PONGS_REUSED);
+	}
+
+	gnutella_header_set_muid(&head, &n->ping_guid);
+	gnutella_header_set_function(&head, GTA_MSG_INIT_RESPONSE);
+	gnutella_header_set_ttl(&head, ttl);
+	gnutella_header_set_hops(&head, hops);
+	gnutella_header_set_size(&head, cp->payload_len);
+
+	n->n_pong_sent++;
+	gmsg_split_sendto_one(n, &head, cp->payload,
+		cp->payload_len + sizeof(head));
+}
+
 /**
  * Internal routine for send_cached_pongs.
  *
@@ -1782,8 +1835,7 @@ iterate_on_cached_line(
 
 		g_assert(hops < 255);		/* Because of MAX_CACHE_HOPS */
 
-		send_pong(n, FALSE, PING_F_NONE,
-			hops + 1, ttl, &n->ping_guid, &cp->info, cp->meta);
+		send_cached_pong(n, cp, hops + 1, ttl);
 
 		n->pong_missing--;
 
@@ -1984,8 +2036,7 @@ pong_all_neighbours_but_one(
 		 * it, so we must increase the hop count.
 		 */
 
-		send_pong(cn, FALSE, PING_F_NONE,
-			hops + 1, ttl, &cn->ping_guid, &cp->info, cp->meta);
+		send_cached_pong(cn, cp, hops + 1, ttl);
 	}
 
 	pslist_free_null(&to_pong);
@@ -2040,8 +2091,7 @@ pong_random_leaf(struct cached_pong *cp, uint8 hops, uint8 ttl)
 	 */
 
 	if (leaf != NULL) {
-		send_pong(leaf, FALSE, PING_F_NONE, hops + 1, ttl, &leaf->ping_guid,
-			&cp->info, cp->meta);
+		send_cached_pong(leaf, cp, hops + 1, ttl);
 
 		if (GNET_PROPERTY(pcache_debug) > 7) {
 			g_debug("%s(): sent pong %s (hops=%d, TTL=%d) to %s",
@@ -2243,6 +2293,8 @@ record_fresh_pong(
 	cp->info.files_count = files_count;
 	cp->info.kbytes_count = kbytes_count;
 	cp->meta = meta;
+	cp->payload = NULL;
+	cp->payload_len = 0;
 
 	hop = CACHE_HOP_IDX(hops);		/* Trim high values to MAX_CACHE_HOPS */
 	cl = &pong_cache[hop];
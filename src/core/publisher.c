@@ -34,6 +34,12 @@
  * if still shared and if not too popular, to make sure that their entries
  * do not expire in the DHT.
  *
+ * Files due for publishing are not published on their own: they are batched
+ * and the keys of a batch are published in KUID order, a few at a time.
+ * Consecutive keys are close in the keyspace, hence the root lookup for a
+ * key is seeded with the k-closest nodes cached for the previous keys by
+ * the roots cache, and converges quickly.
+ *
  * @author Raphael Manfredi
  * @date 2009
  */
@@ -67,6 +73,7 @@
 #include "lib/file.h"
 #include "lib/hikset.h"
 #include "lib/misc.h"
+#include "lib/pslist.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/tm.h"
@@ -83,6 +90,7 @@
 #define PUBLISH_TRANSIENT	7200	/**< less than 2 hours => transient node */
 #define PUBLISH_DMESH_MAX	5		/**< File popularity by dmesh entry count */
 #define PUBLISH_PARTIAL_MAX	1		/**< Partial file popularity (dmesh) */
+#define PUBLISH_BATCH_WINDOW	8	/**< Max publishes in flight per batch */
 
 #define PUBLISH_DB_CACHE_SIZE	128		/**< Amount of data to keep cached */
 #define PUBLISH_SYNC_PERIOD		60000	/**< Flush DB every minute */
@@ -123,6 +131,8 @@ struct publisher_entry {
 	time_t last_publish;		/**< When file was last published */
 	time_t last_delayed;		/**< When republish event was set */
 	uint8 backgrounded;			/**< Whether PDHT is continuing publishing */
+	uint8 queued;				/**< Whether waiting in a publishing batch */
+	uint8 inflight;				/**< Whether batch publishing in progress */
 };
 
 static inline void
@@ -160,7 +170,29 @@ struct pubdata {
 	uint8 version;				/**< Structure version */
 };
 
+/**
+ * Publishing batch.
+ *
+ * Entries due for publishing are collected in the pending list, and when no
+ * batch is running, the pending entries become the next batch.
+ */
+static struct publisher_batch {
+	pslist_t *pending;			/**< Entries due, for next batch */
+	pslist_t *entries;			/**< Entries to launch, sorted by KUID */
+	cevent_t *launch_ev;		/**< Launching event */
+	time_t start;				/**< Start of batch, 0 if none running */
+	uint keys;					/**< Amount of keys in batch */
+	uint launched;				/**< Keys for which publishing was launched */
+	uint inflight;				/**< Amount of publishes in progress */
+	uint published;				/**< Keys published to at least one root */
+	uint64 lookups;				/**< Root lookups issued, at batch start */
+	uint64 seeded;				/**< Seeded root lookups, at batch start */
+	uint64 rpcs;				/**< Root lookup RPCs, at batch start */
+} publisher_batch;
+
 static void publisher_handle(struct publisher_entry *pe);
+static bool publisher_done(void *arg, pdht_error_t code,
+	const pdht_info_t *info);
 
 /**
  *  Get pubdata from database.
@@ -355,6 +387,185 @@ publisher_is_acceptable(const pdht_info_t *info)
 		info->all_roots >= publisher_minimum || !info->can_bg;
 }
 
+/**
+ * Sort publisher entries by increasing KUID.
+ *
+ * Since the KUID of a SHA-1 is the SHA-1 itself, this is a comparison of
+ * the SHA-1 values.
+ */
+static int
+publisher_kuid_cmp(const void *a, const void *b)
+{
+	const struct publisher_entry *pa = a, *pb = b;
+
+	return memcmp(pa->sha1, pb->sha1, SHA1_RAW_SIZE);
+}
+
+/**
+ * Launch publishing of entry from the current batch.
+ */
+static void
+publisher_launch(struct publisher_entry *pe)
+{
+	shared_file_t *sf;
+
+	publisher_check(pe);
+	g_assert(pe->queued);
+	g_assert(!pe->inflight);
+	g_assert(NULL == pe->publish_ev);
+
+	pe->queued = FALSE;
+	sf = shared_file_by_sha1(pe->sha1);
+
+	/*
+	 * If file is no longer shared since it was queued, let the regular
+	 * processing decide what to do with the entry.
+	 */
+
+	if (NULL == sf || SHARE_REBUILDING == sf) {
+		shared_file_unref(&sf);
+		publisher_handle(pe);
+		return;
+	}
+
+	pe->inflight = TRUE;
+	pe->last_enqueued = tm_time();
+	publisher_batch.inflight++;
+	publisher_batch.launched++;
+
+	pdht_publish_file(sf, publisher_done, pe);
+	shared_file_unref(&sf);
+}
+
+/**
+ * Terminate the current batch.
+ */
+static void
+publisher_batch_end(void)
+{
+	struct publisher_batch *b = &publisher_batch;
+	time_delta_t elapsed = delta_time(tm_time(), b->start);
+
+	g_assert(NULL == b->entries);
+	g_assert(0 == b->inflight);
+
+	gnet_stats_inc_general(GNR_DHT_PUBLISH_BATCHES);
+	gnet_stats_set_general(GNR_DHT_PUBLISH_CYCLE_DURATION, elapsed);
+
+	/*
+	 * The root lookups are counted by the DHT layer as they are actually
+	 * issued, so these figures also include the lookups made by other
+	 * publishers whilst the batch was running.
+	 */
+
+	if (GNET_PROPERTY(publisher_debug)) {
+		uint64 lookups, seeded, rpcs;
+
+		lookups = gnet_stats_get_general(GNR_DHT_STORE_ROOT_LOOKUPS) -
+			b->lookups;
+		seeded = gnet_stats_get_general(GNR_DHT_STORE_ROOT_LOOKUPS_SEEDED) -
+			b->seeded;
+		rpcs = gnet_stats_get_general(GNR_DHT_STORE_ROOT_LOOKUP_RPCS) -
+			b->rpcs;
+
+		g_debug("PUBLISHER batch of %u key%s done in %s: "
+			"launched %u, published %u; %s root lookup%s (%s seeded), "
+			"%.2f RPCs per lookup",
+			PLURAL(b->keys), compact_time(elapsed), b->launched, b->published,
+			uint64_to_string(lookups), plural(lookups),
+			uint64_to_string2(seeded),
+			0 == lookups ? 0.0 : (double) rpcs / lookups);
+	}
+
+	b->start = 0;
+}
+
+/**
+ * Callout queue callback to launch more publishes from the current batch.
+ */
+static void
+publisher_batch_launch(cqueue_t *cq, void *unused_obj)
+{
+	struct publisher_batch *b = &publisher_batch;
+
+	(void) unused_obj;
+
+	if (cq != NULL)
+		cq_zero(cq, &b->launch_ev);
+
+	while (b->entries != NULL && b->inflight < PUBLISH_BATCH_WINDOW) {
+		struct publisher_entry *pe = pslist_shift(&b->entries);
+		publisher_launch(pe);
+	}
+
+	if (NULL == b->entries && 0 == b->inflight && b->start != 0)
+		publisher_batch_end();
+}
+
+/**
+ * Record completion of a batched publish.
+ *
+ * Launching of the next publishes is deferred, to not re-enter the
+ * publishing layer from its callback.
+ */
+static void
+publisher_batch_done(struct publisher_entry *pe,
+	pdht_error_t code, const pdht_info_t *info)
+{
+	struct publisher_batch *b = &publisher_batch;
+
+	publisher_check(pe);
+	g_assert(pe->inflight);
+	g_assert(b->inflight != 0);
+
+	pe->inflight = FALSE;
+	b->inflight--;
+
+	if (PDHT_E_OK == code && info->roots > 0) {
+		b->published++;
+		gnet_stats_inc_general(GNR_DHT_PUBLISH_BATCH_PUBLISHED);
+	}
+
+	if (NULL == b->launch_ev)
+		b->launch_ev = cq_insert(publish_cq, 1, publisher_batch_launch, NULL);
+}
+
+/**
+ * Periodic callback to start a new batch with the pending entries, when
+ * the previous batch is over.
+ */
+static bool
+publisher_batch_start(void *unused_obj)
+{
+	struct publisher_batch *b = &publisher_batch;
+
+	(void) unused_obj;
+
+	if (b->start != 0 || NULL == b->pending)
+		return TRUE;		/* Keep calling */
+
+	g_assert(NULL == b->entries);
+	g_assert(0 == b->inflight);
+
+	b->entries = pslist_sort(b->pending, publisher_kuid_cmp);
+	b->pending = NULL;
+	b->keys = pslist_length(b->entries);
+	b->launched = 0;
+	b->published = 0;
+	b->lookups = gnet_stats_get_general(GNR_DHT_STORE_ROOT_LOOKUPS);
+	b->seeded = gnet_stats_get_general(GNR_DHT_STORE_ROOT_LOOKUPS_SEEDED);
+	b->rpcs = gnet_stats_get_general(GNR_DHT_STORE_ROOT_LOOKUP_RPCS);
+	b->start = tm_time();
+
+	if (GNET_PROPERTY(publisher_debug) > 1) {
+		g_debug("PUBLISHER starting batch of %u key%s", PLURAL(b->keys));
+	}
+
+	publisher_batch_launch(NULL, NULL);
+
+	return TRUE;			/* Keep calling */
+}
+
 /**
  * Publishing callback invoked when asynchronous publication is completed,
  * or ended with an error.
@@ -374,6 +585,9 @@ publisher_done(void *arg, pdht_error_t code, const pdht_info_t *info)
 
 	publisher_check(pe);
 
+	if (pe->inflight)
+		publisher_batch_done(pe, code, info);
+
 	pd = get_pubdata(pe->sha1);
 
 	/*
@@ -727,7 +941,7 @@ publisher_handle(struct publisher_entry *pe)
 	}
 
 	/*
-	 * OK, we can publish this alternate location.
+	 * OK, we can publish this alternate location with the next batch.
 	 */
 
 	if (pe->last_publish) {
@@ -738,8 +952,8 @@ publisher_handle(struct publisher_entry *pe)
 		}
 	}
 
-	pe->last_enqueued = tm_time();
-	pdht_publish_file(sf, publisher_done, pe);
+	pe->queued = TRUE;
+	publisher_batch.pending = pslist_prepend(publisher_batch.pending, pe);
 
 	/* FALL THROUGH */
 
@@ -961,6 +1175,7 @@ publisher_init(void)
 		sha1_hash, sha1_eq, GNET_PROPERTY(dht_storage_in_memory));
 
 	cq_periodic_add(publish_cq, PUBLISH_SYNC_PERIOD, publisher_sync, NULL);
+	cq_periodic_add(publish_cq, PUBLISHER_CALLOUT, publisher_batch_start, NULL);
 
 	for (i = 0; i < N_ITEMS(inverse_decimation); i++) {
 		double n = i + 1.0;
@@ -1036,6 +1251,10 @@ publisher_close(void)
 	 * Final cleanup.
 	 */
 
+	cq_cancel(&publisher_batch.launch_ev);
+	pslist_free_null(&publisher_batch.pending);
+	pslist_free_null(&publisher_batch.entries);
+
 	hikset_foreach(publisher_sha1, free_entry, NULL);
 	hikset_free_null(&publisher_sha1);
 
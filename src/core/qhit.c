@@ -41,6 +41,7 @@
 #include "ggep.h"
 #include "ggep_type.h"
 #include "gmsg.h"
+#include "gnet_stats.h"
 #include "gnutella.h"
 #include "ipp_cache.h"
 #include "ipv6-ready.h"
@@ -56,8 +57,10 @@
 #include "if/core/main.h"			/* For main_get_build() */
 
 #include "lib/array.h"
+#include "lib/atoms.h"
 #include "lib/endian.h"
 #include "lib/getdate.h"
+#include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/hset.h"
 #include "lib/product.h"
@@ -78,6 +81,7 @@
 #define QHIT_MAX_PROXIES	8		/**< Send out 8 push-proxies at most */
 #define QHIT_MAX_GGEP		512		/**< Allocated room for trailing GGEP */
 #define QHIT_SIZE_THRESHOLD	2016	/**< Flush query hits larger than this */
+#define QHIT_RATE_PERIOD	60		/**< Entry build rate window (secs) */
 
 /*
  * Minimal trailer length is our code NAME, the open flags, and the GUID.
@@ -613,6 +617,374 @@ qhit_random_index(void)
 	g_error("%s(): no luck with random number generator", G_STRFUNC);
 }
 
+/**
+ * Write the head of a query hit entry for a file, i.e. everything that
+ * follows the file index up to the GGEP extensions: the 32-bit file size,
+ * the file name and its NUL terminator, followed by the SHA1 as a plain
+ * ASCII URN when the other party does not understand GGEP "H".
+ *
+ * @param sf				the shared file
+ * @param sha1_available	whether the SHA1 of the file is known
+ * @param ggep_h			whether the SHA1 is to be emitted as GGEP "H"
+ * @param buf				where to write the head
+ * @param len				length of buffer
+ *
+ * @return amount of bytes written, 0 if there was not enough room.
+ */
+static size_t
+qhit_entry_head(const shared_file_t *sf, bool sha1_available, bool ggep_h,
+	char *buf, size_t len)
+{
+	size_t nlen = shared_file_name_nfc_len(sf);
+	size_t needed = 4 + nlen + 1;
+	uint32 fs32;
+	char *p = buf;
+
+	if (sha1_available && !ggep_h)
+		needed += SHA1_URN_LENGTH + 1;
+
+	if (needed > len)
+		return 0;
+
+	/*
+	 * If size is greater than 2^31-1, we store ~0 as the file size and will
+	 * use the "LF" GGEP extension to hold the real size.
+	 */
+
+	fs32 = shared_file_size(sf) >= (1U << 31) ? ~0U : shared_file_size(sf);
+
+	poke_le32(p, fs32);
+	p += 4;
+	p = mempcpy(p, shared_file_name_nfc(sf), nlen);
+
+	/* Position equals the next byte to be written to */
+
+	*p++ = '\0';
+
+	/*
+	 * We're now between the two NULs at the end of the hit entry.
+	 */
+
+	/*
+	 * Emit the SHA1 as a plain ASCII URN if they don't grok "H".
+	 */
+
+	if (sha1_available && !ggep_h) {
+		const struct sha1 * const sha1 = shared_file_sha1(sf);
+
+		/* Good old way: ASCII URN */
+		p = mempcpy(p, sha1_to_urn_string(sha1), SHA1_URN_LENGTH);
+		*p++ = '\x1c';
+	}
+
+	g_assert(ptr_diff(p, buf) == needed);
+
+	return needed;
+}
+
+/**
+ * Emit the GGEP extensions of a query hit entry that only depend on the file
+ * itself: its hashes, its 64-bit size, relative path and creation time.
+ *
+ * @param sf				the shared file
+ * @param sha1_available	whether the SHA1 of the file is known
+ * @param ggep_h			whether the SHA1 is to be emitted as GGEP "H"
+ * @param gs				the GGEP stream where extensions are written
+ */
+static void
+qhit_entry_ggep(const shared_file_t *sf, bool sha1_available, bool ggep_h,
+	ggep_stream_t *gs)
+{
+	bool ok;
+
+	/*
+	 * Emit the SHA1 as GGEP "H" if they said they understand it. The modern
+	 * way is GGEP "H" for binary URN but only gtk-gnutella implements it.
+	 */
+
+	if (sha1_available && ggep_h) {
+		const struct sha1 * const sha1 = shared_file_sha1(sf);
+		const struct tth * const tth = shared_file_tth(sf);
+		const uint8 type = tth ? GGEP_H_BITPRINT : GGEP_H_SHA1;
+
+		ok =
+			ggep_stream_begin(gs, GGEP_NAME(H), GGEP_W_COBS) &&
+			ggep_stream_write(gs, &type, 1) &&
+			ggep_stream_write(gs, sha1->data, SHA1_RAW_SIZE) &&
+			(tth ? ggep_stream_write(gs, tth->data, TTH_RAW_SIZE) : TRUE) &&
+			ggep_stream_end(gs);
+
+		if (!ok)
+			qhit_log_ggep_write_failure("H");
+	}
+
+	/*
+	 * First LimeWire emitted TTHs as plain text urn:ttroot:<base32 TTH>.
+	 * Now they are still unaware of GGEP "H" but emit GGEP "TT" with the
+	 * hash in binary form.
+	 */
+
+	if (sha1_available && !ggep_h) {
+		const struct tth * const tth = shared_file_tth(sf);
+
+		if (tth) {
+			ok = ggep_stream_pack(gs,
+						GGEP_NAME(TT), tth->data, TTH_RAW_SIZE, GGEP_W_COBS);
+			if (!ok)
+				qhit_log_ggep_write_failure("TT");
+		}
+	}
+
+	/*
+	 * If the 32-bit size is the magic ~0 escape value, we need to emit
+	 * the real size in the "LF" extension.
+	 */
+
+	if (shared_file_size(sf) >= (1U << 31)) {
+		char buf[sizeof(uint64)];
+		int len;
+
+		len = ggept_filesize_encode(shared_file_size(sf), ARYLEN(buf));
+		ok = ggep_stream_pack(gs, GGEP_NAME(LF), buf, len, GGEP_W_COBS);
+
+		if (!ok)
+			qhit_log_ggep_write_failure("LF");
+	}
+
+	{
+		const char *rp = shared_file_relative_path(sf);
+
+		if (rp) {
+			ok = ggep_stream_pack(gs, GGEP_NAME(PATH), rp, vstrlen(rp), 0);
+			if (!ok)
+				qhit_log_ggep_write_failure("PATH");
+		}
+	}
+
+	{
+		time_t create_time;
+
+		create_time = shared_file_creation_time(sf);
+		if ((time_t) -1 != create_time) {
+			char buf[sizeof(uint64)];
+			int len;
+
+			/*
+			 * Suppress negative values (if time_t is signed) as this would
+			 * be interpreted as a date far in this future.
+			 */
+			create_time = MAX(0, create_time);
+
+			len = ggept_ct_encode(create_time, ARYLEN(buf));
+			g_assert(UNSIGNED(len) <= sizeof buf);
+
+			ok = ggep_stream_pack(gs, GGEP_NAME(CT), buf, len, GGEP_W_COBS);
+			if (!ok)
+				qhit_log_ggep_write_failure("CT");
+		}
+	}
+}
+
+/*
+ * Variants of the cached hit records.
+ */
+enum {
+	QHIT_REC_URN = 0,		/**< SHA1 emitted as an ASCII URN */
+	QHIT_REC_H,				/**< SHA1 emitted as GGEP "H" */
+
+	QHIT_REC_VARIANTS
+};
+
+/**
+ * Cached hit record for a complete shared file.
+ *
+ * Apart from its index, the entry of a file in a query hit only depends on
+ * the file and on whether the querying servent understands GGEP "H", with
+ * the exception of the alternate locations, which come from the download
+ * mesh at the time the hit is built.  We therefore encode the head and the
+ * static GGEP extensions of the entry once, for both variants, and keep
+ * them attached to the shared file.
+ *
+ * The record also saves the properties of the file from which it was built,
+ * to be able to spot when it is stale: the SHA1 of the file can be
+ * recomputed, its TTH computed later, its size changed, and the exposure
+ * of relative paths can be turned off.  The file name and creation time
+ * never change for a given shared file.
+ *
+ * The encoded data follow the structure in memory.
+ */
+struct qhit_record {
+	struct sha1 sha1;			/**< SHA1 of the file, if has_sha1 */
+	struct tth tth;				/**< TTH of the file, if has_tth */
+	filesize_t size;			/**< File size */
+	const char *path;			/**< Relative path emitted (atom), or NULL */
+	uint16 head_off[QHIT_REC_VARIANTS];		/**< Offset of entry head */
+	uint16 head_len[QHIT_REC_VARIANTS];		/**< Length of entry head */
+	uint16 ggep_off[QHIT_REC_VARIANTS];		/**< Offset of GGEP block */
+	uint16 ggep_len[QHIT_REC_VARIANTS];		/**< Length of GGEP block */
+	unsigned has_sha1:1;		/**< Whether SHA1 was available */
+	unsigned has_tth:1;			/**< Whether TTH was available */
+};
+
+/**
+ * @return start of the encoded data held in the record.
+ */
+static inline const char *
+qhit_record_data(const struct qhit_record *rec)
+{
+	return const_ptr_add_offset(rec, sizeof *rec);
+}
+
+/**
+ * Check whether cached record is still accurate for the shared file.
+ */
+static bool
+qhit_record_is_valid(const struct qhit_record *rec,
+	const shared_file_t *sf, bool sha1_available)
+{
+	const struct sha1 *sha1 = sha1_available ? shared_file_sha1(sf) : NULL;
+	const struct tth *tth = sha1_available ? shared_file_tth(sf) : NULL;
+
+	if (rec->size != shared_file_size(sf))
+		return FALSE;
+
+	/*
+	 * The path is an atom, on which the record holds a reference: comparing
+	 * the pointers is enough since the atom cannot be reused meanwhile.
+	 */
+
+	if (rec->path != shared_file_relative_path(sf))
+		return FALSE;
+
+	if (rec->has_sha1 != (NULL != sha1))
+		return FALSE;
+
+	if (sha1 != NULL && !sha1_eq(&rec->sha1, sha1))
+		return FALSE;
+
+	if (rec->has_tth != (NULL != tth))
+		return FALSE;
+
+	if (tth != NULL && !tth_eq(&rec->tth, tth))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * Encode the cached hit record for a complete shared file.
+ *
+ * @return the new record, NULL if the entry is too large to be cached.
+ */
+static struct qhit_record *
+qhit_record_build(const shared_file_t *sf, bool sha1_available)
+{
+	struct qhit_record *rec;
+	const char *rp = shared_file_relative_path(sf);
+	size_t head_max, ggep_max, size, pos;
+	char *data;
+	uint v;
+
+	/*
+	 * Compute an upper bound of the room needed by each variant.
+	 */
+
+	head_max = 4 + shared_file_name_nfc_len(sf) + 1 + SHA1_URN_LENGTH + 1;
+	ggep_max = QHIT_MAX_GGEP + (NULL == rp ? 0 : 8 + vstrlen(rp));
+	size = sizeof *rec + QHIT_REC_VARIANTS * (head_max + ggep_max);
+
+	if (size - sizeof *rec > MAX_INT_VAL(uint16))
+		return NULL;
+
+	rec = halloc0(size);
+	rec->size = shared_file_size(sf);
+	rec->path = NULL == rp ? NULL : atom_str_get(rp);
+
+	if (sha1_available) {
+		const struct tth *tth = shared_file_tth(sf);
+
+		rec->sha1 = *shared_file_sha1(sf);
+		rec->has_sha1 = TRUE;
+
+		if (tth != NULL) {
+			rec->tth = *tth;
+			rec->has_tth = TRUE;
+		}
+	}
+
+	data = ptr_add_offset(rec, sizeof *rec);
+	pos = 0;
+
+	for (v = 0; v < QHIT_REC_VARIANTS; v++) {
+		bool ggep_h = QHIT_REC_H == v;
+		ggep_stream_t gs;
+		size_t n;
+
+		n = qhit_entry_head(sf, sha1_available, ggep_h, &data[pos], head_max);
+		g_assert(n != 0);
+
+		rec->head_off[v] = pos;
+		rec->head_len[v] = n;
+		pos += n;
+
+		ggep_stream_init(&gs, &data[pos], ggep_max);
+		qhit_entry_ggep(sf, sha1_available, ggep_h, &gs);
+		n = ggep_stream_close(&gs);
+
+		rec->ggep_off[v] = pos;
+		rec->ggep_len[v] = n;
+		pos += n;
+	}
+
+	gnet_stats_inc_general(GNR_QHIT_RECORDS_ENCODED);
+
+	return hrealloc(rec, sizeof *rec + pos);
+}
+
+/**
+ * Free hit record cached for a shared file.
+ */
+void
+qhit_record_free(void *record)
+{
+	struct qhit_record *rec = record;
+
+	if (NULL == rec)
+		return;
+
+	atom_str_free_null(&rec->path);
+	hfree(rec);
+}
+
+/**
+ * Get the cached hit record for a shared file, building it as needed.
+ *
+ * @return the record, NULL if the file cannot use cached records.
+ */
+static const struct qhit_record *
+qhit_record_get(const shared_file_t *sf, bool sha1_available)
+{
+	struct qhit_record *rec;
+
+	/*
+	 * Partial files are not cached: their entry carries a "PRU" extension
+	 * describing the data we currently have.
+	 */
+
+	if (!GNET_PROPERTY(qhit_record_cache) || shared_file_is_partial(sf))
+		return NULL;
+
+	rec = shared_file_hit_record(sf);
+
+	if G_LIKELY(rec != NULL && qhit_record_is_valid(rec, sf, sha1_available))
+		return rec;
+
+	rec = qhit_record_build(sf, sha1_available);
+	shared_file_set_hit_record(sf, rec);
+
+	return rec;
+}
+
 /**
  * Add file to current query hit.
  *
@@ -625,7 +997,7 @@ add_file(const shared_file_t *sf)
 	bool sha1_available;
 	gnet_host_t hvec[QHIT_MAX_ALT];
 	int hcnt = 0;
-	uint32 fs32, fs32_le, idx_le;
+	uint32 idx_le;
 	int ggep_len;
 	bool ok;
 	ggep_stream_t gs;
@@ -633,6 +1005,7 @@ add_file(const shared_file_t *sf)
 	void *start;
 	bool is_partial;
 	uint32 file_index;
+	const struct qhit_record *rec;
 
 	is_partial = shared_file_is_partial(sf);
 	needed = 8 + 2 + shared_file_name_nfc_len(sf);	/* size of hit entry */
@@ -742,137 +1115,88 @@ add_file(const shared_file_t *sf)
 	if (needed > found_left())
 		return FALSE;
 
-	/*
-	 * If size is greater than 2^31-1, we store ~0 as the file size and will
-	 * use the "LF" GGEP extension to hold the real size.
-	 */
-
-	fs32 = shared_file_size(sf) >= (1U << 31) ? ~0U : shared_file_size(sf);
-
 	poke_le32(&idx_le, file_index);
 	if (!found_write(&idx_le, sizeof idx_le))
 		return FALSE;
-	poke_le32(&fs32_le, fs32);
-	if (!found_write(&fs32_le, sizeof fs32_le))
-		return FALSE;
-	if (!found_write(shared_file_name_nfc(sf), shared_file_name_nfc_len(sf)))
-		return FALSE;
-
-	/* Position equals the next byte to be written to */
-
-	if (!found_write("", 1))
-		return FALSE;
 
 	/*
-	 * We're now between the two NULs at the end of the hit entry.
+	 * For complete files, the remainder of the entry comes from the
+	 * cached record, save for the alternate locations which are dynamic.
 	 */
 
-	/*
-	 * Emit the SHA1 as a plain ASCII URN if they don't grok "H".
-	 */
+	rec = qhit_record_get(sf, sha1_available);
 
-	if (sha1_available && !found_ggep_h()) {
-		const struct sha1 * const sha1 = shared_file_sha1(sf);
+	if (rec != NULL) {
+		uint v = found_ggep_h() ? QHIT_REC_H : QHIT_REC_URN;
+		const char *data = qhit_record_data(rec);
 
-		/* Good old way: ASCII URN */
-		if (!found_write(sha1_to_urn_string(sha1), SHA1_URN_LENGTH))
-			return FALSE;
-		if (!found_write("\x1c", 1))
+		if (!found_write(&data[rec->head_off[v]], rec->head_len[v]))
 			return FALSE;
-	}
 
-	/*
-	 * From now on, we emit GGEP extensions, if we emit at all.
-	 */
+		left = found_left();
+		start = found_open();
+		ggep_stream_init(&gs, start, left);
 
-	left = found_left();
-	start = found_open();
-	ggep_stream_init(&gs, start, left);
+		if (
+			0 != rec->ggep_len[v] &&
+			!ggep_stream_append_block(&gs,
+				&data[rec->ggep_off[v]], rec->ggep_len[v])
+		)
+			qhit_log_ggep_write_failure("cached");
 
-	/*
-	 * If we matched a partial file, let them know (unless the file is
-	 * being seeded, in which case it is really complete).
-	 *
-	 * For now we don't emit the available ranges (need to build the tree
-	 * of 1 KiB blocks and send numbers of the highest node in the tree
-	 * encompassing an available chunk) in PR0, PR1, PR2, PR3 or PR4 keys.
-	 *
-	 * We just emit the "PRU" key, signaling that it's a partial result
-	 * and that its data is still unverified (since we don't verify available
-	 * chunks using the TTH for now).
-	 *		--RAM, 2011-05-15
-	 */
+		gnet_stats_inc_general(GNR_QHIT_ENTRIES_CACHED);
+	} else {
+		size_t n;
+
+		left = found_left();
+		start = found_open();
+		n = qhit_entry_head(sf, sha1_available, found_ggep_h(), start, left);
+		found_close(n);
 
-	if (is_partial && !shared_file_is_finished(sf)) {
-		time_t mtime = shared_file_modification_time(sf);
-		filesize_t available = shared_file_available(sf);
-		char buf[sizeof mtime + sizeof available];
-		uint len;
+		if (0 == n)
+			return FALSE;
 
 		/*
-		 * Starting with 0.98.4, we emit a payload in the "PRU" key to indicate
-		 * the last modification time of the file and the amount of bytes
-		 * available on the server.		--RAM, 2012-11-03
+		 * From now on, we emit GGEP extensions, if we emit at all.
 		 */
 
-		len = ggept_stamp_filesize_encode(mtime, available, ARYLEN(buf));
-		ok = ggep_stream_pack(&gs, GGEP_NAME(PRU), buf, len, GGEP_W_COBS);
-		if (!ok)
-			qhit_log_ggep_write_failure("PRU");
-	}
-
-	/*
-	 * Emit the SHA1 as GGEP "H" if they said they understand it. The modern
-	 * way is GGEP "H" for binary URN but only gtk-gnutella implements it.
-	 */
+		left = found_left();
+		start = found_open();
+		ggep_stream_init(&gs, start, left);
 
-	if (sha1_available && found_ggep_h()) {
-		const struct sha1 * const sha1 = shared_file_sha1(sf);
-		const struct tth * const tth = shared_file_tth(sf);
-		const uint8 type = tth ? GGEP_H_BITPRINT : GGEP_H_SHA1;
-
-		ok =
-			ggep_stream_begin(&gs, GGEP_NAME(H), GGEP_W_COBS) &&
-			ggep_stream_write(&gs, &type, 1) &&
-			ggep_stream_write(&gs, sha1->data, SHA1_RAW_SIZE) &&
-			(tth ? ggep_stream_write(&gs, tth->data, TTH_RAW_SIZE) : TRUE) &&
-			ggep_stream_end(&gs);
-
-		if (!ok)
-			qhit_log_ggep_write_failure("H");
-	}
+		/*
+		 * If we matched a partial file, let them know (unless the file is
+		 * being seeded, in which case it is really complete).
+		 *
+		 * For now we don't emit the available ranges (need to build the tree
+		 * of 1 KiB blocks and send numbers of the highest node in the tree
+		 * encompassing an available chunk) in PR0, PR1, PR2, PR3 or PR4 keys.
+		 *
+		 * We just emit the "PRU" key, signaling that it's a partial result
+		 * and that its data is still unverified (since we don't verify
+		 * available chunks using the TTH for now).
+		 *		--RAM, 2011-05-15
+		 */
 
-	/*
-	 * First LimeWire emitted TTHs as plain text urn:ttroot:<base32 TTH>.
-	 * Now they are still unaware of GGEP "H" but emit GGEP "TT" with the
-	 * hash in binary form.
-	 */
+		if (is_partial && !shared_file_is_finished(sf)) {
+			time_t mtime = shared_file_modification_time(sf);
+			filesize_t available = shared_file_available(sf);
+			char buf[sizeof mtime + sizeof available];
+			uint len;
 
-	if (sha1_available && !found_ggep_h()) {
-		const struct tth * const tth = shared_file_tth(sf);
+			/*
+			 * Starting with 0.98.4, we emit a payload in the "PRU" key to
+			 * indicate the last modification time of the file and the amount
+			 * of bytes available on the server.		--RAM, 2012-11-03
+			 */
 
-		if (tth) {
-			ok = ggep_stream_pack(&gs,
-						GGEP_NAME(TT), tth->data, TTH_RAW_SIZE, GGEP_W_COBS);
+			len = ggept_stamp_filesize_encode(mtime, available, ARYLEN(buf));
+			ok = ggep_stream_pack(&gs, GGEP_NAME(PRU), buf, len, GGEP_W_COBS);
 			if (!ok)
-				qhit_log_ggep_write_failure("TT");
+				qhit_log_ggep_write_failure("PRU");
 		}
-	}
-
-	/*
-	 * If the 32-bit size is the magic ~0 escape value, we need to emit
-	 * the real size in the "LF" extension.
-	 */
 
-	if (fs32 == ~0U) {
-		char buf[sizeof(uint64)];
-		int len;
-
-		len = ggept_filesize_encode(shared_file_size(sf), ARYLEN(buf));
-		ok = ggep_stream_pack(&gs, GGEP_NAME(LF), buf, len, GGEP_W_COBS);
-
-		if (!ok)
-			qhit_log_ggep_write_failure("LF");
+		qhit_entry_ggep(sf, sha1_available, found_ggep_h(), &gs);
 	}
 
 	/*
@@ -889,39 +1213,6 @@ add_file(const shared_file_t *sf)
 			qhit_log_ggep_write_failure("ALT");
 	}
 
-	{
-		const char *rp = shared_file_relative_path(sf);
-
-		if (rp) {
-			ok = ggep_stream_pack(&gs, GGEP_NAME(PATH), rp, vstrlen(rp), 0);
-			if (!ok)
-				qhit_log_ggep_write_failure("PATH");
-		}
-	}
-
-	{
-		time_t create_time;
-
-		create_time = shared_file_creation_time(sf);
-		if ((time_t) -1 != create_time) {
-			char buf[sizeof(uint64)];
-			int len;
-
-			/*
-			 * Suppress negative values (if time_t is signed) as this would
-			 * be interpreted as a date far in this future.
-			 */
-			create_time = MAX(0, create_time);
-
-			len = ggept_ct_encode(create_time, ARYLEN(buf));
-			g_assert(UNSIGNED(len) <= sizeof buf);
-
-			ok = ggep_stream_pack(&gs, GGEP_NAME(CT), buf, len, GGEP_W_COBS);
-			if (!ok)
-				qhit_log_ggep_write_failure("CT");
-		}
-	}
-
 	/*
 	 * Because we don't know exactly the size of the GGEP extension
 	 * (could be COBS-encoded or not), we need to adjust the real
@@ -935,6 +1226,7 @@ add_file(const shared_file_t *sf)
 		return FALSE;
 
 	found_add_files(1);
+	gnet_stats_inc_general(GNR_QHIT_ENTRIES_BUILT);
 
 	/*
 	 * If we have reached our size limit for query hits, flush what
@@ -979,6 +1271,41 @@ found_reset(size_t max_size, const struct guid *muid, unsigned flags,
 	found_clear();
 }
 
+/**
+ * Account for the time spent building query hits, to update the rate at
+ * which we build file entries.
+ *
+ * The rate is computed over periods of QHIT_RATE_PERIOD seconds, so that
+ * it reflects the recent building performance.
+ *
+ * @param start		when we started building the query hits
+ * @param entries	amount of file entries we put in the query hits
+ */
+static void
+qhit_build_rate(const tm_nano_t *start, int entries)
+{
+	static uint64 period_entries, period_ns;
+	static time_t period_start;
+	tm_nano_t end;
+	time_t now = tm_time();
+
+	tm_precise_time(&end);
+
+	period_ns += tm_precise_elapsed_ns(&end, start);
+	period_entries += entries;
+
+	if (0 == period_start) {
+		period_start = now;
+	} else if (delta_time(now, period_start) >= QHIT_RATE_PERIOD) {
+		if (0 != period_ns) {
+			gnet_stats_set_general(GNR_QHIT_ENTRIES_PER_SEC,
+				period_entries * 1000000000.0 / period_ns);
+		}
+		period_entries = period_ns = 0;
+		period_start = now;
+	}
+}
+
 /**
  * Send as many small query hit packets as necessary to hold the `count'
  * results held in the `files' list.
@@ -995,6 +1322,7 @@ qhit_send_results(gnutella_node_t *n, pslist_t *files, int count,
 {
 	pslist_t *sl;
 	int sent = 0;
+	tm_nano_t start;
 
 	g_assert(!NODE_TALKS_G2(n));
 
@@ -1008,6 +1336,7 @@ qhit_send_results(gnutella_node_t *n, pslist_t *files, int count,
 
 	found_reset(QHIT_SIZE_THRESHOLD, muid, flags, qhit_send_node, n,
 		&zero_array);
+	tm_precise_time(&start);
 
 	PSLIST_FOREACH(files, sl) {
 		shared_file_t *sf = sl->data;
@@ -1019,6 +1348,8 @@ qhit_send_results(gnutella_node_t *n, pslist_t *files, int count,
 	if (0 != found_file_count())	/* Still some unflushed results */
 		flush_match();				/* Send last packet */
 
+	qhit_build_rate(&start, sent);
+
 	pslist_free(files);
 
 	if (GNET_PROPERTY(dbg) > 3)
@@ -1058,11 +1389,13 @@ qhit_build_results(const pslist_t *files, int count, size_t max_msgsize,
 {
 	const pslist_t *sl;
 	int sent;
+	tm_nano_t start;
 
 	g_assert(cb != NULL);
 	g_assert(token);
 
 	found_reset(max_msgsize, muid, flags, cb, udata, token);
+	tm_precise_time(&start);
 
 	for (sl = files, sent = 0; sl && sent < count; sl = pslist_next(sl)) {
 		const shared_file_t *sf = sl->data;
@@ -1074,6 +1407,8 @@ qhit_build_results(const pslist_t *files, int count, size_t max_msgsize,
 	if (0 != found_file_count())	/* Still some unflushed results */
 		flush_match();				/* Send last packet */
 
+	qhit_build_rate(&start, sent);
+
 	found_done();
 
 	/*
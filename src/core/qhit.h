@@ -71,6 +71,8 @@ void qhit_build_results(const struct pslist *files,
 	qhit_process_t cb, void *udata, const struct guid *muid, unsigned flags,
 	const struct array *token);
 
+void qhit_record_free(void *record);
+
 #endif /* _core_qhit_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -3791,22 +3791,15 @@ qrt_receive_create(gnutella_node_t *n, struct routing_table *query_table)
 	struct routing_table *table = query_table;
 	struct qrt_receive *qrcv;
 	z_streamp inz;
-	int ret;
 
 	g_assert(query_table == NULL || table->magic == QRP_ROUTE_MAGIC);
 	g_assert(query_table == NULL || table->client_slots > 0);
 
-	WALLOC(inz);
-	inz->zalloc = zlib_alloc_func;
-	inz->zfree = zlib_free_func;
-	inz->opaque = NULL;
-
-	ret = inflateInit(inz);
+	inz = zlib_inflate_stream_get();
 
-	if G_UNLIKELY(ret != Z_OK) {
-		WFREE(inz);
-		g_warning("unable to initialize QRP decompressor for %s: %s",
-			node_infostr(n), zlib_strerror(ret));
+	if G_UNLIKELY(NULL == inz) {
+		g_warning("unable to initialize QRP decompressor for %s",
+			node_infostr(n));
 		return NULL;
 	}
 
@@ -3864,8 +3857,7 @@ qrt_receive_free(struct qrt_receive *qrcv)
 {
 	g_assert(qrcv->magic == QRT_RECEIVE_MAGIC);
 
-	(void) inflateEnd(qrcv->inz);
-	WFREE(qrcv->inz);
+	zlib_inflate_stream_put(qrcv->inz);
 	if (qrcv->table)
 		qrt_unref(qrcv->table);
 	if (qrcv->expansion)
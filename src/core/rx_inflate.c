@@ -35,6 +35,7 @@
 
 #include <zlib.h>
 
+#include "gnet_stats.h"
 #include "hosts.h"
 #include "rx.h"
 #include "rx_inflate.h"
@@ -56,11 +57,46 @@ struct attr {
 	const struct rx_inflate_cb *cb;	/**< Layer-specific callbacks */
 	z_streamp inz;					/**< Decompressing stream */
 	size_t processed;				/**< Input bytes decompressed so far */
+	size_t memory;					/**< Estimated zlib memory (0 = unknown) */
 	int flags;
+	bool gnet;						/**< Gnutella link, accounted in stats */
 };
 
 #define IF_ENABLED	0x00000001		/**< Reception enabled */
 
+/*
+ * Let zlib size the window according to the zlib header of the stream,
+ * to use less memory when the remote end compresses with a reduced window.
+ * This is only supported since zlib 1.2.3.5.
+ */
+#if defined(ZLIB_VERNUM) && ZLIB_VERNUM >= 0x1235
+#define RX_INFLATE_WBITS	0
+#else
+#define RX_INFLATE_WBITS	MAX_WBITS
+#endif
+
+/**
+ * Account for the memory used by zlib to inflate the stream, which depends
+ * on the window size advertised in the zlib header.
+ *
+ * @param attr		the driver's private data
+ * @param data		start of the compressed stream
+ */
+static void
+inflate_account_memory(struct attr *attr, const void *data)
+{
+	uint8 cmf = *(const uint8 *) data;
+	int window_bits = MAX_WBITS;
+
+	if (Z_DEFLATED == (cmf & 0x0f) && (cmf >> 4) + 8 <= MAX_WBITS)
+		window_bits = (cmf >> 4) + 8;
+
+	attr->memory = zlib_inflate_memory(window_bits);
+
+	if (attr->gnet)
+		gnet_stats_count_general(GNR_RX_INFLATE_MEMORY, attr->memory);
+}
+
 /**
  * Decompress more data from the input buffer `mb'.
  * @returns decompressed data in a new buffer, or NULL if no more data.
@@ -83,6 +119,9 @@ inflate_data(rxdrv_t *rx, pmsg_t *mb)
 	if (old_size == 0)
 		return NULL;				/* No more data */
 
+	if G_UNLIKELY(0 == attr->memory)
+		inflate_account_memory(attr, pmsg_start(mb));
+
 	db = rxbuf_new();
 
 	inz->next_out = cast_to_pointer(pdata_start(db));
@@ -187,7 +226,7 @@ rx_inflate_init(rxdrv_t *rx, const void *args)
 	inz->zfree = zlib_free_func;
 	inz->opaque = NULL;
 
-	ret = inflateInit(inz);
+	ret = inflateInit2(inz, RX_INFLATE_WBITS);
 
 	if (ret != Z_OK) {
 		WFREE(inz);
@@ -199,9 +238,13 @@ rx_inflate_init(rxdrv_t *rx, const void *args)
 	WALLOC0(attr);
 	attr->cb = rargs->cb;
 	attr->inz = inz;
+	attr->gnet = rargs->gnet;
 
 	rx->opaque = attr;
 
+	if (attr->gnet)
+		gnet_stats_inc_general(GNR_RX_INFLATE_LINKS);
+
 	return rx;		/* OK */
 }
 
@@ -222,6 +265,10 @@ rx_inflate_destroy(rxdrv_t *rx)
 			gnet_host_to_string(&rx->host), zlib_strerror(ret));
 
 	WFREE_TYPE_NULL(attr->inz);
+	if (attr->gnet) {
+		gnet_stats_dec_general(GNR_RX_INFLATE_LINKS);
+		gnet_stats_count_general(GNR_RX_INFLATE_MEMORY, -(int) attr->memory);
+	}
 	WFREE(attr);
 	rx->opaque = NULL;
 }
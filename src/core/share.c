@@ -97,6 +97,7 @@
 #include "lib/override.h"		/* Must be the last header included */
 
 #define SHARE_RECENT_THRESH		(2 * 7 * 24 * 60 * 60)	/* 2 weeks */
+#define SHARE_QRP_DELAY			2000	/* ms, to coalesce QRP rebuilds */
 
 enum shared_file_magic {
 	SHARED_FILE_MAGIC = 0x3702b437U
@@ -147,6 +148,8 @@ struct shared_file {
 	enum mime_type mime_type;	/**< MIME type of the file */
 	uint media_type;			/**< Media type mask for queries */
 
+	void *hit_record;			/**< Cached query hit record (halloc) */
+
 	int refcnt;					/**< Reference count */
 	uint32 flags;				/**< See below for definition */
 };
@@ -270,17 +273,20 @@ static struct share_thread_vars {
 	spinlock_t lock;					/* Lock to allow concurrent access */
 	bgsched_t *sched;					/* Background task scheduler */
 	struct bgtask *task;				/* Current task, NULL if none */
+	cevent_t *qrp_ev;					/* Deferred QRP rebuild */
 	bool qrp_rebuild;					/* Whether QRP rebuild is pending */
 	bool exiting;						/* Whether thread should exit */
 } share_thread_vars = {
 	SPINLOCK_INIT,			/* lock */
 	NULL,					/* sched */
 	NULL,					/* task */
+	NULL,					/* qrp_ev */
 	FALSE,					/* qrp_rebuild */
 	FALSE,					/* exiting */
 };
 static unsigned share_thread_id = THREAD_INVALID_ID;
 static bool share_rebuilding;			/* Whether library is being rebuilt */
+static uint share_generation;			/* Bumped when library changes */
 
 /**
  * This hash table maps a SHA1 hash (base-32 encoded) onto the corresponding
@@ -482,6 +488,8 @@ shared_file_deindex(shared_file_t *sf)
 	shared_file_check(sf);
 	shared_file_name_check(sf);
 
+	atomic_uint_inc(&share_generation);
+
 	if (SHARE_F_BASENAME & sf->flags) {
 		if (shared_libfile.file_basenames != NULL) {
 			htable_remove(shared_libfile.file_basenames, sf->name_nfc);
@@ -591,6 +599,8 @@ shared_file_free(shared_file_t **sf_ptr)
 		atom_str_free_null(&sf->name_nfc);
 		atom_str_free_null(&sf->name_canonic);
 		atom_str_free_null(&sf->name_normal);
+		qhit_record_free(sf->hit_record);
+		sf->hit_record = NULL;
 		sf->magic = 0;
 
 		WFREE(sf);
@@ -2436,6 +2446,8 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 	shared_libfile.files_scanned		= ctx->files_scanned;
 	shared_libfile.bytes_scanned		= ctx->bytes_scanned;
 
+	atomic_uint_inc(&share_generation);
+
 	/*
 	 * Reset these contextual variables, they are now held by the global ones.
 	 */
@@ -3027,6 +3039,8 @@ share_thread_lib_rescan(void *unused_arg)
 
 	(void) unused_arg;
 
+	cq_cancel(&v->qrp_ev);		/* since rescan takes care of it */
+
 	spinlock(&v->lock);
 
 	if (v->task != NULL) {
@@ -3051,6 +3065,8 @@ share_thread_lib_qrp_rebuild(void *unused_arg)
 
 	(void) unused_arg;
 
+	cq_cancel(&v->qrp_ev);		/* in case we are forced to rebuild now */
+
 	spinlock(&v->lock);
 
 	if (v->task != NULL) {
@@ -3069,6 +3085,40 @@ share_thread_lib_qrp_rebuild(void *unused_arg)
 	}
 }
 
+/**
+ * Callout queue callback to start a deferred QRP rebuild.
+ */
+static void
+share_thread_lib_qrp_deferred(cqueue_t *cq, void *unused_arg)
+{
+	struct share_thread_vars *v = &share_thread_vars;
+
+	(void) unused_arg;
+
+	cq_zero(cq, &v->qrp_ev);
+	share_thread_lib_qrp_rebuild(NULL);
+}
+
+/**
+ * Request a QRP rebuild, deferred for a while to coalesce the bursts of
+ * requests we get when many partial files are added or removed.
+ *
+ * The timer lives in the callout queue of the library thread, so that it
+ * fires from the thread event loop, without involving the main thread.
+ */
+static void
+share_thread_lib_qrp_defer(void *unused_arg)
+{
+	struct share_thread_vars *v = &share_thread_vars;
+
+	(void) unused_arg;
+
+	if (NULL == v->qrp_ev) {
+		v->qrp_ev = cq_insert(cq_thread(), SHARE_QRP_DELAY,
+			share_thread_lib_qrp_deferred, NULL);
+	}
+}
+
 /*
  * The "share_lib_xxx" routine constitute the API from the "main" thread to the
  * "library" thread.
@@ -3097,7 +3147,8 @@ share_lib_qrp_rebuild(bool force)
 	bool done;
 
 	done = teq_post_ext(share_thread_id, !force,
-				share_thread_lib_qrp_rebuild, NULL);
+				force ? share_thread_lib_qrp_rebuild : share_thread_lib_qrp_defer,
+				NULL);
 
 	g_assert(implies(force, done));
 
@@ -3208,6 +3259,7 @@ share_thread_main(void *arg)
 			share_thread_lib_qrp_rebuild(NULL);
 	}
 
+	cq_cancel(&v->qrp_ev);
 	bg_sched_destroy_null(&v->sched);
 
 	g_debug("library thread exiting");
@@ -3349,6 +3401,7 @@ shared_file_set_sha1(shared_file_t *sf, const struct sha1 *sha1)
 	}
 
 	atom_sha1_change(&sf->sha1, sha1);
+	atomic_uint_inc(&share_generation);
 
 	/*
 	 * If the file is no longer in the index table, it must not be
@@ -3866,6 +3919,39 @@ shared_file_set_path(shared_file_t *sf, const char *pathname)
 	atom_str_change(&sf->file_path, pathname);
 }
 
+/**
+ * Get the query hit record cached for the shared file by the query hit
+ * builder, which is responsible for checking that it is still accurate.
+ *
+ * @return the cached record, NULL if none.
+ */
+void *
+shared_file_hit_record(const shared_file_t *sf)
+{
+	shared_file_check(sf);
+	return sf->hit_record;
+}
+
+/**
+ * Cache the query hit record for the shared file, replacing any previous one.
+ *
+ * The record is owned by the shared file afterwards, being freed along with
+ * it through qhit_record_free().
+ */
+void
+shared_file_set_hit_record(const shared_file_t *sf, void *record)
+{
+	shared_file_t *wsf = deconstify_pointer(sf);
+
+	shared_file_check(sf);
+	g_assert(thread_is_main());
+
+	if (wsf->hit_record != record) {
+		qhit_record_free(wsf->hit_record);
+		wsf->hit_record = record;
+	}
+}
+
 void
 shared_file_from_fileinfo(fileinfo_t *fi)
 {
@@ -4127,6 +4213,19 @@ shared_files_scanned(void)
 	return files_scanned();
 }
 
+/**
+ * Get the library generation, which changes each time the set of shared
+ * files or their SHA1 changes.
+ *
+ * This lets callers know whether data they derived from the library is
+ * still accurate.
+ */
+uint
+share_library_generation(void)
+{
+	return atomic_uint_get(&share_generation);
+}
+
 /**
  * Request asynchronous partial file table (for pattern matching) and QRP
  * table rebuild if necessary.
@@ -147,6 +147,8 @@ fileinfo_t *shared_file_fileinfo(const shared_file_t *sf) G_PURE;
 const char *shared_file_mime_type(const shared_file_t *sf) G_PURE;
 bool shared_file_indexed(const shared_file_t *sf) G_PURE;
 bool shared_file_tth_is_available(const shared_file_t *sf);
+void *shared_file_hit_record(const shared_file_t *sf);
+void shared_file_set_hit_record(const shared_file_t *sf, void *record);
 void shared_file_from_fileinfo(fileinfo_t *fi);
 bool shared_file_has_media_type(const shared_file_t *sf, unsigned m)
 	G_PURE;
@@ -158,6 +160,7 @@ void shared_file_slist_free_null(struct pslist **l_ptr);
 void share_add_partial(const shared_file_t *sf);
 void share_remove_partial(const shared_file_t *sf);
 void share_update_matching_information(void);
+uint share_library_generation(void);
 
 struct search_request_info;
 
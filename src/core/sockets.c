@@ -4549,8 +4549,10 @@ socket_set_intern(int fd, int option, unsigned size,
 			G_STRFUNC, type, size, fd);
 
 	len = sizeof(new_len);
-	if (-1 == getsockopt(fd, SOL_SOCKET, option, &new_len, &len))
+	if (-1 == getsockopt(fd, SOL_SOCKET, option, &new_len, &len)) {
 		g_warning("cannot read new %s buffer length on fd #%d: %m", type, fd);
+		return old_len;
+	}
 
 #ifdef LINUX_SYSTEM
 	new_len >>= 1;		/* Linux returns twice the real amount */
@@ -4561,7 +4563,12 @@ socket_set_intern(int fd, int option, unsigned size,
 			G_STRFUNC, type, fd, old_len, size, new_len,
 			(new_len == size) ? "OK" : "FAILED");
 
-	return (new_len == size) ? new_len : old_len;
+	/*
+	 * The kernel can silently clamp the size we requested, for instance
+	 * to the system-wide maximum on Linux: report what it granted.
+	 */
+
+	return new_len;
 }
 
 /**
@@ -4624,6 +4631,52 @@ socket_nodelay(struct gnutella_socket *s, bool on)
 	}
 }
 
+/**
+ * Fetch kernel telemetry for the TCP connection.
+ *
+ * This is only available on systems supporting the TCP_INFO option with
+ * the Linux semantics, where the congestion window is given in segments.
+ *
+ * @return TRUE if `ti' was filled, FALSE if no information is available.
+ */
+bool
+socket_tcp_info(const struct gnutella_socket *s, socket_tcp_info_t *ti)
+{
+	socket_check(s);
+	g_assert(ti != NULL);
+
+	if (!(SOCK_F_TCP & s->flags) || !is_valid_fd(s->file_desc))
+		return FALSE;
+
+#if defined(TCP_INFO) && defined(LINUX_SYSTEM)
+	{
+		struct tcp_info info;
+		socklen_t len = sizeof info;
+
+		ZERO(&info);
+
+		if (-1 == getsockopt(s->file_desc, sol_tcp(), TCP_INFO, &info, &len)) {
+			if (GNET_PROPERTY(socket_debug))
+				g_warning("%s(): cannot read TCP_INFO on fd #%d: %m",
+					G_STRFUNC, s->file_desc);
+			return FALSE;
+		}
+
+		ti->rtt = info.tcpi_rtt;
+		ti->rttvar = info.tcpi_rttvar;
+		ti->mss = info.tcpi_snd_mss;
+		ti->cwnd = uint32_saturate_mult(info.tcpi_snd_cwnd, info.tcpi_snd_mss);
+		ti->unacked = uint32_saturate_mult(info.tcpi_unacked, info.tcpi_snd_mss);
+		ti->retrans = info.tcpi_total_retrans;
+		ti->rcv_space = info.tcpi_rcv_space;
+
+		return TRUE;
+	}
+#else
+	return FALSE;
+#endif	/* TCP_INFO && LINUX_SYSTEM */
+}
+
 /**
  * Shutdown the TX side of the socket.
  */
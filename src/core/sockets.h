@@ -177,6 +177,21 @@ struct udpctx {
 	size_t queued;						/**< Amount of bytes queued */
 };
 
+/**
+ * TCP connection telemetry, as reported by the kernel.
+ *
+ * Sizes are given in bytes, times in microseconds.
+ */
+typedef struct socket_tcp_info {
+	uint32 rtt;					/**< Smoothed round-trip time */
+	uint32 rttvar;				/**< Round-trip time variation */
+	uint32 mss;					/**< Sending maximum segment size */
+	uint32 cwnd;				/**< Congestion window */
+	uint32 unacked;				/**< Data sent but not acknowledged yet */
+	uint32 retrans;				/**< Total amount of retransmitted segments */
+	uint32 rcv_space;			/**< Receiver's estimate of data per RTT */
+} socket_tcp_info_t;
+
 static inline void
 socket_check(const struct gnutella_socket * const s)
 {
@@ -280,6 +295,7 @@ void socket_cork(struct gnutella_socket *s, bool on);
 void socket_send_buf(struct gnutella_socket *s, int size, bool shrink);
 void socket_recv_buf(struct gnutella_socket *s, int size, bool shrink);
 void socket_nodelay(struct gnutella_socket *s, bool on);
+bool socket_tcp_info(const struct gnutella_socket *s, socket_tcp_info_t *ti);
 void socket_tx_shutdown(struct gnutella_socket *s);
 void socket_tos_default(const struct gnutella_socket *s);
 void socket_tos_throughput(const struct gnutella_socket *s);
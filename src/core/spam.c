@@ -53,6 +53,7 @@
 #include "lib/path.h"
 #include "lib/pslist.h"
 #include "lib/str.h"
+#include "lib/thread.h"
 #include "lib/tokenizer.h"
 #include "lib/utf8.h"
 #include "lib/walloc.h"
@@ -119,6 +120,18 @@ struct spam_lut {
 
 static struct spam_lut spam_lut;
 
+/**
+ * Spam entries parsed from a file, not recorded yet.
+ */
+struct spam_parsed {
+	pslist_t *sha1s;	/**< List of struct sha1 (walloc()'ed) */
+	pslist_t *names;	/**< List of struct namesize_item */
+	char *pathname;		/**< File they were read from (halloc()'ed) */
+	bool done;			/**< Whether spam_parse() was run */
+};
+
+static struct spam_parsed spam_parsed;	/**< Parsed by spam_parse() */
+
 typedef enum {
 	SPAM_TAG_UNKNOWN = 0,
 	SPAM_TAG_ADDED,
@@ -157,7 +170,7 @@ struct namesize_item {
 };
 
 static bool
-spam_add_name_and_size(const char *name,
+spam_add_name_and_size(struct spam_parsed *sp, const char *name,
 	filesize_t min_size, filesize_t max_size)
 {
 	struct namesize_item *item;
@@ -179,7 +192,7 @@ spam_add_name_and_size(const char *name,
 	} else {
 		item->min_size = min_size;
 		item->max_size = max_size;
-		spam_lut.sl_names = pslist_prepend(spam_lut.sl_names, item);
+		sp->names = pslist_prepend(sp->names, item);
 		return FALSE;
 	}
 }
@@ -203,10 +216,13 @@ struct spam_item {
  * ADDED <date>
  * END
  *
+ * This only fills the supplied structure and can therefore be run by
+ * any thread: the entries are recorded by spam_record().
+ *
  * @returns the amount of entries loaded or -1 on failure.
  */
 static ulong G_COLD
-spam_load(FILE *f)
+spam_load(FILE *f, struct spam_parsed *parsed)
 {
 	static const struct spam_item zero_item;
 	struct spam_item item;
@@ -365,7 +381,8 @@ spam_load(FILE *f)
 
 		if (item.done && !item.damaged) {
 			if (bit_array_get(tag_used, SPAM_TAG_SHA1)) {
-				spam_sha1_add(&item.sha1);
+				parsed->sha1s =
+					pslist_prepend(parsed->sha1s, WCOPY(&item.sha1));
 				item_count++;
 			}
 			if (bit_array_get(tag_used, SPAM_TAG_NAME)) {
@@ -374,7 +391,7 @@ spam_load(FILE *f)
 					item.max_size = MAX_INT_VAL(filesize_t);
 				}
 				if (
-					spam_add_name_and_size(item.name,
+					spam_add_name_and_size(parsed, item.name,
 						item.min_size, item.max_size)
 				) {
 					item.damaged = TRUE;
@@ -398,9 +415,28 @@ spam_load(FILE *f)
 		}
 	}
 
+	return item_count;
+}
+
+/**
+ * Record the parsed spam entries, emptying the structure.
+ */
+static void
+spam_record(struct spam_parsed *sp)
+{
+	pslist_t *sl;
+
+	PSLIST_FOREACH(sp->sha1s, sl) {
+		struct sha1 *sha1 = sl->data;
+
+		spam_sha1_add(sha1);
+		WFREE(sha1);
+	}
+	pslist_free_null(&sp->sha1s);
 	spam_sha1_sync();
 
-	return item_count;
+	spam_lut.sl_names = pslist_concat(sp->names, spam_lut.sl_names);
+	sp->names = NULL;
 }
 
 /**
@@ -416,68 +452,79 @@ spam_changed(const char *filename, void *unused_udata)
 
 	f = file_fopen(filename, "r");
 	if (f) {
+		struct spam_parsed sp;
 		char buf[80];
 		ulong count;
 
-		spam_close();
-		count = spam_load(f);
+		ZERO(&sp);
+		count = spam_load(f, &sp);
 		fclose(f);
+		spam_close();
+		spam_record(&sp);
 
 		str_bprintf(ARYLEN(buf), "Reloaded %lu spam items.", count);
 		gcu_statusbar_message(buf);
 	}
 }
 
-static void
-spam_retrieve_from_file(FILE *f, const char *path, const char *filename)
-{
-	char *pathname;
-
-	g_assert(f);
-	g_assert(path);
-	g_assert(filename);
-
-	pathname = make_pathname(path, filename);
-	watcher_register(pathname, spam_changed, NULL);
-	HFREE_NULL(pathname);
-	spam_load(f);
-}
-
 /**
- * Loads the spam.txt into memory.
+ * Parses the spam databases, leaving the entries for spam_init().
  *
- * The selected file will then be monitored and a reloading will occur
- * shortly after a modification.
+ * This only reads files and can therefore be run by a separate thread.
  */
-static void
-spam_retrieve(void)
+void G_COLD
+spam_parse(void)
 {
+	struct spam_parsed *sp = &spam_parsed;
 	file_path_t fp[4];
 	FILE *f;
 	int idx;
 	unsigned length;
 
+	g_assert(!sp->done);
+
+	TOKENIZE_CHECK_SORTED(spam_tags);
+
+	spam_sha1_parse();
+
+	sp->done = TRUE;
 	length = settings_file_path_load(fp, spam_text_file, SFP_DFLT);
 
 	g_assert(length <= N_ITEMS(fp));
 
 	f = file_config_open_read_norename_chosen(spam_what, fp, length, &idx);
 	if (f != NULL) {
-		spam_retrieve_from_file(f, fp[idx].dir, fp[idx].name);
+		sp->pathname = make_pathname(fp[idx].dir, fp[idx].name);
+		spam_load(f, sp);
 		fclose(f);
 	}
 }
 
 /**
- * Called on startup. Loads the spam.txt into memory.
+ * Called on startup. Records the entries parsed by spam_parse(), parsing
+ * the spam.txt file now if not done yet.
+ *
+ * The selected file will then be monitored and a reloading will occur
+ * shortly after a modification.
  */
 void
 spam_init(void)
 {
-	TOKENIZE_CHECK_SORTED(spam_tags);
+	struct spam_parsed *sp = &spam_parsed;
+
+	g_assert(thread_is_main());
+
+	if (!sp->done)
+		spam_parse();
 
 	spam_sha1_init();
-	spam_retrieve();
+
+	if (NULL == sp->pathname)
+		return;
+
+	watcher_register(sp->pathname, spam_changed, NULL);
+	HFREE_NULL(sp->pathname);
+	spam_record(sp);
 }
 
 /**
@@ -41,6 +41,7 @@
 #include "spam_sha1.h"
 
 bool spam_check_filename_size(const char *filename, filesize_t size);
+void spam_parse(void);
 void spam_init(void);
 void spam_close(void);
 
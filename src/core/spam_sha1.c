@@ -51,6 +51,7 @@
 #include "lib/path.h"
 #include "lib/sorted_array.h"
 #include "lib/str.h"
+#include "lib/thread.h"
 #include "lib/watcher.h"
 
 #include "if/gnet_property.h"
@@ -85,6 +86,15 @@ struct sha1_lut {
 
 static struct sha1_lut sha1_lut;
 
+/**
+ * SHA-1s parsed by spam_sha1_parse(), until spam_sha1_init() records them.
+ */
+static struct spam_sha1_parsed {
+	struct sorted_array *tab;	/**< Parsed SHA-1s, NULL if no file found */
+	char *pathname;				/**< File they were read from (halloc()'ed) */
+	bool done;					/**< Whether spam_sha1_parse() was run */
+} spam_sha1_parsed;
+
 static inline G_PURE int
 sha1_cmp_func(const void *a, const void *b)
 {
@@ -176,7 +186,7 @@ spam_sha1_sync(void)
 }
 
 /**
- * Load spam database from the supplied FILE.
+ * Parse spam database from the supplied FILE.
  *
  * The current file format is as follows:
  *
@@ -185,19 +195,20 @@ spam_sha1_sync(void)
  * <SHA1 #2>
  * etc...
  *
- * @returns the amount of entries loaded or -1 on failure.
+ * This only fills the returned array and can therefore be run by any thread.
+ *
+ * @returns the sorted array of parsed SHA-1s.
  */
-static ulong G_COLD
-spam_sha1_load(FILE *f)
+static struct sorted_array * G_COLD
+spam_sha1_parse_file(FILE *f)
 {
 	char line[1024];
 	uint line_no = 0;
-	ulong item_count = 0;
+	struct sorted_array *tab;
 
 	g_assert(f);
 
-	spam_lut_create();
-	sha1_lut.state = SPAM_LOADING;
+	tab = sorted_array_new(sizeof(struct sha1), sha1_cmp_func);
 
 	while (fgets(line, sizeof(line), f)) {
 		const struct sha1 *sha1;
@@ -242,10 +253,32 @@ spam_sha1_load(FILE *f)
 				G_STRFUNC, line_no);
 			continue;
 		}
-		spam_sha1_add(sha1);
-		item_count++;
+		sorted_array_add(tab, sha1);
 	}
 
+	sorted_array_sync(tab, sha1_collision);
+
+	return tab;
+}
+
+/**
+ * Load the parsed SHA-1s into the spam database, freeing the array.
+ *
+ * @returns the amount of entries loaded.
+ */
+static ulong G_COLD
+spam_sha1_load(struct sorted_array **tab_ptr)
+{
+	struct sorted_array *tab = *tab_ptr;
+	ulong i, item_count = sorted_array_count(tab);
+
+	spam_lut_create();
+	sha1_lut.state = SPAM_LOADING;
+
+	for (i = 0; i < item_count; i++)
+		spam_sha1_add(sorted_array_item(tab, i));
+
+	sorted_array_free(tab_ptr);
 	spam_sha1_sync();
 	sha1_lut.state = SPAM_LOADED;
 
@@ -269,64 +302,71 @@ spam_sha1_changed(const char *filename, void *unused_udata)
 	f = file_fopen(filename, "r");
 	if (f) {
 		char buf[80];
+		struct sorted_array *tab;
 		ulong count;
 
-		spam_sha1_close();
-		count = spam_sha1_load(f);
+		tab = spam_sha1_parse_file(f);
 		fclose(f);
+		spam_sha1_close();
+		count = spam_sha1_load(&tab);
 
 		str_bprintf(ARYLEN(buf), "Reloaded %lu spam SHA-1 items.", count);
 		gcu_statusbar_message(buf);
 	}
 }
 
-static void
-spam_sha1_retrieve_from_file(FILE *f, const char *path, const char *filename)
-{
-	char *pathname;
-
-	g_assert(f);
-	g_assert(path);
-	g_assert(filename);
-
-	pathname = make_pathname(path, filename);
-	watcher_register(pathname, spam_sha1_changed, NULL);
-	HFREE_NULL(pathname);
-	spam_sha1_load(f);
-}
-
 /**
- * Loads the spam.txt into memory.
+ * Parses the spam_sha1.txt file, leaving the SHA-1s for spam_sha1_init().
  *
- * The selected file will then be monitored and a reloading will occur
- * shortly after a modification.
+ * This only reads the file and can therefore be run by a separate thread.
  */
-static void
-spam_sha1_retrieve(void)
+void G_COLD
+spam_sha1_parse(void)
 {
+	struct spam_sha1_parsed *sp = &spam_sha1_parsed;
 	file_path_t fp[4];
 	FILE *f;
 	int idx;
 	unsigned length;
 
+	g_assert(!sp->done);
+
+	sp->done = TRUE;
 	length = settings_file_path_load(fp, spam_sha1_file, SFP_DFLT);
 
 	g_assert(length <= N_ITEMS(fp));
 
 	f = file_config_open_read_norename_chosen(spam_sha1_what, fp, length, &idx);
 	if (f != NULL) {
-		spam_sha1_retrieve_from_file(f, fp[idx].dir, fp[idx].name);
+		sp->pathname = make_pathname(fp[idx].dir, fp[idx].name);
+		sp->tab = spam_sha1_parse_file(f);
 		fclose(f);
 	}
 }
 
 /**
- * Called on startup. Loads the spam.txt into memory.
+ * Called on startup. Loads the SHA-1s parsed by spam_sha1_parse(), parsing
+ * the spam_sha1.txt file now if not done yet.
+ *
+ * The selected file will then be monitored and a reloading will occur
+ * shortly after a modification.
  */
 void
 spam_sha1_init(void)
 {
-	spam_sha1_retrieve();
+	struct spam_sha1_parsed *sp = &spam_sha1_parsed;
+
+	g_assert(thread_is_main());
+
+	if (!sp->done)
+		spam_sha1_parse();
+
+	if (NULL == sp->tab)
+		return;
+
+	watcher_register(sp->pathname, spam_sha1_changed, NULL);
+	HFREE_NULL(sp->pathname);
+	spam_sha1_load(&sp->tab);
 }
 
 /**
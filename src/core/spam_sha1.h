@@ -41,6 +41,7 @@ struct sha1;
 bool spam_sha1_check(const struct sha1 *sha1);
 void spam_sha1_add(const struct sha1 *sha1);
 void spam_sha1_sync(void);
+void spam_sha1_parse(void);
 void spam_sha1_init(void);
 void spam_sha1_close(void);
 
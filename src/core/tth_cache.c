@@ -28,12 +28,35 @@
  *
  * Caching of tigertree data.
  *
- * The tigertree data for each shared file is stored in a file in the directory
- * GTK_GNUTELLA_DIR/tth_cache/ in raw binary form. For example, if the root
- * hash is 5EDB4PUVFGY2UKVISQ2DMACSPNRODTTODBS52RQ, the tigertree data is
- * stored in
+ * The tigertree data of all the shared files is stored in a few large
+ * append-only segment files in the directory GTK_GNUTELLA_DIR/tth_cache/,
+ * named "pack.0001", "pack.0002", etc...  Each segment starts with a small
+ * header, followed by records made of the root hash, the time at which the
+ * record was written and the amount of leaves, followed by the leaves in
+ * raw binary form.  A record with no leaves is a "tombstone" cancelling all
+ * the previous records for the same root hash.
+ *
+ * Only the last segment is appended to.  Once it reaches TTH_SEGMENT_MAX
+ * bytes, a new segment is started.  Segments are memory-mapped so that
+ * serving the tree to a THEX upload does not require any system call: the
+ * leaves are copied out of the mapping whilst holding the cache mutex.
+ *
+ * The location of the last record of each root hash is kept in memory,
+ * and saved in the "index" file on shutdown and after each cleanup, along
+ * with the size of each segment at that time.  On startup, only the data
+ * appended after the index was saved (e.g. before a crash) needs to be
+ * scanned.  Should the index be unusable, all the segments are scanned.
+ *
+ * The periodic cleanup, done by a separate thread, removes the entries that
+ * are no longer associated with a shared file and rewrites the segments
+ * where obsolete records take more than half of the space.
+ *
+ * Older versions stored the tigertree data in one file per root hash.  For
+ * instance, if the root hash was 5EDB4PUVFGY2UKVISQ2DMACSPNRODTTODBS52RQ,
+ * the data was stored in
  * $GTK_GNUTELLA_DIR/tth_cache/5E/DB4PUVFGY2UKVISQ2DMACSPNRODTTODBS52RQ.
- * This avoids storing too many files per directory.
+ * These files are moved into the segments by the first cleanup, and are
+ * looked at until then.
  *
  * Only the leaves at TTH_MAX_DEPTH or above are stored. The root hash and the
  * nodes at each level between above these leaves can be calculated from the
@@ -54,14 +77,23 @@
 #include "settings.h"
 #include "share.h"
 
+#include "lib/array_util.h"
+#include "lib/atomic.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/compat_pio.h"
+#include "lib/compat_sleep_ms.h"
+#include "lib/endian.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/ftw.h"
 #include "lib/halloc.h"
+#include "lib/hevset.h"
 #include "lib/hset.h"
 #include "lib/hstrfn.h"
+#include "lib/iovec.h"
+#include "lib/mutex.h"
+#include "lib/parse.h"
 #include "lib/path.h"
 #include "lib/pslist.h"
 #include "lib/spinlock.h"
@@ -70,6 +102,8 @@
 #include "lib/thread.h"
 #include "lib/tigertree.h"
 #include "lib/timestamp.h"
+#include "lib/tm.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 
 #include "if/gnet_property_priv.h"
@@ -83,6 +117,75 @@
 #define TTH_FILE_MODE (S_IRUSR | S_IWUSR | S_IRGRP) /* 0640 */
 #endif
 
+#define TTH_SEGMENT_PREFIX	"pack."		/**< Segment file name prefix */
+#define TTH_SEGMENT_MAGIC	"GTTHPACK"	/**< Segment header magic */
+#define TTH_SEGMENT_VERSION	1			/**< Segment format version */
+#define TTH_SEGMENT_HDR		16			/**< Magic + version + reserved */
+#define TTH_SEGMENT_MAX		(64 * 1024 * 1024)	/**< Max segment size */
+#define TTH_RECORD_HDR		32			/**< Root + stamp + leaf count */
+#define TTH_REMAP_SLACK		(1024 * 1024)	/**< Unmapped tail before remap */
+
+#define TTH_INDEX_FILE		"index"
+#define TTH_INDEX_MAGIC		"GTTHINDX"	/**< Index header magic */
+#define TTH_INDEX_VERSION	1			/**< Index format version */
+#define TTH_INDEX_ENTRY		40			/**< Root + seg + offset + count + stamp */
+
+#define TTH_MAGIC_LEN		8
+
+/**
+ * A segment file.
+ */
+struct tth_segment {
+	uint id;				/**< Segment number, in file name */
+	int fd;					/**< Opened file descriptor */
+	char *map;				/**< Read-only mapping of the file, if any */
+	size_t mapped;			/**< Length of mapping */
+	filesize_t size;		/**< Current size of the file */
+	filesize_t indexed;		/**< Size known to the saved index */
+	filesize_t live;		/**< Bytes held by live records */
+	uint map_failed:1;		/**< Do not attempt to map it again */
+};
+
+/**
+ * Location of the last record for a given root hash.
+ */
+struct tth_entry {
+	struct tth root;		/**< The root hash (embedded key) */
+	uint32 seg;				/**< Segment number */
+	uint32 offset;			/**< Offset of the record in the segment */
+	uint32 nleaves;			/**< Amount of leaves in the record */
+	uint32 stamp;			/**< When record was first written */
+};
+
+/**
+ * This mutex protects the index and the segments as seen by readers: it
+ * is only held for in-memory work, never across disk writes.
+ */
+static mutex_t tth_cache_mtx = MUTEX_INIT;
+
+#define TTH_CACHE_LOCK		mutex_lock(&tth_cache_mtx)
+#define TTH_CACHE_UNLOCK	mutex_unlock(&tth_cache_mtx)
+
+/**
+ * This mutex serializes the writers: appending records, changing the index
+ * and saving it.  It must be taken before the cache mutex, and is held
+ * whilst writing to the disk, so that lookups are not delayed by the I/O.
+ *
+ * The index, the segment list and the segment sizes can only change with
+ * both mutexes held, hence holding either one is enough to read them.
+ */
+static mutex_t tth_write_mtx = MUTEX_INIT;
+
+#define TTH_WRITE_LOCK		mutex_lock(&tth_write_mtx)
+#define TTH_WRITE_UNLOCK	mutex_unlock(&tth_write_mtx)
+
+static hevset_t *tth_index;				/**< root hash -> struct tth_entry */
+static struct tth_segment **tth_segs;	/**< Segments, by increasing ID */
+static uint tth_nsegs;					/**< Amount of segments */
+static bool tth_index_dirty;			/**< Saved index is out of date */
+static bool tth_migrated;				/**< No more legacy files */
+static bool tth_cache_closing;			/**< Set when shutting down */
+
 /**
  * This lock is used to protect the creation / removal of directories
  * under the TTH cache.
@@ -103,6 +206,19 @@ tth_cache_directory(void)
 	return NOT_LEAKING(directory);
 }
 
+/**
+ * @return size of a record holding the specified amount of leaves.
+ */
+static inline size_t
+tth_record_size(size_t nleaves)
+{
+	return TTH_RECORD_HDR + nleaves * TTH_RAW_SIZE;
+}
+
+/***
+ *** Legacy layout, one file per tigertree.
+ ***/
+
 static char *
 tth_cache_pathname(const struct tth *tth)
 {
@@ -117,126 +233,883 @@ tth_cache_pathname(const struct tth *tth)
 }
 
 static int
-tth_cache_file_create(const struct tth *tth)
+tth_cache_file_open(const struct tth *tth)
 {
 	char *pathname;
-	int accmode;
 	int fd;
 
 	g_return_val_if_fail(tth, -1);
 
-	accmode = O_WRONLY | O_TRUNC;
 	pathname = tth_cache_pathname(tth);
+	fd = file_open_missing(pathname, O_RDONLY);
+	HFREE_NULL(pathname);
+	return fd;
+}
 
-	/*
-	 * Critical section required since we could have a concurrent thread
-	 * deciding to remove empty directories whilst we are attempting
-	 * to create a new directory to store the new cached entry!
-	 */
+static size_t
+tth_cache_leave_count(const struct tth *tth, const filestat_t *sb)
+{
+	g_return_val_if_fail(tth, 0);
+	g_return_val_if_fail(sb, 0);
 
-	TTH_PATH_LOCK;
+	if (!S_ISREG(sb->st_mode)) {
+		g_warning("%s(%s): not a regular file", G_STRFUNC, tth_base32(tth));
+		return 0;
+	}
+	if (
+		sb->st_size % TTH_RAW_SIZE ||
+		sb->st_size < TTH_RAW_SIZE ||
+		sb->st_size > TTH_MAX_LEAVES * TTH_RAW_SIZE
+	) {
+		g_warning("%s(%s): bad filesize %s", G_STRFUNC,
+			tth_base32(tth), fileoffset_t_to_string(sb->st_size));
+		return 0;
+	}
 
-	fd = file_create_missing(pathname, accmode, TTH_FILE_MODE);
-	if (fd < 0 && ENOENT == errno) {
-		char *dir = filepath_directory(pathname);
-		if (0 == create_directory(dir, DEFAULT_DIRECTORY_MODE)) {
-			fd = file_create(pathname, accmode, TTH_FILE_MODE);
-		}
-		HFREE_NULL(dir);
+	return sb->st_size / TTH_RAW_SIZE;
+}
+
+/**
+ * Read leaves from a legacy file.
+ *
+ * @return the amount of leaves read, 0 if none.
+ */
+static size_t
+tth_cache_file_read(int fd, const struct tth *tth,
+	struct tth *leaves, size_t n)
+{
+	filestat_t sb;
+	size_t n_leaves;
+
+	if (fstat(fd, &sb)) {
+		g_warning("%s(%s): fstat() failed: %m", G_STRFUNC, tth_base32(tth));
+		return 0;
 	}
 
-	TTH_PATH_UNLOCK;
+	n_leaves = tth_cache_leave_count(tth, &sb);
+	n_leaves = MIN(n, n_leaves);
+	if (n_leaves > 0) {
+		size_t size;
+		ssize_t ret;
 
-	HFREE_NULL(pathname);
-	return fd;
+		STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
+
+		size = TTH_RAW_SIZE * n_leaves;
+		ret = read(fd, &leaves[0].data, size);
+		if ((size_t) ret != size)
+			n_leaves = 0;
+	}
+
+	return n_leaves;
 }
 
-static int
-tth_cache_file_open(const struct tth *tth)
+/**
+ * @return amount of leaves in the legacy file for the root hash, 0 if none.
+ */
+static size_t
+tth_cache_legacy_nleaves(const struct tth *tth)
 {
+	filestat_t sb;
 	char *pathname;
+	size_t nleaves = 0;
+
+	pathname = tth_cache_pathname(tth);
+	if (stat(pathname, &sb)) {
+		if (ENOENT != errno) {
+			g_warning("%s(%s): stat(\"%s\") failed: %m",
+				G_STRFUNC, tth_base32(tth), pathname);
+		}
+	} else {
+		nleaves = tth_cache_leave_count(tth, &sb);
+	}
+	HFREE_NULL(pathname);
+
+	return nleaves;
+}
+
+/**
+ * Read leaves from the legacy file for the root hash.
+ *
+ * @return the amount of leaves read, 0 if none.
+ */
+static size_t
+tth_cache_legacy_leaves(const struct tth *tth, struct tth *leaves, size_t n)
+{
 	int fd;
+	size_t num_leaves = 0;
 
-	g_return_val_if_fail(tth, -1);
+	fd = tth_cache_file_open(tth);
+	if (fd >= 0) {
+		num_leaves = tth_cache_file_read(fd, tth, leaves, n);
+		fd_forget_and_close(&fd);
+	}
+	return num_leaves;
+}
+
+/**
+ * Remove legacy file for the root hash, if any.
+ */
+static void
+tth_cache_legacy_remove(const struct tth *tth)
+{
+	char *pathname;
 
 	pathname = tth_cache_pathname(tth);
-	fd = file_open_missing(pathname, O_RDONLY);
+	unlink(pathname);
 	HFREE_NULL(pathname);
-	return fd;
 }
 
+/***
+ *** Segments.
+ ***/
+
+static char *
+tth_segment_pathname(uint id)
+{
+	return h_strdup_printf("%s%c%s%04u",
+		tth_cache_directory(), G_DIR_SEPARATOR, TTH_SEGMENT_PREFIX, id);
+}
+
+/**
+ * Drop the mapping of a segment, if any.
+ */
+static void
+tth_segment_unmap(struct tth_segment *seg)
+{
+#ifdef HAS_MMAP
+	if (seg->map != NULL) {
+		vmm_munmap(seg->map, seg->mapped);
+		seg->map = NULL;
+		seg->mapped = 0;
+	}
+#else
+	(void) seg;
+#endif	/* HAS_MMAP */
+}
+
+/**
+ * Map the whole segment in memory, replacing any previous mapping.
+ */
+static void
+tth_segment_map(struct tth_segment *seg)
+{
+#ifdef HAS_MMAP
+	void *p;
+
+	if (seg->map_failed || 0 == seg->size)
+		return;
+
+	tth_segment_unmap(seg);
+
+	p = vmm_mmap(NULL, seg->size, PROT_READ, MAP_SHARED, seg->fd, 0);
+	if (MAP_FAILED == p) {
+		g_warning("%s(): cannot map TTH cache segment #%u: %m",
+			G_STRFUNC, seg->id);
+		seg->map_failed = TRUE;
+	} else {
+		seg->map = p;
+		seg->mapped = seg->size;
+	}
+#else
+	(void) seg;
+#endif	/* HAS_MMAP */
+}
+
+/**
+ * Read data from a segment, through the mapping when possible.
+ *
+ * @return TRUE if OK.
+ */
 static bool
-tth_cache_file_exists(const struct tth *tth)
+tth_segment_read(struct tth_segment *seg,
+	filesize_t offset, void *buf, size_t len)
 {
-	bool ret;
-	char *pathname;
+	ssize_t r;
 
-	g_return_val_if_fail(tth, FALSE);
+	if (offset + len > seg->size)
+		return FALSE;
 
-	pathname = tth_cache_pathname(tth);
-	ret = file_exists(pathname);
-	HFREE_NULL(pathname);
-	return ret;
+	/*
+	 * The last segment is still being appended to: we only remap it when
+	 * enough data was added since it was last mapped.
+	 */
+
+	if (offset + len > seg->mapped && seg->size - seg->mapped >= TTH_REMAP_SLACK)
+		tth_segment_map(seg);
+
+	if (offset + len <= seg->mapped) {
+		memcpy(buf, seg->map + offset, len);
+		return TRUE;
+	}
+
+	r = compat_pread(seg->fd, buf, len, offset);
+	if ((ssize_t) -1 == r) {
+		g_warning("%s(): cannot read TTH cache segment #%u: %m",
+			G_STRFUNC, seg->id);
+		return FALSE;
+	}
+
+	return (size_t) r == len;
 }
 
-void
-tth_cache_insert(const struct tth *tth, const struct tth *leaves, int n_leaves)
+/**
+ * Close segment and free it, optionally removing the file.
+ */
+static void
+tth_segment_free(struct tth_segment *seg, bool remove)
 {
+	tth_segment_unmap(seg);
+	fd_forget_and_close(&seg->fd);
+
+	if (remove) {
+		char *path = tth_segment_pathname(seg->id);
+
+		if (-1 == unlink(path))
+			g_warning("%s(): cannot unlink %s: %m", G_STRFUNC, path);
+		HFREE_NULL(path);
+	}
+
+	WFREE(seg);
+}
+
+/**
+ * Open existing segment file, checking its header.
+ *
+ * @return the segment, NULL on error.
+ */
+static struct tth_segment *
+tth_segment_open(uint id)
+{
+	struct tth_segment *seg;
+	char hdr[TTH_SEGMENT_HDR];
+	char *path;
+	filestat_t sb;
 	int fd;
 
-	g_return_if_fail(tth);
-	g_return_if_fail(leaves);
-	g_return_if_fail(n_leaves >= 1);
+	path = tth_segment_pathname(id);
+	fd = file_open(path, O_RDWR, 0);
 
-	{
+	if (fd < 0)
+		goto failed;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat %s: %m", G_STRFUNC, path);
+		goto failed;
+	}
+
+	if (
+		sb.st_size < TTH_SEGMENT_HDR ||
+		sizeof hdr != compat_pread(fd, ARYLEN(hdr), 0) ||
+		0 != memcmp(hdr, TTH_SEGMENT_MAGIC, TTH_MAGIC_LEN) ||
+		TTH_SEGMENT_VERSION != peek_le32(&hdr[TTH_MAGIC_LEN])
+	) {
+		g_warning("%s(): ignoring invalid TTH cache segment %s",
+			G_STRFUNC, path);
+		goto failed;
+	}
+
+	WALLOC0(seg);
+	seg->id = id;
+	seg->fd = fd;
+	seg->size = sb.st_size;
+	HFREE_NULL(path);
+
+	return seg;
+
+failed:
+	fd_close(&fd);
+	HFREE_NULL(path);
+	return NULL;
+}
+
+/**
+ * Create new segment file, which becomes the last one.
+ *
+ * The write mutex must be held.
+ *
+ * @return the segment, NULL on error.
+ */
+static struct tth_segment *
+tth_segment_create(void)
+{
+	struct tth_segment *seg;
+	char hdr[TTH_SEGMENT_HDR];
+	char *path;
+	uint id;
+	int fd;
+
+	id = 0 == tth_nsegs ? 1 : tth_segs[tth_nsegs - 1]->id + 1;
+	path = tth_segment_pathname(id);
+
+	TTH_PATH_LOCK;
+
+	fd = file_create_missing(path, O_RDWR | O_TRUNC, TTH_FILE_MODE);
+	if (fd < 0 && ENOENT == errno) {
+		if (0 == create_directory(tth_cache_directory(), DEFAULT_DIRECTORY_MODE))
+			fd = file_create(path, O_RDWR | O_TRUNC, TTH_FILE_MODE);
+	}
+
+	TTH_PATH_UNLOCK;
+
+	if (fd < 0)
+		goto failed;
+
+	ZERO(&hdr);
+	memcpy(hdr, TTH_SEGMENT_MAGIC, TTH_MAGIC_LEN);
+	poke_le32(&hdr[TTH_MAGIC_LEN], TTH_SEGMENT_VERSION);
+
+	if (sizeof hdr != compat_pwrite(fd, ARYLEN(hdr), 0)) {
+		g_warning("%s(): cannot write header of %s: %m", G_STRFUNC, path);
+		fd_forget_and_close(&fd);
+		unlink(path);
+		goto failed;
+	}
+
+	WALLOC0(seg);
+	seg->id = id;
+	seg->fd = fd;
+	seg->size = TTH_SEGMENT_HDR;
+	HFREE_NULL(path);
+
+	TTH_CACHE_LOCK;
+	HREALLOC_ARRAY(tth_segs, tth_nsegs + 1);
+	tth_segs[tth_nsegs++] = seg;
+	TTH_CACHE_UNLOCK;
+
+	return seg;
+
+failed:
+	HFREE_NULL(path);
+	return NULL;
+}
+
+/**
+ * @return segment bearing the given ID, NULL if not found.
+ */
+static struct tth_segment *
+tth_segment_get(uint id)
+{
+	uint i;
+
+	for (i = 0; i < tth_nsegs; i++) {
+		if (id == tth_segs[i]->id)
+			return tth_segs[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Remove segment from the list of known segments.
+ */
+static void
+tth_segment_detach(const struct tth_segment *seg)
+{
+	uint i;
+
+	for (i = 0; i < tth_nsegs; i++) {
+		if (seg == tth_segs[i]) {
+			ARRAY_REMOVE_DEC(tth_segs, i, tth_nsegs);
+			tth_index_dirty = TRUE;
+			return;
+		}
+	}
+
+	g_assert_not_reached();
+}
+
+/***
+ *** Index.
+ ***/
+
+/**
+ * Record that the last record for the root hash is at the given location.
+ */
+static void
+tth_index_set(const struct tth *tth,
+	struct tth_segment *seg, uint32 offset, uint32 nleaves, uint32 stamp)
+{
+	struct tth_entry *e;
+
+	e = hevset_lookup(tth_index, tth);
+
+	if (e != NULL) {
+		struct tth_segment *old = tth_segment_get(e->seg);
+
+		if (old != NULL)
+			old->live -= tth_record_size(e->nleaves);
+	} else {
+		WALLOC(e);
+		e->root = *tth;
+		hevset_insert(tth_index, e);
+	}
+
+	e->seg = seg->id;
+	e->offset = offset;
+	e->nleaves = nleaves;
+	e->stamp = stamp;
+	seg->live += tth_record_size(nleaves);
+}
+
+/**
+ * Forget about the root hash in the index.
+ */
+static void
+tth_index_clear(const struct tth *tth)
+{
+	struct tth_entry *e;
+
+	e = hevset_lookup(tth_index, tth);
+
+	if (e != NULL) {
+		struct tth_segment *seg = tth_segment_get(e->seg);
+
+		if (seg != NULL)
+			seg->live -= tth_record_size(e->nleaves);
+		hevset_remove(tth_index, tth);
+		WFREE(e);
+	}
+}
+
+/**
+ * Scan records of a segment, starting at the given offset, updating the
+ * index.  An incomplete or corrupted record at the end, which can result
+ * from a crash, is truncated.
+ */
+static void
+tth_segment_scan(struct tth_segment *seg, filesize_t offset)
+{
+	filesize_t end = seg->size;
+
+	while (offset < end) {
+		char hdr[TTH_RECORD_HDR];
 		struct tth root;
+		uint32 nleaves;
 
-		root = tt_root_hash(leaves, n_leaves);
-		g_return_if_fail(tth_eq(tth, &root));
+		if (!tth_segment_read(seg, offset, ARYLEN(hdr)))
+			break;
+
+		memcpy(&root, hdr, TTH_RAW_SIZE);
+		nleaves = peek_le32(&hdr[TTH_RAW_SIZE + 4]);
+
+		if (nleaves > TTH_MAX_LEAVES || offset + tth_record_size(nleaves) > end)
+			break;
+
+		if (0 == nleaves) {
+			tth_index_clear(&root);
+		} else {
+			tth_index_set(&root, seg, offset, nleaves,
+				peek_le32(&hdr[TTH_RAW_SIZE]));
+		}
+
+		offset += tth_record_size(nleaves);
 	}
 
-	if (1 == n_leaves)
+	if (offset < end) {
+		g_warning("%s(): truncating TTH cache segment #%u at %s (was %s)",
+			G_STRFUNC, seg->id, filesize_to_string(offset),
+			filesize_to_string2(end));
+
+		tth_segment_unmap(seg);
+		if (-1 == ftruncate(seg->fd, offset)) {
+			g_warning("%s(): cannot truncate segment #%u: %m",
+				G_STRFUNC, seg->id);
+		}
+		seg->size = offset;
+	}
+}
+
+/**
+ * Free index entry -- hash set iterator callback.
+ */
+static bool
+tth_index_free_kv(void *value, void *unused_data)
+{
+	struct tth_entry *e = value;
+
+	(void) unused_data;
+
+	WFREE(e);
+	return TRUE;
+}
+
+/**
+ * Clear the whole index.
+ */
+static void
+tth_index_reset(void)
+{
+	uint i;
+
+	hevset_foreach_remove(tth_index, tth_index_free_kv, NULL);
+
+	for (i = 0; i < tth_nsegs; i++) {
+		tth_segs[i]->indexed = 0;
+		tth_segs[i]->live = 0;
+	}
+}
+
+/**
+ * Load the saved index.
+ *
+ * The index is only used if all the segments it lists still exist and are
+ * at least as large as they were when the index was saved.
+ *
+ * @return TRUE if the index was loaded.
+ */
+static bool
+tth_index_load(void)
+{
+	char hdr[TTH_MAGIC_LEN + 12];
+	char buf[TTH_INDEX_ENTRY];
+	uint32 nsegs, nentries, i;
+	char *path;
+	FILE *f;
+
+	path = make_pathname(tth_cache_directory(), TTH_INDEX_FILE);
+	f = file_fopen_missing(path, "rb");
+	HFREE_NULL(path);
+
+	if (NULL == f)
+		return FALSE;
+
+	if (
+		1 != fread(ARYLEN(hdr), 1, f) ||
+		0 != memcmp(hdr, TTH_INDEX_MAGIC, TTH_MAGIC_LEN) ||
+		TTH_INDEX_VERSION != peek_le32(&hdr[TTH_MAGIC_LEN])
+	)
+		goto invalid;
+
+	nsegs = peek_le32(&hdr[TTH_MAGIC_LEN + 4]);
+	nentries = peek_le32(&hdr[TTH_MAGIC_LEN + 8]);
+
+	for (i = 0; i < nsegs; i++) {
+		struct tth_segment *seg;
+		uint32 indexed;
+
+		if (1 != fread(buf, 8, 1, f))
+			goto invalid;
+
+		seg = tth_segment_get(peek_le32(&buf[0]));
+		indexed = peek_le32(&buf[4]);
+
+		if (NULL == seg || indexed > seg->size || indexed < TTH_SEGMENT_HDR)
+			goto invalid;
+
+		seg->indexed = indexed;
+	}
+
+	for (i = 0; i < nentries; i++) {
+		struct tth_segment *seg;
+		struct tth root;
+		uint32 offset, nleaves;
+
+		if (1 != fread(ARYLEN(buf), 1, f))
+			goto invalid;
+
+		memcpy(&root, buf, TTH_RAW_SIZE);
+		seg = tth_segment_get(peek_le32(&buf[TTH_RAW_SIZE]));
+		offset = peek_le32(&buf[TTH_RAW_SIZE + 4]);
+		nleaves = peek_le32(&buf[TTH_RAW_SIZE + 8]);
+
+		if (
+			NULL == seg || 0 == nleaves || nleaves > TTH_MAX_LEAVES ||
+			offset + tth_record_size(nleaves) > seg->indexed
+		)
+			goto invalid;
+
+		tth_index_set(&root, seg, offset, nleaves,
+			peek_le32(&buf[TTH_RAW_SIZE + 12]));
+	}
+
+	fclose(f);
+	return TRUE;
+
+invalid:
+	g_warning("%s(): ignoring invalid TTH cache index", G_STRFUNC);
+	fclose(f);
+	tth_index_reset();
+	return FALSE;
+}
+
+/**
+ * Serialize index entry -- hash set iterator callback.
+ */
+static void
+tth_index_write_kv(void *value, void *data)
+{
+	const struct tth_entry *e = value;
+	char **p = data;
+	char *buf = *p;
+
+	memcpy(buf, &e->root, TTH_RAW_SIZE);
+	poke_le32(&buf[TTH_RAW_SIZE], e->seg);
+	poke_le32(&buf[TTH_RAW_SIZE + 4], e->offset);
+	poke_le32(&buf[TTH_RAW_SIZE + 8], e->nleaves);
+	poke_le32(&buf[TTH_RAW_SIZE + 12], e->stamp);
+
+	*p += TTH_INDEX_ENTRY;
+}
+
+/**
+ * Save the index, atomically replacing the previous one.
+ *
+ * Segments are flushed first, so that the index never refers to data that
+ * could be lost in a crash.
+ *
+ * The write mutex must be held, which freezes the index: the cache mutex
+ * is only taken to serialize it in memory, lookups being able to proceed
+ * whilst the data is flushed and written.
+ */
+static void
+tth_index_save(void)
+{
+	char *path, *tmp, *buf, *p;
+	size_t len;
+	FILE *f;
+	uint i;
+	bool ok;
+
+	assert_mutex_is_owned(&tth_write_mtx);
+
+	if (!tth_index_dirty)
 		return;
 
-	fd = tth_cache_file_create(tth);
-	if (fd >= 0) {
-		size_t size;
-		ssize_t ret;
+	TTH_CACHE_LOCK;
 
-		STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
+	len = TTH_MAGIC_LEN + 12 + tth_nsegs * 8 +
+		hevset_count(tth_index) * TTH_INDEX_ENTRY;
+	p = buf = halloc(len);
 
-		size = TTH_RAW_SIZE * n_leaves;
-		ret = write(fd, leaves, size);
-		if ((ssize_t) -1 == ret) {
-			g_warning("%s(%s): write() failed: %m", G_STRFUNC, tth_base32(tth));
-		} else if ((size_t) ret != size) {
+	memcpy(p, TTH_INDEX_MAGIC, TTH_MAGIC_LEN);
+	poke_le32(&p[TTH_MAGIC_LEN], TTH_INDEX_VERSION);
+	poke_le32(&p[TTH_MAGIC_LEN + 4], tth_nsegs);
+	poke_le32(&p[TTH_MAGIC_LEN + 8], hevset_count(tth_index));
+	p += TTH_MAGIC_LEN + 12;
+
+	for (i = 0; i < tth_nsegs; i++) {
+		poke_le32(&p[0], tth_segs[i]->id);
+		poke_le32(&p[4], tth_segs[i]->size);
+		p += 8;
+	}
+
+	hevset_foreach(tth_index, tth_index_write_kv, &p);
+
+	TTH_CACHE_UNLOCK;
+
+	g_assert(ptr_diff(p, buf) == len);
+
+	for (i = 0; i < tth_nsegs; i++) {
+		if (tth_segs[i]->size != tth_segs[i]->indexed)
+			fd_fdatasync(tth_segs[i]->fd);
+	}
+
+	path = make_pathname(tth_cache_directory(), TTH_INDEX_FILE);
+	tmp = h_strconcat(path, ".new", NULL_PTR);
+
+	f = file_fopen(tmp, "wb");
+	if (NULL == f)
+		goto done;
+
+	ok = 1 == fwrite(buf, len, 1, f) && !ferror(f);
+
+	if (0 != file_sync_fclose(f) || !ok) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, tmp);
+		unlink(tmp);
+		goto done;
+	}
+
+	if (-1 == rename(tmp, path)) {
+		g_warning("%s(): cannot rename %s as %s: %m", G_STRFUNC, tmp, path);
+		unlink(tmp);
+		goto done;
+	}
+
+	for (i = 0; i < tth_nsegs; i++)
+		tth_segs[i]->indexed = tth_segs[i]->size;
+
+	tth_index_dirty = FALSE;
+
+done:
+	HFREE_NULL(buf);
+	HFREE_NULL(tmp);
+	HFREE_NULL(path);
+}
+
+/***
+ *** Records.
+ ***/
+
+/**
+ * Append a record to the last segment, starting a new one as needed.
+ *
+ * The write mutex must be held, but not the cache mutex: the record only
+ * becomes visible to readers once written.
+ *
+ * @param tth		the root hash
+ * @param leaves	the leaves (NULL for a tombstone)
+ * @param nleaves	amount of leaves (0 for a tombstone)
+ * @param stamp		time at which the record was first written
+ *
+ * @return the segment where the record was written, NULL on error, with
+ * the record offset returned in ``offset''.
+ */
+static struct tth_segment *
+tth_record_append(const struct tth *tth,
+	const struct tth *leaves, size_t nleaves, uint32 stamp, uint32 *offset)
+{
+	struct tth_segment *seg;
+	char hdr[TTH_RECORD_HDR];
+	iovec_t iov[2];
+	size_t len = tth_record_size(nleaves);
+	ssize_t r;
+
+	assert_mutex_is_owned(&tth_write_mtx);
+
+	seg = 0 == tth_nsegs ? NULL : tth_segs[tth_nsegs - 1];
+
+	if (NULL == seg || seg->size + len > TTH_SEGMENT_MAX) {
+		seg = tth_segment_create();
+		if (NULL == seg)
+			return NULL;
+	}
+
+	memcpy(hdr, tth, TTH_RAW_SIZE);
+	poke_le32(&hdr[TTH_RAW_SIZE], stamp);
+	poke_le32(&hdr[TTH_RAW_SIZE + 4], nleaves);
+
+	iov[0] = iov_get(ARYLEN(hdr));
+	iov[1] = iov_get(deconstify_pointer(leaves), nleaves * TTH_RAW_SIZE);
+
+	r = compat_pwritev(seg->fd, iov, 0 == nleaves ? 1 : 2, seg->size);
+
+	if ((ssize_t) len != r) {
+		if ((ssize_t) -1 == r) {
+			g_warning("%s(%s): write() failed: %m",
+				G_STRFUNC, tth_base32(tth));
+		} else {
 			g_warning("%s(%s): incomplete write()", G_STRFUNC, tth_base32(tth));
 		}
-		fd_forget_and_close(&fd);
+		if (-1 == ftruncate(seg->fd, seg->size))
+			g_warning("%s(): cannot truncate: %m", G_STRFUNC);
+		return NULL;
 	}
+
+	*offset = seg->size;
+
+	TTH_CACHE_LOCK;
+	seg->size += len;
+	TTH_CACHE_UNLOCK;
+
+	tth_index_dirty = TRUE;
+
+	return seg;
 }
 
+/**
+ * Read leaves for the index entry.
+ *
+ * @return amount of leaves read, 0 on error.
+ */
 static size_t
-tth_cache_leave_count(const struct tth *tth, const filestat_t *sb)
+tth_record_leaves(const struct tth_entry *e, struct tth *leaves, size_t n)
 {
-	g_return_val_if_fail(tth, 0);
-	g_return_val_if_fail(sb, 0);
+	struct tth_segment *seg;
+	size_t nleaves;
 
-	if (!S_ISREG(sb->st_mode)) {
-		g_warning("%s(%s): not a regular file", G_STRFUNC, tth_base32(tth));
+	seg = tth_segment_get(e->seg);
+	if (NULL == seg)
 		return 0;
-	}
+
+	nleaves = MIN(n, e->nleaves);
+
 	if (
-		sb->st_size % TTH_RAW_SIZE ||
-		sb->st_size < TTH_RAW_SIZE ||
-		sb->st_size > TTH_MAX_LEAVES * TTH_RAW_SIZE
-	) {
-		g_warning("%s(%s): bad filesize %s", G_STRFUNC,
-			tth_base32(tth), fileoffset_t_to_string(sb->st_size));
+		!tth_segment_read(seg, e->offset + TTH_RECORD_HDR,
+			leaves, nleaves * TTH_RAW_SIZE)
+	)
 		return 0;
+
+	return nleaves;
+}
+
+/**
+ * Append leaves to the cache, superseding any previous entry.
+ *
+ * The write mutex must be held.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+tth_cache_store(const struct tth *tth,
+	const struct tth *leaves, size_t nleaves, uint32 stamp)
+{
+	struct tth_segment *seg;
+	uint32 offset;
+
+	seg = tth_record_append(tth, leaves, nleaves, stamp, &offset);
+	if (NULL == seg)
+		return FALSE;
+
+	TTH_CACHE_LOCK;
+	tth_index_set(tth, seg, offset, nleaves, stamp);
+	TTH_CACHE_UNLOCK;
+
+	return TRUE;
+}
+
+/**
+ * @return whether the cache already holds these leaves for the root hash.
+ */
+static bool
+tth_cache_holds(const struct tth *tth, const struct tth *leaves, size_t nleaves)
+{
+	const struct tth_entry *e;
+	const struct tth_segment *seg;
+
+	e = hevset_lookup(tth_index, tth);
+
+	if (NULL == e || e->nleaves != nleaves)
+		return FALSE;
+
+	seg = tth_segment_get(e->seg);
+
+	return seg != NULL &&
+		e->offset + tth_record_size(nleaves) <= seg->mapped &&
+		0 == memcmp(seg->map + e->offset + TTH_RECORD_HDR,
+				leaves, nleaves * TTH_RAW_SIZE);
+}
+
+void
+tth_cache_insert(const struct tth *tth, const struct tth *leaves, int n_leaves)
+{
+	bool held;
+
+	g_return_if_fail(tth);
+	g_return_if_fail(leaves);
+	g_return_if_fail(n_leaves >= 1);
+
+	{
+		struct tth root;
+
+		root = tt_root_hash(leaves, n_leaves);
+		g_return_if_fail(tth_eq(tth, &root));
 	}
 
-	return sb->st_size / TTH_RAW_SIZE;
+	if (1 == n_leaves)
+		return;
+
+	STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
+
+	TTH_WRITE_LOCK;
+
+	TTH_CACHE_LOCK;
+	held = NULL == tth_index || tth_cache_holds(tth, leaves, n_leaves);
+	TTH_CACHE_UNLOCK;
+
+	if (!held)
+		(void) tth_cache_store(tth, leaves, n_leaves, tm_time());
+
+	TTH_WRITE_UNLOCK;
 }
 
 /**
@@ -251,20 +1124,7 @@ tth_cache_lookup(const struct tth *tth, filesize_t filesize)
 
 	expected = tt_good_node_count(filesize);
 	if (expected > 1) {
-		filestat_t sb;
-		char *pathname;
-
-		pathname = tth_cache_pathname(tth);
-		if (stat(pathname, &sb)) {
-			leave_count = 0;
-			if (ENOENT != errno) {
-				g_warning("%s(%s): stat(\"%s\") failed: %m",
-					G_STRFUNC, tth_base32(tth), pathname);
-			}
-		} else {
-			leave_count = tth_cache_leave_count(tth, &sb);
-		}
-		HFREE_NULL(pathname);
+		leave_count = tth_cache_get_nleaves(tth);
 	} else {
 		leave_count = 1;
 	}
@@ -274,50 +1134,61 @@ tth_cache_lookup(const struct tth *tth, filesize_t filesize)
 void
 tth_cache_remove(const struct tth *tth)
 {
-	char *pathname;
+	bool present;
 
 	g_return_if_fail(tth);
 
-	pathname = tth_cache_pathname(tth);
-	unlink(pathname);
-	HFREE_NULL(pathname);
+	/*
+	 * A legacy file can exist even when the root hash is in the index, and
+	 * it would be served again by the lookups once the index entry is gone.
+	 * Unlinking it first ensures a concurrent migration cannot store it
+	 * back after we cleared the index.
+	 */
+
+	if (!atomic_bool_get(&tth_migrated))
+		tth_cache_legacy_remove(tth);
+
+	TTH_WRITE_LOCK;
+
+	TTH_CACHE_LOCK;
+	present = tth_index != NULL && hevset_contains(tth_index, tth);
+	if (present)
+		tth_index_clear(tth);
+	TTH_CACHE_UNLOCK;
+
+	if (present) {
+		uint32 offset;
+
+		(void) tth_record_append(tth, NULL, 0, 0, &offset);
+	}
+
+	TTH_WRITE_UNLOCK;
 }
 
 static size_t
 tth_cache_get_leaves(const struct tth *tth,
 	struct tth leaves[TTH_MAX_LEAVES], size_t n)
 {
-	int fd, num_leaves = 0;
+	const struct tth_entry *e;
+	size_t num_leaves = 0;
+	bool found;
 
 	g_return_val_if_fail(tth, 0);
 	g_return_val_if_fail(leaves, 0);
 
-	fd = tth_cache_file_open(tth);
-	if (fd >= 0) {
-		filestat_t sb;
+	TTH_CACHE_LOCK;
 
-		if (fstat(fd, &sb)) {
-			g_warning("%s(%s): fstat() failed: %m", G_STRFUNC, tth_base32(tth));
-		} else {
-			size_t n_leaves;
+	e = NULL == tth_index ? NULL : hevset_lookup(tth_index, tth);
+	found = e != NULL;
 
-			n_leaves = tth_cache_leave_count(tth, &sb);
-			n_leaves = MIN(n, n_leaves);
-			if (n_leaves > 0) {
-				size_t size;
-				ssize_t ret;
+	if (found)
+		num_leaves = tth_record_leaves(e, leaves, n);
 
-				STATIC_ASSERT(TTH_RAW_SIZE == sizeof(leaves[0]));
+	TTH_CACHE_UNLOCK;
+
+	if (!found && !atomic_bool_get(&tth_migrated))
+		num_leaves = tth_cache_legacy_leaves(tth, leaves, n);
 
-				size = TTH_RAW_SIZE * n_leaves;
-				ret = read(fd, &leaves[0].data, size);
-				if ((size_t) ret == size) {
-					num_leaves = n_leaves;
-				}
-			}
-		}
-		fd_forget_and_close(&fd);
-	}
 	return num_leaves;
 }
 
@@ -364,7 +1235,7 @@ tth_cache_get_tree(const struct tth *tth, filesize_t filesize,
 		}
 	}
 
-	if (tth_cache_file_exists(tth)) {
+	if (0 != tth_cache_get_nleaves(tth)) {
 		g_warning("%s(): removing corrupted tigertree for %s",
 			G_STRFUNC, tth_base32(tth));
 		tth_cache_remove(tth);
@@ -382,28 +1253,31 @@ tth_cache_get_tree(const struct tth *tth, filesize_t filesize,
 size_t
 tth_cache_get_nleaves(const struct tth *tth)
 {
-	int fd;
-	filesize_t nleaves = 0;
+	const struct tth_entry *e;
+	size_t nleaves = 0;
+	bool found;
 
 	g_return_val_if_fail(tth != NULL, 0);
 
-	fd = tth_cache_file_open(tth);
+	TTH_CACHE_LOCK;
 
-	if (fd >= 0) {
-		filestat_t sb;
+	e = NULL == tth_index ? NULL : hevset_lookup(tth_index, tth);
+	found = e != NULL;
+	if (found)
+		nleaves = e->nleaves;
 
-		if (fstat(fd, &sb)) {
-			g_warning("%s(%s): fstat() failed: %m", G_STRFUNC, tth_base32(tth));
-		} else {
-			nleaves = tth_cache_leave_count(tth, &sb);
-		}
+	TTH_CACHE_UNLOCK;
 
-		fd_forget_and_close(&fd);
-	}
+	if (!found && !atomic_bool_get(&tth_migrated))
+		nleaves = tth_cache_legacy_nleaves(tth);
 
 	return nleaves;
 }
 
+/***
+ *** Cleanup.
+ ***/
+
 /**
  * Remove directory, warning only when it cannot be done for a reason other
  * than it not being empty.
@@ -416,7 +1290,7 @@ tth_cache_dir_rmdir(const char *path)
 
 	/*
 	 * To avoid any conflicts with another thread attempting to create a
-	 * file under that directory, take a lock.
+	 * segment under the root directory, take a lock.
 	 *
 	 * Note that there is a race condition between the traversal that detects
 	 * the directory is empty and the time we actually attempt to remove it.
@@ -434,7 +1308,6 @@ tth_cache_dir_rmdir(const char *path)
 	TTH_PATH_UNLOCK;
 }
 
-
 /**
  * ftw_foreach() callback to remove empty directories.
  */
@@ -493,13 +1366,64 @@ tth_cache_file_remove(const char *path, const char *reason)
 }
 
 /**
- * ftw_foreach() callback to remove obsolete / spurious files.
+ * Move legacy file into the segments.
+ */
+static void
+tth_cache_migrate_file(const char *path,
+	const struct tth *tth, const filestat_t *sb)
+{
+	static struct tth leaves[TTH_MAX_LEAVES];	/* Only one cleanup thread */
+	size_t n = 0;
+	int fd;
+
+	fd = file_open_missing(path, O_RDONLY);
+	if (fd >= 0) {
+		n = tth_cache_file_read(fd, tth, leaves, N_ITEMS(leaves));
+		fd_forget_and_close(&fd);
+	}
+
+	if (n > 1) {
+		struct tth root = tt_root_hash(leaves, n);
+
+		if (tth_eq(tth, &root)) {
+			/*
+			 * The file is gone if tth_cache_remove() was called whilst we
+			 * were reading it: do not resurrect the entry.
+			 */
+
+			bool known;
+
+			TTH_WRITE_LOCK;
+
+			TTH_CACHE_LOCK;
+			known = hevset_contains(tth_index, tth);
+			TTH_CACHE_UNLOCK;
+
+			if (!known && file_exists(path))
+				(void) tth_cache_store(tth, leaves, n, sb->st_mtime);
+
+			TTH_WRITE_UNLOCK;
+		} else {
+			tth_cache_file_remove(path, "corrupted");
+			return;
+		}
+	}
+
+	(void) tth_cache_file_unlink(path, "migrated");
+}
+
+/**
+ * ftw_foreach() callback to move legacy files into the segments and remove
+ * spurious files.
  */
 static ftw_status_t
-tth_cache_cleanup_unlink(
-	const ftw_info_t *info, const filestat_t *sb, void *data)
+tth_cache_cleanup_migrate(
+	const ftw_info_t *info, const filestat_t *sb, void *unused_data)
 {
-	const hset_t *shared = data;
+	(void) unused_data;
+
+	if (atomic_bool_get(&tth_cache_closing))
+		return FTW_STATUS_CANCELLED;
 
 	if (FTW_F_DIR & info->flags)
 		return FTW_STATUS_OK;
@@ -521,6 +1445,19 @@ tth_cache_cleanup_unlink(
 			return FTW_STATUS_OK;
 		}
 
+		/*
+		 * Our own segments and index live at the top of the cache.
+		 */
+
+		if (1 == info->level) {
+			if (
+				NULL == is_strprefix(info->fbase, TTH_SEGMENT_PREFIX) &&
+				NULL == is_strprefix(info->fbase, TTH_INDEX_FILE)
+			)
+				tth_cache_file_remove(info->fpath, "spurious");
+			return FTW_STATUS_OK;
+		}
+
 		if (info->level != 2) {
 			tth_cache_file_remove(info->fpath, "spurious");
 			return FTW_STATUS_OK;
@@ -541,42 +1478,291 @@ tth_cache_cleanup_unlink(
 			TTH_RAW_SIZE != base32_decode(VARLEN(tth), b32, TTH_BASE32_SIZE)
 		) {
 			tth_cache_file_remove(info->fpath, "invalid");
-			goto done;
+		} else {
+			tth_cache_migrate_file(info->fpath, &tth, sb);
 		}
 
-		/*
-		 * At this point, we have a valid TTH cache filename.
-		 *
-		 * We want to only process files created before the session started.
-		 *
-		 * The rationale is that users could start unsharing directories,
-		 * moving files around, add new files, etc..  Each time a new library
-		 * rescan occurs, we're going to create new TTH cache files, or some
-		 * cached files could become unused for a while and then files will
-		 * reappear in the library.
-		 *
-		 * By only ever cleaning up files created before the current session,
-		 * we have a higher likelyhood of processing an obsolete cache entry.
-		 */
+		g_strfreev(path);
+		return FTW_STATUS_OK;
+	}
+
+	g_assert_not_reached();
+	return FTW_STATUS_ERROR;
+}
+
+/**
+ * Move all the legacy files into the segments, then remove the legacy
+ * directories.
+ */
+static void
+tth_cache_migrate(const char *rootdir)
+{
+	pslist_t *dirstack;
+	uint32 flags;
+	ftw_status_t res;
 
-		if (delta_time(sb->st_mtime, GNET_PROPERTY(session_start_stamp)) >= 0)
-			goto done;		/* Created after session started, skip */
+	flags = FTW_O_PHYS | FTW_O_MOUNT | FTW_O_ALL;
+	res = ftw_foreach(rootdir, flags, 0, tth_cache_cleanup_migrate, NULL);
 
-		if (!hset_contains(shared, &tth)) {
-			if (debugging(0))
-				g_debug("%s(): unshared TTH (%s)", G_STRFUNC, info->rpath);
-			(void) tth_cache_file_unlink(info->fpath, "unshared");
+	if (res != FTW_STATUS_OK) {
+		if (res != FTW_STATUS_CANCELLED) {
+			g_warning("%s(): traversal failed with %d, will retry later",
+				G_STRFUNC, res);
 		}
+		return;
+	}
+
+	flags |= FTW_O_ENTRY | FTW_O_DEPTH;
+	dirstack = NULL;
+	(void) ftw_foreach(rootdir, flags, 0, tth_cache_cleanup_rmdir, &dirstack);
+	pslist_free(dirstack);
 
-		/* FALL THROUGH */
+	atomic_bool_set(&tth_migrated, TRUE);
 
-	done:
-		g_strfreev(path);
-		return FTW_STATUS_OK;
+	if (debugging(0))
+		g_debug("%s(): TTH cache migrated to %s", G_STRFUNC, rootdir);
+}
+
+struct tth_cache_purge {
+	const hset_t *shared;		/**< TTH of shared files */
+	time_t start;				/**< Session start */
+	struct tth *removed;		/**< Removed root hashes */
+	size_t count;				/**< Amount of removed root hashes */
+	size_t size;				/**< Allocated size of ``removed'' */
+};
+
+/**
+ * Remove entry when no longer shared -- hash set iterator callback.
+ */
+static bool
+tth_cache_purge_kv(void *value, void *data)
+{
+	struct tth_entry *e = value;
+	struct tth_cache_purge *ctx = data;
+	struct tth_segment *seg;
+
+	/*
+	 * We want to only process entries created before the session started.
+	 *
+	 * The rationale is that users could start unsharing directories,
+	 * moving files around, add new files, etc..  Each time a new library
+	 * rescan occurs, we're going to create new TTH cache entries, or some
+	 * cached entries could become unused for a while and then files will
+	 * reappear in the library.
+	 *
+	 * By only ever cleaning up entries created before the current session,
+	 * we have a higher likelyhood of processing an obsolete cache entry.
+	 */
+
+	if (delta_time((time_t) e->stamp, ctx->start) >= 0)
+		return FALSE;		/* Created after session started, skip */
+
+	if (hset_contains(ctx->shared, &e->root))
+		return FALSE;
+
+	if (debugging(0))
+		g_debug("%s(): unshared TTH %s", G_STRFUNC, tth_base32(&e->root));
+
+	if (ctx->count == ctx->size) {
+		ctx->size = MAX(64, ctx->size * 2);
+		HREALLOC_ARRAY(ctx->removed, ctx->size);
 	}
+	ctx->removed[ctx->count++] = e->root;
 
-	g_assert_not_reached();
-	return FTW_STATUS_ERROR;
+	seg = tth_segment_get(e->seg);
+	if (seg != NULL)
+		seg->live -= tth_record_size(e->nleaves);
+
+	WFREE(e);
+	return TRUE;
+}
+
+/**
+ * Remove all the entries created in previous sessions that can no longer
+ * be associated with a shared file.
+ */
+static void
+tth_cache_purge(void)
+{
+	struct tth_cache_purge ctx;
+	size_t i;
+
+	ZERO(&ctx);
+	ctx.shared = share_tthset_get();
+	ctx.start = GNET_PROPERTY(session_start_stamp);
+
+	TTH_WRITE_LOCK;
+
+	TTH_CACHE_LOCK;
+	hevset_foreach_remove(tth_index, tth_cache_purge_kv, &ctx);
+	TTH_CACHE_UNLOCK;
+
+	/*
+	 * Lookups can proceed whilst we write the tombstones.
+	 */
+
+	for (i = 0; i < ctx.count; i++) {
+		uint32 offset;
+
+		(void) tth_record_append(&ctx.removed[i], NULL, 0, 0, &offset);
+	}
+
+	TTH_WRITE_UNLOCK;
+
+	share_tthset_free(deconstify_pointer(ctx.shared));
+	HFREE_NULL(ctx.removed);
+
+	if (debugging(0) && ctx.count != 0) {
+		g_debug("%s(): removed %zu unshared TTH cache entr%s",
+			G_STRFUNC, ctx.count, plural_y(ctx.count));
+	}
+}
+
+/**
+ * Rewrite the live records of a segment at the end of the last segment,
+ * then remove the segment.
+ *
+ * Tombstones are copied as well, unless the segment is the oldest one,
+ * since they may cancel records in older segments.
+ *
+ * @return TRUE if the segment was removed.
+ */
+static bool
+tth_cache_compact_segment(struct tth_segment *seg)
+{
+	static struct tth leaves[TTH_MAX_LEAVES];	/* Only one cleanup thread */
+	filesize_t offset = TTH_SEGMENT_HDR;
+	bool oldest;
+
+	TTH_WRITE_LOCK;
+	oldest = seg == tth_segs[0];
+	TTH_WRITE_UNLOCK;
+
+	/*
+	 * Only the cleanup thread removes segments and nobody appends to this
+	 * one, so we can release the write mutex between records, which lets
+	 * the cache be updated during the compaction.  The cache mutex is only
+	 * held to read the record, not whilst writing its copy.
+	 */
+
+	while (offset < seg->size) {
+		char hdr[TTH_RECORD_HDR];
+		const struct tth_entry *e;
+		struct tth root;
+		uint32 nleaves, stamp = 0, o;
+		bool ok = TRUE, copy = FALSE;
+
+		if (atomic_bool_get(&tth_cache_closing))
+			return FALSE;
+
+		TTH_WRITE_LOCK;
+		TTH_CACHE_LOCK;
+
+		if (!tth_segment_read(seg, offset, ARYLEN(hdr))) {
+			TTH_CACHE_UNLOCK;
+			TTH_WRITE_UNLOCK;
+			break;
+		}
+
+		memcpy(&root, hdr, TTH_RAW_SIZE);
+		nleaves = peek_le32(&hdr[TTH_RAW_SIZE + 4]);
+		e = hevset_lookup(tth_index, &root);
+
+		if (0 == nleaves) {
+			copy = NULL == e && !oldest;
+		} else if (
+			e != NULL && e->seg == seg->id && e->offset == offset
+		) {
+			copy = TRUE;
+			stamp = e->stamp;
+			ok = tth_record_leaves(e, leaves, N_ITEMS(leaves)) == nleaves;
+		}
+
+		TTH_CACHE_UNLOCK;
+
+		if (ok && copy) {
+			if (0 == nleaves)
+				ok = NULL != tth_record_append(&root, NULL, 0, 0, &o);
+			else
+				ok = tth_cache_store(&root, leaves, nleaves, stamp);
+		}
+
+		TTH_WRITE_UNLOCK;
+
+		if (!ok) {
+			g_warning("%s(): cannot rewrite segment #%u, aborting",
+				G_STRFUNC, seg->id);
+			return FALSE;
+		}
+
+		offset += tth_record_size(nleaves);
+	}
+
+	/*
+	 * The index no longer refers to the segment: save it before removing
+	 * the segment so that nothing can be lost should we crash now.
+	 */
+
+	TTH_WRITE_LOCK;
+
+	if G_UNLIKELY(seg->live != 0) {
+		TTH_WRITE_UNLOCK;
+		g_warning("%s(): segment #%u still holds %s live bytes, keeping it",
+			G_STRFUNC, seg->id, filesize_to_string(seg->live));
+		return FALSE;
+	}
+
+	TTH_CACHE_LOCK;
+	tth_segment_detach(seg);
+	TTH_CACHE_UNLOCK;
+
+	tth_index_save();
+	tth_segment_free(seg, TRUE);
+
+	TTH_WRITE_UNLOCK;
+
+	return TRUE;
+}
+
+/**
+ * Compact all the segments where obsolete records use more than half
+ * of the space, except the last one which is still being filled.
+ */
+static void
+tth_cache_compact(void)
+{
+	for (;;) {
+		struct tth_segment *seg = NULL;
+		uint i;
+
+		if (atomic_bool_get(&tth_cache_closing))
+			return;
+
+		TTH_WRITE_LOCK;
+
+		for (i = 0; i + 1 < tth_nsegs; i++) {
+			struct tth_segment *s = tth_segs[i];
+
+			if (s->live < (s->size - TTH_SEGMENT_HDR) / 2) {
+				seg = s;
+				break;
+			}
+		}
+
+		TTH_WRITE_UNLOCK;
+
+		if (NULL == seg)
+			break;
+
+		if (debugging(0)) {
+			g_debug("%s(): compacting TTH cache segment #%u "
+				"(%s live bytes out of %s)", G_STRFUNC, seg->id,
+				filesize_to_string(seg->live), filesize_to_string2(seg->size));
+		}
+
+		if (!tth_cache_compact_segment(seg))
+			break;		/* Compaction failed or was interrupted */
+	}
 }
 
 static int tth_cache_cleanups;
@@ -587,11 +1773,7 @@ static int tth_cache_cleanups;
 static void *
 tth_cache_cleanup_thread(void *unused_arg)
 {
-	hset_t *shared;
 	const char *rootdir = tth_cache_directory();
-	pslist_t *dirstack;
-	uint32 flags;
-	ftw_status_t res;
 
 	(void) unused_arg;
 
@@ -599,30 +1781,32 @@ tth_cache_cleanup_thread(void *unused_arg)
 		goto done;			/* No TTH cache */
 
 	/*
-	 * First pass: spot all file entries that are older than our start
+	 * First pass: move any file left from the legacy layout into the
+	 * segments, removing the legacy directories.
+	 */
+
+	if (!atomic_bool_get(&tth_migrated))
+		tth_cache_migrate(rootdir);
+
+	/*
+	 * Second pass: remove all entries that are older than our start
 	 * time (i.e. were created in another session) and which cannot be
 	 * associated with a shared file.
 	 */
 
-	shared = share_tthset_get();
-	flags = FTW_O_PHYS | FTW_O_MOUNT | FTW_O_ALL;
-	res = ftw_foreach(rootdir, flags, 0, tth_cache_cleanup_unlink, shared);
-	share_tthset_free(shared);
-
-	if (res != FTW_STATUS_OK) {
-		g_warning("%s(): initial traversal failed with %d, aborting",
-			G_STRFUNC, res);
-		goto done;
-	}
+	if (!atomic_bool_get(&tth_cache_closing))
+		tth_cache_purge();
 
 	/*
-	 * Second pass: spot empty directories and remove them.
+	 * Third pass: reclaim space held by obsolete records.
 	 */
 
-	flags |= FTW_O_ENTRY | FTW_O_DEPTH;
-	dirstack = NULL;
-	(void) ftw_foreach(rootdir, flags, 0, tth_cache_cleanup_rmdir, &dirstack);
-	pslist_free(dirstack);
+	tth_cache_compact();
+
+	TTH_WRITE_LOCK;
+	if (!atomic_bool_get(&tth_cache_closing))
+		tth_index_save();
+	TTH_WRITE_UNLOCK;
 
 	/* FALL THROUGH */
 
@@ -637,6 +1821,9 @@ done:
 void
 tth_cache_cleanup(void)
 {
+	if (atomic_bool_get(&tth_cache_closing))
+		return;
+
 	if (0 == atomic_int_inc(&tth_cache_cleanups)) {
 		int id = thread_create(tth_cache_cleanup_thread,
 					NULL, THREAD_F_DETACH | THREAD_F_WARN, THREAD_STACK_MIN);
@@ -648,16 +1835,169 @@ tth_cache_cleanup(void)
 	}
 }
 
+/***
+ *** Initialization.
+ ***/
+
+/**
+ * Open all the segments found in the cache directory, by increasing ID.
+ *
+ * @return whether we found legacy sub-directories.
+ */
+static bool
+tth_cache_open_segments(const char *rootdir)
+{
+	DIR *d;
+	struct dirent *dentry;
+	bool legacy = FALSE;
+
+	d = opendir(rootdir);
+	if (NULL == d) {
+		if (ENOENT != errno)
+			g_warning("%s(): can't open directory %s: %m", G_STRFUNC, rootdir);
+		return FALSE;
+	}
+
+	while (NULL != (dentry = readdir(d))) {
+		const char *filename = dir_entry_filename(dentry);
+		const char *p, *end;
+		struct tth_segment *seg;
+		uint32 id;
+		int error;
+		uint i;
+
+		if ('.' == filename[0])
+			continue;
+
+		if (2 == strlen(filename)) {
+			legacy = TRUE;
+			continue;
+		}
+
+		p = is_strprefix(filename, TTH_SEGMENT_PREFIX);
+		if (NULL == p)
+			continue;
+
+		id = parse_uint32(p, &end, 10, &error);
+		if (error || '\0' != *end || 0 == id)
+			continue;
+
+		seg = tth_segment_open(id);
+		if (NULL == seg)
+			continue;
+
+		HREALLOC_ARRAY(tth_segs, tth_nsegs + 1);
+		for (i = tth_nsegs; i > 0 && tth_segs[i - 1]->id > id; i--)
+			tth_segs[i] = tth_segs[i - 1];
+		tth_segs[i] = seg;
+		tth_nsegs++;
+	}
+
+	closedir(d);
+	return legacy;
+}
+
 void
 tth_cache_init(void)
 {
-	/* NOTHING */
+	const char *rootdir = tth_cache_directory();
+	tm_t start, end;
+	bool legacy;
+	uint i;
+
+	tm_now_exact(&start);
+
+	TTH_WRITE_LOCK;
+	TTH_CACHE_LOCK;
+
+	tth_index = hevset_create_any(offsetof(struct tth_entry, root),
+		tth_hash, NULL, tth_eq);
+
+	legacy = tth_cache_open_segments(rootdir);
+	tth_migrated = !legacy;
+
+	/*
+	 * Load the index, then scan what was appended to the segments after
+	 * the index was saved.  Segments are mapped before scanning so that
+	 * reading the record headers does not require system calls.
+	 */
+
+	if (!tth_index_load())
+		tth_index_dirty = TRUE;
+
+	for (i = 0; i < tth_nsegs; i++) {
+		struct tth_segment *seg = tth_segs[i];
+
+		tth_segment_map(seg);
+
+		if (seg->size != seg->indexed) {
+			tth_segment_scan(seg, MAX(seg->indexed, TTH_SEGMENT_HDR));
+			tth_index_dirty = TRUE;
+		}
+	}
+
+	TTH_CACHE_UNLOCK;
+	TTH_WRITE_UNLOCK;
+
+	tm_now_exact(&end);
+
+	if (debugging(0) || legacy) {
+		g_info("TTH cache: %zu entr%s in %u segment%s loaded in %g secs%s",
+			hevset_count(tth_index), plural_y(hevset_count(tth_index)),
+			tth_nsegs, plural(tth_nsegs), tm_elapsed_f(&end, &start),
+			legacy ? ", legacy files will be migrated" : "");
+	}
+}
+
+/**
+ * Stop any running cleanup and prevent new ones from being launched.
+ *
+ * This must be called before the library is discarded, since the cleanup
+ * thread needs to know about the shared files.
+ */
+void
+tth_cache_shutdown(void)
+{
+	/*
+	 * Wait for any running cleanup, which will stop as soon as possible.
+	 */
+
+	atomic_bool_set(&tth_cache_closing, TRUE);
+
+	while (0 != atomic_int_get(&tth_cache_cleanups))
+		compat_sleep_ms(50);
 }
 
+/**
+ * Close the TTH cache, saving the index.
+ */
 void
 tth_cache_close(void)
 {
-	/* NOTHING */
+	uint i;
+
+	tth_cache_shutdown();
+
+	TTH_WRITE_LOCK;
+
+	if (tth_index != NULL)
+		tth_index_save();
+
+	TTH_CACHE_LOCK;
+
+	if (tth_index != NULL) {
+		hevset_foreach_remove(tth_index, tth_index_free_kv, NULL);
+		hevset_free_null(&tth_index);
+	}
+
+	for (i = 0; i < tth_nsegs; i++)
+		tth_segment_free(tth_segs[i], FALSE);
+
+	HFREE_NULL(tth_segs);
+	tth_nsegs = 0;
+
+	TTH_CACHE_UNLOCK;
+	TTH_WRITE_UNLOCK;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -35,6 +35,7 @@ size_t tth_cache_get_tree(const struct tth *tth, filesize_t filesize,
 		const struct tth **tree);
 size_t tth_cache_get_nleaves(const struct tth *tth);
 void tth_cache_remove(const struct tth *tth);
+void tth_cache_shutdown(void);
 void tth_cache_close(void);
 
 void tth_cache_cleanup(void);
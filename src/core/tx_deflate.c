@@ -39,6 +39,7 @@
 
 #include "tx.h"
 #include "tx_deflate.h"
+#include "gnet_stats.h"
 #include "hosts.h"
 #include "sockets.h"
 
@@ -100,6 +101,8 @@ struct attr {
 	tx_closed_t closed;			/**< Callback to invoke when layer closed */
 	void *closed_arg;			/**< Argument for closing routine */
 	time_t nagle_start;			/**< When we started the Nagle timer */
+	size_t memory;				/**< Estimated zlib memory */
+	bool gnet;					/**< Gnutella link, accounted in stats */
 	struct {
 		bool		enabled;	/**< Whether to use gzip encapsulation */
 		uint32		size;		/**< Payload size counter for gzip */
@@ -826,6 +829,7 @@ tx_deflate_init(txdrv_t *tx, void *args)
 	struct attr *attr;
 	struct tx_deflate_args *targs = args;
 	z_streamp outz;
+	size_t memory;
 	int ret;
 	int i;
 
@@ -890,6 +894,8 @@ tx_deflate_init(txdrv_t *tx, void *args)
 		ret = deflateInit2(outz, level, Z_DEFLATED,
 				targs->gzip ? (-window_bits) : window_bits, mem_level,
 				Z_DEFAULT_STRATEGY);
+
+		memory = zlib_deflate_memory(window_bits, mem_level);
 	}
 
 	if (Z_OK != ret) {
@@ -900,6 +906,12 @@ tx_deflate_init(txdrv_t *tx, void *args)
 	}
 
 	WALLOC0(attr);
+	attr->memory = memory;
+	attr->gnet = targs->gnet;
+	if (attr->gnet) {
+		gnet_stats_inc_general(GNR_TX_DEFLATE_LINKS);
+		gnet_stats_count_general(GNR_TX_DEFLATE_MEMORY, memory);
+	}
 	attr->cq = targs->cq;
 	attr->cb = targs->cb;
 	attr->buffer_size = targs->buffer_size;
@@ -980,6 +992,10 @@ tx_deflate_destroy(txdrv_t *tx)
 
 	WFREE(attr->outz);
 	cq_cancel(&attr->tm_ev);
+	if (attr->gnet) {
+		gnet_stats_dec_general(GNR_TX_DEFLATE_LINKS);
+		gnet_stats_count_general(GNR_TX_DEFLATE_MEMORY, -(int) attr->memory);
+	}
 	WFREE(attr);
 }
 
@@ -61,6 +61,7 @@ struct tx_deflate_args {
 	bool nagle;					/**< Whether to use Nagle or not */
 	bool gzip;					/**< Whether to use gzip encapsulation */
 	bool reduced;				/**< Whether to use reduced compression */
+	bool gnet;					/**< Gnutella link, for stats */
 };
 
 #endif	/* _core_tx_deflate_h_ */
@@ -58,6 +58,7 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
+#include "lib/aioq.h"
 #include "lib/atomic.h"
 #include "lib/atoms.h"
 #include "lib/barrier.h"
@@ -82,6 +83,7 @@
 #include "lib/override.h"	/* Must be the last header included */
 
 #define HASH_BUF_SIZE		(128 * 1024)	/**< Size of the reading buffer */
+#define HASH_READ_DEPTH		4				/**< Amount of reads in flight */
 
 #define HASH_THREAD_MAX			2			/**< At most 2 hashing threads */
 #define VERIFY_DEFERRED			10			/**< ms: deferred free timeout */
@@ -108,8 +110,18 @@ struct verify {
 	filesize_t end;				/**< End offset of range to verify . */
 	time_t started;				/**< Start time, to determine comp. rate */
 	time_t last_progress;		/**< Last time we informed about progress */
-	char *buffer;				/**< Read buffer */
-	size_t buffer_size;			/**< Size of buffer in bytes. */
+	char *buffer;				/**< Read buffers, one per queued read */
+	size_t buffer_size;			/**< Size of each buffer in bytes. */
+	aioq_t *aq;					/**< Queue for reads in flight */
+	filesize_t queued;			/**< Offset of next read to queue */
+	uint head;					/**< Read slot to hash next */
+	uint inflight;				/**< Amount of slots with a queued read */
+	struct verify_read {
+		size_t len;				/**< Amount of bytes requested */
+		ssize_t ret;			/**< Read result, once completed */
+		int error;				/**< Read error, when ret is -1 */
+		bool done;				/**< Whether read completed */
+	} reads[HASH_READ_DEPTH];
 
 	enum verify_status status;	/**< Used for callback multiplexing. */
 	uint8 shutdowned;			/**< Flag indicating context was shutdown */
@@ -606,7 +618,7 @@ verify_new(const struct verify_hash *hash)
 	WALLOC0(ctx);
 	ctx->magic = VERIFY_MAGIC;
 	ctx->buffer_size = HASH_BUF_SIZE;
-	ctx->buffer = halloc(ctx->buffer_size);
+	ctx->buffer = halloc(ctx->buffer_size * HASH_READ_DEPTH);
 	STATIC_ASSERT(sizeof ctx->hash == sizeof(struct verify_hash));
 	*(struct verify_hash *) &ctx->hash = *hash;		/* Assignment to "const" */
 	ctx->files_to_hash = hash_list_new(verify_item_hash, verify_item_equal);
@@ -653,6 +665,7 @@ verify_deferred_free(cqueue_t *cq, void *data)
 		}
 
 		hash_list_free(&ctx->files_to_hash);
+		aioq_free_null(&ctx->aq);
 		ctx->magic = 0;
 		WFREE(ctx);
 	}
@@ -715,6 +728,158 @@ verify_context_free(void *data)
 	}
 }
 
+/**
+ * @return read buffer for given slot.
+ */
+static inline char *
+verify_read_buffer(const struct verify *ctx, uint slot)
+{
+	return &ctx->buffer[slot * ctx->buffer_size];
+}
+
+/**
+ * Record completion of a read.
+ */
+static void
+verify_read_done(struct verify *ctx, const aioq_result_t *res)
+{
+	struct verify_read *vr;
+	size_t slot = pointer_to_size(res->udata);
+
+	g_assert(slot < HASH_READ_DEPTH);
+
+	vr = &ctx->reads[slot];
+	g_assert(!vr->done);
+
+	vr->ret = res->ret;
+	vr->error = res->error;
+	vr->done = TRUE;
+}
+
+/**
+ * Wait for all the reads in flight, discarding their data, so that reading
+ * can resume from the current offset.
+ */
+static void
+verify_read_drain(struct verify *ctx)
+{
+	aioq_result_t res;
+	uint i;
+
+	if (ctx->aq != NULL) {
+		while (aioq_reap(ctx->aq, TRUE, &res))
+			verify_read_done(ctx, &res);
+	}
+
+	for (i = 0; i < N_ITEMS(ctx->reads); i++)
+		ctx->reads[i].done = FALSE;
+
+	ctx->head = 0;
+	ctx->inflight = 0;
+	ctx->queued = ctx->offset;
+}
+
+/**
+ * Close the file being hashed, once no read is in flight.
+ */
+static void
+verify_close_file(struct verify *ctx)
+{
+	verify_read_drain(ctx);
+	file_object_close(&ctx->file);
+}
+
+/**
+ * Queue reads ahead of the data being hashed, so that the disk is kept
+ * busy whilst we are computing.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+static int
+verify_read_ahead(struct verify *ctx)
+{
+	/*
+	 * The queue is created by the thread doing the hashing, which is the
+	 * only one using it.
+	 */
+
+	if G_UNLIKELY(NULL == ctx->aq)
+		ctx->aq = aioq_make(HASH_READ_DEPTH);
+
+	while (ctx->inflight < HASH_READ_DEPTH && ctx->queued < ctx->end) {
+		uint slot = (ctx->head + ctx->inflight) % HASH_READ_DEPTH;
+		struct verify_read *vr = &ctx->reads[slot];
+
+		vr->len = MIN(ctx->end - ctx->queued, ctx->buffer_size);
+		vr->done = FALSE;
+
+		if (
+			-1 == file_object_pread_async(ctx->file, ctx->aq,
+				verify_read_buffer(ctx, slot), vr->len, ctx->queued,
+				size_to_pointer(slot))
+		)
+			return -1;
+
+		ctx->queued += vr->len;
+		ctx->inflight++;
+	}
+
+	return 0;
+}
+
+/**
+ * Read next buffer to hash.
+ *
+ * @param ctx		the verification context
+ * @param buf		where the data buffer is returned
+ *
+ * @return amount of bytes read, 0 at the end, -1 on error with errno set.
+ */
+static ssize_t
+verify_read(struct verify *ctx, const char **buf)
+{
+	struct verify_read *vr;
+	aioq_result_t res;
+	uint slot;
+
+	if (-1 == verify_read_ahead(ctx)) {
+		int saved_errno = errno;
+		verify_read_drain(ctx);
+		errno = saved_errno;
+		return -1;
+	}
+
+	if (0 == ctx->inflight)
+		return 0;
+
+	slot = ctx->head;
+	vr = &ctx->reads[slot];
+
+	while (!vr->done && aioq_reap(ctx->aq, TRUE, &res))
+		verify_read_done(ctx, &res);
+
+	g_assert(vr->done);
+
+	vr->done = FALSE;
+	ctx->head = (ctx->head + 1) % HASH_READ_DEPTH;
+	ctx->inflight--;
+
+	/*
+	 * On errors and short reads, the reads queued after this one are
+	 * discarded and reading will resume where this one stopped.
+	 */
+
+	if (vr->ret != (ssize_t) vr->len) {
+		verify_read_drain(ctx);
+		ctx->queued += MAX(vr->ret, 0);
+		if ((ssize_t) -1 == vr->ret)
+			errno = vr->error;
+	}
+
+	*buf = verify_read_buffer(ctx, slot);
+	return vr->ret;
+}
+
 static void
 verify_next_file(struct verify *ctx)
 {
@@ -732,7 +897,7 @@ verify_next_file(struct verify *ctx)
 		ctx->callback = item->callback;
 		ctx->start = item->offset;
 		ctx->end = item->offset + item->amount;
-		ctx->offset = ctx->start;
+		ctx->offset = ctx->queued = ctx->start;
 
 		if (verify_start(ctx)) {
 			ctx->file = file_object_open(item->pathname, O_RDONLY);
@@ -771,7 +936,7 @@ done:
 	else
 		verify_failure(ctx);
 
-	file_object_close(&ctx->file);
+	verify_close_file(ctx);
 }
 
 static void
@@ -789,26 +954,18 @@ verify_final(struct verify *ctx)
 	} else {
 		verify_done(ctx);
 	}
-	file_object_close(&ctx->file);
+	verify_close_file(ctx);
 }
 
 static void
 verify_update(struct verify *ctx)
 {
+	const char *buf = NULL;
 	ssize_t r;
 
 	verify_check(ctx);
 
-	if (ctx->offset < ctx->end) {
-		filesize_t amount;
-		size_t n;
-
-		amount = ctx->end - ctx->offset;
-		n = MIN(amount, ctx->buffer_size);
-		r = file_object_pread(ctx->file, ctx->buffer, n, ctx->offset);
-	} else {
-		r = 0;
-	}
+	r = verify_read(ctx, &buf);
 
 	if ((ssize_t) -1 == r) {
 		if (!is_temporary_error(errno)) {
@@ -823,7 +980,7 @@ verify_update(struct verify *ctx)
 
 		ctx->offset += (size_t) r;
 
-		if (verify_hash_update(ctx, ctx->buffer, r)) {
+		if (verify_hash_update(ctx, buf, r)) {
 			g_warning("%s computation error for \"%s\"",
 				verify_hash_name(ctx), file_object_pathname(ctx->file));
 			goto error;
@@ -851,7 +1008,7 @@ verify_update(struct verify *ctx)
 
 error:
 	verify_failure(ctx);
-	file_object_close(&ctx->file);
+	verify_close_file(ctx);
 }
 
 /**
@@ -903,7 +1060,7 @@ verify_bg_sighandler(struct bgtask *bt, void *data, bgsig_t sig)
 
 	if (ctx->file != NULL) {
 		verify_shutdown(ctx);
-		file_object_close(&ctx->file);
+		verify_close_file(ctx);
 	}
 	HFREE_NULL(ctx->buffer);
 
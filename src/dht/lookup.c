@@ -3896,8 +3896,10 @@ lookup_send(nlookup_t *nl, knode_t *kn)
 	map_insert(nl->pending, kn->id, knode_refcnt_inc(kn));
 
 	switch (nl->type) {
-	case LOOKUP_NODE:
 	case LOOKUP_STORE:
+		gnet_stats_inc_general(GNR_DHT_STORE_ROOT_LOOKUP_RPCS);
+		/* FALL THROUGH */
+	case LOOKUP_NODE:
 	case LOOKUP_TOKEN:
 	case LOOKUP_REFRESH:
 		revent_find_node(kn, nl->kuid, nl->lid, &lookup_ops, nl->hops);
@@ -4205,6 +4207,9 @@ lookup_load_shortlist(nlookup_t *nl)
 
 	kcnt = roots_fill_closest(nl->kuid, kvec, KDA_K, nl->shortlist);
 
+	if (LOOKUP_STORE == nl->type && kcnt != 0)
+		gnet_stats_inc_general(GNR_DHT_STORE_ROOT_LOOKUPS_SEEDED);
+
 	for (i = 0; i < kcnt; i++) {
 		knode_t *kn = kvec[i];
 
@@ -4377,6 +4382,7 @@ lookup_store_nodes(
 		return NULL;
 	}
 
+	gnet_stats_inc_general(GNR_DHT_STORE_ROOT_LOOKUPS);
 	lookup_async_iterate(nl);
 	return nl;
 }
@@ -166,6 +166,7 @@ struct dl_buffers {
 	slist_t *list;			/**< List of pmsg_t items */
 	size_t amount;			/**< Amount to buffer (extra is read-ahead) */
 	size_t held;			/**< Amount of data held in read buffers */
+	bool verifiable;		/**< Held data are covered by a known TTH tree */
 };
 
 /**
@@ -235,6 +236,8 @@ struct download {
 
 	struct dl_chunk chunk;		/**< Requested chunk */
 	filesize_t pos;				/**< Current file data writing position */
+	uint aio_pending;			/**< Writes queued, not completed yet */
+	int aio_error;				/**< Error of a failed queued write, or 0 */
 
 	struct dl_pipeline *pipeline;	/**< If non-NULL: pipelined HTTP request */
 
@@ -265,6 +268,8 @@ struct download {
 	const char *uri;			/**< Uri if not dealing with regular gnutella
 								 **< file download */
 	time_t last_dmesh;			/**< Time when last download mesh was sent */
+	const char *persisted;		/**< Magnet last persisted (atom), or NULL */
+	uint64 persisted_digest;	/**< Digest of what the magnet was built from */
 
 	http_rangeset_t *ranges;	/**< PFSP -- known set of ranges, or NULL */
 	filesize_t ranges_size;		/**< PFSP -- size of remotely available data */
@@ -170,6 +170,7 @@ typedef struct dl_file_info {
 	time_t last_dht_query;	/**< Last time when SHA1 DHT query was made */
 	filesize_t done;		/**< Total number of bytes completed (flushed) */
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
+	filesize_t unsynced;	/**< Amount written since last forced sync */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
 	eslist_t chunklist;		/**< List of ranges within file */
 	eslist_t available;		/**< List of ranges available, with source count */
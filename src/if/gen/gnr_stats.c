@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Mar 10 21:55:45 2019 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 02:07:08 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -126,6 +126,8 @@ static const char *stats_symbols[] = {
 	"udp_fw2fw_pushes_patched",
 	"udp_uhc_pings",
 	"udp_uhc_pongs",
+	"pcache_pongs_encoded",
+	"pcache_pongs_reused",
 	"udp_bogus_source_ip",
 	"udp_shunned_source_ip",
 	"udp_rx_truncated",
@@ -135,6 +137,10 @@ static const char *stats_symbols[] = {
 	"udp_rx_compressed",
 	"udp_compression_attempts",
 	"udp_larger_hence_not_compressed",
+	"tx_deflate_links",
+	"tx_deflate_memory",
+	"rx_inflate_links",
+	"rx_inflate_memory",
 	"udp_sched_directly_sent_prio_data",
 	"udp_sched_directly_sent_prio_control",
 	"udp_sched_directly_sent_prio_urgent",
@@ -430,6 +436,33 @@ static const char *stats_symbols[] = {
 	"stats_digest",
 	"stats_tcp_digest",
 	"stats_udp_digest",
+	"persist_journal_bytes",
+	"persist_checkpoint_bytes",
+	"persist_bytes_last_hour",
+	"download_writes",
+	"download_written_bytes",
+	"download_avg_write_size",
+	"download_writeback_bytes",
+	"download_syncs",
+	"dmesh_altlocs",
+	"dmesh_memory",
+	"dmesh_altloc_avg_size",
+	"dmesh_evicted",
+	"browse_cache_built",
+	"browse_cache_hits",
+	"browse_cache_precompressed",
+	"browse_cache_memory",
+	"dht_publish_batches",
+	"dht_store_root_lookups",
+	"dht_store_root_lookups_seeded",
+	"dht_store_root_lookup_rpcs",
+	"dht_publish_batch_published",
+	"dht_publish_cycle_duration",
+	"qhit_entries_built",
+	"qhit_entries_cached",
+	"qhit_records_encoded",
+	"qhit_entries_per_sec",
+	"guess_shared_query_keys",
 };
 
 /**
@@ -562,6 +595,8 @@ static const char *stats_text[] = {
 	N_("UDP push messages patched for FW<->FW connections"),
 	N_("UDP UHC pings received"),
 	N_("UDP UHC pongs sent"),
+	N_("Cached pongs encoded"),
+	N_("Cached pongs sent from their encoded payload"),
 	N_("UDP messages with bogus source IP"),
 	N_("UDP messages from shunned IP (discarded)"),
 	N_("UDP truncated incoming messages"),
@@ -571,6 +606,10 @@ static const char *stats_text[] = {
 	N_("Compressed UDP messages received"),
 	N_("Candidates for UDP message compression"),
 	N_("Uncompressed UDP messages due to no gain"),
+	N_("Compressing Gnutella TX links held"),
+	N_("Compressing Gnutella TX links zlib memory (bytes)"),
+	N_("Decompressing Gnutella RX links held"),
+	N_("Decompressing Gnutella RX links zlib memory (bytes)"),
 	N_("UDP scheduler directly sent (P_DATA)"),
 	N_("UDP scheduler directly sent (P_CONTROL)"),
 	N_("UDP scheduler directly sent (P_URGENT)"),
@@ -866,6 +905,33 @@ static const char *stats_text[] = {
 	N_("Digests computed on general statistics"),
 	N_("Digests computed on TCP statistics"),
 	N_("Digests computed on UDP statistics"),
+	N_("Bytes appended to persistence journals"),
+	N_("Bytes written by persistence checkpoints"),
+	N_("Bytes persisted during the last hour"),
+	N_("Disk writes of downloaded data"),
+	N_("Bytes of downloaded data written to disk"),
+	N_("Average size of disk writes for downloaded data"),
+	N_("Downloaded data held in memory, pending write"),
+	N_("Forced synchronizations of downloaded files"),
+	N_("Alternate locations held in the download mesh"),
+	N_("Memory used by the download mesh (estimated)"),
+	N_("Average memory used per alternate location"),
+	N_("Alternate locations evicted to honour memory budget"),
+	N_("Browse Host payloads recorded in the cache"),
+	N_("Browse Host requests served from the cache"),
+	N_("Browse Host requests served precompressed"),
+	N_("Memory used by cached Browse Host payloads"),
+	N_("DHT publishing batches completed"),
+	N_("DHT root lookups issued for publishing"),
+	N_("DHT root lookups seeded from the roots cache"),
+	N_("DHT RPCs sent by root lookups for publishing"),
+	N_("DHT keys published by batched publishing"),
+	N_("Duration of last DHT publishing batch (secs)"),
+	N_("File entries put in query hits"),
+	N_("File entries copied from cached hit records"),
+	N_("Hit records encoded and cached for shared files"),
+	N_("File entries put in query hits per second of building time (last minute)"),
+	N_("GUESS hosts returned to searches with a key requested by another"),
 };
 
 /**
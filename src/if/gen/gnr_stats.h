@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Mar 10 21:55:45 2019 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 02:07:08 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,7 +8,7 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 415
+ * Enum count: 448
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
@@ -122,6 +122,8 @@ typedef enum {
 	GNR_UDP_FW2FW_PUSHES_PATCHED,
 	GNR_UDP_UHC_PINGS,
 	GNR_UDP_UHC_PONGS,
+	GNR_PCACHE_PONGS_ENCODED,
+	GNR_PCACHE_PONGS_REUSED,
 	GNR_UDP_BOGUS_SOURCE_IP,
 	GNR_UDP_SHUNNED_SOURCE_IP,
 	GNR_UDP_RX_TRUNCATED,
@@ -131,6 +133,10 @@ typedef enum {
 	GNR_UDP_RX_COMPRESSED,
 	GNR_UDP_COMPRESSION_ATTEMPTS,
 	GNR_UDP_LARGER_HENCE_NOT_COMPRESSED,
+	GNR_TX_DEFLATE_LINKS,
+	GNR_TX_DEFLATE_MEMORY,
+	GNR_RX_INFLATE_LINKS,
+	GNR_RX_INFLATE_MEMORY,
 	GNR_UDP_SCHED_DIRECTLY_SENT_PRIO_DATA,
 	GNR_UDP_SCHED_DIRECTLY_SENT_PRIO_CONTROL,
 	GNR_UDP_SCHED_DIRECTLY_SENT_PRIO_URGENT,
@@ -426,6 +432,33 @@ typedef enum {
 	GNR_STATS_DIGEST,
 	GNR_STATS_TCP_DIGEST,
 	GNR_STATS_UDP_DIGEST,
+	GNR_PERSIST_JOURNAL_BYTES,
+	GNR_PERSIST_CHECKPOINT_BYTES,
+	GNR_PERSIST_BYTES_LAST_HOUR,
+	GNR_DOWNLOAD_WRITES,
+	GNR_DOWNLOAD_WRITTEN_BYTES,
+	GNR_DOWNLOAD_AVG_WRITE_SIZE,
+	GNR_DOWNLOAD_WRITEBACK_BYTES,
+	GNR_DOWNLOAD_SYNCS,
+	GNR_DMESH_ALTLOCS,
+	GNR_DMESH_MEMORY,
+	GNR_DMESH_ALTLOC_AVG_SIZE,
+	GNR_DMESH_EVICTED,
+	GNR_BROWSE_CACHE_BUILT,
+	GNR_BROWSE_CACHE_HITS,
+	GNR_BROWSE_CACHE_PRECOMPRESSED,
+	GNR_BROWSE_CACHE_MEMORY,
+	GNR_DHT_PUBLISH_BATCHES,
+	GNR_DHT_STORE_ROOT_LOOKUPS,
+	GNR_DHT_STORE_ROOT_LOOKUPS_SEEDED,
+	GNR_DHT_STORE_ROOT_LOOKUP_RPCS,
+	GNR_DHT_PUBLISH_BATCH_PUBLISHED,
+	GNR_DHT_PUBLISH_CYCLE_DURATION,
+	GNR_QHIT_ENTRIES_BUILT,
+	GNR_QHIT_ENTRIES_CACHED,
+	GNR_QHIT_RECORDS_ENCODED,
+	GNR_QHIT_ENTRIES_PER_SEC,
+	GNR_GUESS_SHARED_QUERY_KEYS,
 
 	GNR_TYPE_COUNT
 } gnr_stats_t;
@@ -1164,6 +1164,18 @@ guint64  gnet_property_variable_bc_loopback_in		= 0;
 static const guint64  gnet_property_variable_bc_loopback_in_default = 0;
 guint64  gnet_property_variable_bc_private_in		= 0;
 static const guint64  gnet_property_variable_bc_private_in_default = 0;
+guint32  gnet_property_variable_download_writeback_memory		= 16777216;
+static const guint32  gnet_property_variable_download_writeback_memory_default = 16777216;
+guint32  gnet_property_variable_download_sync_amount		= 0;
+static const guint32  gnet_property_variable_download_sync_amount_default = 0;
+guint32  gnet_property_variable_dmesh_max_memory		= 33554432;
+static const guint32  gnet_property_variable_dmesh_max_memory_default = 33554432;
+gboolean gnet_property_variable_qhit_record_cache		= TRUE;
+static const gboolean gnet_property_variable_qhit_record_cache_default = TRUE;
+gboolean gnet_property_variable_node_tcp_tuning		= TRUE;
+static const gboolean gnet_property_variable_node_tcp_tuning_default = TRUE;
+guint32  gnet_property_variable_node_tcp_buffer_max		= 256;
+static const guint32  gnet_property_variable_node_tcp_buffer_max_default = 256;
 
 static prop_set_t *gnet_property;
 
@@ -11778,6 +11790,132 @@ gnet_prop_init(void) {
 	gnet_property->props[503].data.guint64.max	= (guint64) -1;
 	gnet_property->props[503].data.guint64.min	= 0x0000000000000000;
 
+
+	/*
+	 * PROP_DOWNLOAD_WRITEBACK_MEMORY:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[504].name = "download_writeback_memory";
+	gnet_property->props[504].desc = _("Total amount of downloaded data that gtk-gnutella can hold in memory, across all sources, before writing it to disk.  Within that budget, sources keep buffering past the download_buffer_size amount (up to 1 MiB each), so that data from slow sources are written in fewer, larger and page-aligned writes.  Use 0 to write as soon as download_buffer_size is reached.");
+	gnet_property->props[504].ev_changed = event_new("download_writeback_memory_changed");
+	gnet_property->props[504].save = TRUE;
+	gnet_property->props[504].internal = FALSE;
+	gnet_property->props[504].vector_size = 1;
+	mutex_init(&gnet_property->props[504].lock);
+
+	/* Type specific data: */
+	gnet_property->props[504].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[504].data.guint32.def	= (void *) &gnet_property_variable_download_writeback_memory_default;
+	gnet_property->props[504].data.guint32.value = (void *) &gnet_property_variable_download_writeback_memory;
+	gnet_property->props[504].data.guint32.choices = NULL;
+	gnet_property->props[504].data.guint32.max	= 1073741824;
+	gnet_property->props[504].data.guint32.min	= 0;
+
+
+	/*
+	 * PROP_DOWNLOAD_SYNC_AMOUNT:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[505].name = "download_sync_amount";
+	gnet_property->props[505].desc = _("Amount of data written to a file being downloaded after which gtk-gnutella forces its synchronization to disk.  Batching synchronizations bounds the amount of data that can be lost on a system crash without paying for a synchronization on each write.  Use 0 to leave it to the operating system.");
+	gnet_property->props[505].ev_changed = event_new("download_sync_amount_changed");
+	gnet_property->props[505].save = TRUE;
+	gnet_property->props[505].internal = FALSE;
+	gnet_property->props[505].vector_size = 1;
+	mutex_init(&gnet_property->props[505].lock);
+
+	/* Type specific data: */
+	gnet_property->props[505].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[505].data.guint32.def	= (void *) &gnet_property_variable_download_sync_amount_default;
+	gnet_property->props[505].data.guint32.value = (void *) &gnet_property_variable_download_sync_amount;
+	gnet_property->props[505].data.guint32.choices = NULL;
+	gnet_property->props[505].data.guint32.max	= 1073741824;
+	gnet_property->props[505].data.guint32.min	= 0;
+
+
+	/*
+	 * PROP_DMESH_MAX_MEMORY:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[506].name = "dmesh_max_memory";
+	gnet_property->props[506].desc = _("Maximum amount of memory, in bytes, that the download mesh can use to record alternate locations.  When exceeded, the files with the most alternate locations lose their least recently seen ones first.");
+	gnet_property->props[506].ev_changed = event_new("dmesh_max_memory_changed");
+	gnet_property->props[506].save = TRUE;
+	gnet_property->props[506].internal = FALSE;
+	gnet_property->props[506].vector_size = 1;
+	mutex_init(&gnet_property->props[506].lock);
+
+	/* Type specific data: */
+	gnet_property->props[506].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[506].data.guint32.def	= (void *) &gnet_property_variable_dmesh_max_memory_default;
+	gnet_property->props[506].data.guint32.value = (void *) &gnet_property_variable_dmesh_max_memory;
+	gnet_property->props[506].data.guint32.choices = NULL;
+	gnet_property->props[506].data.guint32.max	= 1073741824;
+	gnet_property->props[506].data.guint32.min	= 1048576;
+
+
+	/*
+	 * PROP_QHIT_RECORD_CACHE:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[507].name = "qhit_record_cache";
+	gnet_property->props[507].desc = _("Whether the encoded query hit records of shared files should be cached, so that hits for the same file are built by copying them instead of encoding them again.");
+	gnet_property->props[507].ev_changed = event_new("qhit_record_cache_changed");
+	gnet_property->props[507].save = TRUE;
+	gnet_property->props[507].internal = FALSE;
+	gnet_property->props[507].vector_size = 1;
+	mutex_init(&gnet_property->props[507].lock);
+
+	/* Type specific data: */
+	gnet_property->props[507].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[507].data.boolean.def	= (void *) &gnet_property_variable_qhit_record_cache_default;
+	gnet_property->props[507].data.boolean.value = (void *) &gnet_property_variable_qhit_record_cache;
+
+
+	/*
+	 * PROP_NODE_TCP_TUNING:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[508].name = "node_tcp_tuning";
+	gnet_property->props[508].desc = _("Whether the socket buffers and the message queue watermarks of Gnutella connections should be adapted to the round-trip time and congestion window reported by the kernel.");
+	gnet_property->props[508].ev_changed = event_new("node_tcp_tuning_changed");
+	gnet_property->props[508].save = TRUE;
+	gnet_property->props[508].internal = FALSE;
+	gnet_property->props[508].vector_size = 1;
+	mutex_init(&gnet_property->props[508].lock);
+
+	/* Type specific data: */
+	gnet_property->props[508].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[508].data.boolean.def	= (void *) &gnet_property_variable_node_tcp_tuning_default;
+	gnet_property->props[508].data.boolean.value = (void *) &gnet_property_variable_node_tcp_tuning;
+
+
+	/*
+	 * PROP_NODE_TCP_BUFFER_MAX:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[509].name = "node_tcp_buffer_max";
+	gnet_property->props[509].desc = _("Maximum size, in KiB, up to which the socket buffers of Gnutella connections can be enlarged when adapting them to the bandwidth-delay product of the link.");
+	gnet_property->props[509].ev_changed = event_new("node_tcp_buffer_max_changed");
+	gnet_property->props[509].save = TRUE;
+	gnet_property->props[509].internal = FALSE;
+	gnet_property->props[509].vector_size = 1;
+	mutex_init(&gnet_property->props[509].lock);
+
+	/* Type specific data: */
+	gnet_property->props[509].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[509].data.guint32.def	= (void *) &gnet_property_variable_node_tcp_buffer_max_default;
+	gnet_property->props[509].data.guint32.value = (void *) &gnet_property_variable_node_tcp_buffer_max;
+	gnet_property->props[509].data.guint32.choices = NULL;
+	gnet_property->props[509].data.guint32.max	= 8192;
+	gnet_property->props[509].data.guint32.min	= 16;
+
 	gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
 	for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
 		htable_insert(gnet_property->by_name,
@@ -540,6 +540,12 @@ typedef enum {
 	PROP_BC_DHT_IN,
 	PROP_BC_LOOPBACK_IN,
 	PROP_BC_PRIVATE_IN,
+	PROP_DOWNLOAD_WRITEBACK_MEMORY,
+	PROP_DOWNLOAD_SYNC_AMOUNT,
+	PROP_DMESH_MAX_MEMORY,
+	PROP_QHIT_RECORD_CACHE,
+	PROP_NODE_TCP_TUNING,
+	PROP_NODE_TCP_BUFFER_MAX,
 	GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -554,6 +554,12 @@ extern const guint64	gnet_property_variable_bc_gnet_udp_in;
 extern const guint64	gnet_property_variable_bc_dht_in;
 extern const guint64	gnet_property_variable_bc_loopback_in;
 extern const guint64	gnet_property_variable_bc_private_in;
+extern const guint32	gnet_property_variable_download_writeback_memory;
+extern const guint32	gnet_property_variable_download_sync_amount;
+extern const guint32	gnet_property_variable_dmesh_max_memory;
+extern const gboolean gnet_property_variable_qhit_record_cache;
+extern const gboolean gnet_property_variable_node_tcp_tuning;
+extern const guint32	gnet_property_variable_node_tcp_buffer_max;
 
 
 prop_set_t *gnet_prop_init(void);
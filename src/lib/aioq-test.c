@@ -0,0 +1,465 @@
+/*
+ * aioq-test -- tests and benchmarks asynchronous file I/O queues.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "aioq.h"
+#include "atoms.h"
+#include "compat_sleep_ms.h"
+#include "fd.h"
+#include "file_object.h"
+#include "halloc.h"
+#include "hstrfn.h"
+#include "inputevt.h"
+#include "iovec.h"
+#include "log.h"
+#include "misc.h"
+#include "progname.h"
+#include "random.h"
+#include "sha1.h"
+#include "stringify.h"
+#include "tm.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define BUF_SIZE	(128 * 1024)
+
+static size_t buf_size = BUF_SIZE;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-hw] [-b size] [-d depth] [-m MiB] [-f file]\n"
+			"  -b : size of each I/O buffer, in KiB (default 128)\n"
+			"  -d : amount of I/Os in flight (default 4)\n"
+			"  -f : benchmark reading of file (e.g. on a throttled device)\n"
+			"  -h : prints this help message\n"
+			"  -m : size of the scratch file to create, in MiB (default 16)\n"
+			"  -w : benchmark writing the scratch file as well\n"
+			"When benchmarking an existing file, drop the page cache between\n"
+			"runs, otherwise both methods read from memory.\n"
+			, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Compute SHA1 of the file with plain synchronous reads.
+ */
+static double
+read_sync(file_object_t *fo, filesize_t size, struct sha1 *digest)
+{
+	SHA1_context ctx;
+	char *buf = halloc(buf_size);
+	filesize_t offset = 0;
+	tm_nano_t start, end;
+
+	SHA1_reset(&ctx);
+	tm_precise_time(&start);
+
+	while (offset < size) {
+		size_t n = MIN(size - offset, buf_size);
+		ssize_t r = file_object_pread(fo, buf, n, offset);
+
+		if ((ssize_t) -1 == r)
+			s_fatal_exit(EXIT_FAILURE, "read error: %m");
+		if (0 == r)
+			break;
+		SHA1_input(&ctx, buf, r);
+		offset += r;
+	}
+
+	tm_precise_time(&end);
+	SHA1_result(&ctx, digest);
+	hfree(buf);
+
+	return tm_precise_elapsed_f(&end, &start);
+}
+
+/*
+ * Compute SHA1 of the file with up to ``depth'' reads in flight, hashing
+ * the buffers in file order.
+ */
+static double
+read_queued(file_object_t *fo, filesize_t size, uint depth,
+	struct sha1 *digest)
+{
+	SHA1_context ctx;
+	char *buf = halloc(buf_size * depth);
+	aioq_t *aq = aioq_make(depth);
+	filesize_t queued = 0, offset = 0;
+	ssize_t *done;
+	uint head = 0, inflight = 0, i;
+	tm_nano_t start, end;
+
+	HALLOC_ARRAY(done, depth);
+	for (i = 0; i < depth; i++)
+		done[i] = -2;
+
+	SHA1_reset(&ctx);
+	tm_precise_time(&start);
+
+	while (offset < size) {
+		aioq_result_t res;
+
+		while (inflight < depth && queued < size) {
+			uint slot = (head + inflight) % depth;
+			size_t n = MIN(size - queued, buf_size);
+
+			if (
+				-1 == file_object_pread_async(fo, aq,
+					&buf[slot * buf_size], n, queued, size_to_pointer(slot))
+			)
+				s_fatal_exit(EXIT_FAILURE, "cannot queue read: %m");
+			queued += n;
+			inflight++;
+		}
+
+		while (-2 == done[head]) {
+			if (!aioq_reap(aq, TRUE, &res))
+				s_fatal_exit(EXIT_FAILURE, "no completion");
+			if ((ssize_t) -1 == res.ret) {
+				errno = res.error;
+				s_fatal_exit(EXIT_FAILURE, "read error: %m");
+			}
+			done[pointer_to_size(res.udata)] = res.ret;
+		}
+
+		if (done[head] != (ssize_t) MIN(size - offset, buf_size))
+			s_fatal_exit(EXIT_FAILURE, "short read at %s",
+				uint64_to_string(offset));
+
+		SHA1_input(&ctx, &buf[head * buf_size], done[head]);
+		offset += done[head];
+		done[head] = -2;
+		head = (head + 1) % depth;
+		inflight--;
+	}
+
+	tm_precise_time(&end);
+	SHA1_result(&ctx, digest);
+	aioq_free_null(&aq);
+	hfree(done);
+	hfree(buf);
+
+	return tm_precise_elapsed_f(&end, &start);
+}
+
+/*
+ * Fill file with random data, using either synchronous or queued writes.
+ */
+static double
+write_file(file_object_t *fo, filesize_t size, uint depth)
+{
+	char *buf = halloc(buf_size * MAX(depth, 1));
+	aioq_t *aq = 0 == depth ? NULL : aioq_make(depth);
+	filesize_t offset = 0;
+	tm_nano_t start, end;
+	uint slot = 0;
+
+	random_bytes(buf, buf_size * MAX(depth, 1));
+	tm_precise_time(&start);
+
+	while (offset < size) {
+		size_t n = MIN(size - offset, buf_size);
+		iovec_t iov = iov_get(&buf[slot * buf_size], n);
+		aioq_result_t res;
+
+		if (NULL == aq) {
+			if ((ssize_t) n != file_object_pwritev(fo, &iov, 1, offset))
+				s_fatal_exit(EXIT_FAILURE, "write error: %m");
+		} else {
+			while (0 == aioq_room(aq)) {
+				if (!aioq_reap(aq, TRUE, &res))
+					s_fatal_exit(EXIT_FAILURE, "no completion");
+				if ((ssize_t) -1 == res.ret) {
+					errno = res.error;
+					s_fatal_exit(EXIT_FAILURE, "write error: %m");
+				}
+			}
+			if (-1 == file_object_pwritev_async(fo, aq, &iov, 1, offset, NULL))
+				s_fatal_exit(EXIT_FAILURE, "cannot queue write: %m");
+			slot = (slot + 1) % depth;
+		}
+		offset += n;
+	}
+
+	if (aq != NULL) {
+		aioq_result_t res;
+
+		while (aioq_reap(aq, TRUE, &res)) {
+			if ((ssize_t) -1 == res.ret) {
+				errno = res.error;
+				s_fatal_exit(EXIT_FAILURE, "write error: %m");
+			}
+		}
+	}
+
+	if (-1 == fd_fdatasync(file_object_fd(fo)))
+		s_fatal_exit(EXIT_FAILURE, "fdatasync() error: %m");
+
+	tm_precise_time(&end);
+	aioq_free_null(&aq);
+	hfree(buf);
+
+	return tm_precise_elapsed_f(&end, &start);
+}
+
+static uint notified;		/* Completions dispatched to notify_done() */
+
+static void
+notify_done(const aioq_result_t *res, void *arg)
+{
+	const size_t *len = arg;
+
+	if ((ssize_t) -1 == res->ret) {
+		errno = res->error;
+		s_fatal_exit(EXIT_FAILURE, "write error: %m");
+	}
+	if ((size_t) res->ret != *len)
+		s_fatal_exit(EXIT_FAILURE, "short write: %zd bytes", res->ret);
+
+	notified++;
+}
+
+static bool
+notify_half(void *arg)
+{
+	const uint *depth = arg;
+
+	return notified >= *depth / 2;
+}
+
+static void
+queue_writes(file_object_t *fo, aioq_t *aq, const char *buf, uint depth)
+{
+	uint i;
+
+	for (i = 0; i < depth; i++) {
+		iovec_t iov = iov_get(deconstify_pointer(&buf[i * buf_size]), buf_size);
+
+		if (
+			-1 == file_object_pwritev_async(fo, aq, &iov, 1,
+				(filesize_t) i * buf_size, NULL)
+		)
+			s_fatal_exit(EXIT_FAILURE, "cannot queue write: %m");
+	}
+}
+
+/*
+ * Check that completions are dispatched from the event loop when a callback
+ * is installed, and that freeing the queue waits for the pending requests.
+ */
+static void
+test_notify(file_object_t *fo, uint depth)
+{
+	char *buf = halloc(buf_size * depth);
+	char *data = halloc(buf_size * depth);
+	aioq_t *aq = aioq_make(depth);
+	tm_nano_t start, now;
+
+	if (!aioq_set_callback(aq, notify_done, &buf_size)) {
+		s_info("completion notification unavailable, not tested");
+		goto done;
+	}
+
+	random_bytes(buf, buf_size * depth);
+	notified = 0;
+	queue_writes(fo, aq, buf, depth);
+	tm_precise_time(&start);
+
+	while (notified < depth) {
+		inputevt_dispatch();
+		if (notified == depth)
+			break;
+		tm_precise_time(&now);
+		if (tm_precise_elapsed_f(&now, &start) > 10.0)
+			s_fatal_exit(EXIT_FAILURE, "only %u/%u completion%s notified",
+				notified, PLURAL(depth));
+		compat_sleep_ms(1);
+	}
+
+	notified = 0;
+	queue_writes(fo, aq, buf, depth);
+
+	if (!aioq_drain(aq) || notified != depth)
+		s_fatal_exit(EXIT_FAILURE, "only %u/%u completion%s drained",
+			notified, PLURAL(depth));
+
+	notified = 0;
+	queue_writes(fo, aq, buf, depth);
+
+	if (!aioq_wait(aq, notify_half, &depth) || notified < depth / 2)
+		s_fatal_exit(EXIT_FAILURE, "only %u/%u completion%s waited for",
+			notified, PLURAL(depth));
+
+	if (!aioq_drain(aq) || notified != depth)
+		s_fatal_exit(EXIT_FAILURE, "only %u/%u completion%s drained",
+			notified, PLURAL(depth));
+
+	random_bytes(buf, buf_size * depth);
+	notified = 0;
+	queue_writes(fo, aq, buf, depth);
+	aioq_free_null(&aq);
+
+	if (notified != depth)
+		s_fatal_exit(EXIT_FAILURE, "only %u/%u completion%s on teardown",
+			notified, PLURAL(depth));
+
+	if (
+		(ssize_t) (buf_size * depth) !=
+			file_object_pread(fo, data, buf_size * depth, 0)
+	)
+		s_fatal_exit(EXIT_FAILURE, "read error: %m");
+
+	if (0 != memcmp(buf, data, buf_size * depth))
+		s_fatal_exit(EXIT_FAILURE, "data written on teardown differ");
+
+	s_info("notified %u completion%s from event loop, wait, drain and teardown",
+		PLURAL(depth));
+
+done:
+	aioq_free_null(&aq);
+	hfree(buf);
+	hfree(data);
+}
+
+static void
+report(const char *what, filesize_t size, double elapsed)
+{
+	s_info("%-16s %8.3f secs, %8.2f MiB/s", what, elapsed,
+		elapsed > 0.0 ? size / (1024.0 * 1024.0) / elapsed : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	const char options[] = "b:d:f:hm:w";
+	const char *file = NULL;
+	char *scratch = NULL;
+	bool writes = FALSE;
+	uint depth = 4;
+	filesize_t size = 16 * 1024 * 1024;
+	file_object_t *fo;
+	struct sha1 d1, d2;
+	aioq_t *aq;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* buffer size */
+			buf_size = MAX(1, atol(optarg)) * 1024;
+			break;
+		case 'd':			/* queue depth */
+			depth = MAX(1, atoi(optarg));
+			break;
+		case 'f':			/* file to benchmark */
+			file = optarg;
+			break;
+		case 'm':			/* scratch file size */
+			size = (filesize_t) MAX(1, atol(optarg)) * 1024 * 1024;
+			break;
+		case 'w':			/* benchmark writes */
+			writes = TRUE;
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	file_object_init();
+	inputevt_init(FALSE);
+
+	aq = aioq_make(depth);
+	s_info("I/O queues are %s", aioq_is_async(aq) ?
+		"asynchronous (io_uring)" : "synchronous (fallback)");
+	aioq_free_null(&aq);
+
+	if (NULL == file) {
+		char cwd[MAX_PATH_LEN];
+
+		if (NULL == getcwd(ARYLEN(cwd)))
+			s_fatal_exit(EXIT_FAILURE, "getcwd() failed: %m");
+
+		scratch = h_strdup_printf("%s/aioq-test.%lu", cwd, (ulong) getpid());
+		fo = file_object_create(scratch, O_RDWR, 0600);
+		if (NULL == fo)
+			s_fatal_exit(EXIT_FAILURE, "cannot create \"%s\": %m", scratch);
+
+		report("sync writes", size, write_file(fo, size, 0));
+		if (writes) {
+			report("queued writes", size, write_file(fo, size, depth));
+		}
+		test_notify(fo, depth);
+	} else {
+		filestat_t buf;
+
+		fo = file_object_open(file, O_RDONLY);
+		if (NULL == fo)
+			s_fatal_exit(EXIT_FAILURE, "cannot open \"%s\": %m", file);
+		if (-1 == file_object_fstat(fo, &buf))
+			s_fatal_exit(EXIT_FAILURE, "cannot stat \"%s\": %m", file);
+		size = buf.st_size;
+	}
+
+	report("sync reads", size, read_sync(fo, size, &d1));
+	report("queued reads", size, read_queued(fo, size, depth, &d2));
+
+	if (!sha1_eq(&d1, &d2))
+		s_fatal_exit(EXIT_FAILURE, "data read differ: %s vs. %s",
+			sha1_to_string(&d1), sha1_to_string(&d2));
+
+	s_info("all checks passed");
+
+	file_object_close(&fo);
+	inputevt_close();
+
+	if (scratch != NULL) {
+		if (-1 == unlink(scratch))
+			s_warning("cannot unlink \"%s\": %m", scratch);
+		HFREE_NULL(scratch);
+	}
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,937 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Asynchronous file I/O queues.
+ *
+ * An I/O queue lets its owner have several reads or writes in flight at
+ * the same time, collecting their completion later on, so that the kernel
+ * can keep the disk busy whilst the data already read is being processed.
+ *
+ * On Linux, the queue is backed by an io_uring instance.  Elsewhere, or
+ * when the kernel refuses to create the ring (too old, or forbidden by a
+ * security policy), requests are performed synchronously as they are
+ * queued and their completion is simply recorded: the caller sees the
+ * same interface, only without the overlapping.
+ *
+ * Completions are reaped in the order the kernel delivers them, which is
+ * not necessarily the submission order: each request carries user data
+ * to identify it.
+ *
+ * A queue is not thread-safe and must not be used by several threads at
+ * the same time.  The buffers given for an I/O must remain valid until its
+ * completion has been reaped, and so must the file descriptor.
+ *
+ * Instead of reaping completions itself, the main thread can have them
+ * dispatched to a callback from the main event loop, which is told about
+ * completions through an eventfd registered with the ring.  This is only
+ * possible when I/O are really asynchronous.
+ *
+ * When a queue is freed, all the pending requests are waited for, and
+ * cancelled if the kernel cannot be waited on, so that no I/O is left
+ * referencing memory that the owner of the queue is about to release.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "aioq.h"
+
+#include "atomic.h"
+#include "compat_pio.h"
+#include "compat_sleep_ms.h"
+#include "halloc.h"
+#include "inputevt.h"
+#include "iovec.h"
+#include "log.h"
+#include "stringify.h"
+#include "thread.h"
+#include "vmm.h"
+#include "walloc.h"
+
+#ifdef HAS_IO_URING
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "override.h"			/* Must be the last header included */
+
+#define AIOQ_DEPTH_MAX		256		/**< Maximum queue depth */
+#define AIOQ_CANCEL			((uint64) -1)	/**< User data of cancellations */
+#define AIOQ_DRAIN_RETRY	1000	/**< Attempts to wait for the kernel */
+
+/**
+ * A queued request.
+ */
+struct aioq_req {
+	void *udata;			/**< User data */
+	iovec_t *iov;			/**< I/O vector used for the request */
+	iovec_t one;			/**< Single buffer for reads */
+	int iovcnt;				/**< Amount of entries in I/O vector */
+	ssize_t ret;			/**< Result, for synchronous completion */
+	int error;				/**< Error, for synchronous completion */
+	bool busy;				/**< Slot in use */
+};
+
+enum aioq_magic { AIOQ_MAGIC = 0x42f8e1d6 };
+
+/**
+ * An I/O queue.
+ */
+struct aioq {
+	enum aioq_magic magic;
+	uint depth;					/**< Maximum amount of pending requests */
+	uint pending;				/**< Amount of pending requests */
+	struct aioq_req *reqs;		/**< Request slots */
+	uint *done;					/**< Synchronously completed slots (FIFO) */
+	uint done_head;				/**< Index of oldest completed slot */
+	uint done_count;			/**< Amount of completed slots */
+	aioq_done_cb_t done_cb;		/**< Completion callback, if any */
+	void *done_arg;				/**< Completion callback argument */
+#ifdef HAS_IO_URING
+	int ring_fd;				/**< The io_uring descriptor, -1 if none */
+	int event_fd;				/**< Completion notification, -1 if none */
+	uint event_id;				/**< Input event ID for event_fd */
+	void *sq_map;				/**< Submission ring mapping */
+	void *cq_map;				/**< Completion ring mapping */
+	size_t sq_map_len;			/**< Length of submission ring mapping */
+	size_t cq_map_len;			/**< Length of completion ring mapping */
+	struct io_uring_sqe *sqes;	/**< Submission entries */
+	size_t sqes_len;			/**< Length of submission entries mapping */
+	uint *sq_head, *sq_tail, *sq_mask, *sq_array;
+	uint *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;	/**< Completion entries */
+#endif
+};
+
+static inline void
+aioq_check(const struct aioq * const aq)
+{
+	g_assert(aq != NULL);
+	g_assert(AIOQ_MAGIC == aq->magic);
+}
+
+static void aioq_slot_free(aioq_t *aq, struct aioq_req *r);
+
+#ifdef HAS_IO_URING
+
+#define AIOQ_RING(aq)	((aq)->ring_fd >= 0)
+
+/**
+ * @return pointer to the ring field at given offset in the mapping.
+ */
+static inline uint *
+aioq_ring_field(void *map, uint32 offset)
+{
+	return ptr_add_offset(map, offset);
+}
+
+/**
+ * Release the io_uring resources.
+ */
+static void
+aioq_ring_free(struct aioq *aq)
+{
+	inputevt_remove(&aq->event_id);
+
+	if (aq->event_fd >= 0) {
+		close(aq->event_fd);
+		aq->event_fd = -1;
+	}
+
+	if (aq->sqes != NULL)
+		vmm_munmap(aq->sqes, aq->sqes_len);
+	if (aq->cq_map != NULL && aq->cq_map != aq->sq_map)
+		vmm_munmap(aq->cq_map, aq->cq_map_len);
+	if (aq->sq_map != NULL)
+		vmm_munmap(aq->sq_map, aq->sq_map_len);
+
+	aq->sqes = NULL;
+	aq->cq_map = aq->sq_map = NULL;
+
+	if (aq->ring_fd >= 0) {
+		close(aq->ring_fd);
+		aq->ring_fd = -1;
+	}
+}
+
+/**
+ * Map the io_uring rings in memory.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+aioq_ring_setup(struct aioq *aq)
+{
+	struct io_uring_params p;
+	int fd;
+
+	ZERO(&p);
+	fd = syscall(__NR_io_uring_setup, aq->depth, &p);
+
+	if (-1 == fd) {
+		s_debug("%s(): io_uring unavailable, using synchronous I/O: %m",
+			G_STRFUNC);
+		return FALSE;
+	}
+
+	aq->ring_fd = fd;
+	aq->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(uint32);
+	aq->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		aq->sq_map_len = aq->cq_map_len = MAX(aq->sq_map_len, aq->cq_map_len);
+	}
+#endif
+
+	aq->sq_map = vmm_mmap(NULL, aq->sq_map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+	if (MAP_FAILED == aq->sq_map) {
+		aq->sq_map = NULL;
+		goto failed;
+	}
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		aq->cq_map = aq->sq_map;
+	} else
+#endif
+	{
+		aq->cq_map = vmm_mmap(NULL, aq->cq_map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+		if (MAP_FAILED == aq->cq_map) {
+			aq->cq_map = NULL;
+			goto failed;
+		}
+	}
+
+	aq->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	aq->sqes = vmm_mmap(NULL, aq->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+	if (MAP_FAILED == aq->sqes) {
+		aq->sqes = NULL;
+		goto failed;
+	}
+
+	aq->sq_head  = aioq_ring_field(aq->sq_map, p.sq_off.head);
+	aq->sq_tail  = aioq_ring_field(aq->sq_map, p.sq_off.tail);
+	aq->sq_mask  = aioq_ring_field(aq->sq_map, p.sq_off.ring_mask);
+	aq->sq_array = aioq_ring_field(aq->sq_map, p.sq_off.array);
+	aq->cq_head  = aioq_ring_field(aq->cq_map, p.cq_off.head);
+	aq->cq_tail  = aioq_ring_field(aq->cq_map, p.cq_off.tail);
+	aq->cq_mask  = aioq_ring_field(aq->cq_map, p.cq_off.ring_mask);
+	aq->cqes     = ptr_add_offset(aq->cq_map, p.cq_off.cqes);
+
+	return TRUE;
+
+failed:
+	s_warning("%s(): cannot map io_uring, using synchronous I/O: %m",
+		G_STRFUNC);
+	aioq_ring_free(aq);
+	return FALSE;
+}
+
+/**
+ * Enter the kernel to submit the queued entries and possibly wait for
+ * a completion.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+static int
+aioq_ring_enter(struct aioq *aq, bool wait)
+{
+	uint unsubmitted;
+	int r;
+
+	/*
+	 * Entries that the kernel did not consume yet (because of a previous
+	 * transient error) are submitted again.
+	 */
+
+	do {
+		atomic_mb();
+		unsubmitted = *aq->sq_tail - *aq->sq_head;
+		r = syscall(__NR_io_uring_enter, aq->ring_fd, unsubmitted,
+			wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (-1 == r && EINTR == errno);
+
+	return r < 0 ? -1 : 0;
+}
+
+/**
+ * Queue request in the submission ring and submit it.
+ */
+static void
+aioq_ring_submit(struct aioq *aq, uint8 opcode, int fd,
+	uint slot, filesize_t offset)
+{
+	const struct aioq_req *r = &aq->reqs[slot];
+	struct io_uring_sqe *sqe;
+	uint tail, idx;
+
+	tail = *aq->sq_tail;
+	idx = tail & *aq->sq_mask;
+	sqe = &aq->sqes[idx];
+
+	ZERO(sqe);
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = pointer_to_ulong(r->iov);
+	sqe->len = r->iovcnt;
+	sqe->user_data = slot;
+
+	aq->sq_array[idx] = idx;
+	atomic_mb();
+	*aq->sq_tail = tail + 1;
+	atomic_mb();
+
+	/*
+	 * A failure here is not fatal: the entry remains in the ring and will
+	 * be submitted again at the next kernel entry.
+	 */
+
+	if (-1 == aioq_ring_enter(aq, FALSE) && EAGAIN != errno && EBUSY != errno)
+		s_carp("%s(): cannot submit I/O: %m", G_STRFUNC);
+}
+
+/**
+ * Fetch next completion from the ring.
+ *
+ * @return TRUE if a completion was fetched.
+ */
+static bool
+aioq_ring_reap(struct aioq *aq, bool wait, aioq_result_t *res)
+{
+	const struct io_uring_cqe *cqe;
+	struct aioq_req *r;
+	uint head;
+
+	for (;;) {
+		head = *aq->cq_head;
+		atomic_mb();
+		if (head != *aq->cq_tail) {
+			cqe = &aq->cqes[head & *aq->cq_mask];
+			if (cqe->user_data != AIOQ_CANCEL)
+				break;
+			atomic_mb();
+			*aq->cq_head = head + 1;	/* Skip completion of cancellation */
+			continue;
+		}
+		if (!wait)
+			return FALSE;
+		if (-1 == aioq_ring_enter(aq, TRUE)) {
+			s_carp("%s(): cannot wait for I/O: %m", G_STRFUNC);
+			return FALSE;
+		}
+	}
+
+	g_assert(cqe->user_data < aq->depth);
+
+	r = &aq->reqs[cqe->user_data];
+	g_assert(r->busy);
+
+	res->udata = r->udata;
+	if (cqe->res < 0) {
+		res->ret = -1;
+		res->error = -cqe->res;
+	} else {
+		res->ret = cqe->res;
+		res->error = 0;
+	}
+
+	atomic_mb();
+	*aq->cq_head = head + 1;
+	atomic_mb();
+
+	aioq_slot_free(aq, r);
+	return TRUE;
+}
+
+/**
+ * Request cancellation of all the pending requests.
+ *
+ * Requests already started by the kernel may still complete normally.
+ */
+static void
+aioq_ring_cancel(struct aioq *aq)
+{
+	uint i;
+
+	for (i = 0; i < aq->depth; i++) {
+		struct io_uring_sqe *sqe;
+		uint tail, idx;
+
+		if (!aq->reqs[i].busy)
+			continue;
+
+		tail = *aq->sq_tail;
+		atomic_mb();
+		if (tail - *aq->sq_head > *aq->sq_mask)
+			break;		/* Submission ring is full */
+
+		idx = tail & *aq->sq_mask;
+		sqe = &aq->sqes[idx];
+
+		ZERO(sqe);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = i;			/* User data of request to cancel */
+		sqe->user_data = AIOQ_CANCEL;
+
+		aq->sq_array[idx] = idx;
+		atomic_mb();
+		*aq->sq_tail = tail + 1;
+		atomic_mb();
+	}
+}
+
+/**
+ * Wait for pending requests to complete, dispatching their completion, until
+ * the supplied condition becomes true or no request is pending any more.
+ *
+ * When no condition is given, we wait for all the requests, cancelling them
+ * if we cannot wait for the kernel.
+ *
+ * @param aq		the I/O queue
+ * @param done		condition telling whether we can stop waiting, or NULL
+ * @param arg		argument for the condition
+ *
+ * @return TRUE if the condition is met or no request is pending any more.
+ */
+static bool
+aioq_ring_wait(struct aioq *aq, predicate_fn_t done, void *arg)
+{
+	uint attempts = 0;
+	bool cancelled = FALSE;
+
+	while (aq->pending != 0) {
+		aioq_result_t res;
+
+		if (done != NULL && (*done)(arg))
+			break;
+
+		if (aioq_ring_reap(aq, FALSE, &res)) {
+			if (aq->done_cb != NULL)
+				(*aq->done_cb)(&res, aq->done_arg);
+			continue;
+		}
+
+		if (0 == aioq_ring_enter(aq, TRUE))
+			continue;
+
+		/*
+		 * Transient errors: the kernel lacks resources or has completions
+		 * it could not post yet, which we are about to reap.  Anything else
+		 * means we cannot wait, so cancel the requests we may have been
+		 * unable to submit, and retry, unless we only wait for some of them:
+		 * the other requests are none of our business.
+		 */
+
+		if (NULL == done && EAGAIN != errno && EBUSY != errno && !cancelled) {
+			s_warning("%s(): cannot wait for %u I/O%s, cancelling: %m",
+				G_STRFUNC, PLURAL(aq->pending));
+			aioq_ring_cancel(aq);
+			cancelled = TRUE;
+		}
+
+		if (++attempts >= AIOQ_DRAIN_RETRY)
+			return FALSE;
+
+		compat_sleep_ms(1);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Invoked from the main event loop when completions were posted.
+ */
+static void
+aioq_event_ready(void *data, int unused_source, inputevt_cond_t cond)
+{
+	aioq_t *aq = data;
+	aioq_result_t res;
+	uint64 value;
+
+	(void) unused_source;
+	aioq_check(aq);
+
+	if G_UNLIKELY(cond & INPUT_EVENT_EXCEPTION) {
+		s_warning("%s(): exception on completion eventfd", G_STRFUNC);
+		return;
+	}
+
+	/*
+	 * Reset the counter before reaping so that completions posted whilst
+	 * we dispatch trigger a new notification.
+	 */
+
+	if (-1 == read(aq->event_fd, VARLEN(value)) && EAGAIN != errno)
+		s_warning("%s(): cannot read completion eventfd: %m", G_STRFUNC);
+
+	while (aioq_ring_reap(aq, FALSE, &res))
+		(*aq->done_cb)(&res, aq->done_arg);
+}
+
+/**
+ * Have completions posted to an eventfd monitored by the main event loop.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+aioq_ring_notify(struct aioq *aq)
+{
+	int fd;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (-1 == fd) {
+		s_warning("%s(): cannot create eventfd: %m", G_STRFUNC);
+		return FALSE;
+	}
+
+	if (
+		-1 == syscall(__NR_io_uring_register, aq->ring_fd,
+			IORING_REGISTER_EVENTFD, &fd, 1)
+	) {
+		s_warning("%s(): cannot register eventfd with io_uring: %m",
+			G_STRFUNC);
+		close(fd);
+		return FALSE;
+	}
+
+	aq->event_fd = fd;
+	aq->event_id = inputevt_add(fd, INPUT_EVENT_RX, aioq_event_ready, aq);
+
+	return TRUE;
+}
+
+#else	/* !HAS_IO_URING */
+
+#define AIOQ_RING(aq)	FALSE
+
+#endif	/* HAS_IO_URING */
+
+/**
+ * Create a new I/O queue.
+ *
+ * @param depth		maximum amount of requests that can be pending
+ *
+ * @return a new I/O queue, which must be freed with aioq_free_null().
+ */
+aioq_t *
+aioq_make(uint depth)
+{
+	aioq_t *aq;
+
+	g_assert(depth != 0);
+
+	WALLOC0(aq);
+	aq->magic = AIOQ_MAGIC;
+	aq->depth = MIN(depth, AIOQ_DEPTH_MAX);
+	HALLOC0_ARRAY(aq->reqs, aq->depth);
+	HALLOC_ARRAY(aq->done, aq->depth);
+
+#ifdef HAS_IO_URING
+	aq->ring_fd = -1;
+	aq->event_fd = -1;
+	(void) aioq_ring_setup(aq);
+#endif
+
+	return aq;
+}
+
+/**
+ * Free I/O queue, waiting for all the pending requests to complete.
+ *
+ * When a completion callback was installed, it is invoked for each of the
+ * requests completing whilst we wait.
+ */
+void
+aioq_free_null(aioq_t **aq_ptr)
+{
+	aioq_t *aq = *aq_ptr;
+
+	if (aq != NULL) {
+		aioq_check(aq);
+
+#ifdef HAS_IO_URING
+		if (AIOQ_RING(aq)) {
+			/*
+			 * If the kernel still has requests, their buffers and the ring
+			 * must stay around: leak them rather than have the kernel write
+			 * to freed memory.
+			 */
+
+			if (!aioq_ring_wait(aq, NULL, NULL)) {
+				s_critical("%s(): leaking I/O queue with %u pending I/O%s",
+					G_STRFUNC, PLURAL(aq->pending));
+				*aq_ptr = NULL;
+				return;
+			}
+			aioq_ring_free(aq);
+		}
+#endif
+
+		{
+			aioq_result_t res;
+
+			while (aioq_reap(aq, FALSE, &res)) {
+				if (aq->done_cb != NULL)
+					(*aq->done_cb)(&res, aq->done_arg);
+			}
+		}
+
+		HFREE_NULL(aq->reqs);
+		HFREE_NULL(aq->done);
+		aq->magic = 0;
+		WFREE(aq);
+		*aq_ptr = NULL;
+	}
+}
+
+/**
+ * Have completions dispatched to the supplied callback from the main event
+ * loop, instead of being reaped by the owner of the queue.
+ *
+ * This must be called from the main thread, before any request is queued.
+ *
+ * @param aq		the I/O queue
+ * @param cb		callback to invoke on each completion
+ * @param arg		additional callback argument
+ *
+ * @return TRUE if OK, FALSE if completions cannot be notified, in which case
+ * requests are not performed asynchronously either.
+ */
+bool
+aioq_set_callback(aioq_t *aq, aioq_done_cb_t cb, void *arg)
+{
+	aioq_check(aq);
+	g_assert(cb != NULL);
+	g_assert(0 == aq->pending);
+	g_assert(NULL == aq->done_cb);
+	g_assert(thread_is_main());
+
+#ifdef HAS_IO_URING
+	if (AIOQ_RING(aq) && aioq_ring_notify(aq)) {
+		aq->done_cb = cb;
+		aq->done_arg = arg;
+		return TRUE;
+	}
+#else
+	(void) arg;
+#endif
+
+	return FALSE;
+}
+
+/**
+ * Wait for all the pending requests of a queue with a completion callback,
+ * dispatching their completion as they are reaped.
+ *
+ * @return TRUE if OK, FALSE if we could not wait for all the requests.
+ */
+bool
+aioq_drain(aioq_t *aq)
+{
+	aioq_check(aq);
+	g_assert(aq->done_cb != NULL);
+	g_assert(thread_is_main());
+
+#ifdef HAS_IO_URING
+	if (AIOQ_RING(aq))
+		return aioq_ring_wait(aq, NULL, NULL);
+#endif
+
+	return TRUE;		/* Only io_uring queues can have a callback */
+}
+
+/**
+ * Wait for pending requests of a queue with a completion callback, until
+ * the supplied condition becomes true.
+ *
+ * Completions are dispatched in the order the kernel posts them, so this
+ * is meant to wait for the requests of one user of a shared queue, without
+ * having to wait for the requests of all the other users.
+ *
+ * @param aq		the I/O queue
+ * @param done		condition telling whether we can stop waiting
+ * @param arg		argument for the condition
+ *
+ * @return TRUE if OK, FALSE if we could not wait for the condition.
+ */
+bool
+aioq_wait(aioq_t *aq, predicate_fn_t done, void *arg)
+{
+	aioq_check(aq);
+	g_assert(done != NULL);
+	g_assert(aq->done_cb != NULL);
+	g_assert(thread_is_main());
+
+#ifdef HAS_IO_URING
+	if (AIOQ_RING(aq))
+		return aioq_ring_wait(aq, done, arg) || (*done)(arg);
+#else
+	(void) arg;
+#endif
+
+	return TRUE;		/* Only io_uring queues can have a callback */
+}
+
+/**
+ * @return whether I/O are really performed asynchronously.
+ */
+bool
+aioq_is_async(const aioq_t *aq)
+{
+	aioq_check(aq);
+
+	return AIOQ_RING(aq);
+}
+
+/**
+ * @return amount of requests whose completion was not reaped yet.
+ */
+uint
+aioq_pending(const aioq_t *aq)
+{
+	aioq_check(aq);
+
+	return aq->pending;
+}
+
+/**
+ * @return amount of requests that can still be queued.
+ */
+uint
+aioq_room(const aioq_t *aq)
+{
+	aioq_check(aq);
+
+	return aq->depth - aq->pending;
+}
+
+/**
+ * Allocate a free request slot.
+ *
+ * @return slot index, -1 if the queue is full.
+ */
+static int
+aioq_slot_alloc(aioq_t *aq, void *udata)
+{
+	uint i;
+
+	if G_UNLIKELY(aq->pending >= aq->depth) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	for (i = 0; i < aq->depth; i++) {
+		struct aioq_req *r = &aq->reqs[i];
+
+		if (!r->busy) {
+			r->busy = TRUE;
+			r->udata = udata;
+			r->iov = &r->one;
+			r->iovcnt = 1;
+			aq->pending++;
+			return i;
+		}
+	}
+
+	g_assert_not_reached();
+}
+
+/**
+ * Record synchronous completion of request.
+ */
+static void
+aioq_sync_done(aioq_t *aq, uint slot, ssize_t ret)
+{
+	struct aioq_req *r = &aq->reqs[slot];
+
+	g_assert(aq->done_count < aq->depth);
+
+	r->ret = ret;
+	r->error = (ssize_t) -1 == ret ? errno : 0;
+	aq->done[(aq->done_head + aq->done_count++) % aq->depth] = slot;
+}
+
+/**
+ * Queue a read request.
+ *
+ * @param aq		the I/O queue
+ * @param fd		the file descriptor to read from
+ * @param buf		the buffer where data is read
+ * @param len		amount of bytes to read
+ * @param offset	offset in file where reading starts
+ * @param udata		user data to identify the request on completion
+ *
+ * @return 0 if queued, -1 on error with errno set (EAGAIN if the queue
+ * is full).
+ */
+int
+aioq_pread(aioq_t *aq, int fd,
+	void *buf, size_t len, filesize_t offset, void *udata)
+{
+	struct aioq_req *r;
+	int slot;
+
+	aioq_check(aq);
+	g_assert(buf != NULL);
+
+	slot = aioq_slot_alloc(aq, udata);
+	if (-1 == slot)
+		return -1;
+
+	r = &aq->reqs[slot];
+	r->one = iov_get(buf, len);
+
+#ifdef HAS_IO_URING
+	if (AIOQ_RING(aq)) {
+		aioq_ring_submit(aq, IORING_OP_READV, fd, slot, offset);
+		return 0;
+	}
+#endif
+
+	aioq_sync_done(aq, slot, compat_pread(fd, buf, len, offset));
+	return 0;
+}
+
+/**
+ * Queue a write request.
+ *
+ * The I/O vector is copied but the data it references must remain valid
+ * until completion.
+ *
+ * @param aq		the I/O queue
+ * @param fd		the file descriptor to write to
+ * @param iov		the I/O vector describing the data to write
+ * @param iovcnt	amount of entries in the vector
+ * @param offset	offset in file where writing starts
+ * @param udata		user data to identify the request on completion
+ *
+ * @return 0 if queued, -1 on error with errno set (EAGAIN if the queue
+ * is full).
+ */
+int
+aioq_pwritev(aioq_t *aq, int fd,
+	const iovec_t *iov, int iovcnt, filesize_t offset, void *udata)
+{
+	int slot;
+
+	aioq_check(aq);
+	g_assert(iov != NULL);
+	g_assert(iovcnt > 0);
+
+	slot = aioq_slot_alloc(aq, udata);
+	if (-1 == slot)
+		return -1;
+
+#ifdef HAS_IO_URING
+	if (AIOQ_RING(aq)) {
+		struct aioq_req *r = &aq->reqs[slot];
+
+		r->iov = HCOPY_ARRAY(iov, iovcnt);
+		r->iovcnt = iovcnt;
+		aioq_ring_submit(aq, IORING_OP_WRITEV, fd, slot, offset);
+		return 0;
+	}
+#endif
+
+	aioq_sync_done(aq, slot, compat_pwritev(fd, iov, iovcnt, offset));
+	return 0;
+}
+
+/**
+ * Release request slot.
+ */
+static void
+aioq_slot_free(aioq_t *aq, struct aioq_req *r)
+{
+	g_assert(r->busy);
+	g_assert(aq->pending != 0);
+
+	if (r->iov != &r->one)
+		HFREE_NULL(r->iov);
+
+	r->busy = FALSE;
+	aq->pending--;
+}
+
+/**
+ * Fetch the completion of a request.
+ *
+ * @param aq		the I/O queue
+ * @param wait		whether to block until a request completes
+ * @param res		where the completion is returned
+ *
+ * @return TRUE if a completion was returned, FALSE if there is none yet
+ * or no request is pending.
+ */
+bool
+aioq_reap(aioq_t *aq, bool wait, aioq_result_t *res)
+{
+	aioq_check(aq);
+	g_assert(res != NULL);
+
+	if (0 == aq->pending)
+		return FALSE;
+
+#ifdef HAS_IO_URING
+	if (AIOQ_RING(aq))
+		return aioq_ring_reap(aq, wait, res);
+#endif
+
+	(void) wait;		/* Synchronous requests are already completed */
+
+	{
+		struct aioq_req *r;
+
+		g_assert(aq->done_count != 0);
+
+		r = &aq->reqs[aq->done[aq->done_head]];
+		aq->done_head = (aq->done_head + 1) % aq->depth;
+		aq->done_count--;
+
+		res->udata = r->udata;
+		res->ret = r->ret;
+		res->error = r->error;
+		aioq_slot_free(aq, r);
+	}
+
+	return TRUE;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
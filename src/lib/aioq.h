@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Asynchronous file I/O queues.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _aioq_h_
+#define _aioq_h_
+
+struct aioq;
+typedef struct aioq aioq_t;
+
+/**
+ * Completion of an I/O request.
+ */
+typedef struct aioq_result {
+	void *udata;		/**< User data given when the request was queued */
+	ssize_t ret;		/**< Amount of bytes transferred, -1 on error */
+	int error;			/**< The errno value, when ret is -1 */
+} aioq_result_t;
+
+/**
+ * Completion callback.
+ *
+ * @param res		the completion of the request
+ * @param arg		additional callback argument
+ */
+typedef void (*aioq_done_cb_t)(const aioq_result_t *res, void *arg);
+
+/*
+ * Public interface.
+ */
+
+aioq_t *aioq_make(uint depth);
+void aioq_free_null(aioq_t **aq_ptr);
+bool aioq_set_callback(aioq_t *aq, aioq_done_cb_t cb, void *arg);
+bool aioq_drain(aioq_t *aq);
+bool aioq_wait(aioq_t *aq, predicate_fn_t done, void *arg);
+
+bool aioq_is_async(const aioq_t *aq);
+uint aioq_pending(const aioq_t *aq);
+uint aioq_room(const aioq_t *aq);
+
+int aioq_pread(aioq_t *aq, int fd,
+	void *buf, size_t len, filesize_t offset, void *udata);
+int aioq_pwritev(aioq_t *aq, int fd,
+	const iovec_t *iov, int iovcnt, filesize_t offset, void *udata);
+bool aioq_reap(aioq_t *aq, bool wait, aioq_result_t *res);
+
+#endif /* _aioq_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,265 @@
+/*
+ * atoms-test -- tests and benchmarks concurrent atom interning.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include "common.h"
+
+#include "atoms.h"
+#include "barrier.h"
+#include "halloc.h"
+#include "hstrfn.h"
+#include "log.h"
+#include "misc.h"
+#include "progname.h"
+#include "random.h"
+#include "sha1.h"
+#include "stringify.h"
+#include "thread.h"
+#include "tm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define KEYS		100000		/* Default amount of distinct keys */
+#define OPS			1000000		/* Default amount of operations per thread */
+#define THREADS		16			/* Default maximum amount of threads */
+
+static char **keys;				/* String keys */
+static struct sha1 *sha1s;		/* SHA1 keys */
+static size_t keycount = KEYS;
+static size_t opcount = OPS;
+
+struct exercise {
+	barrier_t *start;			/* Barrier to start all threads together */
+	uint id;					/* Thread index, seeds the key sequence */
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-h] [-k keys] [-n ops] [-t threads]\n"
+			"  -h : prints this help message\n"
+			"  -k : amount of distinct atoms of each type (default %u)\n"
+			"  -n : amount of get/free pairs per thread (default %u)\n"
+			"  -t : maximum amount of concurrent threads (default %u)\n"
+			"Runs with 1, 2, 4... threads, up to the maximum.\n"
+			, getprogname(), KEYS, OPS, THREADS);
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Intern and release random atoms, half of which already exist.
+ *
+ * Each operation gets an atom and frees it, alternating strings and SHA1s.
+ * Atoms from the first half of the key set are held by the main thread,
+ * hence only see their reference count change, the others are created
+ * and disposed of as threads race for them.
+ *
+ * Returns the elapsed time, in nanoseconds, as a pointer.
+ */
+static void *
+exercise_atoms(void *arg)
+{
+	struct exercise *e = arg;
+	uint32 seed = e->id * 2654435761U + 1;
+	tm_nano_t begin, end;
+	size_t i;
+
+	barrier_wait(e->start);
+	barrier_free_null(&e->start);
+	tm_precise_time(&begin);
+
+	for (i = 0; i < opcount; i++) {
+		size_t n;
+
+		seed = seed * 1664525 + 1013904223;		/* Cheap LCG, no locking */
+		n = (seed >> 8) % keycount;
+
+		if (i & 1) {
+			const struct sha1 *a = atom_sha1_get(&sha1s[n]);
+			g_assert(sha1_eq(a, &sha1s[n]));
+			atom_sha1_free(a);
+		} else {
+			const char *a = atom_str_get(keys[n]);
+			g_assert(0 == strcmp(a, keys[n]));
+			atom_str_free(a);
+		}
+	}
+
+	tm_precise_time(&end);
+
+	return ulong_to_pointer(tm_precise_elapsed_ns(&end, &begin) / 1000);
+}
+
+/*
+ * Run the benchmark with the given amount of threads.
+ *
+ * Returns the amount of operations per second performed.
+ */
+static double
+run_threads(uint n)
+{
+	struct exercise *e;
+	barrier_t *start;
+	int *t;
+	uint i;
+	ulong max_us = 0;
+
+	WALLOC_ARRAY(t, n);
+	WALLOC_ARRAY(e, n);
+	start = barrier_new(n);
+
+	for (i = 0; i < n; i++) {
+		e[i].start = barrier_refcnt_inc(start);
+		e[i].id = i;
+		t[i] = thread_create(exercise_atoms, &e[i],
+				THREAD_F_PANIC, THREAD_STACK_MIN);
+	}
+
+	for (i = 0; i < n; i++) {
+		void *r;
+
+		if (-1 == thread_join(t[i], &r)) {
+			s_fatal_exit(EXIT_FAILURE, "cannot join with %s: %m",
+				thread_id_name(t[i]));
+		}
+		max_us = MAX(max_us, pointer_to_ulong(r));
+	}
+
+	barrier_free_null(&start);
+	WFREE_ARRAY(t, n);
+	WFREE_ARRAY(e, n);
+
+	return 0 == max_us ? 0.0 : (double) opcount * n / max_us * 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	const char options[] = "hk:n:t:";
+	uint maxthreads = THREADS, n;
+	double base = 0.0;
+	const char **held_str;
+	const struct sha1 **held_sha1;
+	size_t i;
+
+	progstart(argc, argv);
+	thread_set_main(TRUE);		/* We're the main thread, we can block */
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'k':			/* distinct keys */
+			keycount = MAX(2, atol(optarg));
+			break;
+		case 'n':			/* operations per thread */
+			opcount = MAX(1, atol(optarg));
+			break;
+		case 't':			/* maximum amount of threads */
+			maxthreads = MAX(1, atoi(optarg));
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	atoms_init();
+
+	HALLOC_ARRAY(keys, keycount);
+	HALLOC_ARRAY(sha1s, keycount);
+
+	for (i = 0; i < keycount; i++) {
+		keys[i] = h_strdup_printf("/home/user/shared/file-%zu.ogg", i);
+		random_bytes(&sha1s[i], sizeof sha1s[i]);
+	}
+
+	/*
+	 * Hold a reference on the first half of the atoms.
+	 */
+
+	HALLOC_ARRAY(held_str, keycount / 2);
+	HALLOC_ARRAY(held_sha1, keycount / 2);
+
+	for (i = 0; i < keycount / 2; i++) {
+		held_str[i] = atom_str_get(keys[i]);
+		held_sha1[i] = atom_sha1_get(&sha1s[i]);
+	}
+
+	for (n = 1; n <= maxthreads; n *= 2) {
+		double ops = run_threads(n);
+
+		if (1 == n)
+			base = ops;
+
+		s_info("%2u thread%s %12.0f ops/s, %4u%% of 1 thread", PLURAL(n), ops,
+			0.0 == base ? 0 : (uint) (100.0 * ops / base + 0.5));
+	}
+
+	/*
+	 * Release the atoms we held, none should remain.
+	 */
+
+	for (i = 0; i < keycount / 2; i++) {
+		atom_str_free(held_str[i]);
+		atom_sha1_free(held_sha1[i]);
+	}
+
+	for (i = 0; i < keycount; i++) {
+		if (atom_exists(ATOM_STRING, keys[i]))
+			s_fatal_exit(EXIT_FAILURE, "string atom \"%s\" leaked", keys[i]);
+		if (atom_exists(ATOM_SHA1, &sha1s[i])) {
+			s_fatal_exit(EXIT_FAILURE, "SHA1 atom %s leaked",
+				sha1_to_string(&sha1s[i]));
+		}
+		HFREE_NULL(keys[i]);
+	}
+
+	HFREE_NULL(keys);
+	HFREE_NULL(sha1s);
+	HFREE_NULL(held_str);
+	HFREE_NULL(held_sha1);
+
+	s_info("all checks passed");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
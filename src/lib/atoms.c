@@ -31,6 +31,11 @@
  * and which is therefore only allocated once: all other instances point
  * to the common object.
  *
+ * Atoms are shared by all the threads, so each type of atom is spread
+ * over several shards, each with its own table and lock.  The shard is
+ * selected from the hash value of the atom, so that concurrent threads
+ * interning different atoms of the same type rarely contend.
+ *
  * @author Raphael Manfredi
  * @date 2002-2003
  */
@@ -531,13 +536,26 @@ atom_dealloc(atom_t *a, size_t size)
 typedef size_t (*len_func_t)(const void *v);
 typedef const char *(*str_func_t)(const void *v);
 
+#define ATOM_SHARD_BITS		4
+#define ATOM_SHARDS			(1U << ATOM_SHARD_BITS)
+#define ATOM_SHARD_ALIGN	64		/* Typical CPU cache line size */
+
+/**
+ * A shard of the atom table for a given type.
+ *
+ * Shards are aligned on cache lines so that threads locking different
+ * shards do not bounce the same line between their CPUs.
+ */
+typedef struct atom_shard {
+	spinlock_t lock;			/**< Lock protecting the hash table */
+	htable_t *table;			/**< Table of atoms: "atom value" -> size */
+} G_ALIGNED(ATOM_SHARD_ALIGN) atom_shard_t;
+
 /**
  * Description of atom types.
  */
 typedef struct atom_desc {
-	spinlock_t lock;			/**< Lock protecting the hash table */
 	const char *type;			/**< Type of atoms */
-	htable_t *table;			/**< Table of atoms: "atom value" -> size */
 	hash_fn_t hash_func;		/**< Hashing function for atoms */
 	eq_fn_t eq_func;			/**< Atom equality function */
 	len_func_t len_func;		/**< Atom length function */
@@ -579,22 +597,20 @@ static const char *packed_host_addr_str(const void *v);
 #define pha_eq		packed_host_addr_equal
 #define pha_len		packed_host_addr_len
 #define pha_str		packed_host_addr_str
-#define S			SPINLOCK_INIT
-#define N			NULL
 
 /**
  * The set of all atom types we know about.
  */
-static atom_desc_t atoms[] = {
-	{ S, "String", N, str_hash,    str_eq,     str_xlen,   str_str  }, /* 0 */
-	{ S, "GUID",   N, guid_hash,   guid_eq,    guid_len,   guid_str }, /* 1 */
-	{ S, "SHA1",   N, sha1_hash,   sha1_eq,	   sha1_len,   sha1_str }, /* 2 */
-	{ S, "TTH",    N, tth_hash,    tth_eq,	   tth_len,    tth_str },  /* 3 */
-	{ S, "uint64", N, uint64_hash, uint64_eq,  uint64_len, uint64_str},/* 4 */
-	{ S, "filesize", N, fs_hash,   fs_eq,      fs_len,     fs_str },   /* 5 */
-	{ S, "uint32", N, uint32_hash, uint32_eq,  uint32_len, uint32_str},/* 6 */
-	{ S, "host",   N, gnh_hash,    gnh_eq,     gnh_len,    gnh_str },  /* 7 */
-	{ S, "addr",   N, pha_hash,    pha_eq,     pha_len,    pha_str },  /* 8 */
+static const atom_desc_t atoms[] = {
+	{ "String", str_hash,    str_eq,     str_xlen,   str_str  }, /* 0 */
+	{ "GUID",   guid_hash,   guid_eq,    guid_len,   guid_str }, /* 1 */
+	{ "SHA1",   sha1_hash,   sha1_eq,	 sha1_len,   sha1_str }, /* 2 */
+	{ "TTH",    tth_hash,    tth_eq,	 tth_len,    tth_str },  /* 3 */
+	{ "uint64", uint64_hash, uint64_eq,  uint64_len, uint64_str},/* 4 */
+	{ "filesize", fs_hash,   fs_eq,      fs_len,     fs_str },   /* 5 */
+	{ "uint32", uint32_hash, uint32_eq,  uint32_len, uint32_str},/* 6 */
+	{ "host",   gnh_hash,    gnh_eq,     gnh_len,    gnh_str },  /* 7 */
+	{ "addr",   pha_hash,    pha_eq,     pha_len,    pha_str },  /* 8 */
 };
 
 #undef str_hash
@@ -611,8 +627,11 @@ static atom_desc_t atoms[] = {
 #undef pha_eq
 #undef pha_len
 #undef pha_str
-#undef S
-#undef N
+
+/**
+ * The shards holding atoms, for each type, set up by atoms_init_once().
+ */
+static atom_shard_t atom_shards[NUM_ATOM_TYPES][ATOM_SHARDS];
 
 /**
  * @return length of string + trailing NUL.
@@ -979,9 +998,15 @@ atoms_init_once(void)
 #endif /* PROTECT_ATOMS */
 
 	for (i = 0; i < N_ITEMS(atoms); i++) {
-		atom_desc_t *ad = &atoms[i];
+		const atom_desc_t *ad = &atoms[i];
+		uint j;
+
+		for (j = 0; j < ATOM_SHARDS; j++) {
+			atom_shard_t *as = &atom_shards[i][j];
 
-		ad->table = htable_create_any(ad->hash_func, NULL, ad->eq_func);
+			spinlock_init(&as->lock);
+			as->table = htable_create_any(ad->hash_func, NULL, ad->eq_func);
+		}
 	}
 
 	/*
@@ -1020,6 +1045,21 @@ atoms_init(void)
 	once_flag_run(&atoms_inited, atoms_init_once);
 }
 
+/**
+ * Locate the shard holding atoms of a given type with the specified value.
+ *
+ * The hash value is mixed before selecting the shard so that the shard
+ * index does not correlate with the slots the atom occupies in the
+ * shard's table.
+ */
+static inline atom_shard_t *
+atom_shard(enum atom_type type, const void *key)
+{
+	uint32 hv = hashing_mix32((*atoms[type].hash_func)(key));
+
+	return &atom_shards[type][hv >> (32 - ATOM_SHARD_BITS)];
+}
+
 /**
  * Check whether atom exists.
  *
@@ -1028,12 +1068,20 @@ atoms_init(void)
 bool
 atom_exists(enum atom_type type, const void *key)
 {
+	atom_shard_t *as;
+	bool found;
+
 	g_assert(key != NULL);
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_contains(atoms[type].table, key);
+	as = atom_shard(type, key);
+	ATOM_TABLE_LOCK(as);
+	found = htable_contains(as->table, key);
+	ATOM_TABLE_UNLOCK(as);
+
+	return found;
 }
 
 /**
@@ -1045,25 +1093,31 @@ bool
 atom_is_atom(enum atom_type type, const void *key)
 {
 	const void *atom;
+	atom_shard_t *as;
+	bool found;
 
 	g_assert(key != NULL);
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_lookup_extended(atoms[type].table, key, &atom, NULL)
-		&& key == atom;
+	as = atom_shard(type, key);
+	ATOM_TABLE_LOCK(as);
+	found = htable_lookup_extended(as->table, key, &atom, NULL);
+	ATOM_TABLE_UNLOCK(as);
+
+	return found && key == atom;
 }
 
 /**
  * Increment / decrement the atom reference count.
  *
- * Must be called with the table description locked.
+ * Must be called with the shard holding the atom locked.
  *
  * @return new reference count.
  */
 static inline size_t
-atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
+atom_refcnt_add(atom_shard_t *as, const void *key, void *value, int delta)
 {
 	if (4 == sizeof(void *)) {
 		/* 32-bit machine, we can directly update the atom_info structure */
@@ -1077,7 +1131,7 @@ atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
 			v += delta;
 		else
 			v -= -delta;	/* Necessary since int may be smaller than long */
-		htable_insert(ad->table, key, ulong_to_pointer(v));
+		htable_insert(as->table, key, ulong_to_pointer(v));
 		return ATOM_REFCNT(v);
 	}
 }
@@ -1091,7 +1145,8 @@ atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
 const void *
 atom_get(enum atom_type type, const void *key)
 {
-	atom_desc_t *ad;
+	const atom_desc_t *ad;
+	atom_shard_t *as;
 	const void *orig_key;
 	void *value;
 	size_t size;
@@ -1108,9 +1163,10 @@ atom_get(enum atom_type type, const void *key)
 		atoms_init();
 
 	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	as = atom_shard(type, key);
+	ATOM_TABLE_LOCK(as);
 
-	if (htable_lookup_extended(ad->table, key, &orig_key, &value)) {
+	if (htable_lookup_extended(as->table, key, &orig_key, &value)) {
 		size_t refcnt;
 
 		size = atom_info_length(value);
@@ -1123,9 +1179,9 @@ atom_get(enum atom_type type, const void *key)
 
 		g_assert(atom_info_refcnt(value) > 0);
 
-		refcnt = atom_refcnt_add(ad, orig_key, value, +1);
+		refcnt = atom_refcnt_add(as, orig_key, value, +1);
 		ATOM_TRACK_REFCNT(orig_key, +1, refcnt);
-		ATOM_TABLE_UNLOCK(ad);
+		ATOM_TABLE_UNLOCK(as);
 
 		return orig_key;
 	} else {
@@ -1156,13 +1212,13 @@ atom_get(enum atom_type type, const void *key)
 			WALLOC(ai);
 			ai->len = size;
 			ai->refcnt = 1;
-			htable_insert(ad->table, atom_arena(a), ai);
+			htable_insert(as->table, atom_arena(a), ai);
 		} else {
 			ulong v = ATOM_INFO(size) + 1;	/* +1 means refcnt is 1 */
-			htable_insert(ad->table, atom_arena(a), ulong_to_pointer(v));
+			htable_insert(as->table, atom_arena(a), ulong_to_pointer(v));
 		}
 
-		ATOM_TABLE_UNLOCK(ad);
+		ATOM_TABLE_UNLOCK(as);
 
 		return atom_arena(a);
 	}
@@ -1175,7 +1231,8 @@ atom_get(enum atom_type type, const void *key)
 void
 atom_free(enum atom_type type, const void *key)
 {
-	atom_desc_t *ad;
+	const atom_desc_t *ad;
+	atom_shard_t *as;
 	size_t size;
 	atom_t *a;
 	bool found;
@@ -1188,9 +1245,10 @@ atom_free(enum atom_type type, const void *key)
 	ATOM_TRACK_IS_LOCKED();
 
 	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	as = atom_shard(type, key);
+	ATOM_TABLE_LOCK(as);
 
-	found = htable_lookup_extended(ad->table, key, &orig_key, &value);
+	found = htable_lookup_extended(as->table, key, &orig_key, &value);
 
 	g_assert_log(found,
 		"attempting to free unknown %s atom at %p", ad->type, key);
@@ -1211,7 +1269,7 @@ atom_free(enum atom_type type, const void *key)
 	 */
 
 	if (1 == refcnt) {
-		htable_remove(ad->table, key);
+		htable_remove(as->table, key);
 		if (4 == sizeof(void *)) {
 			/* 32-bit machine */
 			struct atom_info *ai = value;
@@ -1220,11 +1278,11 @@ atom_free(enum atom_type type, const void *key)
 		atom_unprotect(a, size);
 		atom_dealloc(a, size);
 	} else {
-		size_t rcnt = atom_refcnt_add(ad, key, value, -1);
+		size_t rcnt = atom_refcnt_add(as, key, value, -1);
 		ATOM_TRACK_REFCNT(key, -1, rcnt);
 	}
 
-	ATOM_TABLE_UNLOCK(ad);
+	ATOM_TABLE_UNLOCK(as);
 }
 
 #ifdef TRACK_ATOMS
@@ -1439,7 +1497,7 @@ static void
 atom_warn_free(const void *key, void *value, void *udata)
 {
 	atom_t *a = atom_from_arena(key);
-	atom_desc_t *ad = udata;
+	const atom_desc_t *ad = udata;
 
 	g_warning("found remaining %s atom %p, refcnt=%d: \"%s\"",
 		ad->type, key, atom_info_refcnt(value), (*ad->str_func)(key));
@@ -1469,13 +1527,21 @@ atoms_close(void)
 {
 	uint i;
 
+	if (!ONCE_DONE(atoms_inited))
+		return;
+
 	for (i = 0; i < N_ITEMS(atoms); i++) {
-		atom_desc_t *ad = &atoms[i];
+		const atom_desc_t *ad = &atoms[i];
+		uint j;
+
+		for (j = 0; j < ATOM_SHARDS; j++) {
+			atom_shard_t *as = &atom_shards[i][j];
 
-		ATOM_TABLE_LOCK(ad);
-		htable_foreach(ad->table, atom_warn_free, ad);
-		htable_free_null(&ad->table);
-		ATOM_TABLE_UNLOCK(ad);
+			ATOM_TABLE_LOCK(as);
+			htable_foreach(as->table, atom_warn_free, deconstify_pointer(ad));
+			htable_free_null(&as->table);
+			ATOM_TABLE_UNLOCK(as);
+		}
 	}
 }
 
@@ -0,0 +1,216 @@
+/*
+ * cq-test -- tests per-thread callout queues driven by teq_wait().
+ *
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "atomic.h"
+#include "cq.h"
+#include "log.h"
+#include "misc.h"
+#include "progname.h"
+#include "stringify.h"
+#include "teq.h"
+#include "thread.h"
+#include "tm.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define CQ_TEST_EVENTS	4		/* Timers expected to fire */
+#define CQ_TEST_SLACK	250		/* ms, tolerance on firing time */
+
+static tm_t start;				/* Time at which the thread started */
+static int fired;				/* Timers fired so far */
+static int late;				/* Timers which fired out of tolerance */
+static int dangling;			/* Timers left pending at thread exit */
+static int long_delay = 12000;	/* ms, beyond 10 periods of the queue */
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-h] [-d ms]\n"
+			"  -h : prints this help message\n"
+			"  -d : long timer delay, in ms (default 12000)\n"
+			, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Timers record the time, since the thread started, at which they should fire.
+ */
+static void
+cq_test_fire(cqueue_t *cq, void *arg)
+{
+	int expected = pointer_to_int(arg);
+	tm_t now;
+	long elapsed;
+
+	g_assert(cq == cq_thread());
+
+	tm_now_exact(&now);
+	elapsed = tm_elapsed_ms(&now, &start);
+	fired++;
+
+	s_info("timer for %d ms fired after %ld ms", expected, elapsed);
+
+	if (elapsed < expected || elapsed > expected + CQ_TEST_SLACK)
+		late++;
+}
+
+/*
+ * Never fires: left pending in the queue until the thread exits.
+ */
+static void
+cq_test_never(cqueue_t *unused_cq, void *unused_arg)
+{
+	(void) unused_cq;
+	(void) unused_arg;
+
+	dangling++;
+}
+
+static void
+cq_test_insert(int delay)
+{
+	tm_t now;
+	long elapsed;
+
+	tm_now_exact(&now);
+	elapsed = tm_elapsed_ms(&now, &start);
+
+	cq_insert(cq_thread(), delay, cq_test_fire, int_to_pointer(elapsed + delay));
+}
+
+/*
+ * TEQ event sent by the main thread, scheduling a timer from the thread
+ * owning the queue whilst that thread is waiting for an earlier timer.
+ */
+static void
+cq_test_remote(void *unused_arg)
+{
+	(void) unused_arg;
+
+	cq_test_insert(long_delay + 1000);
+}
+
+static bool
+cq_test_done(void *unused_arg)
+{
+	(void) unused_arg;
+
+	return CQ_TEST_EVENTS == fired;
+}
+
+static void *
+cq_test_thread(void *arg)
+{
+	int *ready = arg;
+
+	thread_set_name("cq-test");
+	teq_create();
+	tm_now_exact(&start);
+
+	/*
+	 * The thread sleeps for more than 10 seconds, i.e. 10 periods of the
+	 * queue, before the second timer fires.
+	 */
+
+	cq_test_insert(500);
+	cq_test_insert(long_delay);
+	cq_test_insert(2 * long_delay);
+	cq_insert(cq_thread(), 3600 * 1000, cq_test_never, NULL);
+
+	atomic_int_set(ready, 1);
+
+	while (!cq_test_done(NULL))
+		teq_wait(cq_test_done, NULL);
+
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c, t, ready = 0;
+	const char options[] = "hd:";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'd':			/* long timer delay */
+			long_delay = MAX(3000, atoi(optarg));
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	/*
+	 * The main callout queue is bound to the thread initializing it, which
+	 * must not be the one we create, lest cq_thread() return the main queue.
+	 */
+
+	(void) cq_main();
+
+	t = thread_create(cq_test_thread, &ready, THREAD_F_PANIC, 0);
+
+	while (0 == atomic_int_get(&ready))
+		thread_sleep_ms(10);
+
+	thread_sleep_ms(1000);
+	teq_post(t, cq_test_remote, NULL);
+
+	if (-1 == thread_join(t, NULL))
+		s_fatal_exit(EXIT_FAILURE, "cannot join thread: %m");
+
+	if (late != 0)
+		s_fatal_exit(EXIT_FAILURE, "%d timer%s fired out of tolerance",
+			PLURAL(late));
+
+	if (dangling != 0)
+		s_fatal_exit(EXIT_FAILURE, "pending timer fired");
+
+	s_info("all checks passed");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
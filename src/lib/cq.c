@@ -192,6 +192,7 @@ struct cqueue {
 	int cq_last_bucket;			/**< Last bucket slot we were at */
 	int cq_period;				/**< Regular callout period, in ms */
 	uint8 cq_call_extended;		/**< Is cq_call an extended event? */
+	uint8 cq_threaded;			/**< Per-thread queue, see cq_thread() */
 	time_t cq_last_idle;		/**< Last time we ran the idle callbacks */
 	mutex_t cq_lock;			/**< Thread-safety for queue changes */
 	mutex_t cq_idle_lock;		/**< Protects idle callbacks */
@@ -241,6 +242,13 @@ static cqueue_t *callout_queue;			/**< The main callout queue */
 static once_flag_t cq_global_inited;	/**< Records global initialization */
 static void cq_global_init(void);
 
+/**
+ * Per-thread callout queues, indexed by thread small ID.
+ *
+ * Each entry is only accessed by the thread owning it, so no lock is needed.
+ */
+static cqueue_t *cq_thread_queue[THREAD_MAX];
+
 /**
  * Add a new callout queue to the global list.
  */
@@ -690,6 +698,45 @@ ev_unlink(cevent_t *ev)
 	g_assert(NULL == ch->ch_tail || NULL == ch->ch_tail->ce_bnext);
 }
 
+/**
+ * Compute the current virtual time of a callout queue.
+ *
+ * Per-thread queues do not heartbeat every period: their thread sleeps until
+ * the next event is due, and cq_heartbeat() then advances their virtual time
+ * by the whole elapsed time.  Between two heartbeats, we must therefore add
+ * the time elapsed since the last one, lest events trigger early.
+ */
+static cq_time_t
+cq_now(const cqueue_t *cq)
+{
+	tm_t now;
+	time_delta_t elapsed;
+
+	if G_LIKELY(!cq->cq_threaded)
+		return cq->cq_time;
+
+	if (cq->cq_current != NULL)
+		return cq->cq_time;		/* Within cq_clock(), time is up-to-date */
+
+	tm_now_exact(&now);
+	elapsed = tm_elapsed_ms(&now, &cq->cq_last_heartbeat);
+
+	return cq->cq_time + MAX(elapsed, 0);
+}
+
+/**
+ * Per-thread queues are freed, along with their pending events, when the
+ * thread owning them exits.  Handles held by another thread would then be
+ * left dangling, hence only the owning thread may manipulate their events.
+ */
+static inline void
+cq_thread_check(const cqueue_t *cq)
+{
+	g_assert_log(!cq->cq_threaded || thread_small_id() == cq->cq_stid,
+		"%s(): per-thread queue \"%s\" used from %s",
+		G_STRFUNC, cq->cq_name, thread_name());
+}
+
 /**
  * Internal initialization and insertion of event in the callout queue.
  *
@@ -720,7 +767,7 @@ cq_insert_internal(cqueue_t *cq, cevent_t *ev,
 	 */
 
 	CQ_LOCK(cq);
-	ev->ce_time = cq->cq_time + delay;
+	ev->ce_time = cq_now(cq) + delay;
 	ev_link(ev);
 	CQ_UNLOCK(cq);
 
@@ -754,6 +801,8 @@ cq_insert(cqueue_t *cq, int delay, cq_service_t fn, void *arg)
 {
 	cevent_t *ev;				/* Event to insert */
 
+	cq_thread_check(cq);
+
 	/*
 	 * If we are called from a "foreign" thread, i.e. not from the thread
 	 * that runs the callout queue, we create extended events.
@@ -1008,6 +1057,7 @@ cq_cancel(cevent_t **handle_ptr)
 		 */
 
 		cq = EV_CQ_LOCK(ev);
+		cq_thread_check(cq);
 
 		triggered = ev_triggered(ev);
 
@@ -1048,6 +1098,7 @@ cq_resched(cevent_t *ev, int delay)
 		G_STRFUNC, delay, stacktrace_function_name(ev->ce_fn), ev->ce_arg);
 
 	cq = EV_CQ_LOCK(ev);
+	cq_thread_check(cq);
 
 	if G_UNLIKELY(ev_triggered(ev)) {
 		CQ_UNLOCK(cq);
@@ -1070,7 +1121,7 @@ cq_resched(cevent_t *ev, int delay)
 	 */
 
 	ev_unlink(ev);
-	ev->ce_time = cq->cq_time + delay;
+	ev->ce_time = cq_now(cq) + delay;
 	ev_link(ev);
 	CQ_UNLOCK(cq);
 
@@ -1085,17 +1136,18 @@ cq_remaining(const cevent_t *ev)
 {
 	bool triggered = FALSE;
 	cqueue_t *cq;
-	cq_time_t remaining;
+	cq_time_t remaining, now;
 
 	cq = EV_CQ_LOCK(ev);
+	now = cq_now(cq);
 
 	if G_UNLIKELY(ev_triggered(ev)) {
 		triggered = TRUE;
 		remaining = 0;
-	} else if (ev->ce_time <= cq->cq_time) {
+	} else if (ev->ce_time <= now) {
 		remaining = 0;
 	} else {
-		remaining = ev->ce_time - cq->cq_time;
+		remaining = ev->ce_time - now;
 	}
 
 	CQ_UNLOCK(cq);
@@ -1212,6 +1264,7 @@ cq_expire(cevent_t *ev)
 	bool saved_call_extended;
 
 	cq = EV_CQ_LOCK(ev);
+	cq_thread_check(cq);
 
 	if G_UNLIKELY(ev_triggered(ev)) {
 		CQ_UNLOCK(cq);
@@ -1249,6 +1302,7 @@ cq_replace(cevent_t *ev, cq_service_t fn, void *arg)
 	cqueue_t *cq;
 
 	cq = EV_CQ_LOCK(ev);
+	cq_thread_check(cq);
 
 	if G_UNLIKELY(ev_triggered(ev)) {
 		CQ_UNLOCK(cq);
@@ -1448,7 +1502,7 @@ cq_delay(const cqueue_t *cq)
 	mutex_lock_const(&cq->cq_lock);
 
 	last_bucket = cq->cq_last_bucket;	/* Last bucket scanned */
-	now = cq->cq_time;
+	now = cq_now(cq);
 
 	for (i = 0; i < HASH_SIZE; i++) {
 		int b = (last_bucket + i) & HASH_MASK;
@@ -1575,14 +1629,21 @@ cq_heartbeat(cqueue_t *cq)
 	cq->cq_last_heartbeat = tv;		/* struct copy */
 
 	/*
-	 * If too much variation, or too little, maybe the clock was adjusted.
-	 * Adjust the delay so that we do not flush events for more than 10 periods,
-	 * but process at least a single period.
+	 * Per-thread queues are not heartbeating every period: their thread
+	 * sleeps until the next event is due, so large delays are expected and
+	 * we must advance by the real elapsed time, lest events trigger late.
+	 *
+	 * For other queues, if too much variation, or too little, maybe the clock
+	 * was adjusted.  Adjust the delay so that we do not flush events for more
+	 * than 10 periods, but process at least a single period.
 	 */
 
 	upper_delay = 10 * cq->cq_period;
 
-	if (delay < 0 || delay > upper_delay) {
+	if G_UNLIKELY(cq->cq_threaded) {
+		delay = MAX(delay, 0);
+		delay = MIN(delay, MAX_INT_VAL(int));
+	} else if (delay < 0 || delay > upper_delay) {
 		time_delta_t adjusted;
 
 		adjusted = MAX(delay, cq->cq_period);	/* At least one period */
@@ -1996,6 +2057,135 @@ cq_subqueue_free(struct csubqueue *csq)
 	WFREE(csq);
 }
 
+/***
+ *** Per-thread queues.
+ ***
+ *** These are standalone callout queues created on demand by threads other
+ *** than the one running the main callout queue, and heartbeating from the
+ *** thread event loop (see teq_wait()).  Timeouts registered by a worker
+ *** thread in its own queue are therefore triggered from that thread,
+ *** instead of bouncing through the main callout queue.
+ ***
+ *** Only the owning thread can schedule events in these queues, since they
+ *** are disposed of along with their pending events when it exits.  Other
+ *** threads wishing to schedule a timeout there must ask the owning thread
+ *** to do so via teq_post().
+ ***/
+
+#define CQ_THREAD_PERIOD	1000	/* ms, nominal period for per-thread queues */
+
+/**
+ * Thread exit callback, disposing of the per-thread queue.
+ */
+static void
+cq_thread_exit(const void *unused_result, void *arg)
+{
+	cqueue_t *cq = arg;
+
+	(void) unused_result;
+
+	cqueue_check(cq);
+	g_assert(cq->cq_threaded);
+	g_assert(cq->cq_stid < THREAD_MAX);
+	g_assert(cq == cq_thread_queue[cq->cq_stid]);
+
+	cq_thread_queue[cq->cq_stid] = NULL;
+
+	cq_free_null(&cq);
+}
+
+/**
+ * Get the callout queue of the current thread, creating it if needed.
+ *
+ * The queue is automatically freed when the thread exits, along with any
+ * events still pending.  For the thread running the main callout queue,
+ * this is the main queue.
+ *
+ * The thread must be running teq_wait() as its event loop, and it alone
+ * can insert, reschedule or cancel events in that queue.
+ *
+ * @return the callout queue for the current thread.
+ */
+cqueue_t *
+cq_thread(void)
+{
+	uint id = thread_small_id();
+	cqueue_t *cq;
+
+	cq_main_init();
+
+	if (id == callout_queue->cq_stid)
+		return callout_queue;
+
+	g_assert(id < THREAD_MAX);
+
+	cq = cq_thread_queue[id];
+
+	if G_LIKELY(cq != NULL)
+		return cq;
+
+	cq = cq_make(thread_name(), 0, CQ_THREAD_PERIOD);
+	cq->cq_stid = id;
+	cq->cq_threaded = TRUE;
+
+	cq_thread_queue[id] = cq;
+
+	thread_atexit(cq_thread_exit, cq);
+
+	return cq;
+}
+
+/**
+ * Heartbeat the callout queue of the current thread, if it has one.
+ *
+ * This is meant to be called from the event loop of the thread.
+ *
+ * @return the amount of triggered events.
+ */
+size_t
+cq_thread_dispatch(void)
+{
+	uint id = thread_small_id();
+	cqueue_t *cq;
+
+	if G_UNLIKELY(id >= THREAD_MAX)
+		return 0;
+
+	cq = cq_thread_queue[id];
+
+	return NULL == cq ? 0 : cq_heartbeat(cq);
+}
+
+/**
+ * Compute how long the current thread can wait before it needs to call
+ * cq_thread_dispatch() again.
+ *
+ * @return the delay in ms, -1 if the thread has no callout queue or if
+ * there is nothing scheduled in it.
+ */
+int
+cq_thread_delay(void)
+{
+	uint id = thread_small_id();
+	cqueue_t *cq;
+	int delay;
+
+	if G_UNLIKELY(id >= THREAD_MAX)
+		return -1;
+
+	cq = cq_thread_queue[id];
+
+	if G_LIKELY(NULL == cq)
+		return -1;
+
+	if (0 == cq->cq_items && NULL == cq->cq_idle)
+		return -1;
+
+	delay = cq_delay(cq);
+
+	return MAX_INT_VAL(int) == delay ? -1 : MAX(delay, 1);
+}
+
 /***
  *** Idle events.
  ***/
@@ -121,6 +121,10 @@ size_t cq_idle(cqueue_t *cq);
 size_t cq_main_idle(void);
 unsigned cq_main_thread_id(void);
 
+cqueue_t *cq_thread(void);
+size_t cq_thread_dispatch(void);
+int cq_thread_delay(void);
+
 cperiodic_t *cq_periodic_add(cqueue_t *cq,
 	int period, cq_invoke_t event, void *arg);
 cperiodic_t *cq_periodic_main_add(int period, cq_invoke_t event, void *arg);
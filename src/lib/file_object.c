@@ -102,6 +102,7 @@
 
 #include "file_object.h"
 
+#include "aioq.h"
 #include "atomic.h"
 #include "atoms.h"
 #include "compat_misc.h"
@@ -1223,6 +1224,89 @@ file_object_preadv(const file_object_t * const fo,
 	return r;
 }
 
+/**
+ * Queue read of data from the file object at the given offset.
+ *
+ * The file object must remain opened until the completion of the request
+ * has been reaped from the I/O queue.
+ *
+ * @param fo An initialized file object.
+ * @param aq The I/O queue where the request is queued.
+ * @param data A buffer for holding the data to be read, until completion.
+ * @param size The amount of bytes to read (i.e., the size of data).
+ * @param offset The file offset from which to start reading data.
+ * @param udata User data identifying the request upon completion.
+ *
+ * @return On failure -1 is returned and errno is set, 0 when queued.
+ */
+int
+file_object_pread_async(const file_object_t * const fo, aioq_t *aq,
+	void * const data, const size_t size, const filesize_t offset,
+	void *udata)
+{
+	const struct file_descriptor *fd;
+	int r;
+
+	file_object_check(fo);
+
+	fd = fo->fd;
+	FILE_DESCRIPTOR_LOCK(fd);
+
+	if G_UNLIKELY(!is_valid_fd(fd->fd))
+		r = file_object_ebadf();
+	else if G_UNLIKELY(!file_object_readable(fo))
+		r = file_object_eperm(fo, "read", G_STRFUNC);
+	else
+		r = aioq_pread(aq, fd->fd, data, size, offset, udata);
+
+	FILE_DESCRIPTOR_UNLOCK(fd);
+
+	return r;
+}
+
+/**
+ * Queue write of data to the file object at the given offset.
+ *
+ * The file object must remain opened until the completion of the request
+ * has been reaped from the I/O queue.
+ *
+ * @param fo An initialized file object.
+ * @param aq The I/O queue where the request is queued.
+ * @param iov An initialized I/O vector, whose data must remain valid until
+ *        completion (the vector itself is copied).
+ * @param iov_cnt The number of initialized buffer in iov (i.e., its size).
+ * @param offset The file offset at which to start writing the data.
+ * @param udata User data identifying the request upon completion.
+ *
+ * @return On failure -1 is returned and errno is set, 0 when queued.
+ */
+int
+file_object_pwritev_async(const file_object_t * const fo, aioq_t *aq,
+	const iovec_t *iov, const int iov_cnt, const filesize_t offset,
+	void *udata)
+{
+	const struct file_descriptor *fd;
+	int w;
+
+	file_object_check(fo);
+	g_assert(iov != NULL);
+	g_assert(iov_cnt > 0);
+
+	fd = fo->fd;
+	FILE_DESCRIPTOR_LOCK(fd);
+
+	if G_UNLIKELY(!is_valid_fd(fd->fd))
+		w = file_object_ebadf();
+	else if G_UNLIKELY(!file_object_writable(fo))
+		w = file_object_eperm(fo, "write", G_STRFUNC);
+	else
+		w = aioq_pwritev(aq, fd->fd, iov, iov_cnt, offset, udata);
+
+	FILE_DESCRIPTOR_UNLOCK(fd);
+
+	return w;
+}
+
 /**
  * Get opened file status.
  *
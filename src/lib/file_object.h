@@ -107,6 +107,14 @@ ssize_t file_object_pread(const file_object_t *fo,
 ssize_t file_object_preadv(const file_object_t *fo,
 					iovec_t *iov, int iov_cnt, filesize_t offset);
 
+struct aioq;
+
+int file_object_pread_async(const file_object_t *fo, struct aioq *aq,
+					void *data, size_t size, filesize_t offset, void *udata);
+int file_object_pwritev_async(const file_object_t *fo, struct aioq *aq,
+					const iovec_t *iov, int iov_cnt, filesize_t offset,
+					void *udata);
+
 int file_object_fd(const file_object_t *fo);
 const char *file_object_pathname(const file_object_t *fo);
 
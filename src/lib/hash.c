@@ -92,6 +92,29 @@
  * also allows for flagging empty slots and tombstones, at the cost of
  * reserving two hash values for that purpose: 0 and 1.
  *
+ * Since the hashes array is the only thing we need to look at until we
+ * find a candidate for a key comparison, probing is not done slot by slot
+ * but by groups of HASH_LINE_ITEMS consecutive slots, i.e. a CPU cacheline
+ * of hashes, which are all compared at once (using SSE2 when available).
+ * Double hashing is applied to groups: when the home group of a key has
+ * no free slot and does not hold the key, we jump to the next group using
+ * the secondary hash.  A key is necessarily in the first group with a free
+ * slot on its path, or before, hence a lookup touches one cacheline most of
+ * the time instead of one per probed slot, and the keys array is only
+ * accessed when the full hash matches.  Within its group, a key is stored
+ * at its home slot when it is free, so that most successful lookups only
+ * need to check that slot.
+ *
+ * Resizing a large table would require rehashing all its keys at once,
+ * which for millions of keys means a pause of tens of milliseconds.  Tables
+ * whose arena holds at least HASH_INCR_SIZE slots are therefore resized
+ * incrementally: the new arena is allocated, but the keys are migrated from
+ * the old arena by small batches of HASH_INCR_STEP slots at each operation
+ * on the table.  Until the migration is completed, keys missing from the
+ * new arena are looked up in the old one and moved over when found, so that
+ * the key indices returned to heirs always refer to the new arena.  Any
+ * iteration completes the migration first.
+ *
  * The code contained here allows for hash tables and hash sets.  Most of the
  * logic is shared, but the API for iteration and insertion is slightly
  * different given that there is no value associated with a key within a set,
@@ -107,17 +130,28 @@
 
 #include "hash.h"
 
+#include "atomic.h"
+#include "dump_options.h"
 #include "endian.h"
 #include "hashing.h"
+#include "log.h"
+#include "pow2.h"
 #include "rand31.h"
 #include "random.h"
+#include "spinlock.h"
+#include "stringify.h"
+#include "tm.h"
 #include "unsigned.h"
 #include "vmm.h"
 #include "walloc.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "override.h"			/* Must be the last header included */
 
-#define HASH_HOPS_MIN	4		/* Theoretical hops when full at 75% */
+#define HASH_HOPS_MIN	1		/* Group hops we always allow */
 
 /*
  * The following definitions help control the amount of hash codes we can keep
@@ -131,6 +165,10 @@
  */
 #define HASH_CACHELINE	64		/* Amount of bytes in a CPU cacheline */
 #define HASH_LINE_ITEMS	(HASH_CACHELINE / INTSIZE)	/* hashes are `uint' */
+#define HASH_GROUP_BITS	4		/* log2(HASH_LINE_ITEMS) */
+
+#define HASH_INCR_SIZE	(1U << 14)	/* Resize incrementally from that size */
+#define HASH_INCR_STEP	64			/* Old slots migrated per operation */
 
 /**
  * Type of table resizing we want to perform.
@@ -187,33 +225,69 @@ hash_random_offset_init(void)
 }
 
 /**
- * How many extra hops past the home location do we allow in the table before
- * considering resizing it.
+ * Statistics.
+ */
+static struct hash_stats {
+	AU64(resizes);					/* Large arenas rebuilt in one go */
+	AU64(resizes_incremental);		/* Incremental resizes started */
+	AU64(resizes_completed);		/* Incremental resizes forced to complete */
+	AU64(keys_migrated);			/* Keys migrated incrementally */
+	AU64(keys_pulled);				/* Keys moved when looked up in old arena */
+	uint64 pause_max_ns;			/* Longest resizing pause */
+	size_t pause_max_size;			/* Size of arena for longest pause */
+} hash_stats;
+static spinlock_t hash_stats_slk = SPINLOCK_INIT;
+
+#define HASH_STATS_INC(x)		AU64_INC(&hash_stats.x)
+#define HASH_STATS_ADD(x, n)	AU64_ADD(&hash_stats.x, n)
+
+/**
+ * Record time spent in resizing work, keeping the longest pause.
+ *
+ * @param start		when resizing work started
+ * @param size		size of the old arena
+ */
+static void
+hash_stats_pause(const tm_nano_t *start, size_t size)
+{
+	tm_nano_t end, elapsed;
+	uint64 ns;
+
+	tm_precise_time(&end);
+	tm_precise_elapsed(&elapsed, &end, start);
+	ns = tmn2ns(&elapsed);
+
+	spinlock_hidden(&hash_stats_slk);
+	if (ns > hash_stats.pause_max_ns) {
+		hash_stats.pause_max_ns = ns;
+		hash_stats.pause_max_size = size;
+	}
+	spinunlock_hidden(&hash_stats_slk);
+}
+
+/**
+ * How many extra group hops past the home group do we allow in the table
+ * before considering resizing it.
  */
 static inline size_t
 hash_hops_max(const struct hkeys *hk)
 {
 	/*
-	 * We allow HASH_HOPS_MIN hops at least, because this is the theoretical
-	 * average amount of hops we can expect when the table is full at the
-	 * nominal rate we allow.
+	 * Each hop skips a whole group of HASH_LINE_ITEMS slots, so at the
+	 * nominal 75% filling rate we allow, most lookups should end in their
+	 * home group.  We allow HASH_HOPS_MIN hops at least, and a few more as
+	 * the table grows since overflowing groups become more likely.
 	 *
-	 * However we want the hash table to be more efficient than what a binary
-	 * search on a sorted table would bring, which would require hk->bits
-	 * comparisons at most.
-	 *
-	 * The exception is when there are up to HASH_LINE_ITEMS slots in the
-	 * hash table: when everything fits in the "memory cacheline", it's pretty
-	 * cheap to iterate through the hash array, even if it's completely full.
-	 * This trade-off helps hash tables with a small amount of items keep a
-	 * small memory footprint.
-	 *		--RAM, 2012-12-15
+	 * When there are up to HASH_LINE_ITEMS slots in the hash table, the
+	 * whole table is a single group that is looked at in one go, even if
+	 * it's completely full.  This trade-off helps hash tables with a small
+	 * amount of items keep a small memory footprint.
 	 */
 
 	if G_UNLIKELY(hk->size <= HASH_LINE_ITEMS)
-		return HASH_LINE_ITEMS;			/* Allows to loop over all keys */
+		return 0;						/* Single group, never hops */
 
-	return HASH_HOPS_MIN + (hk->bits - HASH_MIN_BITS) / 2;
+	return HASH_HOPS_MIN + (hk->bits - HASH_GROUP_BITS) / 4;
 }
 
 /**
@@ -304,6 +378,19 @@ hash_arena_allocate(struct hash *h, size_t bits)
 
 	size = hash_arena_size(hk->size, hk->has_values);
 
+	/*
+	 * Large arenas are usually too big for the VMM page cache and come
+	 * straight from the kernel, already zeroed: vmm_alloc0() knows when it
+	 * can avoid clearing the memory, which saves touching all the pages of
+	 * the hashes array when we resize incrementally.
+	 */
+
+	if (hk->size >= HASH_INCR_SIZE && !hk->raw_memory) {
+		arena = vmm_alloc0(size);
+		hash_update_arena_pointers(h, arena);
+		return;
+	}
+
 	if (size >= compat_pagesize() || hk->raw_memory)
 		arena = vmm_alloc(size);
 	else
@@ -388,6 +475,23 @@ hash_arena_kset_free(struct hash *h)
 	hash_arena_size_free(hk->keys, size, hk->raw_memory);
 }
 
+/**
+ * Free old arena left by an incremental resize, if any.
+ */
+static void
+hash_arena_old_free(struct hash *h)
+{
+	struct hold *ho = h->kset.old;
+
+	if G_LIKELY(NULL == ho)
+		return;
+
+	hash_arena_size_free(ho->ks.keys,
+		hash_arena_size(ho->ks.size, ho->ks.has_values), ho->ks.raw_memory);
+	WFREE(ho);
+	h->kset.old = NULL;
+}
+
 /**
  * Free allocated arena structures.
  */
@@ -397,6 +501,7 @@ hash_arena_free(struct hash *h)
 	hash_check(h);
 
 	hash_arena_kset_free(h);
+	hash_arena_old_free(h);
 
 	/*
 	 * If the table was marked thread-safe, now is a good time to clean up
@@ -556,6 +661,67 @@ hash_keyset_equals(const struct hkeys *hk, const void *k1, const void *k2)
 	g_assert_not_reached();
 }
 
+/**
+ * Probe a group of slots in the hashes array.
+ *
+ * @param base		first hash of the group
+ * @param n			amount of slots in the group (up to HASH_LINE_ITEMS)
+ * @param hv		the hashed value we are looking for
+ * @param freeb		written with the bitmap of free slots
+ * @param tombs		written with the bitmap of tombstones
+ *
+ * @return the bitmap of slots whose hash is ``hv'', bit 0 being ``base''.
+ */
+static inline ALWAYS_INLINE unsigned
+hash_group_probe(const unsigned *base, size_t n, unsigned hv,
+	unsigned *freeb, unsigned *tombs)
+{
+	unsigned match = 0, f = 0, t = 0;
+	size_t i;
+
+	STATIC_ASSERT(HASH_LINE_ITEMS == (1U << HASH_GROUP_BITS));
+
+#ifdef __SSE2__
+	STATIC_ASSERT(0 == HASH_LINE_ITEMS % 4);
+
+	if G_LIKELY(HASH_LINE_ITEMS == n) {
+		const __m128i vh = _mm_set1_epi32((int) hv);
+		const __m128i vf = _mm_set1_epi32(HASH_FREE);
+		const __m128i vt = _mm_set1_epi32(HASH_TOMB);
+
+		for (i = 0; i < HASH_LINE_ITEMS; i += 4) {
+			__m128i w = _mm_loadu_si128((const __m128i *) &base[i]);
+
+			match |= (unsigned) _mm_movemask_ps(
+				_mm_castsi128_ps(_mm_cmpeq_epi32(w, vh))) << i;
+			f |= (unsigned) _mm_movemask_ps(
+				_mm_castsi128_ps(_mm_cmpeq_epi32(w, vf))) << i;
+			t |= (unsigned) _mm_movemask_ps(
+				_mm_castsi128_ps(_mm_cmpeq_epi32(w, vt))) << i;
+		}
+
+		*freeb = f;
+		*tombs = t;
+		return match;
+	}
+#endif	/* __SSE2__ */
+
+	for (i = 0; i < n; i++) {
+		unsigned ih = base[i];
+
+		if (ih == hv)
+			match |= 1U << i;
+		else if (HASH_IS_FREE(ih))
+			f |= 1U << i;
+		else if (HASH_IS_TOMB(ih))
+			t |= 1U << i;
+	}
+
+	*freeb = f;
+	*tombs = t;
+	return match;
+}
+
 /**
  * Lookup key in the key set.
  *
@@ -577,127 +743,122 @@ static bool G_HOT
 hash_keyset_lookup(struct hkeys *hk, const void *key, unsigned hv,
 	size_t *kidx, size_t *tombidx)
 {
-	unsigned inc, ih;
-	size_t idx, nidx;
-	size_t first_tomb, mask, hops;
-	bool found;
+	unsigned inc = 0, ih;
+	size_t gbits, grpsize, gmask, home, g, idx, hidx;
+	size_t first_tomb = (size_t) -1, hops = 0;
+	bool found = FALSE;
 
-	idx = hashing_keep(hv, hk->bits);
-	ih = hk->hashes[idx];
+	/*
+	 * Tables with less than HASH_LINE_ITEMS slots are made of a single
+	 * group, spanning the whole table.
+	 */
+
+	gbits = MIN(hk->bits, HASH_GROUP_BITS);
+	grpsize = 1UL << gbits;
+	gmask = (hk->size >> gbits) - 1;	/* Amount of groups is a power of 2 */
+	hidx = hashing_keep(hv, hk->bits);
+	home = g = hidx >> gbits;
 
 	/*
-	 * If the home slot is free, we're done: the key does not exist and
-	 * it can be inserted there.
+	 * Keys are preferably stored at their home slot, so check it first:
+	 * when it holds the key, we need not probe the whole group.
 	 */
 
-	if (HASH_IS_FREE(ih)) {
-		*kidx = idx;
+	ih = hk->hashes[hidx];
+
+	if (ih == hv && hash_keyset_equals(hk, hk->keys[hidx], key)) {
+		*kidx = hidx;
 		if (tombidx != NULL)
 			*tombidx = (size_t) -1;
-		return FALSE;
+		return TRUE;
 	}
 
 	/*
-	 * If the home slot contains the key we're looking for, we're done.
+	 * By design, the hash table can never become full because we're constantly
+	 * monitoring its size and resizing it as it grows past a high watermark.
+	 * Therefore, we know we have to end up on a group with a free slot.
+	 *
+	 * We may very well loop back to the original home group though, meaning
+	 * the key was nowhere to be found.  We can't go back to the home group
+	 * before we have been through all the other groups in the table since
+	 * the increment is odd and the amount of groups is a power of 2: the two
+	 * numbers are prime with each other, so the first n > 0 for which
+	 * n * inc = 0 modulo the amount of groups is the amount of groups itself.
 	 */
 
-	if (HASH_IS_REAL(ih)) {
-		if (ih == hv && hash_keyset_equals(hk, hk->keys[idx], key)) {
-			*kidx = idx;
-			if (tombidx != NULL)
-				*tombidx = (size_t) -1;
-			return TRUE;
+	for (;;) {
+		size_t start = g << gbits;
+		unsigned match, freeb, tombs;
+
+		match = hash_group_probe(&hk->hashes[start], grpsize, hv,
+			&freeb, &tombs);
+
+		while (match != 0) {
+			idx = start + ctz(match);
+			if (hash_keyset_equals(hk, hk->keys[idx], key)) {
+				found = TRUE;
+				break;
+			}
+			match &= match - 1;		/* Clear lowest bit set */
 		}
-		first_tomb = (size_t) -1;
-	} else {
-		first_tomb = idx;		/* Not free and not real -> must be a tomb */
-	}
 
-	/*
-	 * We're going to need the secondary hash now.
-	 */
+		if (found)
+			break;
 
-	inc = hash_compute_increment(hk, key, hv);
-	found = FALSE;
-	mask = hk->size - 1;		/* Size is power of two */
+		/*
+		 * Only record tombs when the key is not in the current group: it
+		 * is pointless to move a key within the group, but a tomb in the
+		 * group can be re-used to insert a missing key.
+		 */
 
-	/*
-	 * By design, the hash table can never become full because we're constantly
-	 * monitoring its size and resizing it as it grows past a high watermark.
-	 * Therefore, we know we have to end up on a free slot or a tomb.
-	 *
-	 * We may very well loop back to the original home slot though, meaning
-	 * the key was nowhere to be found.  We can't go back to the home slot
-	 * before we have been through all the other slots in the table since
-	 * the increment and the table size are prime with each other.
-	 *
-	 * Here's the mathematical proof: let S be the table size (a power of 2)
-	 * and i be the increment (odd number).
-	 *
-	 * Lemma: S and i are prime together.
-	 * Proof: let d be a common divisor of S and i.  Since S is a power of 2,
-	 * then d is of the form 2^k with k a natural number.  Because i is odd,
-	 * it cannot be divided by 2, so d is necessary 2^0 = 1.  QED.
-	 *
-	 * Now that the lemma is established, here's the original proposition proof.
-	 * Let x be the initial position index.  Suppose we find a natural number k
-	 * such that x + i*k = x (modulo S).  Here k represents the number of
-	 * steps after which we are back to the initial position.
-	 *
-	 * Because (Z/nZ, +) is a group, each item has on opposite y such that
-	 * x + y = 0 (modulo n). Let us write y = -x.  Adding -x to both sides
-	 * of our equation leads to i*k = 0 (modulo S).  This means that it can
-	 * also be written i*k = a*S, with "a" an integer number, this being an
-	 * equation within R, the set of real numbers.  So k = a*(S/i).  Because
-	 * S and i are prime together, S/i is not an integer value unless i = S
-	 * or i = 1.  The former would mean that i = 0 (modulo S) and i was odd,
-	 * so that's impossible, and the latter means trivially that k is a
-	 * multiple of S, meaning k = 0 (mod S).  The only other alternatives for
-	 * k to be a natural number when S/i is not an integer are a = 0, in which
-	 * case k = 0, or a = n*i, in which case k = n*S so k = 0 (mod S).
-	 *
-	 * Therefore, we have established the only k such that x + i*k = x (mod S)
-	 * is k = 0 (mod S).  We won't come back to x before having looped through
-	 * all the other slots first. QED
-	 *
-	 * Our proof does not depend on the value of x, the initial position, hence
-	 * we have demonstrated that the while loop below will either look at all
-	 * the slots or stop when it reaches a free slot.
-	 */
+		if ((size_t) -1 == first_tomb && tombs != 0)
+			first_tomb = start + ctz(tombs);
 
-	hops = 1;
-	nidx = (idx + inc) & mask;
-	ih = hk->hashes[nidx];
+		/*
+		 * A key is always inserted in the first group with a free slot on
+		 * its lookup path, or before if a tomb was found.  Since a slot never
+		 * becomes free again unless the table is rebuilt, the key cannot be
+		 * further down the path if the current group has a free slot.
+		 */
 
-	while (!HASH_IS_FREE(ih) && nidx != idx) {
-		size_t aidx = (nidx + inc) & mask;
-		G_PREFETCH_R(&hk->hashes[aidx]);
-		if (ih == hv && hash_keyset_equals(hk, hk->keys[nidx], key)) {
-			found = TRUE;
+		if (freeb != 0) {
+			idx = (g == home && HASH_IS_FREE(ih)) ? hidx : start + ctz(freeb);
 			break;
-		} else if ((size_t) -1 == first_tomb && HASH_IS_TOMB(ih)) {
-			first_tomb = nidx;
 		}
-		nidx = aidx;
-		ih = hk->hashes[nidx];
+
+		/*
+		 * We're going to need the secondary hash now.
+		 */
+
+		if (0 == inc)
+			inc = hash_compute_increment(hk, key, hv);
+
+		g = (g + inc) & gmask;
 		hops++;
-	}
 
-	G_PREFETCH_W(kidx);
+		if G_UNLIKELY(g == home) {
+			idx = start;			/* Table is full, looped over all groups */
+			break;
+		}
+
+		G_PREFETCH_R(&hk->hashes[g << gbits]);
+	}
 
 	/*
 	 * When lookups go through too many hops before ending, flag for a resizing
 	 * at the next opportunity.
 	 *
-	 * If we looped back to the initial index, it means the table is full...
+	 * If we looped back to the initial group, it means the table is full...
 	 */
 
-	if G_UNLIKELY(hops > hash_hops_max(hk) || nidx == idx)
+	if G_UNLIKELY(hops > hash_hops_max(hk) || (g == home && 0 != hops))
 		hk->resize = TRUE;
 
+	G_PREFETCH_W(kidx);
+
 	if (tombidx != NULL)
 		*tombidx = first_tomb;
-	*kidx = (found || (size_t) -1 == first_tomb) ? nidx : first_tomb;
+	*kidx = (found || (size_t) -1 == first_tomb) ? idx : first_tomb;
 
 	return found;
 }
@@ -727,6 +888,138 @@ hash_erect_tombstone(struct hash *h, size_t idx)
 	return TRUE;
 }
 
+/**
+ * Move key at index ``oidx'' in the old arena to index ``idx'' in the new
+ * arena, as returned by a failed lookup of the key in the new arena.
+ *
+ * @param h			the hash table being incrementally resized
+ * @param oidx		index of the key in the old arena
+ * @param idx		insertion index in the new arena
+ * @param tombidx	first tomb on the lookup path in the new arena
+ */
+static void
+hash_migrate_key(struct hash *h, size_t oidx, size_t idx, size_t tombidx)
+{
+	struct hold *ho = h->kset.old;
+	struct hkeys *hk = &h->kset;
+
+	g_assert(HASH_IS_REAL(ho->ks.hashes[oidx]));
+	g_assert(size_is_positive(ho->ks.items));
+	g_assert(!HASH_IS_REAL(hk->hashes[idx]));
+
+	if (tombidx == idx) {
+		g_assert(size_is_positive(hk->tombs));
+		hk->tombs--;
+	}
+
+	hk->keys[idx] = ho->ks.keys[oidx];
+	hk->hashes[idx] = ho->ks.hashes[oidx];
+	if (ho->values != NULL) {
+		const void **values = (*h->ops->get_values)(h);
+		values[idx] = ho->values[oidx];
+	}
+
+	/*
+	 * A tomb in the old arena keeps the lookup paths of the other keys
+	 * intact there until they are migrated.
+	 */
+
+	ho->ks.hashes[oidx] = HASH_TOMB;
+	ho->ks.items--;
+}
+
+/**
+ * Migrate up to ``n'' slots from the old arena, freeing it when all the
+ * keys have been moved to the new arena.
+ */
+static void
+hash_migrate(struct hash *h, size_t n)
+{
+	struct hold *ho = h->kset.old;
+	size_t i, end, moved = 0;
+	tm_nano_t start;
+
+	g_assert(ho != NULL);
+
+	tm_precise_time(&start);
+	end = MIN(ho->pos + n, ho->ks.size);
+
+	for (i = ho->pos; i < end && 0 != ho->ks.items; i++) {
+		unsigned hv = ho->ks.hashes[i];
+
+		if (HASH_IS_REAL(hv)) {
+			size_t idx, tombidx;
+			bool found;
+
+			found = hash_keyset_lookup(&h->kset, ho->ks.keys[i], hv,
+				&idx, &tombidx);
+			g_assert(!found);
+
+			hash_migrate_key(h, i, idx, tombidx);
+			moved++;
+		}
+	}
+
+	ho->pos = i;
+	HASH_STATS_ADD(keys_migrated, moved);
+
+	if (0 == ho->ks.items) {
+		size_t size = ho->ks.size;
+
+		hash_arena_old_free(h);
+		hash_stats_pause(&start, size);
+	} else {
+		hash_stats_pause(&start, ho->ks.size);
+	}
+}
+
+/**
+ * Complete pending incremental resize, if any.
+ */
+static void
+hash_migrate_complete(struct hash *h)
+{
+	if G_UNLIKELY(h->kset.old != NULL) {
+		HASH_STATS_INC(resizes_completed);
+		hash_migrate(h, h->kset.old->ks.size);
+		g_assert(NULL == h->kset.old);
+	}
+}
+
+/**
+ * When a key is missing from the new arena during an incremental resize,
+ * look whether it is still in the old arena and move it to the new arena.
+ *
+ * @param h			the hash table
+ * @param key		the key we are looking for
+ * @param hv		the hashed value for the key (primary hash)
+ * @param idx		insertion index in the new arena, from failed lookup
+ * @param tombidx	first tomb on the lookup path in the new arena
+ *
+ * @return TRUE if key was found, with the key now at ``idx'' in new arena.
+ */
+static bool
+hash_migrate_lookup(struct hash *h, const void *key, unsigned hv,
+	size_t idx, size_t tombidx)
+{
+	struct hold *ho = h->kset.old;
+	size_t oidx;
+
+	if G_LIKELY(NULL == ho)
+		return FALSE;
+
+	if (!hash_keyset_lookup(&ho->ks, key, hv, &oidx, NULL))
+		return FALSE;
+
+	hash_migrate_key(h, oidx, idx, tombidx);
+	HASH_STATS_INC(keys_pulled);
+
+	if (0 == ho->ks.items)
+		hash_arena_old_free(h);
+
+	return TRUE;
+}
+
 /**
  * Resize empty table to its minimal state.
  *
@@ -737,6 +1030,8 @@ hash_resize_min(struct hash *h)
 {
 	assert_hash_locked(h);
 
+	hash_arena_old_free(h);
+
 	if G_UNLIKELY(HASH_MIN_BITS == h->kset.bits) {
 		memset(h->kset.hashes, 0,
 			(1U << HASH_MIN_BITS) * sizeof h->kset.hashes[0]);
@@ -766,10 +1061,24 @@ hash_resize(struct hash *h, enum hash_resize_mode mode)
 	const void **old_keys, **hk;
 	unsigned *old_hashes, *hp;
 	size_t old_size, old_arena_size, i, keys;
+	struct hkeys old_kset;
+	tm_nano_t start;
+	bool large;
 
 	hash_check(h);
 	assert_hash_locked(h);
+	g_assert(NULL == h->kset.old);
+
+	/*
+	 * Only the resizing of large tables is timed and accounted for, to
+	 * keep the overhead off the many small tables.
+	 */
+
+	large = h->kset.size >= HASH_INCR_SIZE;
+	if (large)
+		tm_precise_time(&start);
 
+	old_kset = h->kset;			/* Struct copy */
 	old_keys = h->kset.keys;
 	old_hashes = h->kset.hashes;
 	if (h->kset.has_values)
@@ -813,6 +1122,27 @@ size_computed:
 
 	hash_arena_allocate(h, h->kset.bits);
 
+	/*
+	 * Large tables not being iterated over are resized incrementally.
+	 */
+
+	if (
+		large && h->kset.size > HASH_LINE_ITEMS &&
+		!h->kset.raw_memory && 0 == h->refcnt
+	) {
+		struct hold *ho;
+
+		WALLOC0(ho);
+		ho->ks = old_kset;		/* Struct copy */
+		ho->values = old_values;
+		h->kset.old = ho;
+
+		HASH_STATS_INC(resizes_incremental);
+		hash_stats_pause(&start, old_size);
+		hash_migrate(h, HASH_INCR_STEP);
+		return;
+	}
+
 	if (old_values != NULL)
 		new_values = (*h->ops->get_values)(h);
 
@@ -840,6 +1170,11 @@ size_computed:
 
 	hash_arena_size_free(old_keys, old_arena_size, h->kset.raw_memory);
 	h->kset.relocate = 0;
+
+	if (large) {
+		HASH_STATS_INC(resizes);
+		hash_stats_pause(&start, old_size);
+	}
 }
 
 /**
@@ -862,6 +1197,17 @@ hash_resize_as_needed(struct hash *h)
 	if G_UNLIKELY(0 != h->refcnt)
 		return FALSE;
 
+	/*
+	 * During an incremental resize, migrate some keys and defer any other
+	 * decision until the old arena is gone.
+	 */
+
+	if G_UNLIKELY(h->kset.old != NULL) {
+		hash_migrate(h, HASH_INCR_STEP);
+		if (h->kset.old != NULL)
+			return FALSE;
+	}
+
 	if (h->kset.items <= HASH_LINE_ITEMS) {
 		/*
 		 * An empty table is immediately brought back to its minimal state.
@@ -1006,6 +1352,8 @@ hash_insert_key(struct hash *h, const void *key)
 	} else {
 		hash_resize_as_needed(h);
 		found = hash_keyset_lookup(&h->kset, key, hv, &idx, &tombidx);
+		if (!found)
+			found = hash_migrate_lookup(h, key, hv, idx, tombidx);
 	}
 
 	if (!found) {
@@ -1044,6 +1392,17 @@ hash_lookup_key(struct hash *h, const void *key)
 	hv = hash_compute_primary(&h->kset, key);
 	found = hash_keyset_lookup(&h->kset, key, hv, &idx, &tombidx);
 
+	/*
+	 * During an incremental resize, migrated keys can fill the tombs we
+	 * saw on the lookup path, so we do not attempt to relocate the key.
+	 */
+
+	if G_UNLIKELY(h->kset.old != NULL) {
+		if (!found)
+			found = hash_migrate_lookup(h, key, hv, idx, tombidx);
+		tombidx = (size_t) -1;
+	}
+
 	/*
 	 * Regardless of whether key was found, attempt a resize if we went
 	 * through too many hops.  If the table ends-up being resized, then
@@ -1058,8 +1417,15 @@ hash_lookup_key(struct hash *h, const void *key)
 			bool kept;
 
 			kept = hash_keyset_lookup(&h->kset, key, hv, &idx, &tombidx);
+			if (!kept) {
+				kept = hash_migrate_lookup(h, key, hv, idx, tombidx);
+				tombidx = (size_t) -1;
+			}
 			g_assert(kept);		/* Since key existed before resizing */
 		}
+	} else if G_UNLIKELY(h->kset.old != NULL) {
+		if (0 == h->refcnt)
+			hash_migrate(h, HASH_INCR_STEP);
 	} else {
 		hash_arena_relocate(h);
 	}
@@ -1136,6 +1502,22 @@ hash_delete_key(struct hash *h, const void *key)
 		h->kset.items--;
 		hash_resize_as_needed(h);
 		return TRUE;
+	} else if G_UNLIKELY(h->kset.old != NULL) {
+		struct hold *ho = h->kset.old;
+
+		if (!hash_keyset_lookup(&ho->ks, key, hv, &idx, NULL))
+			return FALSE;	/* Key not found */
+
+		g_assert(size_is_positive(ho->ks.items));
+		g_assert(size_is_positive(h->kset.items));
+
+		ho->ks.hashes[idx] = HASH_TOMB;
+		ho->ks.items--;
+		h->kset.items--;
+		if (0 == ho->ks.items)
+			hash_arena_old_free(h);
+		hash_resize_as_needed(h);
+		return TRUE;
 	} else {
 		return FALSE;		/* Key not found */
 	}
@@ -1169,6 +1551,13 @@ hash_refcnt_inc(const struct hash *h)
 	hash_check(h);
 	assert_hash_locked(h);
 
+	/*
+	 * Iterations only traverse the current arena.
+	 */
+
+	if (0 == wh->refcnt)
+		hash_migrate_complete(wh);
+
 	wh->refcnt++;
 }
 
@@ -1219,6 +1608,8 @@ hash_random(const struct hash *h, const void **keyptr)
 	 * from the bottom otherwise.
 	 */
 
+	hash_migrate_complete(deconstify_pointer(h));
+
 	hk = &h->kset;
 	n = (size_t) random_ulong_value(hk->items - 1);
 
@@ -1331,4 +1722,37 @@ hash_thread_safe(struct hash *h)
 	mutex_init(h->lock);
 }
 
+/**
+ * Dump hash table statistics to specified log agent.
+ */
+void G_COLD
+hash_dump_stats_log(logagent_t *la, unsigned options)
+{
+	struct hash_stats stats;
+	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
+
+	spinlock_hidden(&hash_stats_slk);
+	stats = hash_stats;		/* Struct copy under lock protection */
+	spinunlock_hidden(&hash_stats_slk);
+
+#define DUMP64(x) G_STMT_START {							\
+	uint64 v = AU64_VALUE(&stats.x);						\
+	log_info(la, "HASH %s = %s", #x,						\
+		uint64_to_string_grp(v, groupped));					\
+} G_STMT_END
+
+	DUMP64(resizes);
+	DUMP64(resizes_incremental);
+	DUMP64(resizes_completed);
+	DUMP64(keys_migrated);
+	DUMP64(keys_pulled);
+
+#undef DUMP64
+
+	log_info(la, "HASH pause_max_us = %s",
+		uint64_to_string_grp(stats.pause_max_ns / 1000, groupped));
+	log_info(la, "HASH pause_max_size = %s",
+		size_t_to_string_grp(stats.pause_max_size, groupped));
+}
+
 /* vi: set ts=4 sw=4 cindent: */
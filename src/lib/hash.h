@@ -67,6 +67,8 @@ enum hmagic {
 #define HASH_MIN_BITS			1
 #define HASH_MIN_SIZE			(1U << HASH_MIN_BITS)
 
+struct hold;
+
 /**
  * The key set structure.
  */
@@ -77,6 +79,7 @@ struct hkeys {
 	size_t tombs;				/* Amount of deleted items (tombstones) */
 	const void **keys;			/* Array of keys */
 	unsigned *hashes;			/* Array of hashed keys */
+	struct hold *old;			/* Previous arena, during incremental resize */
 	union {
 		struct {
 			hash_fn_t hash;			/* Primary key hashing function */
@@ -99,6 +102,18 @@ struct hkeys {
 	unsigned relocate:10;		/* Attempts for arena relocation */
 };
 
+/**
+ * The previous arena of a table being incrementally resized.
+ *
+ * Keys are migrated to the new arena a few at a time, from the lowest index
+ * up, and looked up in the old arena when missing from the new one.
+ */
+struct hold {
+	struct hkeys ks;			/* Old key set, ks.items is what is left */
+	const void **values;		/* Old values, NULL if none */
+	size_t pos;					/* Next slot to migrate */
+};
+
 #define HASH(x)		((struct hash *) (x))
 
 /*
@@ -216,12 +231,16 @@ void hash_refcnt_dec(const struct hash *h);
  * Public polymorphic interface.
  */
 
+struct logagent;
+
 void hash_foreach(const struct hash *h, data_fn_t fn, void *data);
 void hash_clear(struct hash *h);
 size_t hash_count(const struct hash *h);
 size_t hash_random(const struct hash *h, const void **keyptr);
 void hash_free(struct hash *h);
 
+void hash_dump_stats_log(struct logagent *la, unsigned options);
+
 #endif /* _hash_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,223 @@
+/*
+ * htable-test -- tests incremental resizing of large hash tables.
+ *
+ * Copyright (c) 2026 agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "halloc.h"
+#include "hash.h"
+#include "htable.h"
+#include "log.h"
+#include "misc.h"
+#include "progname.h"
+#include "random.h"
+#include "stringify.h"
+#include "tm.h"
+
+#include "override.h"		/* Must be the last header included */
+
+static char *present;		/* Shadow flags, indexed by key - 1 */
+static size_t count;		/* Amount of keys present */
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-h] [-k keys] [-l keys] [-r rounds]\n"
+			"  -h : prints this help message\n"
+			"  -k : amount of distinct keys for churning (default 200000)\n"
+			"  -l : amount of keys for the latency benchmark "
+				"(default 1000000)\n"
+			"  -r : rounds of random churn over the keys (default 4)\n"
+			, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+check_key(htable_t *ht, size_t n)
+{
+	void *p = ulong_to_pointer(n + 1);
+
+	if (htable_contains(ht, p) != booleanize(present[n]))
+		s_fatal_exit(EXIT_FAILURE, "key %zu %s", n + 1,
+			present[n] ? "missing" : "unexpectedly present");
+
+	if (present[n] && htable_lookup(ht, p) != p)
+		s_fatal_exit(EXIT_FAILURE, "wrong value for key %zu", n + 1);
+}
+
+static void
+flip_key(htable_t *ht, size_t n)
+{
+	void *p = ulong_to_pointer(n + 1);
+
+	check_key(ht, n);
+
+	if (present[n]) {
+		htable_remove(ht, p);
+		present[n] = 0;
+		count--;
+	} else {
+		htable_insert(ht, p, p);
+		present[n] = 1;
+		count++;
+	}
+
+	if (count != htable_count(ht))
+		s_fatal_exit(EXIT_FAILURE, "has %zu keys, expected %zu",
+			htable_count(ht), count);
+}
+
+/*
+ * Grow the table well past the size from which it is resized incrementally,
+ * churn it, then shrink it, removing and looking up random keys all along
+ * so that these operations run whilst keys are migrated.
+ */
+static void
+test_churn(size_t keys, uint rounds)
+{
+	htable_t *ht;
+	size_t i;
+
+	HALLOC0_ARRAY(present, keys);
+	count = 0;
+	ht = htable_create(HASH_KEY_SELF, 0);
+
+	for (i = 0; i < keys; i++) {
+		if (!present[i])
+			flip_key(ht, i);
+		if (0 == i % 3)
+			flip_key(ht, random_value(i));
+		check_key(ht, random_value(keys - 1));
+	}
+
+	s_info("grown to %zu keys", count);
+
+	for (i = 0; i < rounds * keys; i++)
+		flip_key(ht, random_value(keys - 1));
+
+	s_info("churned %zu times, %zu keys left", i, count);
+
+	for (i = 0; i < keys; i++) {
+		if (present[i])
+			flip_key(ht, i);
+		if (0 == i % 7)
+			flip_key(ht, random_value(keys - 1));
+		check_key(ht, random_value(keys - 1));
+	}
+
+	s_info("shrunk to %zu keys", count);
+
+	for (i = 0; i < keys; i++)
+		check_key(ht, i);
+
+	htable_free_null(&ht);
+	HFREE_NULL(present);
+}
+
+/*
+ * Measure the average and worst-case latency of sequential inserts, which
+ * includes the resizing pauses.
+ */
+static void
+test_latency(size_t keys)
+{
+	htable_t *ht;
+	size_t i;
+	uint64 total = 0, worst = 0;
+
+	ht = htable_create(HASH_KEY_SELF, 0);
+
+	for (i = 0; i < keys; i++) {
+		void *p = ulong_to_pointer(i + 1);
+		tm_nano_t start, end;
+		uint64 ns;
+
+		tm_precise_time(&start);
+		htable_insert(ht, p, p);
+		tm_precise_time(&end);
+
+		ns = tm_precise_elapsed_ns(&end, &start);
+		total += ns;
+		worst = MAX(worst, ns);
+	}
+
+	s_info("%zu inserts: %s ns on average, %s usecs at worst",
+		keys, uint64_to_string(total / keys),
+		uint64_to_string2(worst / 1000));
+
+	htable_free_null(&ht);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	const char options[] = "hk:l:r:";
+	size_t keys = 200000, lkeys = 1000000;
+	uint rounds = 4;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'k':			/* keys for churning */
+			keys = MAX(1, atol(optarg));
+			break;
+		case 'l':			/* keys for latency benchmark */
+			lkeys = MAX(1, atol(optarg));
+			break;
+		case 'r':			/* churning rounds */
+			rounds = atoi(optarg);
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	test_churn(keys, rounds);
+	test_latency(lkeys);
+	hash_dump_stats_log(log_agent_stderr_get(), 0);
+
+	s_info("all checks passed");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,274 @@
+/*
+ * inputevt-test -- tests and benchmarks I/O event dispatching.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "fd.h"
+#include "halloc.h"
+#include "inputevt.h"
+#include "log.h"
+#include "misc.h"
+#include "progname.h"
+#include "random.h"
+#include "stringify.h"
+#include "tm.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define WRITE_SIZE	64		/* Bytes sent to a connection per round */
+#define READ_SIZE	48		/* Bytes read per event, less than written */
+#define IDLE_ROUNDS	1000	/* Rounds without progress before stall */
+
+struct conn {
+	int fd[2];				/* fd[0] is monitored, fd[1] is the peer */
+	unsigned id;			/* Event source ID, 0 if disabled */
+};
+
+static struct conn **disabled;
+static size_t disabled_count;
+static uint churn = 50;
+static uint64 sent, received, events, spurious;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-hl] [-a percent] [-c percent] [-n fds] [-r rounds]\n"
+			"  -a : percentage of connections receiving data per round "
+				"(default 5)\n"
+			"  -c : percentage of sources disabled after reading, as "
+				"bandwidth\n"
+			"       scheduling does, and enabled again next round "
+				"(default 50)\n"
+			"  -h : prints this help message\n"
+			"  -l : use level-triggered epoll()\n"
+			"  -n : amount of connections (socket pairs) (default 10000)\n"
+			"  -r : amount of rounds (default 1000)\n"
+			, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+conn_readable(void *data, int fd, inputevt_cond_t cond)
+{
+	struct conn *c = data;
+	char buf[READ_SIZE];
+	ssize_t r;
+
+	g_assert(fd == c->fd[0]);
+	g_assert(INPUT_EVENT_R & cond);
+
+	events++;
+	r = read(fd, buf, sizeof buf);
+
+	if ((ssize_t) -1 == r) {
+		if (!is_temporary_error(errno))
+			s_fatal_exit(EXIT_FAILURE, "read error on fd #%d: %m", fd);
+		spurious++;
+		return;
+	}
+
+	received += r;
+
+	if (random_value(99) < churn) {
+		inputevt_remove(&c->id);
+		disabled[disabled_count++] = c;
+	}
+}
+
+static void
+conn_enable(struct conn *c)
+{
+	g_assert(0 == c->id);
+
+	c->id = inputevt_add(c->fd[0], INPUT_EVENT_RX, conn_readable, c);
+}
+
+/*
+ * Dispatch events, then enable the sources disabled whilst dispatching,
+ * as bandwidth scheduling does at the next time slice.
+ */
+static void
+round_dispatch(void)
+{
+	inputevt_dispatch();
+
+	while (disabled_count != 0)
+		conn_enable(disabled[--disabled_count]);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	const char options[] = "a:c:hln:r:";
+	uint active = 5, n = 10000, rounds = 1000, i, idle;
+	struct conn *conns;
+	struct rlimit lim;
+	tm_nano_t start, end;
+	double elapsed;
+	uint64 last;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'a':			/* active connections per round */
+			active = MIN(100, atoi(optarg));
+			break;
+		case 'c':			/* churn of event sources */
+			churn = MIN(100, atoi(optarg));
+			break;
+		case 'l':			/* level-triggered */
+			inputevt_set_edge_triggered(FALSE);
+			break;
+		case 'n':			/* amount of connections */
+			n = MAX(1, atoi(optarg));
+			break;
+		case 'r':			/* amount of rounds */
+			rounds = MAX(1, atoi(optarg));
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	/*
+	 * Each connection needs two file descriptors.
+	 */
+
+	if (-1 == getrlimit(RLIMIT_NOFILE, &lim))
+		s_fatal_exit(EXIT_FAILURE, "getrlimit() failed: %m");
+
+	if (lim.rlim_cur < lim.rlim_max) {
+		lim.rlim_cur = lim.rlim_max;
+		if (-1 == setrlimit(RLIMIT_NOFILE, &lim))
+			s_warning("cannot raise file descriptor limit: %m");
+		else if (-1 == getrlimit(RLIMIT_NOFILE, &lim))
+			s_fatal_exit(EXIT_FAILURE, "getrlimit() failed: %m");
+	}
+
+	if (lim.rlim_cur < 2 * (rlim_t) n + 64) {
+		uint max = lim.rlim_cur > 64 ? (lim.rlim_cur - 64) / 2 : 1;
+		s_warning("file descriptor limit is %lu, using %u connection%s",
+			(ulong) lim.rlim_cur, PLURAL(max));
+		n = max;
+	}
+
+	inputevt_init(FALSE);
+
+	HALLOC0_ARRAY(conns, n);
+	HALLOC_ARRAY(disabled, n);
+
+	for (i = 0; i < n; i++) {
+		struct conn *cn = &conns[i];
+
+		if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, cn->fd))
+			s_fatal_exit(EXIT_FAILURE, "socketpair() failed: %m");
+
+		fd_set_nonblocking(cn->fd[0]);
+		fd_set_nonblocking(cn->fd[1]);
+		conn_enable(cn);
+	}
+
+	s_info("%u connection%s, %u round%s, %u%% active, %u%% churn",
+		PLURAL(n), PLURAL(rounds), active, churn);
+
+	tm_precise_time(&start);
+
+	for (i = 0; i < rounds; i++) {
+		uint j, k = MAX(1, n * active / 100);
+		char buf[WRITE_SIZE];
+
+		ZERO(&buf);
+
+		for (j = 0; j < k; j++) {
+			struct conn *cn = &conns[random_value(n - 1)];
+
+			if (WRITE_SIZE == write(cn->fd[1], buf, sizeof buf))
+				sent += WRITE_SIZE;
+		}
+
+		round_dispatch();
+	}
+
+	/*
+	 * Reads are shorter than writes: data left unread must still be
+	 * reported until the connections are drained.
+	 */
+
+	for (idle = 0, last = received; received != sent; /* empty */) {
+		round_dispatch();
+
+		if (received == last) {
+			if (++idle >= IDLE_ROUNDS) {
+				s_fatal_exit(EXIT_FAILURE,
+					"stalled with %s bytes unread",
+					uint64_to_string(sent - received));
+			}
+		} else {
+			idle = 0;
+			last = received;
+		}
+	}
+
+	tm_precise_time(&end);
+	elapsed = tm_precise_elapsed_f(&end, &start);
+
+	s_info("%.3f secs, %u usecs per round, %s events, %s spurious",
+		elapsed, (uint) (elapsed * 1e6 / rounds),
+		uint64_to_string(events), uint64_to_string2(spurious));
+
+	for (i = 0; i < n; i++) {
+		inputevt_remove(&conns[i].id);
+		fd_close(&conns[i].fd[0]);
+		fd_close(&conns[i].fd[1]);
+	}
+
+	inputevt_close();
+	HFREE_NULL(conns);
+	HFREE_NULL(disabled);
+
+	s_info("all checks passed");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
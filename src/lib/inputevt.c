@@ -126,12 +126,14 @@ typedef struct {
 #include "tm.h"
 #include "walloc.h"
 #include "xmalloc.h"
+#include "xsort.h"
 
 #include "override.h"		/* Must be the last header included */
 
 static unsigned inputevt_debug;
 static bool inputevt_trace;
 static unsigned inputevt_stid = THREAD_INVALID_ID;
+static bool inputevt_edge = TRUE;
 
 /**
  * Set debugging level.
@@ -151,6 +153,17 @@ inputevt_set_trace(bool on)
 	inputevt_trace = on;
 }
 
+/**
+ * Select whether epoll() is to be used in edge-triggered mode, the default.
+ *
+ * This must be called before inputevt_init() to have any effect.
+ */
+void
+inputevt_set_edge_triggered(bool on)
+{
+	inputevt_edge = on;
+}
+
 /*
  * The following defines map the GDK-compatible input condition flags
  * to those used by GLIB.
@@ -196,12 +209,16 @@ typedef struct relay_list {
 	size_t readers;
 	size_t writers;
 	unsigned poll_idx;
+	inputevt_cond_t ready;	/**< Edge-triggered: conditions deemed ready */
+	inputevt_cond_t kernel;	/**< Edge-triggered: conditions registered */
+	unsigned parked:1;		/**< Edge-triggered: no relay, removal pending */
 } relay_list_t;
 
 struct event {
 	int fd;
 	inputevt_cond_t condition;
 	unsigned data_available;
+	const void *group;		/**< Dispatching group (handler of the source) */
 };
 
 struct new_relay {
@@ -221,15 +238,23 @@ struct poll_ctx {
 	pslist_t *added_relays;		/**< List of added relays */
 	htable_t *ht;				/**< Records file descriptors */
 	hash_list_t *readable;		/**< Records readable file descriptors */
+	hash_list_t *hot;			/**< Edge-triggered: ready file descriptors */
+	pslist_t *parked;			/**< Edge-triggered: fds awaiting removal */
+	struct event *dispatch;		/**< Events to dispatch, grouped by handler */
+	struct pollfd *hot_pfd;		/**< Edge-triggered: readiness confirmation */
 	int master_fd;				/**< The ``master'' fd for epoll or kqueue */
 	unsigned num_ev;			/**< Length of the "ev" and "relay" arrays */
 	unsigned num_ev_reserved;	/**< Next reserved ID */
 	unsigned num_poll_idx;		/**< Length of used_poll_idx array */
 	unsigned max_poll_idx;
 	unsigned num_ready;			/**< Used for /dev/poll only */
+	unsigned dispatch_size;		/**< Length of the "dispatch" array */
+	unsigned hot_pfd_size;		/**< Length of the "hot_pfd" array */
+	unsigned idle_id;			/**< Edge-triggered: GLib idle source */
 	unsigned initialized:1;		/**< TRUE if the context has been initialized */
 	unsigned dispatching:1;		/**< TRUE if dispatching events */
 	unsigned collecting:1;		/**< TRUE when collecing / waiting for events */
+	unsigned edge_triggered:1;	/**< TRUE if events are edge-triggered */
 
 #ifdef HAS_KQUEUE
 	struct kevent *kev_arr;
@@ -535,6 +560,59 @@ event_set_mask_with_epoll(struct poll_ctx *ctx, int fd,
 	return epoll_ctl(ctx->master_fd, op, fd, &ev);
 }
 
+/*
+ * In edge-triggered mode, the kernel interest set of a descriptor follows
+ * the conditions we wait for, but its removal is deferred until the next
+ * event collection, by inputevt_purge_parked(): when the last relay goes,
+ * the descriptor stays registered with the conditions it last had.
+ *
+ * A descriptor revived before being purged is added again since it could
+ * have been closed and reused meanwhile: EEXIST tells us it was not.
+ */
+static int
+event_set_mask_with_epoll_et(struct poll_ctx *ctx, int fd,
+	inputevt_cond_t old, inputevt_cond_t cur)
+{
+	static const struct epoll_event zero_ev;
+	struct epoll_event ev;
+	relay_list_t *rl;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	cur &= INPUT_EVENT_RW;
+	if (0 == cur)
+		return 0;
+
+	rl = htable_lookup(ctx->ht, int_to_pointer(fd));
+	g_assert(rl != NULL);
+
+	ev = zero_ev;
+	ev.data.ptr = int_to_pointer(fd);
+	ev.events = EPOLLET;
+
+	if (INPUT_EVENT_R & cur)
+		ev.events |= EPOLLIN | EPOLLPRI;
+	if (INPUT_EVENT_W & cur)
+		ev.events |= EPOLLOUT;
+
+	if (0 == (INPUT_EVENT_RW & old)) {
+		if (0 == epoll_ctl(ctx->master_fd, EPOLL_CTL_ADD, fd, &ev))
+			goto registered;
+		if (EEXIST != errno)
+			return -1;
+	}
+
+	if (cur == rl->kernel)
+		return 0;
+
+	if (-1 == epoll_ctl(ctx->master_fd, EPOLL_CTL_MOD, fd, &ev))
+		return -1;
+
+registered:
+	rl->kernel = cur;
+	return 0;
+}
+
 static int
 event_check_all_with_epoll(struct poll_ctx *ctx)
 {
@@ -899,6 +977,154 @@ inputevt_poll_idx_compact(struct poll_ctx *ctx)
 	CTX_UNLOCK(ctx);
 }
 
+/**
+ * @return the conditions the relays of the descriptor are waiting for.
+ */
+static inline inputevt_cond_t
+relay_list_cond(const relay_list_t *rl)
+{
+	if (0 == rl->readers && 0 == rl->writers)
+		return 0;
+
+	return (rl->readers ? INPUT_EVENT_R : 0) |
+		(rl->writers ? INPUT_EVENT_W : 0) | INPUT_EVENT_EXCEPTION;
+}
+
+/**
+ * Record whether descriptor, in edge-triggered mode, is deemed ready for
+ * one of the conditions its relays are waiting for.
+ */
+static void
+inputevt_hot_update(struct poll_ctx *ctx, int fd, const relay_list_t *rl)
+{
+	void *key = int_to_pointer(fd);
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	if (!ctx->edge_triggered)
+		return;
+
+	if (0 != (rl->ready & relay_list_cond(rl))) {
+		if (!hash_list_contains(ctx->hot, key))
+			hash_list_append(ctx->hot, key);
+	} else {
+		hash_list_remove(ctx->hot, key);
+	}
+}
+
+/**
+ * Free the relay list of a descriptor that no longer has any relay.
+ */
+static void
+relay_list_free(struct poll_ctx *ctx, int fd, relay_list_t *rl)
+{
+	g_assert(CTX_IS_LOCKED(ctx));
+	g_assert(NULL == rl->sl);
+	g_assert(0 == rl->readers && 0 == rl->writers);
+
+	inputevt_poll_idx_free(ctx, &rl->poll_idx);
+	hash_list_remove(ctx->readable, int_to_pointer(fd));
+	hash_list_remove(ctx->hot, int_to_pointer(fd));
+	htable_remove(ctx->ht, int_to_pointer(fd));
+	WFREE(rl);
+}
+
+/**
+ * Purge the parked descriptors, which lost their last relay since the
+ * previous event collection in edge-triggered mode.
+ *
+ * Descriptors already closed were removed from the kernel interest set
+ * when closing, hence EBADF and ENOENT are expected here.
+ */
+static void
+inputevt_purge_parked(struct poll_ctx *ctx)
+{
+	pslist_t *sl;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+	g_assert(!ctx->dispatching);
+
+	PSLIST_FOREACH(ctx->parked, sl) {
+		int fd = pointer_to_int(sl->data);
+		relay_list_t *rl = htable_lookup(ctx->ht, sl->data);
+
+		if (NULL == rl || !rl->parked)
+			continue;		/* Revived, or already purged */
+
+#ifdef HAS_EPOLL
+		if (
+			-1 == epoll_ctl(ctx->master_fd, EPOLL_CTL_DEL, fd, NULL) &&
+			EBADF != errno && ENOENT != errno
+		) {
+			s_warning("%s(): epoll_ctl(%d, DEL, %d) failed: %m",
+				G_STRFUNC, ctx->master_fd, fd);
+		}
+#endif	/* HAS_EPOLL */
+
+		relay_list_free(ctx, fd, rl);
+	}
+
+	pslist_free_null(&ctx->parked);
+}
+
+/**
+ * Confirm readiness of the descriptors deemed ready in edge-triggered mode.
+ *
+ * Handlers are not required to read or write until EAGAIN (bandwidth
+ * shaping routinely leaves data unread), so a condition reported by an
+ * edge is kept until a poll() of all these descriptors, done with one
+ * single system call, says it is gone.
+ */
+static void
+inputevt_hot_confirm(struct poll_ctx *ctx)
+{
+	hash_list_iter_t *iter;
+	unsigned i, n;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	n = hash_list_length(ctx->hot);
+	if (0 == n)
+		return;
+
+	if (n > ctx->hot_pfd_size) {
+		ctx->hot_pfd_size = MAX(n, 2 * ctx->hot_pfd_size);
+		XREALLOC_ARRAY(ctx->hot_pfd, ctx->hot_pfd_size);
+	}
+
+	iter = hash_list_iterator(ctx->hot);
+	for (i = 0; hash_list_iter_has_next(iter); i++) {
+		struct pollfd *pfd = &ctx->hot_pfd[i];
+
+		pfd->fd = pointer_to_int(hash_list_iter_next(iter));
+		pfd->events = POLLIN | POLLPRI | POLLOUT;
+		pfd->revents = 0;
+	}
+	hash_list_iter_release(&iter);
+
+	g_assert(i == n);
+
+	if (-1 == compat_poll(ctx->hot_pfd, n, 0)) {
+		if (!is_temporary_error(errno))
+			s_warning("%s(): poll() failed: %m", G_STRFUNC);
+		return;		/* Keep conditions, will dispatch anyway */
+	}
+
+	for (i = 0; i < n; i++) {
+		const struct pollfd *pfd = &ctx->hot_pfd[i];
+		relay_list_t *rl = htable_lookup(ctx->ht, int_to_pointer(pfd->fd));
+
+		g_assert(NULL != rl);
+
+		rl->ready =
+			((POLLIN | POLLPRI | POLLHUP) & pfd->revents ? INPUT_EVENT_R : 0)
+			| (POLLOUT & pfd->revents ? INPUT_EVENT_W : 0)
+			| (POLLERR & pfd->revents ? INPUT_EVENT_EXCEPTION : 0);
+
+		inputevt_hot_update(ctx, pfd->fd, rl);
+	}
+}
+
 static void
 relay_list_remove(struct poll_ctx *ctx, unsigned id)
 {
@@ -921,10 +1147,22 @@ relay_list_remove(struct poll_ctx *ctx, unsigned id)
 	rl->sl = pslist_remove(rl->sl, uint_to_pointer(id));
 	if (NULL == rl->sl) {
 		g_assert(0 == rl->readers && 0 == rl->writers);
-		inputevt_poll_idx_free(ctx, &rl->poll_idx);
-		hash_list_remove(ctx->readable, int_to_pointer(relay->fd));
-		htable_remove(ctx->ht, int_to_pointer(relay->fd));
-		WFREE(rl);
+
+		/*
+		 * In edge-triggered mode, keep the descriptor registered until
+		 * the next event collection: it is frequently revived before,
+		 * when bandwidth scheduling enables the I/O source again.
+		 */
+
+		if (ctx->edge_triggered) {
+			if (!rl->parked) {
+				rl->parked = TRUE;
+				ctx->parked = pslist_prepend(ctx->parked,
+					int_to_pointer(relay->fd));
+			}
+		} else {
+			relay_list_free(ctx, relay->fd, rl);
+		}
 	}
 }
 
@@ -1012,6 +1250,147 @@ inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition)
 	}
 }
 
+/**
+ * Append event to the list of events to dispatch.
+ *
+ * The event is tagged with the handler of the first relay of its descriptor,
+ * so that events can be dispatched grouped by type of I/O source.
+ */
+static void
+inputevt_dispatch_add(struct poll_ctx *ctx, unsigned *count,
+	int fd, inputevt_cond_t condition)
+{
+	const relay_list_t *rl;
+	struct event *ev;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+	g_assert(ctx->dispatching);
+
+	if (*count >= ctx->dispatch_size) {
+		ctx->dispatch_size = MAX(32, 2 * ctx->dispatch_size);
+		XREALLOC_ARRAY(ctx->dispatch, ctx->dispatch_size);
+	}
+
+	ev = &ctx->dispatch[(*count)++];
+	ev->fd = fd;
+	ev->condition = condition;
+	ev->data_available = 0;
+	ev->group = NULL;
+
+	rl = htable_lookup(ctx->ht, int_to_pointer(fd));
+	if (rl != NULL && rl->sl != NULL) {
+		const inputevt_relay_t *relay = ctx->relay[pointer_to_uint(rl->sl->data)];
+		ev->group = func_to_pointer(relay->handler);
+	}
+}
+
+/**
+ * Sort events by dispatching group, then by file descriptor.
+ */
+static int
+inputevt_event_cmp(const void *a, const void *b)
+{
+	const struct event *ea = a, *eb = b;
+
+	if (ea->group != eb->group)
+		return CMP(pointer_to_ulong(ea->group), pointer_to_ulong(eb->group));
+
+	return CMP(ea->fd, eb->fd);
+}
+
+/**
+ * Collect the events to dispatch in level-triggered mode.
+ *
+ * @return amount of events to dispatch.
+ */
+static unsigned
+inputevt_collect_levels(struct poll_ctx *ctx, int num_events)
+{
+	unsigned idx, count = 0;
+
+	g_assert(UNSIGNED(num_events) <= ctx->num_ev);
+
+	for (idx = 0; num_events > 0 && idx < ctx->num_ev; idx++) {
+		struct event event;
+
+		event = (*ctx->event_get)(ctx, idx);
+		g_assert(event.fd >= -1);
+
+		if (!is_valid_fd(event.fd) || 0 == event.condition)
+			continue;
+
+		num_events--;
+		inputevt_dispatch_add(ctx, &count, event.fd, event.condition);
+	}
+
+	return count;
+}
+
+/**
+ * Collect the events to dispatch in edge-triggered mode.
+ *
+ * Reported edges are merged into the readiness state of descriptors, and
+ * all the descriptors deemed ready for one of the conditions their relays
+ * are waiting for are dispatched.
+ *
+ * @return amount of events to dispatch.
+ */
+static unsigned
+inputevt_collect_edges(struct poll_ctx *ctx, int num_events)
+{
+	hash_list_iter_t *iter;
+	unsigned idx, count = 0;
+
+	for (idx = 0; num_events > 0 && idx < ctx->num_ev; idx++) {
+		struct event event;
+		relay_list_t *rl;
+
+		event = (*ctx->event_get)(ctx, idx);
+		g_assert(event.fd >= -1);
+
+		if (!is_valid_fd(event.fd) || 0 == event.condition)
+			continue;
+
+		num_events--;
+
+		rl = htable_lookup(ctx->ht, int_to_pointer(event.fd));
+		if (NULL == rl)
+			continue;		/* Descriptor closed whilst still registered */
+
+		rl->ready |= event.condition;
+		inputevt_hot_update(ctx, event.fd, rl);
+	}
+
+	iter = hash_list_iterator(ctx->hot);
+	while (hash_list_iter_has_next(iter)) {
+		void *key = hash_list_iter_next(iter);
+		const relay_list_t *rl = htable_lookup(ctx->ht, key);
+
+		g_assert(NULL != rl);
+
+		inputevt_dispatch_add(ctx, &count, pointer_to_int(key),
+			rl->ready & relay_list_cond(rl));
+	}
+	hash_list_iter_release(&iter);
+
+	return count;
+}
+
+static bool inputevt_idle(void *udata);
+
+/**
+ * Make sure we are called again if, in edge-triggered mode, descriptors
+ * remain ready: no further edge may come to wake us up.
+ */
+static void
+inputevt_idle_check(struct poll_ctx *ctx)
+{
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	if (0 == ctx->idle_id && 0 != hash_list_length(ctx->hot))
+		ctx->idle_id = g_idle_add(inputevt_idle, ctx);
+}
+
 /**
  * Our main I/O event dispatching loop.
  */
@@ -1019,6 +1398,7 @@ static void G_HOT
 inputevt_timer(struct poll_ctx *ctx)
 {
 	int num_events;
+	unsigned evcount = 0;
 
 	g_assert(ctx != NULL);
 
@@ -1034,6 +1414,11 @@ inputevt_timer(struct poll_ctx *ctx)
 		return;
 	}
 
+	if (ctx->edge_triggered) {
+		inputevt_purge_parked(ctx);
+		inputevt_hot_confirm(ctx);
+	}
+
 	num_events = (*ctx->event_check_all)(ctx);
 	if (-1 == num_events && !is_temporary_error(errno)) {
 		s_warning("%s(): event_check_all(%d) failed with %s(): %m",
@@ -1043,42 +1428,38 @@ inputevt_timer(struct poll_ctx *ctx)
 
 	ctx->dispatching = TRUE;
 
-	if (num_events > 0) {
-		unsigned idx;
-		pslist_t *evlist = NULL, *es;
-
-		g_assert(UNSIGNED(num_events) <= ctx->num_ev);
-
-		for (idx = 0; num_events > 0 && idx < ctx->num_ev; idx++) {
-			struct event event;
+	if (ctx->edge_triggered)
+		evcount = inputevt_collect_edges(ctx, num_events);
+	else if (num_events > 0)
+		evcount = inputevt_collect_levels(ctx, num_events);
 
-			event = (*ctx->event_get)(ctx, idx);
-			g_assert(event.fd >= -1);
+	if (evcount > 0) {
+		unsigned i;
 
-			if (!is_valid_fd(event.fd) || 0 == event.condition)
-				continue;
+		/*
+		 * Dispatch events grouped by handler, so that the same kind of
+		 * I/O sources are processed in a row.
+		 */
 
-			num_events--;
-			evlist = pslist_prepend(evlist, WCOPY(&event));
-		}
+		xsort(ctx->dispatch, evcount, sizeof ctx->dispatch[0],
+			inputevt_event_cmp);
 
 		/*
 		 * Invoke I/O callbacks without any locks.
 		 *
 		 * Becauuse ctx->dispatching is TRUE, no changes to the relay list
-		 * can happen concurrently (hopefully -- RAM).
+		 * can happen concurrently (hopefully -- RAM).  The dispatching
+		 * array is only ever resized above, hence it cannot move either.
 		 */
 
 		CTX_UNLOCK(ctx);
 
-		PSLIST_FOREACH(evlist, es) {
-			struct event *event = es->data;
+		for (i = 0; i < evcount; i++) {
+			const struct event *event = &ctx->dispatch[i];
 
 			inputevt_handle(ctx, event->fd, event->condition);
-			WFREE(event);
 		}
 
-		pslist_free_null(&evlist);
 		CTX_LOCK(ctx);
 	}
 
@@ -1120,9 +1501,33 @@ inputevt_timer(struct poll_ctx *ctx)
 		inputevt_purge_removed(ctx);
 	}
 
+	if (ctx->edge_triggered)
+		inputevt_idle_check(ctx);
+
 	CTX_UNLOCK(ctx);
 }
 
+/**
+ * GLib idle callback, dispatching events whilst descriptors remain ready
+ * in edge-triggered mode.
+ */
+static bool
+inputevt_idle(void *udata)
+{
+	struct poll_ctx *ctx = udata;
+	bool more;
+
+	inputevt_timer(ctx);
+
+	CTX_LOCK(ctx);
+	more = 0 != hash_list_length(ctx->hot);
+	if (!more)
+		ctx->idle_id = 0;
+	CTX_UNLOCK(ctx);
+
+	return more;
+}
+
 /**
  * Trampoline function bridging glib's event loop with ours.
  */
@@ -1247,6 +1652,8 @@ inputevt_remove(unsigned *id_ptr)
 	cur = (rl->readers ? INPUT_EVENT_R : 0) |
 		(rl->writers ? INPUT_EVENT_W : 0);
 
+	inputevt_hot_update(ctx, fd, rl);
+
 	if (-1 == (*ctx->event_set_mask)(ctx, fd, old, cur)) {
 		s_warning("%s(): event_set_mask(%d, %d) failed using %s(): %m",
 			G_STRFUNC, ctx->master_fd, fd,
@@ -1375,6 +1782,9 @@ inputevt_add_source(struct poll_ctx *ctx, inputevt_relay_t *relay, uint id)
 			rl->readers = 0;
 			rl->writers = 0;
 			rl->sl = NULL;
+			rl->ready = 0;
+			rl->kernel = 0;
+			rl->parked = FALSE;
 			rl->poll_idx = inputevt_poll_idx_new(ctx, relay->fd);
 			old = 0;
 			htable_insert(ctx->ht, key, rl);
@@ -1386,6 +1796,8 @@ inputevt_add_source(struct poll_ctx *ctx, inputevt_relay_t *relay, uint id)
 			rl->writers++;
 
 		rl->sl = pslist_prepend(rl->sl, uint_to_pointer(id));
+		rl->parked = FALSE;
+		inputevt_hot_update(ctx, relay->fd, rl);
 	}
 
 	if
@@ -1396,6 +1808,9 @@ inputevt_add_source(struct poll_ctx *ctx, inputevt_relay_t *relay, uint id)
 			G_STRFUNC, ctx->master_fd, relay->fd,
 			stacktrace_function_name(ctx->event_set_mask));
 	}
+
+	if (ctx->edge_triggered)
+		inputevt_idle_check(ctx);
 }
 
 /**
@@ -1522,6 +1937,12 @@ init_with_epoll(struct poll_ctx *ctx)
 	ctx->event_check_all = event_check_all_with_epoll;
 	ctx->event_get = event_get_with_epoll;
 	ctx->event_set_mask = event_set_mask_with_epoll;
+
+	if (inputevt_edge) {
+		ctx->edge_triggered = TRUE;
+		ctx->polling_method = "edge-triggered epoll()";
+		ctx->event_set_mask = event_set_mask_with_epoll_et;
+	}
 	return 0;
 }
 #else
@@ -1582,6 +2003,7 @@ inputevt_init(int use_poll)
 	ctx->initialized = TRUE;
 	ctx->ht = htable_create(HASH_KEY_SELF, 0);
 	ctx->readable = hash_list_new(NULL, NULL);
+	ctx->hot = hash_list_new(NULL, NULL);
 	mutex_init(&ctx->lock);
 
 	/*
@@ -1754,12 +2176,20 @@ inputevt_close(void)
 	CTX_LOCK(ctx);
 
 	inputevt_purge_removed(ctx);
+	inputevt_purge_parked(ctx);
+	if (ctx->idle_id != 0) {
+		g_source_remove(ctx->idle_id);
+		ctx->idle_id = 0;
+	}
 	htable_free_null(&ctx->ht);
 	hash_list_free(&ctx->readable);
+	hash_list_free(&ctx->hot);
 	HFREE_NULL(ctx->used_poll_idx);
 	HFREE_NULL(ctx->used_event_id);
 	XFREE_NULL(ctx->relay);
 	XFREE_NULL(ctx->pfd_arr);
+	XFREE_NULL(ctx->dispatch);
+	XFREE_NULL(ctx->hot_pfd);
 	fd_close(&ctx->master_fd);
 	ctx->initialized = FALSE;
 
@@ -75,6 +75,7 @@ void inputevt_dispatch(void);
 
 void inputevt_set_debug(unsigned level);
 void inputevt_set_trace(bool on);
+void inputevt_set_edge_triggered(bool on);
 unsigned inputevt_thread_id(void);
 
 /**
@@ -0,0 +1,761 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Change journal for text configuration databases.
+ *
+ * Some configuration databases are made of "stanzas", i.e. groups of lines
+ * separated by blank lines, each describing one item.  Rewriting the whole
+ * file each time one item changes is costly when there are many items, so
+ * instead the changed items are appended to a journal, the file being only
+ * rewritten (checkpointed) when the journal becomes larger than the file.
+ *
+ * Each stanza is identified by a key, which is the first of its lines that
+ * starts with a given prefix (e.g. "GUID ").  The journal is made of entries
+ * which are either:
+ *
+ *   "+ <key>" or "+", followed by the new stanza, then a blank line.  When
+ *   the key is not given, it is taken from the stanza.  An empty stanza
+ *   means the item is no longer persisted.
+ *
+ *   "- <key>", followed by a blank line, to remove an item.
+ *
+ * The first line of the journal holds the "epoch" of the checkpoint to which
+ * it applies, which is also written as a comment in the checkpoint file.  On
+ * startup, journal_replay() merges the entries of the journal into the file
+ * before it is read, provided the epochs match: a journal left over by a
+ * crash between the renaming of a new checkpoint and the truncation of the
+ * journal is therefore ignored.  An incomplete entry at the end of the
+ * journal, which can result from a crash, is ignored as well.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "journal.h"
+
+#include "fd.h"
+#include "file.h"
+#include "halloc.h"
+#include "hstrfn.h"
+#include "htable.h"
+#include "log.h"
+#include "parse.h"
+#include "path.h"
+#include "random.h"
+#include "stringify.h"
+#include "walloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define JOURNAL_EXT			"journal"
+#define JOURNAL_EPOCH		"# Journal epoch: "	/**< Epoch line prefix */
+#define JOURNAL_MIN_SIZE	(64 * 1024)	/**< Journal size always tolerated */
+
+enum journal_magic { JOURNAL_MAGIC = 0x1e8c07a3 };
+
+/**
+ * A change journal.
+ */
+struct journal {
+	enum journal_magic magic;
+	const char *what;		/**< What is journaled, for logging (static) */
+	char *path;				/**< Journal pathname */
+	FILE *f;				/**< Opened journal, NULL when inactive */
+	uint64 epoch;			/**< Epoch of the last checkpoint */
+	uint64 next_epoch;		/**< Epoch of the checkpoint being written */
+	filesize_t synced;		/**< Journal size at last synchronization */
+	filesize_t checkpoint;	/**< Size of last checkpoint */
+};
+
+static inline void
+journal_check(const struct journal * const j)
+{
+	g_assert(j != NULL);
+	g_assert(JOURNAL_MAGIC == j->magic);
+}
+
+/**
+ * @return pathname of the journal for the named file, to be freed by hfree().
+ */
+static char *
+journal_pathname(const char *dir, const char *name)
+{
+	return h_strdup_printf("%s%c%s.%s", dir, G_DIR_SEPARATOR, name, JOURNAL_EXT);
+}
+
+/***
+ *** Replaying.
+ ***/
+
+/**
+ * A stanza, as a slice of a file loaded in memory.
+ */
+struct journal_stanza {
+	const char *text;		/**< Start of stanza */
+	size_t len;				/**< Length, including last line's "\n" */
+	bool dead;				/**< Item was removed */
+};
+
+/**
+ * Replaying context.
+ */
+struct journal_replay {
+	const char *key;				/**< Key line prefix */
+	struct journal_stanza *vec;		/**< Stanzas, in file order */
+	size_t count;					/**< Amount of stanzas in vector */
+	size_t size;					/**< Allocated vector size */
+	htable_t *index;				/**< Key -> 1 + stanza index */
+};
+
+/**
+ * Load the whole file in memory, appending a trailing NUL.
+ *
+ * @return the data, to be freed with hfree(), NULL if the file cannot be read.
+ */
+static char *
+journal_load(const char *path, size_t *len)
+{
+	filestat_t sb;
+	char *buf;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (NULL == f)
+		return NULL;
+
+	if (-1 == fstat(fileno(f), &sb) || UNSIGNED(sb.st_size) != (size_t) sb.st_size) {
+		fclose(f);
+		return NULL;
+	}
+
+	buf = halloc(sb.st_size + 1);
+	*len = fread(buf, 1, sb.st_size, f);
+	buf[*len] = '\0';
+
+	if (ferror(f)) {
+		s_warning("%s(): cannot read \"%s\": %m", G_STRFUNC, path);
+		HFREE_NULL(buf);
+	}
+
+	fclose(f);
+	return buf;
+}
+
+/**
+ * @return end of the line starting at ``p'', i.e. the position of its "\n"
+ * or the end of the data.
+ */
+static inline const char *
+journal_eol(const char *p, const char *end)
+{
+	const char *q = memchr(p, '\n', end - p);
+
+	return NULL == q ? end : q;
+}
+
+/**
+ * @return whether the line from ``p'' to ``e'' (excluded) is blank.
+ */
+static inline bool
+journal_is_blank(const char *p, const char *e)
+{
+	return p == e || (1 == e - p && '\r' == *p);
+}
+
+/**
+ * @return the key of the stanza as a new string, NULL if none.
+ */
+static char *
+journal_stanza_key(const struct journal_replay *jr, const char *p, size_t len)
+{
+	const char *end = p + len;
+	size_t klen = vstrlen(jr->key);
+
+	while (p < end) {
+		const char *e = journal_eol(p, end);
+
+		if (UNSIGNED(e - p) >= klen && 0 == memcmp(p, jr->key, klen)) {
+			if (e > p && '\r' == e[-1])
+				e--;
+			return h_strndup(p, e - p);
+		}
+		p = e + 1;
+	}
+
+	return NULL;
+}
+
+/**
+ * Record new stanza, or a new version of an existing one.
+ *
+ * @param jr		the replaying context
+ * @param key		the key of the stanza, NULL if none (to be freed by caller)
+ * @param text		start of the stanza
+ * @param len		length of the stanza, 0 if the item is to be removed
+ */
+static void
+journal_stanza_set(struct journal_replay *jr,
+	const char *key, const char *text, size_t len)
+{
+	struct journal_stanza *js;
+	size_t idx = 0;
+
+	if (key != NULL)
+		idx = pointer_to_size(htable_lookup(jr->index, key));
+
+	if (0 != idx) {
+		js = &jr->vec[idx - 1];
+	} else {
+		if (0 == len)
+			return;			/* Removing unknown item */
+
+		if (jr->count >= jr->size) {
+			jr->size = MAX(16, jr->size * 2);
+			HREALLOC_ARRAY(jr->vec, jr->size);
+		}
+
+		js = &jr->vec[jr->count++];
+		if (key != NULL)
+			htable_insert(jr->index, h_strdup(key), size_to_pointer(jr->count));
+	}
+
+	js->text = text;
+	js->len = len;
+	js->dead = 0 == len;
+}
+
+/**
+ * Split the checkpoint into stanzas.
+ */
+static void
+journal_parse_checkpoint(struct journal_replay *jr,
+	const char *buf, size_t len)
+{
+	const char *p = buf, *end = buf + len;
+
+	while (p < end) {
+		const char *start, *e = journal_eol(p, end);
+		char *key;
+
+		if (journal_is_blank(p, e)) {
+			p = e + 1;
+			continue;
+		}
+
+		/*
+		 * Found the start of a stanza, which ends at the next blank line
+		 * or at the end of the file.
+		 */
+
+		start = p;
+
+		while (p < end) {
+			e = journal_eol(p, end);
+			if (journal_is_blank(p, e))
+				break;
+			p = MIN(e + 1, end);
+		}
+
+		key = journal_stanza_key(jr, start, p - start);
+		journal_stanza_set(jr, key, start, p - start);
+		HFREE_NULL(key);
+	}
+}
+
+/**
+ * Apply journal entries, starting after the epoch line.
+ *
+ * @return the amount of applied entries.
+ */
+static size_t
+journal_parse_entries(struct journal_replay *jr,
+	const char *what, const char *buf, size_t len)
+{
+	const char *p = buf, *end = buf + len;
+	size_t applied = 0;
+
+	while (p < end) {
+		const char *start, *e = journal_eol(p, end);
+		char *key = NULL;
+		char op = *p;
+		bool complete = FALSE;
+
+		if (journal_is_blank(p, e)) {
+			p = e + 1;
+			continue;
+		}
+
+		if ('+' != op && '-' != op) {
+			s_warning("%s(): [%s] corrupted journal entry, stopping replay",
+				G_STRFUNC, what);
+			break;
+		}
+
+		if (e - p > 2 && ' ' == p[1]) {
+			const char *ke = (e > p && '\r' == e[-1]) ? e - 1 : e;
+			key = h_strndup(p + 2, ke - (p + 2));
+		}
+
+		/*
+		 * Gather the stanza up to the next blank line, which must be there
+		 * for the entry to be complete.
+		 */
+
+		p = start = e + 1;
+
+		while (p < end) {
+			e = journal_eol(p, end);
+			if (e == end)
+				break;			/* Unterminated line */
+			if (journal_is_blank(p, e)) {
+				complete = TRUE;
+				break;
+			}
+			p = e + 1;
+		}
+
+		if (!complete) {
+			HFREE_NULL(key);
+			s_warning("%s(): [%s] ignoring incomplete trailing journal entry",
+				G_STRFUNC, what);
+			break;
+		}
+
+		if ('-' == op && p != start) {
+			HFREE_NULL(key);
+			s_warning("%s(): [%s] corrupted journal removal, stopping replay",
+				G_STRFUNC, what);
+			break;
+		}
+
+		if (NULL == key && p != start)
+			key = journal_stanza_key(jr, start, p - start);
+
+		if (NULL == key) {
+			s_warning("%s(): [%s] ignoring journal entry without key",
+				G_STRFUNC, what);
+		} else {
+			journal_stanza_set(jr, key, start, p - start);
+			applied++;
+		}
+
+		HFREE_NULL(key);
+		p = e + 1;
+	}
+
+	return applied;
+}
+
+/**
+ * Extract the epoch held in the line starting with JOURNAL_EPOCH.
+ *
+ * @param buf		the data where the epoch line is searched
+ * @param first		whether the epoch must be on the first line
+ * @param epoch		where the epoch is written
+ *
+ * @return pointer to the line following the epoch, NULL if not found.
+ */
+static const char *
+journal_epoch(const char *buf, bool first, uint64 *epoch)
+{
+	const char *p;
+	int error;
+
+	if (is_strprefix(buf, JOURNAL_EPOCH)) {
+		p = buf;
+	} else if (first) {
+		return NULL;
+	} else {
+		p = vstrstr(buf, "\n" JOURNAL_EPOCH);
+		if (NULL == p)
+			return NULL;
+		p++;
+	}
+
+	*epoch = parse_uint64(p + CONST_STRLEN(JOURNAL_EPOCH), &p, 10, &error);
+	if (error)
+		return NULL;
+
+	p = vstrchr(p, '\n');
+	return NULL == p ? NULL : p + 1;
+}
+
+static void
+journal_replay_free_kv(const void *key, void *unused_value, void *unused_data)
+{
+	void *k = deconstify_pointer(key);
+
+	(void) unused_value;
+	(void) unused_data;
+
+	hfree(k);
+}
+
+/**
+ * Merge the journal of the named configuration file into the file itself,
+ * then discard the journal.
+ *
+ * This must be called before the file is loaded.
+ *
+ * @param dir		directory where the file lies
+ * @param name		name of the file
+ * @param what		what the file holds, for logging
+ * @param key		prefix of the line identifying items in the file
+ *
+ * @return TRUE if journal entries were merged into the file.
+ */
+bool
+journal_replay(const char *dir, const char *name,
+	const char *what, const char *key)
+{
+	struct journal_replay jr;
+	char *jpath, *cpath = NULL, *jbuf, *cbuf = NULL;
+	const char *entries;
+	size_t jlen, clen, applied = 0, i;
+	uint64 jepoch, cepoch;
+	bool replayed = FALSE;
+
+	jpath = journal_pathname(dir, name);
+	jbuf = journal_load(jpath, &jlen);
+
+	if (NULL == jbuf)
+		goto done;		/* No journal */
+
+	/*
+	 * If we crashed after having read the file but before writing it
+	 * back, only the ".orig" copy exists.
+	 */
+
+	cpath = make_pathname(dir, name);
+	cbuf = journal_load(cpath, &clen);
+
+	if (NULL == cbuf) {
+		char *orig = h_strconcat(cpath, ".orig", NULL_PTR);
+		cbuf = journal_load(orig, &clen);
+		HFREE_NULL(orig);
+	}
+
+	entries = journal_epoch(jbuf, TRUE, &jepoch);
+
+	if (NULL == entries || NULL == cbuf)
+		goto discard;
+
+	if (NULL == journal_epoch(cbuf, FALSE, &cepoch) || cepoch != jepoch) {
+		s_info("[%s] ignoring journal from another checkpoint", what);
+		goto discard;
+	}
+
+	ZERO(&jr);
+	jr.key = key;
+	jr.index = htable_create(HASH_KEY_STRING, 0);
+
+	journal_parse_checkpoint(&jr, cbuf, clen);
+	applied = journal_parse_entries(&jr, what, entries, jlen - (entries - jbuf));
+
+	if (applied != 0) {
+		file_path_t fp;
+		FILE *f;
+
+		file_path_set(&fp, dir, name);
+		f = file_config_open_write(what, &fp);
+
+		if (f != NULL) {
+			for (i = 0; i < jr.count; i++) {
+				const struct journal_stanza *js = &jr.vec[i];
+
+				if (js->dead)
+					continue;
+
+				(void) fwrite(js->text, js->len, 1, f);
+				(void) fputc('\n', f);
+			}
+			replayed = file_config_close(f, &fp);
+		}
+
+		if (replayed) {
+			s_info("[%s] replayed %zu journal entr%s",
+				what, applied, plural_y(applied));
+		}
+	}
+
+	htable_foreach(jr.index, journal_replay_free_kv, NULL);
+	htable_free_null(&jr.index);
+	HFREE_NULL(jr.vec);
+
+	/*
+	 * If we could not rewrite the file, keep the journal for next time.
+	 */
+
+	if (applied != 0 && !replayed)
+		goto done;
+
+	/* FALL THROUGH */
+
+discard:
+	if (-1 == unlink(jpath))
+		s_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, jpath);
+
+done:
+	HFREE_NULL(cbuf);
+	HFREE_NULL(jbuf);
+	HFREE_NULL(cpath);
+	HFREE_NULL(jpath);
+	return replayed;
+}
+
+/***
+ *** Journaling.
+ ***/
+
+/**
+ * Create a journal for the named configuration file.
+ *
+ * The journal only becomes active after the first checkpoint.
+ *
+ * @param dir		directory where the file lies
+ * @param name		name of the file
+ * @param what		what the file holds, for logging (static string)
+ *
+ * @return a new journal.
+ */
+journal_t *
+journal_make(const char *dir, const char *name, const char *what)
+{
+	journal_t *j;
+
+	WALLOC0(j);
+	j->magic = JOURNAL_MAGIC;
+	j->what = what;
+	j->path = journal_pathname(dir, name);
+
+	return j;
+}
+
+/**
+ * Deactivate journal, after an I/O error.
+ */
+static void
+journal_deactivate(journal_t *j)
+{
+	if (j->f != NULL) {
+		fclose(j->f);
+		j->f = NULL;
+	}
+}
+
+/**
+ * Flush and close the journal, then free it.
+ */
+void
+journal_free_null(journal_t **j_ptr)
+{
+	journal_t *j = *j_ptr;
+
+	if (j != NULL) {
+		journal_check(j);
+
+		if (j->f != NULL)
+			(void) journal_sync(j);
+		journal_deactivate(j);
+		HFREE_NULL(j->path);
+		j->magic = 0;
+		WFREE(j);
+		*j_ptr = NULL;
+	}
+}
+
+/**
+ * Record the epoch of a new checkpoint in the file being written.
+ */
+void
+journal_checkpoint_mark(journal_t *j, FILE *f)
+{
+	journal_check(j);
+
+	do {
+		j->next_epoch = random_u64();
+	} while (0 == j->next_epoch || j->epoch == j->next_epoch);
+
+	fprintf(f, "%s%s\n\n", JOURNAL_EPOCH, uint64_to_string(j->next_epoch));
+}
+
+/**
+ * Signal that the checkpoint file, marked by journal_checkpoint_mark(),
+ * was successfully written: the journal is restarted from scratch.
+ *
+ * @param j		the journal
+ * @param size	size of the checkpoint, to determine when to checkpoint again
+ */
+void
+journal_checkpointed(journal_t *j, filesize_t size)
+{
+	journal_check(j);
+	g_assert(j->next_epoch != 0);
+
+	journal_deactivate(j);
+
+	j->epoch = j->next_epoch;
+	j->next_epoch = 0;
+	j->checkpoint = size;
+	j->synced = 0;
+
+	j->f = file_fopen(j->path, "w");
+	if (NULL == j->f)
+		return;
+
+	fprintf(j->f, "%s%s\n\n", JOURNAL_EPOCH, uint64_to_string(j->epoch));
+
+	/*
+	 * The epoch line is not accounted for as journaled data.
+	 */
+
+	if (journal_sync(j) < 0)
+		s_warning("%s(): [%s] cannot start journal", G_STRFUNC, j->what);
+}
+
+/**
+ * @return whether journal can be used.
+ */
+bool
+journal_is_active(const journal_t *j)
+{
+	journal_check(j);
+
+	return j->f != NULL;
+}
+
+/**
+ * @return whether a checkpoint is needed instead of journaling changes,
+ * because the journal is inactive or larger than the last checkpoint.
+ */
+bool
+journal_wants_checkpoint(const journal_t *j)
+{
+	long size;
+
+	journal_check(j);
+
+	if (NULL == j->f)
+		return TRUE;
+
+	size = ftell(j->f);
+
+	return size < 0 || UNSIGNED(size) > MAX(j->checkpoint, JOURNAL_MIN_SIZE);
+}
+
+/**
+ * Start a new journal entry.
+ *
+ * @param j		the journal
+ * @param key	the key of the item, NULL to take it from the stanza
+ *
+ * @return the FILE where the stanza must be written, followed by a call
+ * to journal_end().  If nothing is written, the item is removed.
+ */
+FILE *
+journal_begin(journal_t *j, const char *key)
+{
+	journal_check(j);
+	g_assert(j->f != NULL);
+
+	if (NULL == key)
+		fputs("+\n", j->f);
+	else
+		fprintf(j->f, "+ %s\n", key);
+
+	return j->f;
+}
+
+/**
+ * Terminate the journal entry started by journal_begin().
+ */
+void
+journal_end(journal_t *j)
+{
+	journal_check(j);
+	g_assert(j->f != NULL);
+
+	fputc('\n', j->f);
+}
+
+/**
+ * Record removal of item in the journal, if active.
+ */
+void
+journal_delete(journal_t *j, const char *key)
+{
+	journal_check(j);
+	g_assert(key != NULL);
+
+	if (j->f != NULL)
+		fprintf(j->f, "- %s\n\n", key);
+}
+
+/**
+ * Make sure all the entries written so far reach the disk.
+ *
+ * Upon error, the journal is deactivated, which means the next changes
+ * will require a checkpoint.
+ *
+ * @return the amount of bytes added since the last synchronization, -1
+ * on error or when the journal is not active.
+ */
+ssize_t
+journal_sync(journal_t *j)
+{
+	long size;
+	ssize_t written;
+
+	journal_check(j);
+
+	if (NULL == j->f)
+		return -1;
+
+	size = ftell(j->f);
+	if (size < 0)
+		goto failed;
+
+	if (UNSIGNED(size) == j->synced)
+		return 0;			/* Nothing written since last time */
+
+	if (0 != fflush(j->f) || -1 == fd_fdatasync(fileno(j->f))) {
+		s_warning("%s(): [%s] cannot write journal: %m", G_STRFUNC, j->what);
+		goto failed;
+	}
+
+	written = size - j->synced;
+	j->synced = size;
+	return written;
+
+failed:
+	journal_deactivate(j);
+	return -1;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
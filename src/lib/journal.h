@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Change journal for text configuration databases.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _journal_h_
+#define _journal_h_
+
+struct journal;
+typedef struct journal journal_t;
+
+/*
+ * Public interface.
+ */
+
+bool journal_replay(const char *dir, const char *name,
+	const char *what, const char *key);
+
+journal_t *journal_make(const char *dir, const char *name, const char *what);
+void journal_free_null(journal_t **j_ptr);
+
+void journal_checkpoint_mark(journal_t *j, FILE *f);
+void journal_checkpointed(journal_t *j, filesize_t size);
+bool journal_wants_checkpoint(const journal_t *j);
+bool journal_is_active(const journal_t *j);
+
+FILE *journal_begin(journal_t *j, const char *key);
+void journal_end(journal_t *j);
+void journal_delete(journal_t *j, const char *key);
+ssize_t journal_sync(journal_t *j);
+
+#endif /* _journal_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -62,6 +62,7 @@ usage(void)
 			"  -L : sets lower limit for alphabet size (absolute min 1)\n"
 			"  -a : run all tests\n"
 			"  -b : what to benchmark: s or S = strstr(), p or P = pattern_*()\n"
+			"       m = pattern_set_*() against many pattern_search()\n"
 			"  -i : verbose level for pattern_init()\n"
 			"  -h : prints this help message\n"
 			"  -u : use un-matchable patterns\n"
@@ -1031,6 +1032,188 @@ test_qs_flags(pattern_search_fn_t *fn, const char *name)
 	s_info("%s(): all OK for %s()", G_STRFUNC, name);
 }
 
+#define SET_PATTERNS	5000		/* Patterns in benchmarked set */
+#define SET_TEXTS		2000		/* Texts scanned in benchmark */
+#define SET_TEXT_MAXLEN	100
+
+static void
+pattern_set_found(uint id, void *udata)
+{
+	bool *found = udata;
+
+	found[id] = TRUE;
+}
+
+/*
+ * Check pattern sets against searching each pattern on its own.
+ */
+static void
+test_pattern_set(void)
+{
+	static const char *patterns[] = {
+		"he", "she", "his", "hers", "", "h", "hishers", "ers", "e", "xyz",
+		"she",
+	};
+	static const char *texts[] = {
+		"", "ushers", "hishers", "xyzhe", "ahishersx", "sh", "HERS", "x",
+	};
+	pattern_set_t *ps;
+	size_t i, j, n, k;
+	bool found[SET_PATTERNS];
+
+	ps = pattern_set_make();
+
+	for (i = 0; i < N_ITEMS(patterns); i++) {
+		pattern_set_add(ps, patterns[i], strlen(patterns[i]), i);
+	}
+
+	pattern_set_compile(ps);
+	g_assert(N_ITEMS(patterns) == pattern_set_count(ps));
+
+	for (i = 0; i < N_ITEMS(texts); i++) {
+		ZERO(&found);
+		pattern_set_match(ps, texts[i], strlen(texts[i]),
+			pattern_set_found, found);
+
+		for (j = 0; j < N_ITEMS(patterns); j++) {
+			bool expected = NULL != strstr(texts[i], patterns[j]);
+
+			g_assert_log(expected == found[j],
+				"%s(): text \"%s\", pattern \"%s\": expected %s, got %s",
+				G_STRFUNC, texts[i], patterns[j],
+				bool_to_string(expected), bool_to_string(found[j]));
+		}
+	}
+
+	pattern_set_free_null(&ps);
+
+	/*
+	 * Now random patterns over a small alphabet, to get plenty of overlaps.
+	 */
+
+	for (n = 0; n < 10; n++) {
+		char pat[SET_PATTERNS / 10][8];
+		char text[SET_TEXT_MAXLEN];
+		size_t count = 1 + random_value(N_ITEMS(pat) - 1);
+
+		ps = pattern_set_make();
+
+		for (i = 0; i < count; i++) {
+			fill_random_asize_string(pat[i], 2 + random_value(6), 3);
+			pattern_set_add(ps, pat[i], strlen(pat[i]), i);
+		}
+
+		pattern_set_compile(ps);
+
+		for (k = 0; k < 100; k++) {
+			fill_random_asize_string(text, 1 + random_value(N_ITEMS(text) - 1),
+				3 + random_value(1));
+			ZERO(&found);
+			pattern_set_match(ps, text, 0, pattern_set_found, found);
+
+			for (j = 0; j < count; j++) {
+				bool expected = NULL != strstr(text, pat[j]);
+
+				g_assert_log(expected == found[j],
+					"%s(): text \"%s\", pattern \"%s\": expected %s, got %s",
+					G_STRFUNC, text, pat[j],
+					bool_to_string(expected), bool_to_string(found[j]));
+			}
+		}
+
+		pattern_set_free_null(&ps);
+	}
+
+	s_info("%s(): all OK", G_STRFUNC);
+}
+
+/*
+ * Benchmark a set of SET_PATTERNS patterns against searching each pattern
+ * on its own, as a filter made of as many substring rules would do.
+ */
+static void
+benchmark_pattern_set(void)
+{
+	char (*pat)[16], (*text)[SET_TEXT_MAXLEN];
+	cpattern_t **cpat;
+	pattern_set_t *ps;
+	bool *found;
+	size_t i, j, hits_set = 0, hits_each = 0;
+	tm_nano_t start, end;
+	double e_set, e_each;
+
+	XMALLOC_ARRAY(pat, SET_PATTERNS);
+	XMALLOC_ARRAY(cpat, SET_PATTERNS);
+	XMALLOC_ARRAY(text, SET_TEXTS);
+	XMALLOC_ARRAY(found, SET_PATTERNS);
+
+	ps = pattern_set_make();
+
+	for (i = 0; i < SET_PATTERNS; i++) {
+		fill_random_string(pat[i], 5 + random_value(8));
+		cpat[i] = pattern_compile(pat[i], FALSE);
+		pattern_set_add(ps, pat[i], strlen(pat[i]), i);
+	}
+
+	tm_precise_time(&start);
+	pattern_set_compile(ps);
+	tm_precise_time(&end);
+
+	s_info("%s(): compiled %d patterns in %.3f ms", G_STRFUNC,
+		SET_PATTERNS, tm_precise_elapsed_f(&end, &start) * 1000.0);
+
+	for (i = 0; i < SET_TEXTS; i++) {
+		fill_random_string(text[i], 20 + random_value(SET_TEXT_MAXLEN - 21));
+
+		/* Plant a pattern in one text out of ten */
+		if (0 == i % 10) {
+			const char *p = pat[random_value(SET_PATTERNS - 1)];
+			memcpy(text[i], p, strlen(p));
+		}
+	}
+
+	tm_precise_time(&start);
+	for (i = 0; i < SET_TEXTS; i++) {
+		memset(found, 0, SET_PATTERNS * sizeof found[0]);
+		pattern_set_match(ps, text[i], 0, pattern_set_found, found);
+		for (j = 0; j < SET_PATTERNS; j++) {
+			if (found[j])
+				hits_set++;
+		}
+	}
+	tm_precise_time(&end);
+	e_set = tm_precise_elapsed_f(&end, &start);
+
+	tm_precise_time(&start);
+	for (i = 0; i < SET_TEXTS; i++) {
+		for (j = 0; j < SET_PATTERNS; j++) {
+			if (NULL != pattern_search(cpat[j], text[i], 0, 0, qs_any))
+				hits_each++;
+		}
+	}
+	tm_precise_time(&end);
+	e_each = tm_precise_elapsed_f(&end, &start);
+
+	g_assert_log(hits_set == hits_each,
+		"%s(): set found %zu hits, searching each pattern found %zu",
+		G_STRFUNC, hits_set, hits_each);
+
+	s_info("%s(): %d patterns, %zu hits: set does %.0f texts/s, "
+		"each pattern does %.0f texts/s (%.1f times slower)",
+		G_STRFUNC, SET_PATTERNS, hits_set,
+		SET_TEXTS / e_set, SET_TEXTS / e_each, e_each / e_set);
+
+	for (i = 0; i < SET_PATTERNS; i++) {
+		pattern_free(cpat[i]);
+	}
+
+	pattern_set_free_null(&ps);
+	xfree(pat);
+	xfree(cpat);
+	xfree(text);
+	xfree(found);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -1038,7 +1221,7 @@ main(int argc, char **argv)
 	extern char *optarg;
 	int c;
 	const char options[] = "A:L:ab:i:huz";
-	const char all_benchmarks[] = "spSP";
+	const char all_benchmarks[] = "spSPm";
 	int default_init_level = PATTERN_INIT_PROGRESS | PATTERN_INIT_SELECTED;
 	int init_level = default_init_level;
 	const char *benchmarks = "";
@@ -1127,6 +1310,8 @@ main(int argc, char **argv)
 	test_qs_flags(FN(pattern_qsearch));
 	test_qs_flags(FN(pattern_match));
 
+	test_pattern_set();
+
 	/*
 	 * OK, seems the above are correct, benchmark our routines.
 	 */
@@ -1147,6 +1332,9 @@ main(int argc, char **argv)
 		case 'P':
 			benchmark_pattern(MIN(alphabet_min, small_size));
 			break;
+		case 'm':
+			benchmark_pattern_set();
+			break;
 		default:
 			s_warning("skipping unknown benchmark code '%c'", c);
 			break;
@@ -42,13 +42,16 @@
 #include "misc.h"
 #include "op.h"
 #include "pow2.h"
+#include "parse.h"
 #include "random.h"
 #include "stats.h"
+#include "str.h"
 #include "stringify.h"
 #include "tm.h"
 #include "unsigned.h"
 #include "walloc.h"
 #include "xmalloc.h"
+#include "xsort.h"
 
 #include "override.h"		/* Must be the last header included */
 
@@ -101,13 +104,11 @@ static const char *pattern_qsearch_known(
 #if 1
 static pattern_dflt_unknown_t *pattern_dflt_unknown = pattern_match_unknown;
 static pattern_dflt_known_t   *pattern_dflt_known   = pattern_match_known;
-static bool                    pattern_dflt_u_2way  = TRUE;
 static const char *            pattern_dflt_name_u  = "pattern_match_unknown";
 static const char *            pattern_dflt_name_k  = "pattern_match_known";
 #else
 static pattern_dflt_unknown_t *pattern_dflt_unknown = pattern_qsearch_unknown;
 static pattern_dflt_known_t   *pattern_dflt_known   = pattern_qsearch_known;
-static bool                    pattern_dflt_u_2way  = FALSE;
 static const char *            pattern_dflt_name_u  = "pattern_qsearch_unknown";
 static const char *            pattern_dflt_name_k  = "pattern_qsearch_known";
 #endif
@@ -2223,6 +2224,7 @@ vstrstr(const char *haystack, const char *needle)
 	uint8 uperiod[ALPHA_SIZE];
 	const char *match;
 	size_t min_hlen;	/* Minimal haystack length */
+	pattern_dflt_unknown_t *dflt_unknown;
 
 	/*
 	 * Determine the needle length, and, as a by-product, make sure the
@@ -2269,11 +2271,16 @@ vstrstr(const char *haystack, const char *needle)
 
 	/*
 	 * Perform matching.
+	 *
+	 * The default matcher can be changed concurrently by pattern_init() or
+	 * pattern_calibration_set(): take a snapshot, since the pattern must
+	 * be compiled for the routine that will actually use it.
 	 */
 
+	dflt_unknown = pattern_dflt_unknown;
 	pattern_compile_static(&p, delta, uperiod,
-		needle, nlen, FALSE, pattern_dflt_u_2way);
-	match = pattern_dflt_unknown(&p, (void *) h, min_hlen, qs_any);
+		needle, nlen, FALSE, pattern_match_unknown == dflt_unknown);
+	match = (*dflt_unknown)(&p, (void *) h, min_hlen, qs_any);
 	pattern_free(&p);
 
 	return deconstify_char(match);		/* vstrstr() returns a non-const */
@@ -2293,6 +2300,7 @@ vstrcasestr(const char *haystack, const char *needle)
 	uint8 uperiod[ALPHA_SIZE];
 	const char *match;
 	size_t nlen;
+	pattern_dflt_unknown_t *dflt_unknown;
 
 	/*
 	 * Determine the needle length, and, as a by-product, make sure the
@@ -2313,10 +2321,11 @@ vstrcasestr(const char *haystack, const char *needle)
 	 */
 
 	nlen = ptr_diff(n, needle);
+	dflt_unknown = pattern_dflt_unknown;	/* Snapshot, see vstrstr() */
 
 	pattern_compile_static(&p, delta, uperiod,
-		needle, nlen, TRUE, pattern_dflt_u_2way);
-	match = pattern_dflt_unknown(&p, (void *) (haystack + 1), nlen - 1, qs_any);
+		needle, nlen, TRUE, pattern_match_unknown == dflt_unknown);
+	match = (*dflt_unknown)(&p, (void *) (haystack + 1), nlen - 1, qs_any);
 	pattern_free(&p);
 
 	return deconstify_char(match);
@@ -3178,7 +3187,6 @@ pattern_benchmark_dflt(int verbose, struct pattern_benchmark_context *ctx)
 
 	pattern_dflt_unknown = ctx->u.pu[winner];
 	pattern_dflt_name_u = ctx->name[winner];
-	pattern_dflt_u_2way = (pattern_dflt_unknown == pattern_match_unknown);
 
 	/*
 	 * With known text lengths, always use the 2-Way String Matching
@@ -3477,4 +3485,537 @@ pattern_init(int verbose)
 	}
 }
 
+/**
+ * Format a cut-off value for pattern_calibration().
+ */
+static const char *
+pattern_cutoff_to_string(size_t cutoff, char *buf, size_t len)
+{
+	if (MAX_INT_VAL(size_t) == cutoff)
+		return "none";
+
+	size_t_to_string_buf(cutoff, buf, len);
+	return buf;
+}
+
+/**
+ * Append the current selection of matching routines and cut-off values to
+ * the string, one "pattern.<key> <value>" line per item.
+ *
+ * This is the format understood by pattern_calibration_set(), allowing the
+ * results of pattern_init() to be persisted and reused across runs.
+ */
+void
+pattern_calibration(str_t *s)
+{
+	char buf[SIZE_T_DEC_BUFLEN];
+
+#define PATTERN_SHOW(key, var, libc, ours) \
+	str_catf(s, "pattern.%s %s\n", key, libc == var ? #libc : #ours)
+
+	PATTERN_SHOW("memchr",  fast_memchr,  memchr,  pattern_memchr);
+	PATTERN_SHOW("memrchr", fast_memrchr, memrchr, pattern_memrchr);
+	PATTERN_SHOW("strchr",  fast_strchr,  strchr,  pattern_strchr);
+	PATTERN_SHOW("strrchr", fast_strrchr, strrchr, pattern_strrchr);
+	PATTERN_SHOW("strlen",  fast_strlen,  strlen,  pattern_strlen);
+	PATTERN_SHOW("unknown", pattern_dflt_unknown,
+		pattern_match_unknown, pattern_qsearch_unknown);
+
+#undef PATTERN_SHOW
+
+	str_catf(s, "pattern.cutoff.known %s\n",
+		pattern_cutoff_to_string(pattern_known_cutoff, ARYLEN(buf)));
+	str_catf(s, "pattern.cutoff.unknown %s\n",
+		pattern_cutoff_to_string(pattern_unknown_cutoff, ARYLEN(buf)));
+	str_catf(s, "pattern.cutoff.vstrstr %s\n",
+		pattern_cutoff_to_string(pattern_vstrstr_cutoff, ARYLEN(buf)));
+}
+
+/**
+ * Restore one matching routine or cut-off value, as previously listed by
+ * pattern_calibration(), without running any benchmark.
+ *
+ * @param key		the key, e.g. "pattern.strlen"
+ * @param value		the value, e.g. "pattern_strlen"
+ *
+ * @return TRUE if the key was recognized and the value valid.
+ */
+bool
+pattern_calibration_set(const char *key, const char *value)
+{
+	const char *p;
+
+	p = is_strprefix(key, "pattern.");
+	if (NULL == p)
+		return FALSE;
+
+#define PATTERN_SELECT(k, var, libc, ours) G_STMT_START {	\
+	if (0 == strcmp(p, k)) {								\
+		if (0 == strcmp(value, #libc))						\
+			var = libc;										\
+		else if (0 == strcmp(value, #ours))					\
+			var = ours;										\
+		else												\
+			return FALSE;									\
+		return TRUE;										\
+	}														\
+} G_STMT_END
+
+	PATTERN_SELECT("memchr",  fast_memchr,  memchr,  pattern_memchr);
+	PATTERN_SELECT("memrchr", fast_memrchr, memrchr, pattern_memrchr);
+	PATTERN_SELECT("strchr",  fast_strchr,  strchr,  pattern_strchr);
+	PATTERN_SELECT("strrchr", fast_strrchr, strrchr, pattern_strrchr);
+	PATTERN_SELECT("strlen",  fast_strlen,  strlen,  pattern_strlen);
+
+#undef PATTERN_SELECT
+
+	if (0 == strcmp(p, "unknown")) {
+		if (0 == strcmp(value, "pattern_match_unknown")) {
+			pattern_dflt_unknown = pattern_match_unknown;
+			pattern_dflt_name_u = "pattern_match_unknown";
+		} else if (0 == strcmp(value, "pattern_qsearch_unknown")) {
+			pattern_dflt_unknown = pattern_qsearch_unknown;
+			pattern_dflt_name_u = "pattern_qsearch_unknown";
+		} else {
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	p = is_strprefix(p, "cutoff.");
+	if (p != NULL) {
+		size_t cutoff;
+		int error;
+
+		if (0 == strcmp(value, "none")) {
+			cutoff = MAX_INT_VAL(size_t);
+		} else {
+			cutoff = parse_size(value, NULL, 10, &error);
+			if (error != 0)
+				return FALSE;
+		}
+
+		if (0 == strcmp(p, "known"))
+			pattern_known_cutoff = cutoff;
+		else if (0 == strcmp(p, "unknown"))
+			pattern_unknown_cutoff = cutoff;
+		else if (0 == strcmp(p, "vstrstr"))
+			pattern_vstrstr_cutoff = cutoff;
+		else
+			return FALSE;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/***
+ *** Multi-pattern matching.
+ ***/
+
+/*
+ * A pattern set is an Aho-Corasick automaton built over many patterns, which
+ * are all searched for in a single pass over the text, regardless of the
+ * amount of patterns.
+ *
+ * Patterns are first added to a trie, and the failure links are computed
+ * when the set is compiled.  Node 0 is the root of the trie.
+ *
+ * Once compiled, the outgoing edges of each node are stored contiguously,
+ * sorted by byte value, and the transitions from the root are held in a
+ * direct table since the root is likely to have many children.
+ */
+
+enum pattern_set_magic { PATTERN_SET_MAGIC = 0x2a9b3e71 };
+
+struct pattern_set_node {
+	uint32 child;			/**< First child, whilst building */
+	uint32 sibling;			/**< Next sibling, whilst building */
+	uint32 edge;			/**< Index of first outgoing edge */
+	uint32 fail;			/**< Failure link */
+	uint32 dict;			/**< Closest suffix node with outputs, 0 if none */
+	uint32 out;				/**< Index of first output */
+	uint32 nout;			/**< Amount of outputs */
+	uint16 nedges;			/**< Amount of outgoing edges */
+	uint8 c;				/**< Byte leading to this node */
+};
+
+struct pattern_set_output {
+	uint32 node;			/**< Node where pattern ends */
+	uint id;				/**< User-supplied pattern ID */
+};
+
+struct pattern_set {
+	enum pattern_set_magic magic;
+	struct pattern_set_node *nodes;		/**< Trie nodes, root first */
+	struct pattern_set_output *outputs;	/**< Outputs, sorted by node */
+	uint8 *ebyte;			/**< Edge bytes */
+	uint32 *enode;			/**< Edge targets */
+	uint32 root[256];		/**< Transitions from root, 0 if none */
+	size_t count;			/**< Amount of nodes */
+	size_t size;			/**< Allocated amount of nodes */
+	size_t ocount;			/**< Amount of outputs */
+	size_t osize;			/**< Allocated amount of outputs */
+	size_t patterns;		/**< Amount of patterns added */
+	bool compiled;			/**< Whether automaton was compiled */
+};
+
+static inline void
+pattern_set_check(const struct pattern_set * const ps)
+{
+	g_assert(ps != NULL);
+	g_assert(PATTERN_SET_MAGIC == ps->magic);
+}
+
+/**
+ * Allocate a new trie node.
+ *
+ * @return index of the new node.
+ */
+static uint32
+pattern_set_node_new(pattern_set_t *ps, uint8 c)
+{
+	struct pattern_set_node *n;
+
+	if (ps->count == ps->size) {
+		ps->size = MAX(64, ps->size * 2);
+		XREALLOC_ARRAY(ps->nodes, ps->size);
+	}
+
+	g_assert(ps->count < MAX_INT_VAL(uint32));
+
+	n = &ps->nodes[ps->count];
+	ZERO(n);
+	n->c = c;
+
+	return ps->count++;
+}
+
+/**
+ * Create a new empty pattern set, to which patterns are then added with
+ * pattern_set_add() before the set is compiled by pattern_set_compile().
+ *
+ * @return new pattern set, to be freed with pattern_set_free_null().
+ */
+pattern_set_t *
+pattern_set_make(void)
+{
+	pattern_set_t *ps;
+
+	XMALLOC0(ps);
+	ps->magic = PATTERN_SET_MAGIC;
+	(void) pattern_set_node_new(ps, 0);		/* The root */
+
+	return ps;
+}
+
+/**
+ * Free pattern set and nullify its pointer.
+ */
+void
+pattern_set_free_null(pattern_set_t **ps_ptr)
+{
+	pattern_set_t *ps = *ps_ptr;
+
+	if (ps != NULL) {
+		pattern_set_check(ps);
+		XFREE_NULL(ps->nodes);
+		XFREE_NULL(ps->outputs);
+		XFREE_NULL(ps->ebyte);
+		XFREE_NULL(ps->enode);
+		ps->magic = 0;
+		xfree(ps);
+		*ps_ptr = NULL;
+	}
+}
+
+/**
+ * @return the child of node `n' reached through byte `c', 0 if none.
+ *
+ * This is only used whilst building the automaton.
+ */
+static uint32
+pattern_set_child(const pattern_set_t *ps, uint32 n, uint8 c)
+{
+	uint32 i;
+
+	for (i = ps->nodes[n].child; i != 0; i = ps->nodes[i].sibling) {
+		if (c == ps->nodes[i].c)
+			return i;
+	}
+
+	return 0;
+}
+
+/**
+ * Add pattern to the set.
+ *
+ * The same ID can be given to several patterns, and the same pattern can be
+ * given several IDs.  An empty pattern matches any text.
+ *
+ * @param ps		the pattern set, not compiled yet
+ * @param pattern	the pattern to add
+ * @param plen		the length of the pattern
+ * @param id		the ID reported when the pattern is found
+ */
+void
+pattern_set_add(pattern_set_t *ps, const char *pattern, size_t plen, uint id)
+{
+	struct pattern_set_output *o;
+	uint32 n = 0;
+	size_t i;
+
+	pattern_set_check(ps);
+	g_assert(!ps->compiled);
+	g_assert(pattern != NULL || 0 == plen);
+
+	for (i = 0; i < plen; i++) {
+		uint8 c = pattern[i];
+		uint32 child = pattern_set_child(ps, n, c);
+
+		if (0 == child) {
+			child = pattern_set_node_new(ps, c);
+			ps->nodes[child].sibling = ps->nodes[n].child;
+			ps->nodes[n].child = child;
+		}
+
+		n = child;
+	}
+
+	if (ps->ocount == ps->osize) {
+		ps->osize = MAX(64, ps->osize * 2);
+		XREALLOC_ARRAY(ps->outputs, ps->osize);
+	}
+
+	o = &ps->outputs[ps->ocount++];
+	o->node = n;
+	o->id = id;
+	ps->patterns++;
+}
+
+/**
+ * @return amount of patterns added to the set.
+ */
+size_t
+pattern_set_count(const pattern_set_t *ps)
+{
+	pattern_set_check(ps);
+
+	return ps->patterns;
+}
+
+static int
+pattern_set_output_cmp(const void *a, const void *b)
+{
+	const struct pattern_set_output *oa = a, *ob = b;
+
+	return CMP(oa->node, ob->node);
+}
+
+/**
+ * Compile the pattern set, after which no more patterns can be added.
+ */
+void
+pattern_set_compile(pattern_set_t *ps)
+{
+	uint32 *queue, *children;
+	size_t i, head, tail, edges;
+
+	pattern_set_check(ps);
+	g_assert(!ps->compiled);
+
+	/*
+	 * Attach the outputs to their nodes.
+	 */
+
+	xqsort(ps->outputs, ps->ocount, sizeof ps->outputs[0],
+		pattern_set_output_cmp);
+
+	for (i = 0; i < ps->ocount; i++) {
+		struct pattern_set_node *n = &ps->nodes[ps->outputs[i].node];
+
+		if (0 == n->nout)
+			n->out = i;
+		n->nout++;
+	}
+
+	/*
+	 * Compute the failure and dictionary links, walking the trie in
+	 * breadth-first order so that the links of shorter prefixes are known
+	 * when we need them.
+	 */
+
+	XMALLOC_ARRAY(queue, ps->count);
+	head = tail = 0;
+
+	for (i = ps->nodes[0].child; i != 0; i = ps->nodes[i].sibling) {
+		ps->nodes[i].fail = 0;
+		queue[tail++] = i;
+	}
+
+	while (head < tail) {
+		uint32 u = queue[head++];
+
+		for (i = ps->nodes[u].child; i != 0; i = ps->nodes[i].sibling) {
+			struct pattern_set_node *v = &ps->nodes[i];
+			uint32 f = ps->nodes[u].fail;
+			uint32 t;
+
+			for (;;) {
+				t = pattern_set_child(ps, f, v->c);
+				if (t != 0 || 0 == f)
+					break;
+				f = ps->nodes[f].fail;
+			}
+
+			v->fail = t;
+			v->dict = 0 != ps->nodes[t].nout ? t : ps->nodes[t].dict;
+			queue[tail++] = i;
+		}
+	}
+
+	g_assert(tail == ps->count - 1);
+
+	/*
+	 * Lay out the outgoing edges of each node, sorted by byte value.
+	 */
+
+	XMALLOC_ARRAY(ps->ebyte, ps->count);
+	XMALLOC_ARRAY(ps->enode, ps->count);
+	XMALLOC_ARRAY(children, 256);
+
+	for (edges = 0, i = 0; i < ps->count; i++) {
+		struct pattern_set_node *n = &ps->nodes[i];
+		size_t j, k = 0;
+		uint32 c;
+
+		for (c = n->child; c != 0; c = ps->nodes[c].sibling) {
+			/* Insertion sort, there are at most 256 children */
+			for (j = k++; j > 0 && ps->nodes[children[j - 1]].c >
+				ps->nodes[c].c; j--)
+			{
+				children[j] = children[j - 1];
+			}
+			children[j] = c;
+		}
+
+		n->edge = edges;
+		n->nedges = k;
+
+		for (j = 0; j < k; j++) {
+			ps->ebyte[edges] = ps->nodes[children[j]].c;
+			ps->enode[edges++] = children[j];
+		}
+	}
+
+	for (i = ps->nodes[0].child; i != 0; i = ps->nodes[i].sibling) {
+		ps->root[ps->nodes[i].c] = i;
+	}
+
+	xfree(children);
+	xfree(queue);
+	ps->compiled = TRUE;
+}
+
+/**
+ * @return the node reached from node `n' through byte `c', 0 if none.
+ */
+static inline uint32
+pattern_set_goto(const pattern_set_t *ps, uint32 n, uint8 c)
+{
+	const struct pattern_set_node *node = &ps->nodes[n];
+	const uint8 *eb = &ps->ebyte[node->edge];
+	size_t lo = 0, hi = node->nedges;
+
+	/* Binary search, edges are sorted */
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (eb[mid] == c)
+			return ps->enode[node->edge + mid];
+		else if (eb[mid] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+/**
+ * Report the outputs of node `n'.
+ */
+static inline void
+pattern_set_report(const pattern_set_t *ps, uint32 n,
+	pattern_set_cb_t cb, void *udata)
+{
+	const struct pattern_set_node *node = &ps->nodes[n];
+	size_t i;
+
+	for (i = 0; i < node->nout; i++) {
+		(*cb)(ps->outputs[node->out + i].id, udata);
+	}
+}
+
+/**
+ * Search text for all the patterns of the set.
+ *
+ * The callback is invoked with the ID of each pattern found, each time it
+ * is found in the text, hence it can be invoked several times for the same
+ * pattern.
+ *
+ * @param ps		the compiled pattern set
+ * @param text		the text to scan
+ * @param tlen		length of text, 0 meaning it is NUL-terminated
+ * @param cb		callback invoked for each pattern found
+ * @param udata		additional callback argument
+ */
+void
+pattern_set_match(const pattern_set_t *ps, const char *text, size_t tlen,
+	pattern_set_cb_t cb, void *udata)
+{
+	const uint8 *p, *end;
+	uint32 s = 0;
+
+	pattern_set_check(ps);
+	g_assert(ps->compiled);
+	g_assert(text != NULL);
+	g_assert(cb != NULL);
+
+	pattern_set_report(ps, 0, cb, udata);	/* Empty patterns */
+
+	if (0 == tlen)
+		tlen = vstrlen(text);
+
+	p = (const uint8 *) text;
+	end = p + tlen;
+
+	while (p < end) {
+		uint8 c = *p++;
+		uint32 n;
+
+		for (;;) {
+			if (0 == s) {
+				s = ps->root[c];
+				break;
+			}
+			n = pattern_set_goto(ps, s, c);
+			if (n != 0) {
+				s = n;
+				break;
+			}
+			s = ps->nodes[s].fail;
+		}
+
+		n = 0 != ps->nodes[s].nout ? s : ps->nodes[s].dict;
+
+		while (n != 0) {
+			pattern_set_report(ps, n, cb, udata);
+			n = ps->nodes[n].dict;
+		}
+	}
+}
+
 /* vi: set ts=4 sw=4 cindent: */
@@ -87,6 +87,11 @@ size_t pattern_strlen(const char *s);
 
 void pattern_init(int verbose);
 
+struct str;
+
+void pattern_calibration(struct str *s);
+bool pattern_calibration_set(const char *key, const char *value);
+
 /**
  * Compile a static string.
  */
@@ -121,6 +126,26 @@ extern pattern_strlen_t *fast_strlen;
 char *vstrstr(const char *haystack, const char *needle);
 char *vstrcasestr(const char *haystack, const char *needle);
 
+/*
+ * Multi-pattern matching.
+ */
+
+typedef struct pattern_set pattern_set_t;
+
+/**
+ * Callback invoked with the ID of each pattern found by pattern_set_match().
+ */
+typedef void (*pattern_set_cb_t)(uint id, void *udata);
+
+pattern_set_t *pattern_set_make(void);
+void pattern_set_add(pattern_set_t *ps, const char *pattern, size_t plen,
+	uint id);
+void pattern_set_compile(pattern_set_t *ps);
+size_t pattern_set_count(const pattern_set_t *ps);
+void pattern_set_match(const pattern_set_t *ps, const char *text, size_t tlen,
+	pattern_set_cb_t cb, void *udata);
+void pattern_set_free_null(pattern_set_t **ps_ptr);
+
 #endif /* _pattern_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Startup sequencer and profiler.
+ *
+ * The main() routine calls many initialization routines in sequence.  Each
+ * of them can be wrapped with STARTUP() to record the time it takes, so that
+ * a regression in the time it takes before we can accept connections can be
+ * spotted and attributed.
+ *
+ * Routines that parse independent data (e.g. large text databases that are
+ * not needed until much later) can be launched in a worker thread with
+ * STARTUP_ASYNC().  Dependencies are expressed by STARTUP_NEEDS(), which
+ * blocks until the named asynchronous routine has completed, and must be
+ * placed before the first step that relies on the data it parsed.
+ *
+ * Asynchronous routines must only parse data into structures private to
+ * their module.  Anything that is not thread-safe, such as callout queue
+ * events, DBM maps or file watchers, must be set up by a synchronous step
+ * of the main thread that installs the parsed data after STARTUP_NEEDS().
+ *
+ * All the asynchronous routines are waited for by startup_done(), which
+ * must be called before entering the main loop.
+ *
+ * Steps are only ever created and waited for by the main thread, and each
+ * worker thread only updates its own step, which is only read by the main
+ * thread once the worker has been joined: hence no locking is necessary.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "startup.h"
+
+#include "log.h"
+#include "str.h"
+#include "thread.h"
+#include "tm.h"
+#include "vsort.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define STARTUP_STEPS_MAX	256		/**< Amount of steps we can record */
+
+/**
+ * A startup step.
+ */
+struct startup_step {
+	const char *what;		/**< Statement or routine (static string) */
+	startup_fn_t fn;		/**< Routine, for asynchronous steps */
+	tm_nano_t start;		/**< Time at which step started */
+	double elapsed;			/**< Wall-clock time taken, in seconds */
+	double waited;			/**< Time the main thread waited for it */
+	int stid;				/**< Thread running asynchronous step */
+	uint async:1;			/**< Step run by a worker thread */
+	uint joined:1;			/**< Worker thread was joined */
+};
+
+static struct startup_step startup_steps[STARTUP_STEPS_MAX];
+static size_t startup_count;		/**< Amount of recorded steps */
+static size_t startup_dropped;		/**< Steps we could not record */
+static struct startup_step *startup_current;	/**< Synchronous step */
+static tm_nano_t startup_origin;	/**< Start of first step */
+static double startup_total;		/**< Total startup time, in seconds */
+static bool startup_completed;		/**< Set by startup_done() */
+
+/**
+ * Allocate a new step, starting now.
+ *
+ * @return the new step, NULL if the table is full.
+ */
+static struct startup_step *
+startup_step_new(const char *what)
+{
+	struct startup_step *st;
+
+	g_assert(thread_is_main());
+	g_assert(!startup_completed);
+
+	if G_UNLIKELY(startup_count >= N_ITEMS(startup_steps)) {
+		startup_dropped++;
+		return NULL;
+	}
+
+	st = &startup_steps[startup_count++];
+	st->what = what;
+	tm_precise_time(&st->start);
+
+	if G_UNLIKELY(1 == startup_count)
+		startup_origin = st->start;
+
+	return st;
+}
+
+/**
+ * Record the completion of a step.
+ */
+static void
+startup_step_end(struct startup_step *st)
+{
+	tm_nano_t end;
+
+	tm_precise_time(&end);
+	st->elapsed = tm_precise_elapsed_f(&end, &st->start);
+}
+
+/**
+ * Mark the beginning of a synchronous step.
+ *
+ * @param what		the statement being run, as a static string
+ */
+void
+startup_begin(const char *what)
+{
+	g_assert(NULL == startup_current);
+
+	startup_current = startup_step_new(what);
+}
+
+/**
+ * Mark the end of the synchronous step begun by startup_begin().
+ */
+void
+startup_end(void)
+{
+	g_assert(thread_is_main());
+
+	if (startup_current != NULL) {
+		startup_step_end(startup_current);
+		startup_current = NULL;
+	}
+}
+
+/**
+ * Worker thread running an asynchronous step.
+ */
+static void *
+startup_thread(void *arg)
+{
+	struct startup_step *st = arg;
+
+	thread_set_name(st->what);
+
+	(*st->fn)();
+	startup_step_end(st);
+
+	return NULL;
+}
+
+/**
+ * Launch an initialization routine in a worker thread.
+ *
+ * The routine must not depend on anything that is not initialized yet,
+ * must only fill structures private to its module, and nothing must use
+ * what it parses until STARTUP_NEEDS() has been called for it.
+ *
+ * @param what		the name of the routine
+ * @param fn		the routine to run
+ */
+void
+startup_launch(const char *what, startup_fn_t fn)
+{
+	struct startup_step *st;
+	int r;
+
+	g_assert(NULL == startup_current);
+
+	st = startup_step_new(what);
+
+	/*
+	 * If the table is full or we cannot create a thread, run the routine
+	 * synchronously: we lose time, but not correctness.
+	 */
+
+	if G_UNLIKELY(NULL == st) {
+		(*fn)();
+		return;
+	}
+
+	st->fn = fn;
+	r = thread_create(startup_thread, st, THREAD_F_WARN, 0);
+
+	if (-1 == r) {
+		(*fn)();
+		startup_step_end(st);
+	} else {
+		st->async = TRUE;
+		st->stid = r;
+	}
+}
+
+/**
+ * Wait for the worker thread running an asynchronous step.
+ */
+static void
+startup_join(struct startup_step *st)
+{
+	bool blockable = TRUE;
+	tm_nano_t start, end;
+
+	g_assert(st->async);
+	g_assert(!st->joined);
+
+	/*
+	 * Allow main thread to block whilst waiting for the worker.
+	 */
+
+	if (!thread_main_is_blockable()) {
+		thread_set_main(TRUE);
+		blockable = FALSE;
+	}
+
+	tm_precise_time(&start);
+	if (-1 == thread_join(st->stid, NULL))
+		s_carp("%s(): cannot join with %s: %m", G_STRFUNC, st->what);
+	tm_precise_time(&end);
+
+	if (!blockable)
+		thread_set_main(FALSE);
+
+	st->waited = tm_precise_elapsed_f(&end, &start);
+	st->joined = TRUE;
+}
+
+/**
+ * Wait until the asynchronous step launched for the named routine has
+ * completed.
+ *
+ * It is not an error to wait for a routine that was run synchronously
+ * or that has already been waited for.
+ *
+ * @param what		the name of the routine, as given to startup_launch()
+ */
+void
+startup_wait(const char *what)
+{
+	size_t i;
+
+	g_assert(thread_is_main());
+
+	for (i = 0; i < startup_count; i++) {
+		struct startup_step *st = &startup_steps[i];
+
+		if (st->async && !st->joined && 0 == strcmp(what, st->what)) {
+			startup_join(st);
+			return;
+		}
+	}
+}
+
+/**
+ * Signal that the startup sequence is over, waiting for all the pending
+ * asynchronous steps.
+ *
+ * @param verbose	whether to log the startup report
+ */
+void
+startup_done(bool verbose)
+{
+	size_t i;
+	tm_nano_t end;
+
+	g_assert(thread_is_main());
+	g_assert(NULL == startup_current);
+	g_return_unless(!startup_completed);
+
+	for (i = 0; i < startup_count; i++) {
+		struct startup_step *st = &startup_steps[i];
+
+		if (st->async && !st->joined)
+			startup_join(st);
+	}
+
+	tm_precise_time(&end);
+	startup_total = tm_precise_elapsed_f(&end, &startup_origin);
+	startup_completed = TRUE;
+
+	if (verbose) {
+		str_t *s = str_new(4096);
+
+		startup_report(s, FALSE);
+		s_info("startup profile:\n%s", str_2c(s));
+		str_destroy_null(&s);
+	}
+}
+
+/**
+ * @return whether the startup sequence is over.
+ */
+bool
+startup_is_done(void)
+{
+	return startup_completed;
+}
+
+/**
+ * Sort steps by decreasing elapsed time.
+ */
+static int
+startup_step_elapsed_cmp(const void *a, const void *b)
+{
+	const struct startup_step * const *sa = a, * const *sb = b;
+
+	return CMP((*sb)->elapsed, (*sa)->elapsed);
+}
+
+/**
+ * Append the startup report to the string.
+ *
+ * For each step we list when it started relative to the first step, how
+ * long it took, which thread ran it and how long the main thread had to
+ * wait for asynchronous steps.
+ *
+ * @param s			the string to append to
+ * @param sorted	whether to sort steps by decreasing elapsed time
+ */
+void
+startup_report(str_t *s, bool sorted)
+{
+	const struct startup_step **steps;
+	double async = 0.0, waited = 0.0;
+	size_t i, count = startup_count;
+
+	steps = xmalloc(MAX(1, count) * sizeof steps[0]);
+
+	for (i = 0; i < count; i++) {
+		steps[i] = &startup_steps[i];
+		if (steps[i]->async) {
+			async += steps[i]->elapsed;
+			waited += steps[i]->waited;
+		}
+	}
+
+	if (sorted)
+		vsort(steps, count, sizeof steps[0], startup_step_elapsed_cmp);
+
+	str_catf(s, "%8s %8s %-6s %s\n", "Start", "Time", "Thread", "Step");
+
+	for (i = 0; i < count; i++) {
+		const struct startup_step *st = steps[i];
+
+		str_catf(s, "%8.3f %8.3f ",
+			tm_precise_elapsed_f(&st->start, &startup_origin), st->elapsed);
+
+		if (st->async) {
+			str_catf(s, "#%-5d %s", st->stid, st->what);
+			if (st->waited >= 0.001)
+				str_catf(s, " (waited %.3f)", st->waited);
+		} else {
+			str_catf(s, "%-6s %s", "main", st->what);
+		}
+
+		str_putc(s, '\n');
+	}
+
+	xfree(steps);
+
+	if (startup_completed) {
+		str_catf(s, "Total: %.3f secs in %zu steps", startup_total, count);
+		if (async != 0.0) {
+			str_catf(s, ", %.3f secs asynchronous (%.3f waited for)",
+				async, waited);
+		}
+		str_putc(s, '\n');
+	} else {
+		STR_CAT(s, "Startup still in progress\n");
+	}
+
+	if (startup_dropped != 0)
+		str_catf(s, "(%zu more steps not recorded)\n", startup_dropped);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
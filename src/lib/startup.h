@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Startup sequencer and profiler.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _startup_h_
+#define _startup_h_
+
+typedef void (*startup_fn_t)(void);
+
+/**
+ * Run a startup statement synchronously, recording the time it takes.
+ */
+#define STARTUP(x) G_STMT_START {	\
+	startup_begin(#x);				\
+	x;								\
+	startup_end();					\
+} G_STMT_END
+
+/**
+ * Launch an independent parsing routine in a worker thread.
+ */
+#define STARTUP_ASYNC(fn)	startup_launch(#fn, fn)
+
+/**
+ * Declare that what follows depends on a routine launched asynchronously,
+ * blocking until it has completed.
+ */
+#define STARTUP_NEEDS(fn)	startup_wait(#fn)
+
+struct str;
+
+/*
+ * Public interface.
+ */
+
+void startup_begin(const char *what);
+void startup_end(void);
+void startup_launch(const char *what, startup_fn_t fn);
+void startup_wait(const char *what);
+void startup_done(bool verbose);
+bool startup_is_done(void);
+void startup_report(struct str *s, bool sorted);
+
+#endif /* _startup_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -1763,6 +1763,9 @@ teq_monitor_install(void)
  * the thread can be accessed without lock protection if the only other source
  * of concurrency is the processing of events from the thread event queue.
  *
+ * If the thread created its own callout queue via cq_thread(), it is also
+ * heartbeating from here, so that timeouts are triggered whilst waiting.
+ *
  * @note
  * This routine is a cancellation point.
  *
@@ -1781,6 +1784,16 @@ teq_wait(predicate_fn_t predicate, void *arg)
 	tsig_addset(&nset, TSIG_TEQ);
 
 	for (;;) {
+		int delay;
+
+		/*
+		 * If the thread runs its own callout queue, trigger the events
+		 * that are due before checking for work: their callbacks may
+		 * well have generated some.
+		 */
+
+		cq_thread_dispatch();
+
 		thread_sigmask(TSIG_BLOCK, &nset, &oset);	/* Critical section */
 
 		/*
@@ -1801,9 +1814,23 @@ teq_wait(predicate_fn_t predicate, void *arg)
 		 *
 		 * There is nothing to cleanup here: should the thread be cancelled,
 		 * its signal mask will be irrelevant.
+		 *
+		 * When the thread has a callout queue, we must wake up in time to
+		 * heartbeat it.  Only this thread can schedule events there, and
+		 * those inserted whilst processing TEQ events interrupt the wait,
+		 * so we recompute the delay before suspending again.
 		 */
 
-		thread_sigsuspend(&oset);
+		delay = cq_thread_delay();
+
+		if G_LIKELY(-1 == delay) {
+			thread_sigsuspend(&oset);
+		} else {
+			tm_t timeout;
+
+			tm_fill_ms(&timeout, delay);
+			thread_timed_sigsuspend(&oset, &timeout);
+		}
 	}
 }
 
@@ -887,6 +887,27 @@ tm_cputime(double *user, double *sys)
 	return u + s;
 }
 
+/**
+ * Get the CPU time (user and kernel) used so far by the calling thread.
+ *
+ * Unlike tm_cputime(), which accounts for the whole process, this does not
+ * include the time used by the other threads.
+ *
+ * @return thread CPU time in seconds, -1.0 if it cannot be determined.
+ */
+double
+tm_thread_cputime(void)
+{
+#if defined(HAS_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec tp;
+
+	if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp))
+		return (double) tp.tv_sec + (double) tp.tv_nsec / 1e9;
+#endif	/* HAS_CLOCK_GETTIME && CLOCK_THREAD_CPUTIME_ID */
+
+	return -1.0;
+}
+
 /**
  * Returns the current time relative to the startup time (cached).
  *
@@ -0,0 +1,469 @@
+/*
+ * utf8-test -- tests and benchmarks the UTF-8 validation routines.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "halloc.h"
+#include "log.h"
+#include "misc.h"
+#include "progname.h"
+#include "random.h"
+#include "stats.h"
+#include "str.h"
+#include "stringify.h"
+#include "tm.h"
+#include "utf8.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+/*
+ * Default corpus, made of typical queries and shared filenames.
+ */
+static const char *default_corpus[] = {
+	"linux",
+	"free software song",
+	"The Quick Brown Fox Jumps Over The Lazy Dog.txt",
+	"ubuntu-22.04.3-desktop-amd64.iso",
+	"Project Gutenberg - The Adventures of Sherlock Holmes.epub",
+	"01 - Introduction (live at the Paradiso, 1998).ogg",
+	"Beyonc\xc3\xa9 - Halo.mp3",
+	"Edith Piaf - Non, je ne regrette rien.flac",
+	"\xc3\x89" "dith Piaf - La vie en rose.flac",
+	"Ga\xc3\xabtan Roussel - Help Myself (Nous ne faisons que passer).mp3",
+	"M\xc3\xb6tley Cr\xc3\xbc" "e - Dr. Feelgood.mp3",
+	"Sigur R\xc3\xb3s - Hopp\xc3\xadpolla.ogg",
+	"stra\xc3\x9f" "e",
+	"caf\xc3\xa9",
+	"cafe\xcc\x81",						/* Decomposed form */
+	"\xef\xac\x81" "nancial report \xc2\xbd.pdf",	/* Compatibility chars */
+	"\xe6\x9d\xb1\xe4\xba\xac\xe3\x82\xbf\xe3\x83\xaf\xe3\x83\xbc.jpg",
+	"\xd0\x92\xd0\xbe\xd0\xb9\xd0\xbd\xd0\xb0 \xd0\xb8 \xd0\xbc\xd0\xb8\xd1\x80",
+	"\xce\x9f\xce\xb4\xcf\x8d\xcf\x83\xcf\x83\xce\xb5\xce\xb9\xce\xb1.txt",
+	"\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4",
+};
+
+static const char **corpus;
+static size_t corpus_count;
+static size_t corpus_size;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-bh] [-f file] [-n loops]\n"
+			"  -b : benchmark routines on the corpus\n"
+			"  -f : read corpus from file, one string per line\n"
+			"  -h : prints this help message\n"
+			"  -n : amount of loops over the corpus when benchmarking\n"
+			, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+corpus_add(const char *s)
+{
+	if (corpus_count >= corpus_size) {
+		corpus_size = MAX(16, corpus_size * 2);
+		corpus = xrealloc(corpus, corpus_size * sizeof corpus[0]);
+	}
+	corpus[corpus_count++] = s;
+}
+
+static void
+corpus_load(const char *file)
+{
+	FILE *f;
+	char line[4096];
+
+	f = fopen(file, "r");
+	if (NULL == f)
+		s_fatal_exit(EXIT_FAILURE, "can't open \"%s\": %m", file);
+
+	while (fgets(line, sizeof line, f)) {
+		strchomp(line, 0);
+		if (utf8_is_valid_string(line))
+			corpus_add(xstrdup(line));
+	}
+
+	fclose(f);
+
+	if (0 == corpus_count)
+		s_fatal_exit(EXIT_FAILURE, "no valid UTF-8 string in \"%s\"", file);
+
+	s_info("loaded %zu strings from \"%s\"", corpus_count, file);
+}
+
+/*
+ * Naive implementations, for checking and benchmarking purposes.
+ */
+
+static bool
+naive_is_ascii_string(const char *s)
+{
+	while (*s > 0)
+		s++;
+
+	return '\0' == *s;
+}
+
+static bool
+naive_utf8_is_valid_string(const char *src)
+{
+	const char *s;
+	uint clen;
+
+	for (s = src; '\0' != *s; s += clen) {
+		if (0 == (clen = utf8_char_len(s)))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static size_t
+naive_utf8_char_count(const char *src)
+{
+	const char *s;
+	uint clen;
+	size_t n;
+
+	for (s = src, n = 0; '\0' != *s; s += clen, n++)
+		if (0 == (clen = utf8_char_len(s)))
+			return (size_t) -1;
+
+	return n;
+}
+
+/*
+ * Check the word-at-a-time routines against the naive ones on the string,
+ * copied at all the possible word alignments.
+ */
+static void
+check_string(const char *str)
+{
+	char buf[4096 + 8];
+	size_t len = strlen(str);
+	uint i;
+
+	g_assert(len < sizeof buf - 8);
+
+	for (i = 0; i < 8; i++) {
+		char *s = &buf[i];
+		bool valid;
+
+		memcpy(s, str, len + 1);
+		valid = naive_utf8_is_valid_string(s);
+
+		g_assert_log(valid == utf8_is_valid_string(s),
+			"%s(): alignment %u, valid=%s for \"%s\"",
+			G_STRFUNC, i, bool_to_string(valid), str);
+		g_assert_log(valid == utf8_is_valid_data(s, len),
+			"%s(): alignment %u, valid=%s for data \"%s\"",
+			G_STRFUNC, i, bool_to_string(valid), str);
+		g_assert_log(
+			naive_is_ascii_string(s) == is_ascii_string(s),
+			"%s(): alignment %u, ASCII mismatch for \"%s\"",
+			G_STRFUNC, i, str);
+		g_assert_log(
+			naive_utf8_char_count(s) == utf8_char_count(s),
+			"%s(): alignment %u, count mismatch for \"%s\"",
+			G_STRFUNC, i, str);
+	}
+}
+
+/*
+ * Make sure the quick normalization check agrees with the full algorithm.
+ *
+ * Decomposing a non-ASCII string yields combining characters, which always
+ * forces the full composition algorithm, and applying the decomposition
+ * twice checks the quick path against the full one.
+ */
+static void
+check_normalize(const char *str)
+{
+	static const struct {
+		uni_norm_t compose, decompose;
+	} forms[] = {
+		{ UNI_NORM_NFC,		UNI_NORM_NFD },
+		{ UNI_NORM_NFKC,	UNI_NORM_NFKD },
+	};
+	uint i;
+
+	if (!utf8_is_valid_string(str))
+		return;
+
+	for (i = 0; i < N_ITEMS(forms); i++) {
+		char *c, *d, *cd, *dd;
+
+		c  = utf8_normalize(str, forms[i].compose);
+		d  = utf8_normalize(str, forms[i].decompose);
+		cd = utf8_normalize(d, forms[i].compose);
+		dd = utf8_normalize(d, forms[i].decompose);
+
+		g_assert_log(0 == strcmp(c, cd),
+			"%s(): composed form mismatch for \"%s\"", G_STRFUNC, str);
+		g_assert_log(0 == strcmp(d, dd),
+			"%s(): decomposed form mismatch for \"%s\"", G_STRFUNC, str);
+
+		G_FREE_NULL(c);
+		G_FREE_NULL(d);
+		G_FREE_NULL(cd);
+		G_FREE_NULL(dd);
+	}
+}
+
+/*
+ * Generate random strings mixing ASCII with multi-byte characters, some
+ * of them invalid, to stress the transitions between fast and slow paths.
+ */
+static void
+check_random(void)
+{
+	static const char *chunks[] = {
+		"a", "Z", " ", "0123456", "abcdefghijklmno",
+		"\xc3\xa9", "\xcc\x81", "\xe2\x82\xac", "\xf0\x9f\x8e\xb5",
+		"\xc3", "\x80", "\xe2\x82", "\xff", "\xc0\xaf",
+	};
+	uint i;
+
+	for (i = 0; i < 10000; i++) {
+		char buf[256];
+		str_t *s = str_new_in_buffer(buf, sizeof buf);
+		uint n = random_value(12);
+
+		while (n-- != 0)
+			str_cat(s, chunks[random_value(N_ITEMS(chunks) - 1)]);
+
+		check_string(str_2c(s));
+		check_normalize(str_2c(s));
+	}
+}
+
+#define POINTS		100
+#define OUTLIERS	3.0
+
+typedef size_t (corpus_routine_t)(const char *s);
+
+static size_t
+run_is_ascii(const char *s)
+{
+	return is_ascii_string(s);
+}
+
+static size_t
+run_naive_is_ascii(const char *s)
+{
+	return naive_is_ascii_string(s);
+}
+
+static size_t
+run_is_valid(const char *s)
+{
+	return utf8_is_valid_string(s);
+}
+
+static size_t
+run_naive_is_valid(const char *s)
+{
+	return naive_utf8_is_valid_string(s);
+}
+
+static size_t
+run_char_count(const char *s)
+{
+	return utf8_char_count(s);
+}
+
+static size_t
+run_naive_char_count(const char *s)
+{
+	return naive_utf8_char_count(s);
+}
+
+static size_t
+run_nfc(const char *s)
+{
+	char *r = utf8_normalize(s, UNI_NORM_NFC);
+	size_t n = strlen(r);
+
+	G_FREE_NULL(r);
+	return n;
+}
+
+static size_t
+run_canonize(const char *s)
+{
+	char *r = utf8_canonize(s);
+	size_t n = strlen(r);
+
+	HFREE_NULL(r);
+	return n;
+}
+
+static double
+timeit(corpus_routine_t *r, size_t loops, size_t *result)
+{
+	size_t i, sum = 0;
+	statx_t *sx;
+	double elapsed;
+
+	sx = statx_make();
+
+	for (i = 0; i < POINTS; i++) {
+		size_t j;
+		tm_nano_t start, end;
+
+		tm_precise_time(&start);
+
+		for (j = 0; j < loops; j++) {
+			size_t k;
+
+			for (k = 0; k < corpus_count; k++)
+				sum += (*r)(corpus[k]);
+		}
+
+		tm_precise_time(&end);
+		statx_add(sx, tm_precise_elapsed_f(&end, &start) / loops);
+	}
+
+	statx_remove_outliers(sx, OUTLIERS);
+	elapsed = statx_avg(sx);
+	statx_free_null(&sx);
+
+	*result = sum;
+	return elapsed;
+}
+
+static void
+benchmark(size_t loops)
+{
+	static const struct {
+		const char *what;
+		corpus_routine_t *fast, *naive;
+	} tests[] = {
+		{ "is_ascii_string()",		run_is_ascii,	run_naive_is_ascii },
+		{ "utf8_is_valid_string()",	run_is_valid,	run_naive_is_valid },
+		{ "utf8_char_count()",		run_char_count,	run_naive_char_count },
+		{ "utf8_normalize(NFC)",	run_nfc,		NULL },
+		{ "utf8_canonize()",		run_canonize,	NULL },
+	};
+	uint i;
+
+	s_info("benchmarking over %zu strings, %zu loops", corpus_count, loops);
+
+	for (i = 0; i < N_ITEMS(tests); i++) {
+		double e1, e2;
+		size_t r1, r2;
+
+		e1 = timeit(tests[i].fast, loops, &r1);
+
+		if (NULL == tests[i].naive) {
+			s_info("\t%-24s %'zu ns", tests[i].what, (size_t) (e1 * 1e9));
+			continue;
+		}
+
+		e2 = timeit(tests[i].naive, loops, &r2);
+
+		g_assert_log(r1 == r2, "%s(): %s returned %zu, naive version %zu",
+			G_STRFUNC, tests[i].what, r1, r2);
+
+		s_info("\t%-24s %'zu ns (naive: %'zu ns)", tests[i].what,
+			(size_t) (e1 * 1e9), (size_t) (e2 * 1e9));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	const char options[] = "bf:hn:";
+	const char *file = NULL;
+	bool bench = FALSE;
+	size_t loops = 100;
+	size_t i;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* benchmark */
+			bench = TRUE;
+			break;
+		case 'f':			/* corpus file */
+			file = optarg;
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	locale_init();
+
+	if (file != NULL) {
+		corpus_load(file);
+	} else {
+		for (i = 0; i < N_ITEMS(default_corpus); i++)
+			corpus_add(default_corpus[i]);
+	}
+
+	/*
+	 * Check correctness before timing anything.
+	 */
+
+	for (i = 0; i < corpus_count; i++) {
+		check_string(corpus[i]);
+		check_normalize(corpus[i]);
+	}
+
+	check_random();
+
+	s_info("all checks passed");
+
+	if (bench)
+		benchmark(MAX(1, loops));
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -971,6 +971,98 @@ utf8_char_len_probe(const char *s)
 	return 0xE0 == uc ? 3 : 4;
 }
 
+#define ONEMASK ((size_t) (-1) / 0xff)	/* 0x01010101 on 32-bit machine */
+
+#if CHAR_BIT == 8
+#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
+#else
+#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
+#endif
+
+/**
+ * Compute the length of the leading run of non-NUL ASCII characters.
+ *
+ * Most of the strings we handle (queries, filenames) are largely made of
+ * ASCII characters, so we skip them a word at a time, using the same
+ * technique as utf8_strlen().
+ *
+ * @param str		a NUL-terminated string
+ *
+ * @return the amount of leading bytes which are non-NUL ASCII characters.
+ */
+static inline size_t G_HOT
+utf8_ascii_span(const char *str)
+{
+	const char *s;
+
+	/*
+	 * Handle any initial misaligned bytes.
+	 */
+
+	for (s = str; pointer_to_ulong(s) & (sizeof(size_t) - 1); s++) {
+		if (!IS_NON_NUL_ASCII(s))
+			return s - str;
+	}
+
+	/*
+	 * Handle complete blocks.
+	 *
+	 * As in utf8_strlen(), this may read past the trailing NUL but cannot
+	 * cross a page boundary since reads are aligned.
+	 *
+	 * A zero byte gets its high bit set when we subtract 1 from it, so a
+	 * block only holds non-NUL ASCII bytes when neither the block nor the
+	 * result of the subtraction have any high bit set.
+	 */
+
+	for (;; s += sizeof(size_t)) {
+		size_t u = *(size_t *) s;
+
+		if (((u - ONEMASK) | u) & (ONEMASK * 0x80))
+			break;
+	}
+
+	/*
+	 * Locate the first offending byte within the block.
+	 */
+
+	while (IS_NON_NUL_ASCII(s))
+		s++;
+
+	return s - str;
+}
+
+/**
+ * Compute the length of the leading run of ASCII characters in a buffer.
+ *
+ * Contrary to utf8_ascii_span(), NUL bytes are part of the run since they
+ * are valid UTF-8 characters within a buffer.
+ *
+ * @param data		the start of the buffer
+ * @param len		length of the buffer
+ *
+ * @return the amount of leading bytes which are ASCII characters.
+ */
+static inline size_t G_HOT
+utf8_ascii_data_span(const char *data, size_t len)
+{
+	const char *s = data, *end = data + len;
+
+	while (ptr_diff(end, s) >= sizeof(size_t)) {
+		size_t u;
+
+		memcpy(&u, s, sizeof u);	/* Buffer may not be aligned */
+		if (u & (ONEMASK * 0x80))
+			break;
+		s += sizeof u;
+	}
+
+	while (s < end && UTF8_IS_ASCII(*s))
+		s++;
+
+	return s - data;
+}
+
 /**
  * Determine whether a string is UTF-8 encoded.
  *
@@ -981,15 +1073,18 @@ utf8_char_len_probe(const char *s)
 bool
 utf8_is_valid_string(const char *src)
 {
-	const char *s;
-	uint clen;
+	const char *s = src;
 
-	for (s = src; '\0' != *s; s += clen) {
+	for (;;) {
+		uint clen;
+
+		s += utf8_ascii_span(s);
+		if ('\0' == *s)
+			return TRUE;
 		if (0 == (clen = utf8_char_len(s)))
 			return FALSE;
+		s += clen;
 	}
-
-	return TRUE;
 }
 
 /**
@@ -1004,6 +1099,12 @@ utf8_is_valid_data(const char *src, size_t len)
 	while (len > 0) {
 		size_t clen;
 
+		clen = utf8_ascii_data_span(src, len);
+		len -= clen;
+		src += clen;
+		if (0 == len)
+			break;
+
 		clen = utf8_skip(*src);
 		if (clen > len || 0 == utf8_char_len(src))
 			break;
@@ -1025,13 +1126,22 @@ utf8_is_valid_data(const char *src, size_t len)
 size_t
 utf8_char_count(const char *src)
 {
-	const char *s;
-	uint clen;
-	size_t n;
+	const char *s = src;
+	size_t n = 0;
 
-	for (s = src, n = 0; '\0' != *s; s += clen, n++)
+	for (;;) {
+		size_t span = utf8_ascii_span(s);
+		uint clen;
+
+		s += span;
+		n += span;
+		if ('\0' == *s)
+			break;
 		if (0 == (clen = utf8_char_len(s)))
 			return (size_t) -1;
+		s += clen;
+		n++;
+	}
 
 	return n;
 }
@@ -1065,8 +1175,6 @@ utf8_data_char_count(const char *src, size_t len)
 	return n;
 }
 
-#define ONEMASK ((size_t) (-1) / 0xff)	/* 0x01010101 on 32-bit machine */
-
 /**
  * Quickly compute the amount of UTF-8 codepoints in the string, without
  * validating that the string is a valid UTF-8 one.
@@ -2650,19 +2758,10 @@ charset_to_utf8(const char *cs, const char *src, size_t src_len)
 	return result;
 }
 
-#if CHAR_BIT == 8
-#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
-#else
-#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
-#endif
-
 bool
 is_ascii_string(const char *s)
 {
-	while (IS_NON_NUL_ASCII(s))
-		++s;
-
-	return '\0' == *s;
+	return '\0' == s[utf8_ascii_span(s)];
 }
 
 static inline const char *
@@ -5561,6 +5660,54 @@ utf32_normalize(const uint32 *src, uni_norm_t norm)
 	return NULL;
 }
 
+/**
+ * Quickly check whether a valid UTF-8 string is already in the requested
+ * normal form, without having to decompose and recompose it.
+ *
+ * No character below U+00C0 has a canonical decomposition and none below
+ * U+00A0 has a compatibility decomposition.  Strings made only of characters
+ * below these bounds are left untouched by the decomposition, and there is
+ * nothing to compose afterwards since all combining characters lie above.
+ *
+ * @param src the string to check, must be valid UTF-8.
+ * @param norm one of UNI_NORM_NFC, UNI_NORM_NFD, UNI_NORM_NFKC, UNI_NORM_NFKD.
+ *
+ * @return TRUE if the string is known to be normalized, FALSE if it has
+ * to go through the normalization algorithm.
+ */
+static bool
+utf8_is_trivially_normalized(const char *src, uni_norm_t norm)
+{
+	const char *s = src;
+	uint32 bound = 0;
+
+	switch (norm) {
+	case UNI_NORM_NFC:
+	case UNI_NORM_NFD:
+		bound = 0xC0;
+		break;
+	case UNI_NORM_NFKC:
+	case UNI_NORM_NFKD:
+		bound = 0xA0;
+		break;
+	case NUM_UNI_NORM:
+		g_assert_not_reached();
+	}
+
+	for (;;) {
+		uint32 uc;
+		uint clen;
+
+		s += utf8_ascii_span(s);
+		if ('\0' == *s)
+			return TRUE;
+		uc = utf8_decode_char_fast(s, &clen);
+		if (uc >= bound)
+			return FALSE;
+		s += clen;
+	}
+}
+
 /**
  * Normalizes an UTF-8 string to the request normal form and returns
  * it as a newly allocated string.
@@ -5579,7 +5726,7 @@ utf8_normalize(const char *src, uni_norm_t norm)
 	g_assert(utf8_is_valid_string(src));
 	g_assert(UNSIGNED(norm) < NUM_UNI_NORM);
 
-	if (is_ascii_string(src)) {
+	if (utf8_is_trivially_normalized(src, norm)) {
 		/*
 		 * Optimize this later and return the original src pointer.
 		 */
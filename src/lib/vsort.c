@@ -60,6 +60,7 @@
 #include "op.h"
 #include "random.h"
 #include "smsort.h"
+#include "str.h"
 #include "tm.h"
 #include "tqsort.h"
 #include "unsigned.h"
@@ -99,6 +100,23 @@ static struct {
 	{ tqsort, xqsort },		/* Default if they do not call vsort_init() */
 };
 
+static const char *vsort_table_name[] = {
+	"small",				/* VSORT_SMALL */
+	"large",				/* VSORT_LARGE */
+	"huge",					/* VSORT_HUGE */
+};
+
+static const struct {
+	vsort_t routine;
+	const char *name;
+} vsort_routines[] = {
+	{ qsort,	"qsort" },
+	{ xqsort,	"xqsort" },
+	{ xsort,	"xsort" },
+	{ tqsort,	"tqsort" },
+	{ smsort,	"smsort" },
+};
+
 static int
 vsort_long_cmp(const void *a, const void *b)
 {
@@ -539,4 +557,100 @@ vsort_init(int verbose)
 		thread_set_main(FALSE);
 }
 
+/**
+ * @return the name of a sorting routine, for logging and persistence.
+ */
+static const char *
+vsort_name_of(const vsort_t routine)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(vsort_routines); i++) {
+		if (vsort_routines[i].routine == routine)
+			return vsort_routines[i].name;
+	}
+
+	return "unknown";
+}
+
+/**
+ * @return the sorting routine bearing that name, NULL if unknown.
+ */
+static vsort_t
+vsort_named(const char *name, size_t len)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(vsort_routines); i++) {
+		const char *n = vsort_routines[i].name;
+
+		if (len == vstrlen(n) && 0 == memcmp(n, name, len))
+			return vsort_routines[i].routine;
+	}
+
+	return NULL;
+}
+
+/**
+ * Append the current selection of sorting routines to the string, one line
+ * per array size class, formatted as "vsort.<class> <general> <almost>".
+ *
+ * This is the format understood by vsort_calibration_set(), allowing the
+ * results of vsort_init() to be persisted and reused across runs.
+ */
+void
+vsort_calibration(str_t *s)
+{
+	uint i;
+
+	STATIC_ASSERT(N_ITEMS(vsort_table_name) == N_ITEMS(vsort_table));
+
+	for (i = 0; i < N_ITEMS(vsort_table); i++) {
+		str_catf(s, "vsort.%s %s %s\n", vsort_table_name[i],
+			vsort_name_of(vsort_table[i].v_sort),
+			vsort_name_of(vsort_table[i].v_sort_almost));
+	}
+}
+
+/**
+ * Restore the sorting routines for one array size class, as previously
+ * listed by vsort_calibration(), without running any benchmark.
+ *
+ * @param key		the key, e.g. "vsort.large"
+ * @param value		the routines, e.g. "xqsort smsort"
+ *
+ * @return TRUE if the key was recognized and the value valid.
+ */
+bool
+vsort_calibration_set(const char *key, const char *value)
+{
+	const char *p, *sp;
+	vsort_t v_sort, v_sort_almost;
+	uint i;
+
+	p = is_strprefix(key, "vsort.");
+	if (NULL == p)
+		return FALSE;
+
+	sp = vstrchr(value, ' ');
+	if (NULL == sp)
+		return FALSE;
+
+	v_sort = vsort_named(value, sp - value);
+	v_sort_almost = vsort_named(sp + 1, vstrlen(sp + 1));
+
+	if (NULL == v_sort || NULL == v_sort_almost)
+		return FALSE;
+
+	for (i = 0; i < N_ITEMS(vsort_table); i++) {
+		if (0 == strcmp(p, vsort_table_name[i])) {
+			vsort_table[i].v_sort = v_sort;
+			vsort_table[i].v_sort_almost = v_sort_almost;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 /* vi: set ts=4 sw=4 cindent: */
@@ -40,6 +40,11 @@
 
 void vsort_init(int verbose);
 
+struct str;
+
+void vsort_calibration(struct str *s);
+bool vsort_calibration_set(const char *key, const char *value);
+
 void vsort(void *b, size_t n, size_t s, cmp_fn_t cmp);
 void vsort_almost(void *b, size_t n, size_t s, cmp_fn_t cmp);
 
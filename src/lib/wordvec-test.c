@@ -0,0 +1,306 @@
+/*
+ * wordvec-test -- tests and benchmarks the query word splitting.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "log.h"
+#include "misc.h"
+#include "progname.h"
+#include "random.h"
+#include "stats.h"
+#include "str.h"
+#include "stringify.h"
+#include "tm.h"
+#include "wordvec.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+/*
+ * Default corpus, made of canonized queries as seen on the network.
+ */
+static const char *default_corpus[] = {
+	"linux",
+	"free software song",
+	"the quick brown fox jumps over the lazy dog",
+	"ubuntu 22 04 3 desktop amd64 iso",
+	"project gutenberg the adventures of sherlock holmes epub",
+	"the file is the one",
+	"a a a a a a a a a a a a a",
+	"  leading and trailing spaces  ",
+	"one two three four five six seven eight nine ten eleven twelve",
+	"mp3",
+	"beyonce halo",
+	"edith piaf non je ne regrette rien flac",
+	"01 introduction live at the paradiso 1998 ogg",
+	"",
+	"   ",
+};
+
+static const char **corpus;
+static size_t corpus_count;
+static size_t corpus_size;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-bh] [-f file] [-n loops]\n"
+			"  -b : benchmark word splitting on the corpus\n"
+			"  -f : read corpus from file, one query per line\n"
+			"  -h : prints this help message\n"
+			"  -n : amount of loops over the corpus when benchmarking\n"
+			, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+corpus_add(const char *s)
+{
+	if (corpus_count >= corpus_size) {
+		corpus_size = MAX(16, corpus_size * 2);
+		corpus = xrealloc(corpus, corpus_size * sizeof corpus[0]);
+	}
+	corpus[corpus_count++] = s;
+}
+
+static void
+corpus_load(const char *file)
+{
+	FILE *f;
+	char line[4096];
+
+	f = fopen(file, "r");
+	if (NULL == f)
+		s_fatal_exit(EXIT_FAILURE, "can't open \"%s\": %m", file);
+
+	while (fgets(line, sizeof line, f)) {
+		strchomp(line, 0);
+		corpus_add(xstrdup(line));
+	}
+
+	fclose(f);
+
+	s_info("loaded %zu queries from \"%s\"", corpus_count, file);
+}
+
+/*
+ * Make sure the word vector holds each word of the query with the proper
+ * amount of occurrences, using a naive quadratic count.
+ */
+static void
+check_query(const char *query)
+{
+	word_vec_t *wovec;
+	uint n, i, words = 0;
+	const char *p = query;
+
+	n = word_vec_make(query, &wovec);
+
+	for (;;) {
+		const char *start;
+		size_t len;
+		uint amount = 0;
+
+		while (' ' == *p)
+			p++;
+		if ('\0' == *p)
+			break;
+
+		start = p;
+		while (*p != ' ' && *p != '\0')
+			p++;
+		len = p - start;
+		words++;
+
+		for (i = 0; i < n; i++) {
+			if (UNSIGNED(wovec[i].len) == len &&
+				0 == memcmp(wovec[i].word, start, len)
+			) {
+				amount = wovec[i].amount;
+				break;
+			}
+		}
+
+		g_assert_log(amount != 0,
+			"%s(): missing word \"%.*s\" in \"%s\"",
+			G_STRFUNC, (int) len, start, query);
+	}
+
+	for (i = 0; i < n; i++) {
+		g_assert_log(UNSIGNED(wovec[i].len) == strlen(wovec[i].word),
+			"%s(): bad length for word #%u \"%s\" in \"%s\"",
+			G_STRFUNC, i, wovec[i].word, query);
+		g_assert(words >= wovec[i].amount);
+		words -= wovec[i].amount;
+	}
+
+	g_assert_log(0 == words,
+		"%s(): %u word occurrence%s unaccounted for in \"%s\"",
+		G_STRFUNC, PLURAL(words), query);
+
+	if (n != 0)
+		word_vec_free(wovec, n);
+}
+
+/*
+ * Generate random queries made of a few short words, to get duplicates
+ * and vectors larger than the default size.
+ */
+static void
+check_random(void)
+{
+	static const char *words[] = {
+		"a", "b", "the", "one", "mp3", "avi", "fox", "dog", "live", "remix",
+	};
+	uint i;
+
+	for (i = 0; i < 10000; i++) {
+		char buf[512];
+		str_t *s = str_new_in_buffer(buf, sizeof buf);
+		uint n = random_value(40);
+
+		while (n-- != 0) {
+			str_cat(s, words[random_value(N_ITEMS(words) - 1)]);
+			str_cat(s, random_value(3) ? " " : "  ");
+		}
+
+		check_query(str_2c(s));
+	}
+}
+
+#define POINTS		100
+#define OUTLIERS	3.0
+
+static void
+benchmark(size_t loops)
+{
+	size_t i, words = 0;
+	statx_t *sx;
+
+	sx = statx_make();
+
+	for (i = 0; i < POINTS; i++) {
+		size_t j;
+		tm_nano_t start, end;
+
+		tm_precise_time(&start);
+
+		for (j = 0; j < loops; j++) {
+			size_t k;
+
+			for (k = 0; k < corpus_count; k++) {
+				word_vec_t *wovec;
+				uint n = word_vec_make(corpus[k], &wovec);
+
+				if (n != 0)
+					word_vec_free(wovec, n);
+				words += n;
+			}
+		}
+
+		tm_precise_time(&end);
+		statx_add(sx, tm_precise_elapsed_f(&end, &start) /
+			(loops * corpus_count));
+	}
+
+	statx_remove_outliers(sx, OUTLIERS);
+
+	s_info("word_vec_make() + word_vec_free(): %'zu ns per query "
+		"(%zu queries, %.1f distinct words per query)",
+		(size_t) (statx_avg(sx) * 1e9), corpus_count,
+		(double) words / (POINTS * loops * corpus_count));
+
+	statx_free_null(&sx);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	const char options[] = "bf:hn:";
+	const char *file = NULL;
+	bool bench = FALSE;
+	size_t loops = 1000;
+	size_t i;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* benchmark */
+			bench = TRUE;
+			break;
+		case 'f':			/* corpus file */
+			file = optarg;
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 'h':			/* show help */
+			/* FALL THROUGH */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (0 != (argc -= optind))
+		usage();
+
+	word_vec_init();
+
+	if (file != NULL) {
+		corpus_load(file);
+	} else {
+		for (i = 0; i < N_ITEMS(default_corpus); i++)
+			corpus_add(default_corpus[i]);
+	}
+
+	for (i = 0; i < corpus_count; i++)
+		check_query(corpus[i]);
+
+	check_random();
+
+	s_info("all checks passed");
+
+	if (bench && corpus_count != 0)
+		benchmark(MAX(1, loops));
+
+	word_vec_close();
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
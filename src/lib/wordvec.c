@@ -40,7 +40,6 @@
 #include "htable.h"
 #include "unsigned.h"
 #include "utf8.h"
-#include "walloc.h"
 #include "zalloc.h"
 
 #include "override.h"		/* Must be the last header included */
@@ -121,14 +120,28 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 	uint n = 0;
 	htable_t *seen_word = NULL;
 	uint nv = WOVEC_DFLT;
-	word_vec_t *wv = zalloc(wovec_zone);
-	const char *start = NULL;
-	char * const query_dup = h_strdup(query_str);
-	char *query;
+	word_vec_t *wv;
+	char *start = NULL;
+	char *query_dup, *query;
 	uchar c;
 
 	g_assert(wovec != NULL);
 
+	/*
+	 * All the words point into a single copy of the query, which starts
+	 * with the first word so that word_vec_free() can release the copy
+	 * through the first entry of the vector.
+	 */
+
+	while (' ' == *query_str)
+		query_str++;
+
+	if ('\0' == *query_str)
+		return 0;
+
+	wv = zalloc(wovec_zone);
+	query_dup = h_strdup(query_str);
+
 	for (query = query_dup; /* empty */; query++) {
 		bool is_separator;
 
@@ -143,30 +156,38 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 			if (!is_separator)
 				start = query;
 		} else {
-			uint np1;
+			uint np1 = 0;
+			int len;
 
 			if (!is_separator)
 				continue;
 
 			*query = '\0';
-
-			/* Only create a hash table if there is more than one word. */
-			if G_UNLIKELY(0 == n)
-				np1 = 0;
-			else {
-				if G_UNLIKELY(NULL == seen_word) {
-					seen_word = htable_create(HASH_KEY_STRING, 0);
-					htable_insert(seen_word, wv[0].word, uint_to_pointer(1));
-				}
-
-				/*
-			 	 * If word already seen in query, it's in the seen_word table.
-				 * The associated value is the index in the vector plus 1: that
-				 * way, we can know a word is not present in the table since
-				 * the line below will evaluate to 0.
-		 	 	 */
-
+			len = query - start;
+
+			/*
+			 * If word already seen in query, np1 is its index in the vector
+			 * plus 1: that way, we know a word is not present when np1 is 0.
+			 *
+			 * Queries have few words, so a linear scan of the vector is
+			 * cheaper than a hash table, which we only create when the
+			 * vector has to be expanded.
+			 */
+
+			if G_UNLIKELY(seen_word != NULL) {
 				np1 = pointer_to_uint(htable_lookup(seen_word, start));
+			} else {
+				uint i;
+
+				for (i = 0; i < n; i++) {
+					if (
+						wv[i].len == len &&
+						0 == memcmp(wv[i].word, start, len)
+					) {
+						np1 = i + 1;
+						break;
+					}
+				}
 			}
 
 			if (np1--) {
@@ -179,25 +200,25 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 
 				if G_UNLIKELY(n == nv) {		/* Filled all the slots */
 					nv *= 2;
-					if (n > WOVEC_DFLT)
+					if (n > WOVEC_DFLT) {
 						HREALLOC_ARRAY(wv, nv);
-					else
+					} else {
+						uint i;
+
 						wv = word_vec_zrealloc(wv, nv);
+						seen_word = htable_create(HASH_KEY_STRING, 0);
+						for (i = 0; i < n; i++) {
+							htable_insert(seen_word,
+								wv[i].word, uint_to_pointer(i + 1));
+						}
+					}
 				}
 				entry = &wv[n++];
-				entry->len = query - start;
-				entry->word = walloc(entry->len + 1);	/* For trailing NUL */
-				memcpy(entry->word, start, entry->len + 1); /* Includes NUL */
-
+				entry->len = len;
+				entry->word = start;
 				entry->amount = 1;
 
-				/*
-				 * Delay insertion of first word until we find another one.
-				 * The hash table storing duplicates is not created for
-				 * the first word.
-				 */
-
-				if (n > 1)
+				if (seen_word != NULL)
 					htable_insert(seen_word, entry->word, uint_to_pointer(n));
 			}
 			start = NULL;
@@ -207,11 +228,11 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 	}
 
 	htable_free_null(&seen_word);	/* Key pointers belong to vector */
-	if (n)
-		*wovec = wv;
-	else
-		zfree(wovec_zone, wv);
-	hfree(query_dup);
+
+	g_assert(n != 0);				/* Query had at least one word */
+	g_assert(wv[0].word == query_dup);
+
+	*wovec = wv;
 	return n;
 }
 
@@ -221,12 +242,9 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 void
 word_vec_free(word_vec_t *wovec, uint n)
 {
-	uint i;
-
 	g_assert(uint_is_positive(n));
 
-	for (i = 0; i < n; i++)
-		wfree(wovec[i].word, wovec[i].len + 1);
+	hfree(wovec[0].word);		/* All words are held in that buffer */
 
 	if (n > WOVEC_DFLT)
 		HFREE_NULL(wovec);
@@ -39,12 +39,33 @@
 #include "glib-missing.h"
 #include "misc.h"
 #include "halloc.h"
+#include "spinlock.h"
 #include "unsigned.h"
 #include "walloc.h"
 #include "override.h"		/* Must be the last header included */
 
 #define OUT_GROW	1024		/**< To grow output buffer if it's to short */
 
+/*
+ * Approximate size of the internal zlib state, besides the window and the
+ * hash tables whose size depends on the stream parameters.
+ */
+#define ZLIB_DEFLATE_STATE	(6 * 1024)
+#define ZLIB_INFLATE_STATE	(7 * 1024)
+
+/*
+ * Pool of inflating streams, reset after usage.
+ *
+ * One-shot inflations (deflated UDP payloads, GGEP extensions, QRP tables)
+ * reuse these instead of setting up and tearing down a new zlib stream,
+ * along with its 32 KiB window, each time.
+ */
+#define ZLIB_INFLATE_POOL	8
+
+static z_streamp zlib_inflate_pool[ZLIB_INFLATE_POOL];
+static size_t zlib_inflate_pool_cnt;
+static spinlock_t zlib_inflate_pool_slk = SPINLOCK_INIT;
+
 enum zlib_stream_magic {
 	ZLIB_DEFLATER_MAGIC = 0x22a22f45,
 	ZLIB_INFLATER_MAGIC = 0x49ad00b4
@@ -209,6 +230,102 @@ zlib_free_func(void *unused_opaque, void *p)
 	hfree(p);
 }
 
+/**
+ * Estimate the amount of memory used by a deflating stream.
+ *
+ * @param window_bits	the window size, as given to deflateInit2()
+ * @param mem_level		the memory level, as given to deflateInit2()
+ *
+ * @return approximate amount of bytes used by zlib for the stream.
+ */
+size_t
+zlib_deflate_memory(int window_bits, int mem_level)
+{
+	g_assert(window_bits >= 8 && window_bits <= MAX_WBITS);
+	g_assert(mem_level >= 1 && mem_level <= MAX_MEM_LEVEL);
+
+	return ((size_t) 1 << (window_bits + 2)) +
+		((size_t) 1 << (mem_level + 9)) + ZLIB_DEFLATE_STATE;
+}
+
+/**
+ * Estimate the amount of memory used by an inflating stream.
+ *
+ * @param window_bits	the window size used by the deflated stream
+ *
+ * @return approximate amount of bytes used by zlib for the stream.
+ */
+size_t
+zlib_inflate_memory(int window_bits)
+{
+	g_assert(window_bits >= 8 && window_bits <= MAX_WBITS);
+
+	return ((size_t) 1 << window_bits) + ZLIB_INFLATE_STATE;
+}
+
+/**
+ * Get an inflating stream, ready to process a new zlib stream.
+ *
+ * The stream must be given back with zlib_inflate_stream_put() when done.
+ *
+ * @return an initialized stream, NULL if zlib could not allocate one.
+ */
+struct z_stream_s *
+zlib_inflate_stream_get(void)
+{
+	z_streamp z = NULL;
+	int ret;
+
+	spinlock(&zlib_inflate_pool_slk);
+	if (zlib_inflate_pool_cnt != 0)
+		z = zlib_inflate_pool[--zlib_inflate_pool_cnt];
+	spinunlock(&zlib_inflate_pool_slk);
+
+	if (z != NULL)
+		return z;
+
+	WALLOC(z);
+	z->zalloc = zlib_alloc_func;
+	z->zfree = zlib_free_func;
+	z->opaque = NULL;
+
+	ret = inflateInit(z);
+
+	if (ret != Z_OK) {
+		WFREE(z);
+		g_carp("%s(): unable to initialize decompressor: %s",
+			G_STRFUNC, zlib_strerror(ret));
+		return NULL;
+	}
+
+	return z;
+}
+
+/**
+ * Give back an inflating stream obtained through zlib_inflate_stream_get().
+ *
+ * The stream is reset and kept for the next user, unless the pool is full.
+ */
+void
+zlib_inflate_stream_put(struct z_stream_s *z)
+{
+	g_assert(z != NULL);
+
+	if (Z_OK == inflateReset(z)) {
+		spinlock(&zlib_inflate_pool_slk);
+		if (zlib_inflate_pool_cnt < N_ITEMS(zlib_inflate_pool)) {
+			zlib_inflate_pool[zlib_inflate_pool_cnt++] = z;
+			z = NULL;
+		}
+		spinunlock(&zlib_inflate_pool_slk);
+	}
+
+	if (z != NULL) {
+		(void) inflateEnd(z);
+		WFREE(z);
+	}
+}
+
 /**
  * Initialize internal state for our incremental zlib stream.
  *
@@ -803,16 +920,25 @@ void *
 zlib_uncompress(const void *data, int len, ulong uncompressed_len)
 {
 	int ret;
-	uchar *out = halloc(uncompressed_len);
-	ulong retlen = uncompressed_len;
+	uchar *out;
+	int retlen = uncompressed_len;
 
+	g_return_val_if_fail(len >= 0, NULL);
 	g_return_val_if_fail(uncompressed_len != 0, NULL);
+	g_return_val_if_fail(uncompressed_len <= INT_MAX, NULL);
+
+	out = halloc(uncompressed_len);
+
+	/*
+	 * There is nothing to inflate in empty input, which zlib_inflate_into()
+	 * does not accept: fail as uncompress() would, with a buffer error.
+	 */
 
-	ret = uncompress(out, &retlen, data, len);
+	ret = 0 == len ? Z_BUF_ERROR : zlib_inflate_into(data, len, out, &retlen);
 
 	if (ret == Z_OK) {
-		if (retlen != uncompressed_len)
-			g_carp("%s(): expected %lu bytes of decompressed data, got %ld",
+		if (UNSIGNED(retlen) != uncompressed_len)
+			g_carp("%s(): expected %lu bytes of decompressed data, got %d",
 				G_STRFUNC, uncompressed_len, retlen);
 		return out;
 	}
@@ -848,21 +974,13 @@ zlib_inflate_into(const void *data, int len, void *out, int *outlen)
 	g_assert(*outlen > 0);
 
 	/*
-	 * Allocate decompressor.
+	 * Get decompressor.
 	 */
 
-	WALLOC(inz);
-	inz->zalloc = zlib_alloc_func;
-	inz->zfree = zlib_free_func;
-	inz->opaque = NULL;
+	inz = zlib_inflate_stream_get();
 
-	ret = inflateInit(inz);
-
-	if (ret != Z_OK) {
-		g_carp("%s(): unable to setup decompressor: %s",
-			G_STRFUNC, zlib_strerror(ret));
-		goto done;
-	}
+	if (NULL == inz)
+		return Z_MEM_ERROR;
 
 	/*
 	 * Prepare call to inflate().
@@ -894,8 +1012,7 @@ zlib_inflate_into(const void *data, int len, void *out, int *outlen)
 	/* FALL THROUGH */
 
 done:
-	(void) inflateEnd(inz);
-	WFREE(inz);
+	zlib_inflate_stream_put(inz);
 	return ret;
 }
 
@@ -1054,6 +1171,24 @@ zlib_inflater_free(zlib_inflater_t *zi, bool output)
 	WFREE(zi);
 }
 
+/**
+ * Dispose of the pooled inflating streams.
+ */
+void
+zlib_close(void)
+{
+	spinlock(&zlib_inflate_pool_slk);
+
+	while (zlib_inflate_pool_cnt != 0) {
+		z_streamp z = zlib_inflate_pool[--zlib_inflate_pool_cnt];
+
+		(void) inflateEnd(z);
+		WFREE(z);
+	}
+
+	spinunlock(&zlib_inflate_pool_slk);
+}
+
 /**
  * Check whether first bytes of data make up a valid zlib marker.
  */
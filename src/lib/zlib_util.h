@@ -42,6 +42,8 @@ typedef struct zlib_deflater zlib_deflater_t;
 struct zlib_inflater;
 typedef struct zlib_inflater zlib_inflater_t;
 
+struct z_stream_s;
+
 /*
  * Public interface.
  */
@@ -93,6 +95,14 @@ bool zlib_is_valid_header(const void *data, int len);
 void zlib_free_func(void *unused_opaque, void *p);
 void *zlib_alloc_func(void *unused_opaque, uint n, uint m);
 
+struct z_stream_s *zlib_inflate_stream_get(void);
+void zlib_inflate_stream_put(struct z_stream_s *z);
+
+size_t zlib_deflate_memory(int window_bits, int mem_level);
+size_t zlib_inflate_memory(int window_bits);
+
+void zlib_close(void);
+
 #endif	/* _zlib_util_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -41,8 +41,10 @@
 #define CORE_SOURCES
 
 #include "core/ban.h"
+#include "core/bh_upload.h"
 #include "core/bogons.h"
 #include "core/bsched.h"
+#include "core/calibration.h"
 #include "core/clock.h"
 #include "core/ctl.h"
 #include "core/dh.h"
@@ -95,6 +97,7 @@
 #include "core/tls_common.h"
 #include "core/topless.h"
 #include "core/tsync.h"
+#include "core/tth_cache.h"
 #include "core/tx.h"
 #include "core/udp.h"
 #include "core/uhc.h"
@@ -156,6 +159,7 @@
 #include "lib/shuffle.h"
 #include "lib/signal.h"
 #include "lib/stacktrace.h"
+#include "lib/startup.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/strtok.h"
@@ -171,7 +175,6 @@
 #include "lib/vendors.h"
 #include "lib/vmea.h"
 #include "lib/vmm.h"
-#include "lib/vsort.h"
 #include "lib/walloc.h"
 #include "lib/watcher.h"
 #include "lib/wordvec.h"
@@ -180,6 +183,7 @@
 #include "lib/xsort.h"
 #include "lib/xxtea.h"
 #include "lib/zalloc.h"
+#include "lib/zlib_util.h"
 
 #include "shell/shell.h"
 
@@ -267,6 +271,7 @@ enum main_arg {
 	main_arg_restart_on_crash,
 	main_arg_resume_session,
 	main_arg_shell,
+	main_arg_startup_profile,
 	main_arg_topless,
 	main_arg_use_poll,
 	main_arg_version,
@@ -342,6 +347,7 @@ static struct option {
 	OPTION(restart_on_crash,NONE, "Force auto-restarts on crash."),
 	OPTION(resume_session,	NONE, "Request resuming of previous session."),
 	OPTION(shell,			NONE, "Access the local shell interface."),
+	OPTION(startup_profile,NONE, "Log time spent in each startup step."),
 #ifdef USE_TOPLESS
 	OPTION(topless,			NONE, NULL),	/* accept but hide */
 #else
@@ -722,6 +728,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(file_info_close_pre);
 	DO_BOOL(node_bye_all, byeall);
 	DO(upload_close);	/* Done before upload_stats_close() for stats update */
+	DO(bh_upload_close);
 	DO(upload_stats_close);
 	DO(parq_close_pre);
 	DO(verify_sha1_close);
@@ -948,6 +955,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(ext_close);
 	DO(node_close);
 	DO(g2_node_close);
+	DO(tth_cache_shutdown);	/* Before share_close() */
 	DO(share_close);	/* After node_close() */
 	DO(udp_close);
 	DO(urpc_close);
@@ -975,8 +983,10 @@ gtk_gnutella_exit(int exit_code)
 	DO(word_vec_close);
 	DO(pmsg_close);
 	DO(gmsg_close);
+	DO(zlib_close);			/* After node_close() and ext_close() */
 	DO(g2_build_close);
 	DO(version_close);
+	DO(calibration_close);
 	DO(ignore_close);
 	DO(iso3166_close);
 	atom_str_free_null(&start_rfc822_date);
@@ -988,6 +998,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(misc_close);
 	DO(mingw_close);
 	DO(verify_tth_close);
+	DO(tth_cache_close);		/* After verify_tth_close() */
 	DO(inputevt_close);
 	DO(locale_close);
 	DO(wq_close);
@@ -2487,54 +2498,55 @@ main(int argc, char **argv)
 	STATIC_ASSERT(MAX_INT_VALUE(int32) == MAX_INT_VAL(int32));
 	STATIC_ASSERT(MIN_INT_VALUE(int32) == MIN_INT_VAL(int32));
 
-	mem_test();
-	random_init();
-	vsort_init(isatty(STDERR_FILENO) ? 0 : 1);
-	pattern_init(isatty(STDERR_FILENO) ? 0 : dflt_pattern);
-	htable_test();
-	wq_init();
-	inputevt_init(OPT(use_poll));
-	teq_io_create();
-	teq_set_throttle(70, 50);	/* 70 ms max for TEQ events, every 50 ms */
-	tiger_check();
-	tt_check();
-	tea_test();
-	xxtea_test();
-	patricia_test();
-	strtok_test();
-	locale_init();
-	adns_init();
-	file_object_init();
-	socket_init();
-	gnet_stats_init();
-	iso3166_init();
-	dbus_util_init(OPT(no_dbus));
-	vendor_init();
-	mime_type_init();
-
-	bg_init();
-	upnp_init();
-	udp_init();
-	urpc_init();
-	g2_rpc_init();
-	vmsg_init();
-	tsync_init();
-	ctl_init();
-	hcache_init();			/* before settings_init() */
-	bsched_early_init();	/* before settings_init() */
-	ipp_cache_init();		/* before settings_init() */
-	settings_init(OPT(resume_session));
+	STARTUP(mem_test());
+	STARTUP(random_init());
+	STARTUP(calibration_init(main_argv[0],
+		isatty(STDERR_FILENO) ? 0 : 1,
+		isatty(STDERR_FILENO) ? 0 : dflt_pattern));
+	STARTUP(htable_test());
+	STARTUP(wq_init());
+	STARTUP(inputevt_init(OPT(use_poll)));
+	STARTUP(teq_io_create());
+	STARTUP(teq_set_throttle(70, 50));	/* 70 ms max for TEQ, every 50 ms */
+	STARTUP(tiger_check());
+	STARTUP(tt_check());
+	STARTUP(tea_test());
+	STARTUP(xxtea_test());
+	STARTUP(patricia_test());
+	STARTUP(strtok_test());
+	STARTUP(locale_init());
+	STARTUP(adns_init());
+	STARTUP(file_object_init());
+	STARTUP(socket_init());
+	STARTUP(gnet_stats_init());
+	STARTUP(iso3166_init());
+	STARTUP(dbus_util_init(OPT(no_dbus)));
+	STARTUP(vendor_init());
+	STARTUP(mime_type_init());
+
+	STARTUP(bg_init());
+	STARTUP(upnp_init());
+	STARTUP(udp_init());
+	STARTUP(urpc_init());
+	STARTUP(g2_rpc_init());
+	STARTUP(vmsg_init());
+	STARTUP(tsync_init());
+	STARTUP(ctl_init());
+	STARTUP(hcache_init());			/* before settings_init() */
+	STARTUP(bsched_early_init());	/* before settings_init() */
+	STARTUP(ipp_cache_init());		/* before settings_init() */
+	STARTUP(settings_init(OPT(resume_session)));
 
 	/*
 	 * From now on, settings_init() was called so properties have been loaded.
 	 * Routines requiring access to properties should therefore be put below.
 	 */
 
-	xmalloc_post_init();	/* after settings_init() */
-	vmm_post_init();		/* after settings_init() */
+	STARTUP(xmalloc_post_init());	/* after settings_init() */
+	STARTUP(vmm_post_init());		/* after settings_init() */
 
 	if (debugging(0) || is_running_on_mingw())
-		stacktrace_load_symbols();
+		STARTUP(stacktrace_load_symbols());
 
 	if (str_discrepancies && debugging(0)) {
 		g_info("found %zu discrepanc%s in string formatting:",
@@ -2548,71 +2560,88 @@ main(int argc, char **argv)
 	 */
 
 	if (!running_topless) {
-		main_gui_early_init(argc, argv, OPT(no_xshm));
+		STARTUP(main_gui_early_init(argc, argv, OPT(no_xshm)));
 		main_gui_disable_ancient(OPT(no_expire));
 	}
 
-	upload_stats_load_history();	/* Loads the upload statistics */
-
-	map_test();
-	ipp_cache_load_all();
-	tls_global_init();
-	pmsg_init();
-	hostiles_init();
-	spam_init();
-	bogons_init();
-	gip_init();
-	guid_init();
-	uhc_init();
-	ghc_init();
-	gwc_init();
-	verify_sha1_init();
-	verify_tth_init();
-	move_init();
-	ignore_init();
-	word_vec_init();
-
-	file_info_init();
-	host_init();
-	gmsg_init();
-	bsched_init();
-	dump_init();
-	node_init();
-	g2_node_init();
-    hcache_retrieve_all();	/* after settings_init() and node_init() */
-	routing_init();
-	search_init();
-	share_init();
-	dmesh_init();			/* MUST be done BEFORE download_init() */
-	download_init();		/* MUST be done AFTER file_info_init() */
-	upload_init();
-	shell_init();
-	ban_init();
-	whitelist_init();
-	ext_init();
-	inet_init();
-	crc_init();
-	parq_init();
-	hsep_init();
-	clock_init();
-	dq_init();
-	dh_init();
-	sq_init();
-	gdht_init();
-	pdht_init();
-	publisher_init();
-	guess_init();
-
-	dht_init();
-	upnp_post_init();
+	STARTUP(upload_stats_load_history());	/* Loads the upload statistics */
+
+	STARTUP(map_test());
+	STARTUP(ipp_cache_load_all());
+	STARTUP(tls_global_init());
+	STARTUP(pmsg_init());
+	STARTUP(hostiles_init());
+	STARTUP_ASYNC(hostiles_parse);
+	STARTUP_ASYNC(spam_parse);
+	STARTUP_ASYNC(bogons_parse);
+	STARTUP_ASYNC(gip_parse);
+	STARTUP(guid_init());
+	STARTUP(uhc_init());
+	STARTUP(ghc_init());
+	STARTUP(gwc_init());
+	STARTUP(verify_sha1_init());
+	STARTUP(verify_tth_init());
+	STARTUP(tth_cache_init());
+	STARTUP(move_init());
+	STARTUP(ignore_init());
+	STARTUP(word_vec_init());
+
+	/*
+	 * Databases parsed asynchronously are installed by the main thread,
+	 * which also sets up their file watchers and DBM storage, before we
+	 * can start handling files and connections.
+	 */
+
+	STARTUP_NEEDS(hostiles_parse);
+	STARTUP(hostiles_retrieve_all());
+	STARTUP_NEEDS(spam_parse);
+	STARTUP(spam_init());
+	STARTUP_NEEDS(bogons_parse);
+	STARTUP(bogons_init());
+	STARTUP_NEEDS(gip_parse);
+	STARTUP(gip_init());
+
+	STARTUP(file_info_init());
+	STARTUP(host_init());
+	STARTUP(gmsg_init());
+	STARTUP(bsched_init());
+	STARTUP(dump_init());
+	STARTUP(node_init());
+	STARTUP(g2_node_init());
+	STARTUP(hcache_retrieve_all());	/* after settings_init() and node_init() */
+	STARTUP(routing_init());
+	STARTUP(search_init());
+	STARTUP(crc_init());		/* MUST be done BEFORE share_init() */
+	STARTUP(share_init());
+	STARTUP(dmesh_init());		/* MUST be done BEFORE download_init() */
+	STARTUP(download_init());	/* MUST be done AFTER file_info_init() */
+	STARTUP(upload_init());
+	STARTUP(shell_init());
+	STARTUP(ban_init());
+	STARTUP(whitelist_init());
+	STARTUP(ext_init());
+	STARTUP(inet_init());
+	STARTUP(parq_init());
+	STARTUP(hsep_init());
+	STARTUP(clock_init());
+	STARTUP(dq_init());
+	STARTUP(dh_init());
+	STARTUP(sq_init());
+	STARTUP(gdht_init());
+	STARTUP(pdht_init());
+	STARTUP(publisher_init());
+	STARTUP(guess_init());
+
+	STARTUP(dht_init());
+	STARTUP(upnp_post_init());
 
 	if (!running_topless) {
-		main_gui_init();
+		STARTUP(main_gui_init());
 	}
-	node_post_init();
-	file_info_init_post();
-	download_restore_state();
-	ntp_init();
+	STARTUP(node_post_init());
+	STARTUP(file_info_init_post());
+	STARTUP(download_restore_state());
+	STARTUP(ntp_init());
 	random_added_listener_add(settings_add_randomness);
 
 	/* Some signal handlers */
@@ -2638,12 +2667,15 @@ main(int argc, char **argv)
 
 	(void) tm_time_exact();
 	cq_main_insert(1000, scan_files_once, NULL);
-	bsched_enable_all();
-	version_ancient_warn();
-	dht_attempt_bootstrap();
-	http_test();
-	vxml_test();
-	g2_tree_test();
+	STARTUP(bsched_enable_all());
+	STARTUP(version_ancient_warn());
+	STARTUP(dht_attempt_bootstrap());
+	STARTUP(http_test());
+	STARTUP(vxml_test());
+	STARTUP(g2_tree_test());
+
+	startup_done(OPT(startup_profile));
+	calibration_launch();		/* After startup, not to compete with it */
 
 	if (OPT(topless))
 		gnet_prop_set_boolean_val(PROP_RUNNING_TOPLESS, TRUE);
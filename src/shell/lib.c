@@ -35,6 +35,8 @@
 
 #include "cmd.h"
 
+#include "core/calibration.h"
+
 #include "lib/ascii.h"
 #include "lib/cq.h"
 #include "lib/file_object.h"
@@ -48,6 +50,28 @@
 
 #include "lib/override.h"		/* Must be the last header included */
 
+static enum shell_reply
+shell_exec_lib_show_calibration(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	str_t *s;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	s = str_new(512);
+	calibration_info(s);
+
+	shell_write(sh, "100~\n");
+	shell_write(sh, str_2c(s));
+	shell_write(sh, ".\n");
+
+	str_destroy_null(&s);
+
+	return REPLY_READY;
+}
+
 static enum shell_reply
 shell_exec_lib_show_callout(struct gnutella_shell *sh,
 	int argc, const char *argv[])
@@ -294,6 +318,7 @@ shell_exec_lib_show(struct gnutella_shell *sh,
 		return shell_exec_lib_show_ ## name(sh, argc - 1, argv + 1); \
 } G_STMT_END
 
+	CMD(calibration);
 	CMD(callout);
 	CMD(files);
 
@@ -345,9 +370,16 @@ shell_help_lib(int argc, const char *argv[])
 		if (0 == ascii_strcasecmp(argv[1], "show")) {
 			if (2 == argc) {
 				return
+					"lib show calibration  # display selected routines\n"
 					"lib show callout      # display callout queues\n"
 					"lib show files [-duw] # display open files\n";
 			} else {
+				if (0 == ascii_strcasecmp(argv[2], "calibration")) {
+					return "lib show calibration\n"
+						"display the sorting and matching routines selected "
+							"at startup,\n"
+						"and whether they were benchmarked or restored\n";
+				} else
 				if (0 == ascii_strcasecmp(argv[2], "callout")) {
 					return "lib show callout\n"
 						"display information about all the callout queues\n";
@@ -363,7 +395,7 @@ shell_help_lib(int argc, const char *argv[])
 			}
 		}
 	} else {
-		return "lib show callout|files\n";
+		return "lib show calibration|callout|files\n";
 	}
 	return NULL;
 }
@@ -44,6 +44,7 @@
 #include "lib/file.h"
 #include "lib/glib-missing.h"
 #include "lib/halloc.h"
+#include "lib/hash.h"
 #include "lib/log.h"
 #include "lib/misc.h"
 #include "lib/omalloc.h"
@@ -445,6 +446,16 @@ shell_exec_memory_stats_halloc(struct gnutella_shell *sh,
 	return memory_run_opt_shower(sh, halloc_dump_stats_log, "HALLOC ", opt);
 }
 
+static enum shell_reply
+shell_exec_memory_stats_hash(struct gnutella_shell *sh,
+	unsigned opt, unsigned which)
+{
+	if (which & STATS_USAGE)
+		return memory_stats_unsupported(sh, "hash", STATS_USAGE_STR);
+
+	return memory_run_opt_shower(sh, hash_dump_stats_log, "HASH ", opt);
+}
+
 static enum shell_reply
 shell_exec_memory_stats_palloc(struct gnutella_shell *sh,
 	unsigned opt, unsigned which)
@@ -541,6 +552,7 @@ shell_exec_memory_stats(struct gnutella_shell *sh,
 } G_STMT_END
 
 	CMD(halloc);
+	CMD(hash);
 	CMD(palloc);
 	CMD(tmalloc);
 	CMD(vmm);
@@ -768,7 +780,7 @@ shell_help_memory(int argc, const char *argv[])
 				"memory show zones     # display zone usage\n";
 		} else if (0 == ascii_strcasecmp(argv[1], "stats")) {
 			return "memory stats [-pu] "
-				"halloc|omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
+				"halloc|hash|omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
 				"show statistics about specified memory sub-system\n"
 				"-p : pretty-print numbers with thousands separators\n"
 				"-u : show allocation usage statistics, if available\n";
@@ -783,7 +795,7 @@ shell_help_memory(int argc, const char *argv[])
 #endif
 		"memory check xmalloc\n"
 		"memory show hole|magazines|options|pmap|pools|xmalloc|zones\n"
-		"memory stats [-pu] omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
+		"memory stats [-pu] hash|omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
 		"memory usage zone <size> on|off|show\n"
 		;
 	}
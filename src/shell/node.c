@@ -37,12 +37,15 @@
 #include "cmd.h"
 
 #include "core/nodes.h"
+#include "core/sockets.h"
 
 #include "if/core/sockets.h"
 
 #include "lib/ascii.h"
 #include "lib/misc.h"			/* For clamp_strcpy() */
 #include "lib/parse.h"
+#include "lib/pslist.h"
+#include "lib/str.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -172,6 +175,47 @@ error:
 	return REPLY_ERROR;
 }
 
+static enum shell_reply
+shell_exec_node_tcp(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	const pslist_t *sl;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	shell_set_msg(sh, "");
+
+	shell_write(sh,
+		"100~ \n"
+		"Node                  RTT/ms Var/ms   Cwnd Unacked Retrans "
+		"SndBuf RcvBuf  Lowat  Hiwat Queued\n");
+
+	PSLIST_FOREACH(node_all_nodes(), sl) {
+		const gnutella_node_t *n = sl->data;
+		const socket_tcp_info_t *ti;
+		char buf[256];
+
+		node_check(n);
+
+		ti = n->tcp_info;
+		if (NULL == ti || NULL == n->socket || NULL == n->outq)
+			continue;
+
+		str_bprintf(ARYLEN(buf),
+			"%-21.45s %6u %6u %6u %7u %7u %6u %6u %6d %6d %6d\n",
+			node_gnet_addr(n), ti->rtt / 1000, ti->rttvar / 1000,
+			ti->cwnd, ti->unacked, ti->retrans,
+			n->socket->so_sndbuf, n->socket->so_rcvbuf,
+			mq_lowat(n->outq), mq_hiwat(n->outq), mq_size(n->outq));
+
+		shell_write(sh, buf);
+	}
+	shell_write(sh, ".\n");	/* Terminate message body */
+
+	return REPLY_READY;
+}
+
 /**
  * Handle the "NODE" command.
  */
@@ -192,6 +236,7 @@ shell_exec_node(struct gnutella_shell *sh, int argc, const char *argv[])
 
 	CMD(add);
 	CMD(drop);
+	CMD(tcp);
 
 	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
 	return REPLY_ERROR;
@@ -218,11 +263,17 @@ shell_help_node(int argc, const char *argv[])
 		} else if (0 == ascii_strcasecmp(argv[1], "drop")) {
 			return "node drop <ip>[:<port>]\n"
 				"drop connection to specified <ip>[:<port>]\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "tcp")) {
+			return "node tcp\n"
+				"show kernel TCP telemetry of connected nodes: round-trip\n"
+				"time, congestion window, unacknowledged and retransmitted\n"
+				"data, socket buffer sizes and message queue watermarks\n";
 		}
 	} else {
 		return
 			"node add\n"
 			"node drop\n"
+			"node tcp\n"
 			"Use \"help node <cmd>\" for additional information\n";
 	}
 	return NULL;
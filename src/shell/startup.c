@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2026 agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "startup" command.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "lib/options.h"
+#include "lib/startup.h"
+#include "lib/str.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+/**
+ * Display time spent in each startup step.
+ */
+enum shell_reply
+shell_exec_startup(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	const char *sorted;
+	const option_t options[] = {
+		{ "s", &sorted },			/* sort by decreasing time */
+	};
+	int parsed;
+	str_t *s;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	s = str_new(4096);
+	startup_report(s, NULL != sorted);
+	shell_write_lines(sh, REPLY_READY, str_2c(s));
+	str_destroy_null(&s);
+
+	return REPLY_READY;
+}
+
+const char *
+shell_summary_startup(void)
+{
+	return "Show time spent in startup steps";
+}
+
+const char *
+shell_help_startup(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	return "Shows the time spent in each step of the startup sequence.\n"
+		"Steps run by a separate thread show the thread number and the time\n"
+		"the main thread had to wait for them.\n"
+		"-s : sort steps by decreasing time.\n";
+}
+
+/* vi: set ts=4 sw=4 cindent: */
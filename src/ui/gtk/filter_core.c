@@ -46,8 +46,10 @@
 #include "if/core/search.h"
 
 #include "lib/atoms.h"
+#include "lib/bit_array.h"
 #include "lib/cstr.h"
 #include "lib/halloc.h"
+#include "lib/hset.h"
 #include "lib/hstrfn.h"
 #include "lib/parse.h"
 #include "lib/str.h"
@@ -95,8 +97,34 @@ struct filter_context {
 	size_t l_len;				/**< Length of lower-cased representation */
 	const gchar *utf8_name;		/**< Normalized UTF-8 version of name; atom */
 	size_t utf8_len;			/**< Length of UTF-8 name representation */
+	gboolean scanned[2];		/**< Whether name was scanned by text matcher */
+	gboolean sha1_checked;		/**< Whether sha1_listed was computed */
+	gboolean sha1_listed;		/**< Whether SHA-1 is referenced by a rule */
 };
 
+/**
+ * The text matcher compiles all the substring and word rules into two
+ * multi-pattern sets: one for the case-insensitive rules, which scans the
+ * lower-cased name, and one for the case-sensitive rules, which scans the
+ * UTF-8 name.  Each name is scanned once per set, and the rules then look
+ * at whether their patterns were found instead of searching the name.
+ *
+ * Rules are still evaluated in order by filter_apply(), so that their
+ * counters, negation and targets behave exactly as before.
+ *
+ * The SHA-1 of all the SHA-1 rules are also kept in a set, so that we only
+ * need to compare hashes when the record's SHA-1 is referenced by a rule.
+ */
+static struct filter_matcher {
+	pattern_set_t *set[2];		/**< Patterns, indexed by case-sensitivity */
+	bit_array_t *found[2];		/**< Patterns found in current record */
+	guint count[2];				/**< Amount of patterns in each set */
+	hset_t *text_rules;			/**< Substring and words rules */
+	hset_t *sha1_rules;			/**< SHA-1 rules */
+	hset_t *sha1;				/**< SHA-1 referenced by rules */
+	gboolean dirty;				/**< Whether we need to recompile */
+} filter_matcher;
+
 /*
  * Private functions prototypes
  */
@@ -484,6 +512,226 @@ filter_close_dialog(gboolean commit)
 
 
 
+/**
+ * Record rule in the text matcher or the SHA-1 set, if relevant.
+ */
+static void
+filter_matcher_add_rule(rule_t *r)
+{
+	struct filter_matcher *fm = &filter_matcher;
+
+	switch (r->type) {
+	case RULE_TEXT:
+		if (
+			RULE_TEXT_SUBSTR != r->u.text.type &&
+			RULE_TEXT_WORDS != r->u.text.type
+		)
+			return;
+		if (NULL == fm->text_rules)
+			fm->text_rules = hset_create(HASH_KEY_SELF, 0);
+		hset_insert(fm->text_rules, r);
+		break;
+	case RULE_SHA1:
+		if (NULL == fm->sha1_rules)
+			fm->sha1_rules = hset_create(HASH_KEY_SELF, 0);
+		hset_insert(fm->sha1_rules, r);
+		break;
+	default:
+		return;
+	}
+
+	fm->dirty = TRUE;
+}
+
+/**
+ * Forget about rule in the text matcher or the SHA-1 set.
+ */
+static void
+filter_matcher_remove_rule(rule_t *r)
+{
+	struct filter_matcher *fm = &filter_matcher;
+	hset_t *hs;
+
+	switch (r->type) {
+	case RULE_TEXT:	hs = fm->text_rules; break;
+	case RULE_SHA1:	hs = fm->sha1_rules; break;
+	default:		return;
+	}
+
+	if (hs != NULL && hset_remove(hs, r))
+		fm->dirty = TRUE;
+}
+
+/**
+ * hset_foreach() callback to add the patterns of a text rule to the matcher.
+ */
+static void
+filter_matcher_add_patterns(const void *key, void *unused_data)
+{
+	struct filter_matcher *fm = &filter_matcher;
+	rule_t *r = deconstify_pointer(key);
+	guint cs = r->u.text.case_sensitive ? 1 : 0;
+	GList *iter;
+
+	(void) unused_data;
+
+	r->u.text.pid = fm->count[cs];
+
+	switch (r->u.text.type) {
+	case RULE_TEXT_SUBSTR:
+		pattern_set_add(fm->set[cs],
+			pattern_string(r->u.text.u.pattern),
+			pattern_len(r->u.text.u.pattern), fm->count[cs]++);
+		break;
+	case RULE_TEXT_WORDS:
+		for (
+			iter = g_list_first(r->u.text.u.words);
+			iter != NULL;
+			iter = g_list_next(iter)
+		) {
+			pattern_set_add(fm->set[cs],
+				pattern_string(iter->data), pattern_len(iter->data),
+				fm->count[cs]++);
+		}
+		break;
+	default:
+		g_assert_not_reached();
+	}
+
+	r->u.text.npids = fm->count[cs] - r->u.text.pid;
+}
+
+/**
+ * hset_foreach() callback to record the SHA-1 of a rule.
+ */
+static void
+filter_matcher_add_sha1(const void *key, void *unused_data)
+{
+	const rule_t *r = key;
+
+	(void) unused_data;
+
+	if (r->u.sha1.hash != NULL)
+		hset_insert(filter_matcher.sha1, r->u.sha1.hash);
+}
+
+/**
+ * Rebuild the text matcher and the SHA-1 set after rules were changed.
+ */
+static void
+filter_matcher_compile(void)
+{
+	struct filter_matcher *fm = &filter_matcher;
+	guint cs;
+
+	for (cs = 0; cs < N_ITEMS(fm->set); cs++) {
+		pattern_set_free_null(&fm->set[cs]);
+		HFREE_NULL(fm->found[cs]);
+		fm->set[cs] = pattern_set_make();
+		fm->count[cs] = 0;
+	}
+
+	if (fm->text_rules != NULL)
+		hset_foreach(fm->text_rules, filter_matcher_add_patterns, NULL);
+
+	for (cs = 0; cs < N_ITEMS(fm->set); cs++) {
+		pattern_set_compile(fm->set[cs]);
+		fm->found[cs] = halloc(BIT_ARRAY_BYTE_SIZE(MAX(fm->count[cs], 1)));
+	}
+
+	if (NULL == fm->sha1)
+		fm->sha1 = hset_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
+	else
+		hset_clear(fm->sha1);
+
+	if (fm->sha1_rules != NULL)
+		hset_foreach(fm->sha1_rules, filter_matcher_add_sha1, NULL);
+
+	if (GUI_PROPERTY(gui_debug) >= 5) {
+		g_debug("%s(): %zu text rules, %u+%u patterns, %zu SHA-1",
+			G_STRFUNC,
+			NULL == fm->text_rules ? 0 : hset_count(fm->text_rules),
+			fm->count[0], fm->count[1], hset_count(fm->sha1));
+	}
+
+	fm->dirty = FALSE;
+}
+
+/**
+ * Free the text matcher and the SHA-1 set.
+ */
+static void
+filter_matcher_close(void)
+{
+	struct filter_matcher *fm = &filter_matcher;
+	guint cs;
+
+	for (cs = 0; cs < N_ITEMS(fm->set); cs++) {
+		pattern_set_free_null(&fm->set[cs]);
+		HFREE_NULL(fm->found[cs]);
+	}
+
+	hset_free_null(&fm->text_rules);
+	hset_free_null(&fm->sha1_rules);
+	hset_free_null(&fm->sha1);
+}
+
+/**
+ * pattern_set_match() callback to flag patterns found.
+ */
+static void
+filter_matcher_found(uint id, void *data)
+{
+	bit_array_set(data, id);
+}
+
+/**
+ * Check whether all the patterns of a substring or words rule are present
+ * in the name of the record being filtered.
+ *
+ * The name is only scanned the first time we need it, then all the other
+ * text rules sharing the same case-sensitivity reuse the results.
+ */
+static gboolean
+filter_matcher_text(struct filter_context *ctx, const rule_t *r)
+{
+	struct filter_matcher *fm = &filter_matcher;
+	guint cs = r->u.text.case_sensitive ? 1 : 0;
+	guint i;
+
+	g_assert(!fm->dirty);
+
+	if (!ctx->scanned[cs]) {
+		bit_array_init(fm->found[cs], fm->count[cs]);
+		pattern_set_match(fm->set[cs],
+			cs ? ctx->utf8_name : ctx->l_name,
+			cs ? ctx->utf8_len : ctx->l_len,
+			filter_matcher_found, fm->found[cs]);
+		ctx->scanned[cs] = TRUE;
+	}
+
+	for (i = 0; i < r->u.text.npids; i++) {
+		if (!bit_array_get(fm->found[cs], r->u.text.pid + i))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Check whether the SHA-1 of the record being filtered is used by a rule.
+ */
+static gboolean
+filter_matcher_sha1(struct filter_context *ctx)
+{
+	if (!ctx->sha1_checked) {
+		ctx->sha1_listed = hset_contains(filter_matcher.sha1, ctx->rec->sha1);
+		ctx->sha1_checked = TRUE;
+	}
+
+	return ctx->sha1_listed;
+}
+
 /**
  * returns a new rule created with information based on the given rule
  * with the appropriate filter_new_*_rule call. Defaults set by those
@@ -588,6 +836,8 @@ filter_new_text_rule(const gchar *match, gint type,
 	}
     hfree(buf);
 
+	filter_matcher_add_rule(r);
+
     return r;
 }
 
@@ -690,6 +940,8 @@ filter_new_sha1_rule(const struct sha1 *sha1, const gchar *filename,
     f->flags = flags;
     f->flags |= RULE_FLAG_VALID;
 
+	filter_matcher_add_rule(f);
+
     return f;
 }
 
@@ -1390,6 +1642,8 @@ filter_free_rule(rule_t *r)
     if (GUI_PROPERTY(gui_debug) >= 6)
         g_debug("freeing rule: %s", filter_rule_to_string(r));
 
+	filter_matcher_remove_rule(r);
+
     switch (r->type) {
     case RULE_TEXT:
         HFREE_NULL(r->u.text.match);
@@ -2143,26 +2397,8 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
                         match = TRUE;
                     break;
                 case RULE_TEXT_WORDS:	/* Contains ALL the words */
-                    {
-                        GList *iter;
-						gboolean failed = FALSE;
-
-                        for (
-                            iter = g_list_first(r->u.text.u.words);
-                            iter && !failed;
-                            iter = g_list_next(iter)
-                        ) {
-                            if (
-								NULL == pattern_search(iter->data,
-									r->u.text.case_sensitive ?
-										ctx->utf8_name : ctx->l_name,
-									0, 0, qs_any)
-							)
-                                failed = TRUE;
-                        }
-
-						match = !failed;
-                    }
+                case RULE_TEXT_SUBSTR:
+					match = filter_matcher_text(ctx, r);
                     break;
                 case RULE_TEXT_SUFFIX: {
 					size_t namelen = r->u.text.case_sensitive ?
@@ -2176,16 +2412,6 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
                         match = TRUE;
 				   }
                     break;
-                case RULE_TEXT_SUBSTR:
-                    if (
-						NULL != pattern_search(
-							r->u.text.u.pattern,
-							r->u.text.case_sensitive ?
-								ctx->utf8_name : ctx->l_name,
-							0, 0, qs_any)
-					)
-                        match = TRUE;
-                    break;
                 case RULE_TEXT_REGEXP:
                     if (
 						0 == (i = regexec(r->u.text.u.re,
@@ -2214,7 +2440,10 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
             case RULE_SHA1:
                 if (rec->sha1 == r->u.sha1.hash)
                     match = TRUE;
-                else if (rec->sha1 != NULL && r->u.sha1.hash != NULL)
+                else if (
+					rec->sha1 != NULL && r->u.sha1.hash != NULL &&
+					filter_matcher_sha1(ctx)
+				)
                     if (sha1_eq(rec->sha1, r->u.sha1.hash))
                         match = TRUE;
                 break;
@@ -2370,9 +2599,11 @@ filter_record(struct search *search, const struct record *rec)
     g_assert(search != NULL);
 	record_check(rec);
 
+	ZERO(&ctx);
 	ctx.rec = rec;
-	ctx.l_name = ctx.utf8_name = NULL;
-	ctx.l_len = ctx.utf8_len = 0;
+
+	if (filter_matcher.dirty)
+		filter_matcher_compile();
 
 	/*
 	 * Initialize all properties with FILTER_PROP_STATE_UNKNOWN and
@@ -2477,6 +2708,8 @@ filter_shutdown(void)
      */
     for (f = filters; f != NULL; f = filters)
         filter_free(f->data);
+
+	filter_matcher_close();
 }
 
 static void G_COLD
@@ -116,6 +116,8 @@ typedef struct rule {
             enum rule_text_type type;	/**< type of match, see above */
             gchar *match; 	            /**< match string */
 			size_t match_len;			/**< length of match string */
+			guint pid;					/**< first pattern ID in matcher */
+			guint npids;				/**< amount of patterns in matcher */
             union {
                 cpattern_t *pattern;	/**< substring pattern */
                 GList *words;		    /**< a list of substring patterns */